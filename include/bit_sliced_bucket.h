@@ -0,0 +1,82 @@
+/*==============================================================================
+*   Copyright (C) 2016 All rights reserved.
+*
+*  File Name    : bit_sliced_bucket.h
+*  Author       : Zhongping Liang
+*  Date         : 2016-07-11
+*  Version      : 1.0
+*  Description  : This file provides declaration of the BitSlicedBucket.
+==============================================================================*/
+
+#ifndef SIMHASH_BIT_SLICED_BUCKET_H_
+#define SIMHASH_BIT_SLICED_BUCKET_H_
+
+#include <vector>
+
+#include "common.h"
+#include "wide_hash.h"
+
+namespace simhash
+{
+
+/*
+* class BitSlicedBucket.
+* BitSlicedBucket keeps simhash values in a vertical layout: the values are
+* grouped into blocks of LANES, and a block stores bit i of its values as the
+* bit-plane i, LANES bits in a row. A query walks the planes of a block,
+* XORs each plane with bit i of the query, and adds the result to a bit-sliced
+* counter of each lane, so LANES distances are counted by a few wide bitwise
+* operations per bit. The counters start at 2^C - 1 - maxHamDist, so a carry
+* out of the C bits means the distance exceeds maxHamDist, and the block is
+* left as soon as every lane has carried.
+* Only the lowest planeNum bits are stored and compared, the higher bits are
+* the key of the bucket, which the values and the queries share.
+*/
+template <typename HashT>
+class BitSlicedBucket
+{
+public :
+    static const uint_t LANES       = 256U;     // The values of a block.
+    static const uint_t LANE_WORDS  = LANES / 64U;
+//constructors
+public :
+    explicit BitSlicedBucket(uint_t planeNum = HashTraits<HashT>::WIDTH);
+//public functions
+public :
+    /* Adds a value, it should not be in the bucket. */
+    void Add(HashT hash);
+    /* Removes a value, returns false if it is not in the bucket. */
+    bool Remove(HashT hash);
+    /* Returns the number of values. */
+    uint_t GetSize() const;
+    /*
+    *   @brief      This func finds the values near-duplicate with hash.
+    *   @author     Zhongping Liang
+    *   @date       2016-07-11
+    *   @param      hash        : the query, its higher bits are ignored.
+    *   @param      maxHamDist  : the max Hamming distance can be tolerated.
+    *   @param      firstOnly   : whether to stop at the first found.
+    *   @param      ans         : the values found are appended into it.
+    *   @return     the number of values found.
+    */
+    uint_t FindNearDups(HashT hash, uint_t maxHamDist, bool firstOnly,
+        std::vector<HashT> &ans) const;
+    /* Returns the bytes used. */
+    uint64_t GetMemoryUsage() const;
+private :
+    /* Returns the first word of plane p of block b. */
+    inline uint64_t *GetPlane(uint_t b, uint_t p)
+    {
+        return &mPlanes[(static_cast<size_t>(b) * mPlaneNum + p) * LANE_WORDS];
+    }
+    /* Writes hash into lane of the planes. */
+    void SetLane(uint_t lane, HashT hash);
+private :
+    uint_t mPlaneNum;               // The bits stored of each value.
+    std::vector<HashT> mValues;     // The values, lane i holds mValues[i].
+    std::vector<uint64_t> mPlanes;  // The planes of all blocks.
+};
+
+} // namespace simhash
+
+#endif // SIMHASH_BIT_SLICED_BUCKET_H_
@@ -0,0 +1,98 @@
+/*==============================================================================
+*   Copyright (C) 2016 All rights reserved.
+*
+*  File Name    : bloom_filter.h
+*  Author       : Zhongping Liang
+*  Date         : 2016-06-08
+*  Version      : 1.0
+*  Description  : This file provides declaration of the BlockedBloomFilter.
+==============================================================================*/
+
+#ifndef SIMHASH_BLOOM_FILTER_H_
+#define SIMHASH_BLOOM_FILTER_H_
+
+#include <vector>
+#include <cstddef>
+
+#include "common.h"
+
+namespace simhash
+{
+
+/*
+* class BlockedBloomFilter.
+* BlockedBloomFilter is a bloom filter of 64-bit keys. All the bits of a key
+* are set in one block of 512 bits, which is a cache line, so a query costs
+* only one cache miss. Keys can not be removed, the owner should rebuild the
+* filter when too many keys have gone.
+*/
+class BlockedBloomFilter
+{
+public :
+    static const uint_t BLOCK_BITS  = 512U;     // The bits of a block.
+    static const uint_t BLOCK_WORDS = 8U;       // The words of a block.
+//constructors
+public :
+    BlockedBloomFilter();
+    ~BlockedBloomFilter();
+    BlockedBloomFilter(const BlockedBloomFilter &another);
+    BlockedBloomFilter& operator=(const BlockedBloomFilter &another);
+//public functions
+public :
+    /*
+    *   @brief      This func resizes the filter and clears all keys.
+    *   @author     Zhongping Liang
+    *   @date       2016-06-08
+    *   @param      expectedKeys: the number of keys expected to be added.
+    *   @param      bitsPerKey  : the bits spent for each key, the false
+    *           positive rate is about 1% when it is 10.
+    *   @return     void.
+    */
+    void Reset(uint_t expectedKeys, uint_t bitsPerKey = 10U);
+    /*
+    *   @brief      This func adds a key into filter.
+    *   @author     Zhongping Liang
+    *   @date       2016-06-08
+    *   @param      key: the input key.
+    *   @return     void.
+    */
+    void Add(uint64_t key);
+    /*
+    *   @brief      This func judges whether a key may be in the filter.
+    *   @author     Zhongping Liang
+    *   @date       2016-06-08
+    *   @param      key: the input key.
+    *   @return     false, if the key is surely not added; true, otherwise.
+    */
+    bool MayContain(uint64_t key) const;
+    /*
+    *   @brief      This func clears all keys, the size is kept.
+    *   @author     Zhongping Liang
+    *   @date       2016-06-08
+    *   @return     void.
+    */
+    void Clear();
+    /*
+    *   @brief      This func returns the bytes used by the filter.
+    *   @author     Zhongping Liang
+    *   @date       2016-06-08
+    *   @return     the bytes.
+    */
+    size_t GetMemoryUsage() const;
+private :
+    /* Returns the first word of the block of key. */
+    inline uint64_t *GetBlock(uint64_t key) const
+    {
+        //Maps the high 32 bits to [0, mBlockNum) without division.
+        return mBlocks + ((key >> 32) * mBlockNum >> 32) * BLOCK_WORDS;
+    }
+private :
+    std::vector<uint64_t> mBuff;    // The storage, with room for alignment.
+    uint64_t *mBlocks;              // The cache line aligned blocks in mBuff.
+    uint64_t mBlockNum;             // The number of blocks.
+    uint_t mProbeNum;               // The bits set for each key.
+};
+
+} // namespace simhash
+
+#endif // SIMHASH_BLOOM_FILTER_H_
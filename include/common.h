@@ -11,6 +11,8 @@
 #ifndef SIMHASH_COMMON_H_
 #define SIMHASH_COMMON_H_
 
+#include <stdint.h>
+
 namespace simhash
 {
 typedef uint64_t hash_t;            //hash type
@@ -13,6 +13,7 @@
 
 #include <string>
 #include "common.h"
+#include "wide_hash.h"
 
 namespace simhash 
 {
@@ -27,6 +28,19 @@ namespace simhash
     *           and under a public domain licence on May 25, 2012.
     */
     hash_t JenkinsHash(const std::string &str);
+
+    /*
+    *   @brief      These funcs hash the input string to its 128-bit and
+    *           256-bit fingerprint, for Simhash128 and Simhash256.
+    *   @author     agent
+    *   @date       2026-10-19
+    *   @param      str: the input string.
+    *   @return     The fingerprint of the input string.
+    *   @desc       Each 64-bit word is a JenkinsHash with its own seed, and
+    *           the lowest word equals JenkinsHash(str).
+    */
+    hash128_t JenkinsHash128(const std::string &str);
+    hash256_t JenkinsHash256(const std::string &str);
 }
 
 #endif // SIMHASH_HASH_JENKINS_H
@@ -15,25 +15,34 @@
 #include <vector>
 
 #include "common.h"
+#include "wide_hash.h"
+#include "token_hash_cache.h"
 
 namespace simhash
 {
+template <typename HashT>
+class BasicSimhashAccumulator;
+
 /*
-* class Simhash.
-* Simhash provides operations on simhash.
+* class BasicSimhash.
+* BasicSimhash provides operations on simhash, HashT is the type of simhash
+* values, it can be hash_t, hash128_t or hash256_t. Simhash, Simhash128 and
+* Simhash256 are the instances.
 */
-class Simhash
+template <typename HashT>
+class BasicSimhash
 {
 //typedefs
 public :
+    static const uint_t WIDTH = HashTraits<HashT>::WIDTH;
     /* Type of hash function.*/
-    typedef hash_t (*HashFunc) (const std::string &);
+    typedef HashT (*HashFunc) (const std::string &);
     /* 
     *  Type of hash feature. In the pair:
     *      first  - is feature, should be a hash value.
     *      second - is weight,  should be a double type.
     */
-    typedef std::pair<hash_t        , real_t> HashFeatureType;
+    typedef std::pair<HashT         , real_t> HashFeatureType;
     /* 
     *  Type of string feature. In the pair:
     *      first  - is feature, should be a string. When using this type of 
@@ -54,7 +63,7 @@ public :
     *   @return     true, if the Hamming distance of lhs and rhs is not greater
     *           than d; false otherwise.
     */
-    static bool IsNearDups(hash_t lhs, hash_t rhs, uint_t d = 3);
+    static bool IsNearDups(const HashT &lhs, const HashT &rhs, uint_t d = 3);
     /*
     *   @brief      This func calculates the Hamming distance between two given
     *           simhash values.
@@ -64,17 +73,17 @@ public :
     *   @param      rhs: the right hand simhash value.
     *   @return     the Hamming distance.
     */
-    static uint_t GetHammingDistance(hash_t lhs, hash_t rhs);
+    static uint_t GetHammingDistance(const HashT &lhs, const HashT &rhs);
     /*
     *   @brief      This func builds simhash value from HashFeatureType
     *           features.
     *   @author     Zhongping Liang
     *   @date       2016-05-19
     *   @param      features: the input features, each should be
-    *           <hash_t, real_t> pair.
+    *           <HashT, real_t> pair.
     *   @return     the simhash value of features.
     */
-    static hash_t Build(const std::vector<HashFeatureType> &features);
+    static HashT Build(const std::vector<HashFeatureType> &features);
     /*
     *   @brief      This func builds simhash value from StringFeatureType
     *           features.
@@ -87,15 +96,50 @@ public :
     *   @return     the simhash value of features.
     *   @desc       When using this overloaded build, you should given a hash
     *           function in parameter. The given hash function should take a
-    *           string as input, and give out a hash_t as output meaning the
+    *           string as input, and give out a HashT as output meaning the
     *           hash value of the input string. This function simple calls 
     *           hasher for each feature. Note that hasher should not be null, or
-    *           this func will do nothing. You can use JenkinsHash in hash.h
-    *           conveniently.
+    *           this func will do nothing. You can use JenkinsHash (or
+    *           JenkinsHash128, JenkinsHash256) in hash.h conveniently.
     */
-    static hash_t Build(const std::vector<StringFeatureType> &features,
+    static HashT Build(const std::vector<StringFeatureType> &features,
         HashFunc hasher);
     /*
+    *   @brief      This func builds the simhash value of string features,
+    *           with the hashes of tokens memoized in a cache.
+    *   @author     Zhongping Liang
+    *   @date       2016-07-22
+    *   @param      features: the features of document.
+    *   @param      cache   : the cache, its hasher hashes the features.
+    *   @return     The simhash value, the same as Build with the hasher.
+    */
+    static HashT Build(const std::vector<StringFeatureType> &features,
+        BasicTokenHashCache<HashT> &cache);
+    /*
+    *   @brief      This func builds the simhash values of many documents in
+    *           parallel.
+    *   @author     Zhongping Liang
+    *   @date       2016-07-22
+    *   @param      features : the features of all documents, back to back.
+    *   @param      offsets  : the features of document i are features[
+    *           offsets[i], offsets[i + 1]), there are docNum + 1 offsets.
+    *   @param      docNum   : the number of documents.
+    *   @param      out      : the simhash value of document i is out[i].
+    *   @param      threadNum: the threads, 0 is the number of CPUs.
+    *   @return     void.
+    *   @desc       The documents are cut into tasks of about TASK_FEATURES
+    *           features, so a task is a run of small documents or one large
+    *           document, and each thread takes the next task when it is done
+    *           with one, so a large document doesn't hold up the others. The
+    *           values are the same as Build.
+    */
+    static void BuildBatch(const HashFeatureType *features,
+        const size_t *offsets, size_t docNum, HashT *out, uint_t threadNum = 0U);
+    /* Likewise, the features are hashed by hasher, see Build. */
+    static void BuildBatch(const StringFeatureType *features,
+        const size_t *offsets, size_t docNum, HashFunc hasher, HashT *out,
+        uint_t threadNum = 0U);
+    /*
     *   @brief      This func convert simhash value into a binary string.
     *   @author     Zhongping Liang
     *   @date       2016-05-19
@@ -103,7 +147,7 @@ public :
     *   @param      ans : the output binary string.
     *   @return     void.
     */
-    static void HashToBinaryString(hash_t hash, std::string& ans);
+    static void HashToBinaryString(HashT hash, std::string& ans);
     /*
     *   @brief      This func convert binary string into simhash value.
     *   @author     Zhongping Liang
@@ -111,15 +155,80 @@ public :
     *   @param      str: the input binary string.
     *   @return     the output simhash value.
     */
-    static hash_t BinaryStringToHash(const std::string& str);
+    static HashT BinaryStringToHash(const std::string& str);
 //private functions
 private :
-    /* Build from holds, the length of holds should equal to HASH_WIDTH. */
-    static hash_t Build(const std::vector<real_t> &holds);
+    /* The features of a task of BuildBatch. */
+    static const size_t TASK_FEATURES = 16384U;
+    struct BatchContext;
+    /* Builds the tasks of context until none is left. */
+    static void* RunBatch(void *context);
+    /* Cuts the tasks of context, and runs them in threadNum threads. */
+    static void BuildBatch(BatchContext &context, uint_t threadNum);
+    /* Build from holds, the length of holds should equal to WIDTH. */
+    template <typename HoldT>
+    static HashT Build(const std::vector<HoldT> &holds);
     /* Flush holds by hash feature and its weight. */
-    static void FlushHolds(hash_t hash, real_t weight,
-        std::vector<real_t> &holds);
+    template <typename HoldT>
+    static void FlushHolds(const HashT &hash, HoldT weight,
+        std::vector<HoldT> &holds);
+    friend class BasicSimhashAccumulator<HashT>;
+};
+
+typedef BasicSimhash<hash_t>    Simhash;
+typedef BasicSimhash<hash128_t> Simhash128;
+typedef BasicSimhash<hash256_t> Simhash256;
+
+/*
+* class BasicSimhashAccumulator.
+* BasicSimhashAccumulator keeps the holds of a simhash, so that when a document
+* is edited, its new simhash is got by adding and removing the changed
+* features, in O(changed features), instead of building from all features.
+* The weights are quantized to int32_t by WEIGHT_SCALE, so that removing a
+* feature restores the holds exactly, and the holds are saved in WIDTH * 4
+* bytes. A bit whose hold is within 1 / WEIGHT_SCALE of 0 may differ from
+* BasicSimhash::Build, and the sum of weights should be less than 2^21.
+*/
+template <typename HashT>
+class BasicSimhashAccumulator
+{
+public :
+    static const uint_t WIDTH = HashTraits<HashT>::WIDTH;
+    static const int32_t WEIGHT_SCALE = 1024;
+    static const size_t SERIALIZED_BYTES = WIDTH * sizeof(int32_t);
+    typedef typename BasicSimhash<HashT>::HashFeatureType HashFeatureType;
+public :
+    BasicSimhashAccumulator();
+public :
+    /* Adds a feature, which is the hash of a token, and its weight. */
+    void AddFeature(const HashT &hash, real_t weight);
+    /* Removes a feature added before, with the same weight. */
+    void RemoveFeature(const HashT &hash, real_t weight);
+    /* Adds all features. */
+    void AddFeatures(const std::vector<HashFeatureType> &features);
+    /* Returns the simhash of the features added. */
+    HashT GetHash() const;
+    /* Removes all features. */
+    void Clear();
+    /* Returns the holds, WIDTH of them. */
+    const std::vector<int32_t>& GetHolds() const
+    {
+        return mHolds;
+    }
+    /* Appends the holds in SERIALIZED_BYTES, in host order, to out. */
+    void Serialize(std::string &out) const;
+    /* Loads the holds, returns false if size is not SERIALIZED_BYTES. */
+    bool Deserialize(const char *data, size_t size);
+private :
+    /* Quantizes weight by WEIGHT_SCALE. */
+    static int32_t Quantize(real_t weight);
+private :
+    std::vector<int32_t> mHolds;
 };
+
+typedef BasicSimhashAccumulator<hash_t>     SimhashAccumulator;
+typedef BasicSimhashAccumulator<hash128_t>  SimhashAccumulator128;
+typedef BasicSimhashAccumulator<hash256_t>  SimhashAccumulator256;
 } // namespace simhash
 
 #endif // SIMHASH_SIMHASH_H_
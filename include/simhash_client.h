@@ -0,0 +1,116 @@
+/*==============================================================================
+*   Copyright (C) 2016 All rights reserved.
+*
+*  File Name    : simhash_client.h
+*  Author       : Zhongping Liang
+*  Date         : 2016-07-19
+*  Version      : 1.0
+*  Description  : This file provides declaration of the SimhashClient, which
+*           talks to a SimhashServer.
+==============================================================================*/
+
+#ifndef SIMHASH_SIMHASH_CLIENT_H_
+#define SIMHASH_SIMHASH_CLIENT_H_
+
+#include <string>
+#include <tr1/memory>   //for shared_ptr
+
+#include "common.h"
+#include "simhash_table.h"
+#include "simhash_protocol.h"
+
+namespace simhash
+{
+
+/*
+* struct SimhashResponse.
+* A response of SimhashServer, see simhash_protocol.h.
+*/
+struct SimhashResponse
+{
+    uint_t status;
+    FindAnswerType values;
+};
+
+/*
+* class SimhashClient.
+* SimhashClient is a blocking connection to a SimhashServer. The calls such as
+* Insert send a request and wait for its response. To pipeline, call
+* SendRequest many times, then Flush, then ReceiveResponse once for each
+* request, the responses come in the order of requests. The sending and the
+* receiving may be done by two threads, but each of them by one thread only.
+*/
+class SimhashClient
+{
+//constructors
+public :
+    virtual ~SimhashClient();
+protected :
+    SimhashClient();
+private :
+    SimhashClient(const SimhashClient &another);
+    SimhashClient& operator=(const SimhashClient &another);
+//public functions
+public:
+    /*
+    *   The same as the funcs of SimhashTable, they return false also when
+    *   the connection fails, see IsBroken.
+    */
+    virtual bool Insert         (hash_t hash) = 0;
+    virtual bool Remove         (hash_t hash) = 0;
+    virtual bool Search         (hash_t hash) = 0;
+    virtual bool HasNearDups    (hash_t hash) = 0;
+    virtual bool FindNearDups   (hash_t hash, FindAnswerType &ans) = 0;
+    virtual uint_t GetSize() = 0;
+    virtual void Clear() = 0;
+    /*
+    *   @brief      This func buffers a request, the buffer is sent when it is
+    *           large or Flush is called.
+    *   @author     Zhongping Liang
+    *   @date       2016-07-19
+    *   @param      op  : the op code, see SimhashOpCode.
+    *   @param      hash: the simhash value of the request.
+    *   @return     false, if the connection fails; true, otherwise.
+    */
+    virtual bool SendRequest(uint_t op, hash_t hash) = 0;
+    /*
+    *   @brief      This func buffers a request followed by a name, such as
+    *           SIMHASH_OP_CODE_SAVE_TO_FILE.
+    *   @author     agent
+    *   @date       2026-10-19
+    *   @param      op  : the op code, see SimhashOpCode.
+    *   @param      arg : the argument of op, e.g. the SimhashFileFormat.
+    *   @param      name: the name, at most MAX_NAME_BYTES.
+    *   @return     false, if the connection fails or the name is too long;
+    *           true, otherwise.
+    */
+    virtual bool SendNamedRequest(uint_t op, uint_t arg,
+        const std::string &name) = 0;
+    /* Sends the requests buffered, returns false if the connection fails. */
+    virtual bool Flush() = 0;
+    /*
+    *   @brief      This func waits for the next response.
+    *   @author     Zhongping Liang
+    *   @date       2016-07-19
+    *   @param      response: the output response.
+    *   @return     false, if the connection fails; true, otherwise.
+    */
+    virtual bool ReceiveResponse(SimhashResponse &response) = 0;
+    /* Returns true if the connection has failed. */
+    virtual bool IsBroken() = 0;
+};
+
+typedef std::tr1::shared_ptr<SimhashClient> SimhashClientPtr;
+
+/*
+*   @brief      This func connects to a SimhashServer.
+*   @author     Zhongping Liang
+*   @date       2016-07-19
+*   @param      address: the address of server, see ListenSimhashAddress.
+*   @return     the client, or an empty pointer if it fails to connect.
+*/
+SimhashClientPtr CreateSimhashClient(const std::string &address);
+
+} // namespace simhash
+
+#endif  //SIMHASH_SIMHASH_CLIENT_H_
@@ -0,0 +1,221 @@
+/*==============================================================================
+*   Copyright (C) 2016 All rights reserved.
+*
+*  File Name    : simhash_file.h
+*  Author       : Zhongping Liang
+*  Date         : 2016-07-21
+*  Version      : 1.0
+*  Description  : This file provides the reader and the writer of the files of
+*           simhash values.
+==============================================================================*/
+
+#ifndef SIMHASH_SIMHASH_FILE_H_
+#define SIMHASH_SIMHASH_FILE_H_
+
+#include <string>
+#include <vector>
+#include <cstring>
+
+#include "common.h"
+#include "wide_hash.h"
+#include "simhash_snapshot.h"
+
+namespace simhash
+{
+
+/*
+* enum SimhashFileFormat.
+* The formats of the files of simhash values.
+*/
+enum SimhashFileFormat
+{
+    SIMHASH_FILE_BIT_STRING = 0,    // A line of '0' and '1' per value.
+    SIMHASH_FILE_BINARY,            // The bytes of values, in host order.
+    SIMHASH_FILE_HEX,               // A line of hex digits per value.
+    SIMHASH_FILE_SNAPSHOT           // The compressed blocks of sorted values,
+                                    // see simhash_snapshot.h.
+};
+
+/*
+* class SimhashFileWriter.
+* SimhashFileWriter writes simhash values into a file. The values are encoded
+* into a buffer of BUFFER_BYTES, which is written by one write call when it
+* is full, so no stream and no flush per line is involved. In the text
+* formats, the highest bit or digit comes first, and the hex digits are lower
+* case. A snapshot is written sorted : while the values come sorted, as a
+* table writes them, each block is encoded once it is full;
+* after a value out of order, the blocks written are read back, and all the
+* values are kept in memory and sorted at Close, 8 bytes per value of 64 bits,
+* which is small beside a table of them.
+*/
+template <typename HashT>
+class SimhashFileWriter
+{
+public :
+    static const uint_t WIDTH = HashTraits<HashT>::WIDTH;
+    static const size_t BUFFER_BYTES = 4U << 20;
+public :
+    SimhashFileWriter();
+    ~SimhashFileWriter();
+private :
+    SimhashFileWriter(const SimhashFileWriter &another);
+    SimhashFileWriter& operator=(const SimhashFileWriter &another);
+public :
+    /* Creates or truncates the file, returns false if failed. */
+    bool Open(const std::string &filename, SimhashFileFormat format);
+    /* Writes a value. */
+    inline void Write(const HashT &hash)
+    {
+        if (SIMHASH_FILE_SNAPSHOT == mFormat)
+        {
+            if (mSorted && hash < mLast)
+            {
+                Unsort();
+            }
+            mLast = hash;
+            mValues.push_back(hash);
+            if (mSorted && SNAPSHOT_BLOCK_SIZE == mValues.size())
+            {
+                WriteBlock(&mValues[0], mValues.size());
+                mValues.clear();
+            }
+            return;
+        }
+        if (mBuffer.size() - mSize < RECORD_BYTES)
+        {
+            Flush();
+        }
+        char *out = &mBuffer[mSize];
+        switch (mFormat)
+        {
+        case SIMHASH_FILE_BINARY :
+            memcpy(out, &hash, sizeof(HashT));
+            mSize += sizeof(HashT);
+            break;
+        case SIMHASH_FILE_HEX :
+            EncodeHex(hash, out);
+            out[WIDTH / 4U] = '\n';
+            mSize += WIDTH / 4U + 1U;
+            break;
+        default :
+            EncodeBitString(hash, out);
+            out[WIDTH] = '\n';
+            mSize += WIDTH + 1U;
+            break;
+        }
+    }
+    /* Writes the buffer and closes the file, returns false if any failed. */
+    bool Close();
+    /* Encodes hash into WIDTH / 4 hex digits at out. */
+    static void EncodeHex(const HashT &hash, char *out);
+    /* Encodes hash into WIDTH '0' and '1' at out. */
+    static void EncodeBitString(const HashT &hash, char *out);
+private :
+    void Flush();
+    /* Appends data to the buffer, size should be at most BUFFER_BYTES. */
+    void Append(const char *data, size_t size);
+    /* Encodes a block of sorted values, and appends it to the buffer. */
+    void WriteBlock(const HashT *values, size_t count);
+    /* Reads the blocks written back into mValues, to be sorted at Close. */
+    void Unsort();
+    /* Writes mValues, sorted if needed, the index and the header. */
+    void WriteSnapshot();
+private :
+    static const size_t RECORD_BYTES = WIDTH + 1U;
+    int mFd;
+    SimhashFileFormat mFormat;
+    std::vector<char> mBuffer;
+    size_t mSize;               // The bytes of buffer used.
+    bool mFailed;
+    std::vector<HashT> mValues; // The values of snapshot not written.
+    bool mSorted;               // Whether the values so far are sorted.
+    HashT mLast;                // The last value written.
+    uint64_t mOffset;           // The offset of the next block.
+    std::vector<SimhashSnapshotBlock> mBlocks;  // The blocks written.
+    std::string mBlock;         // The encoded block.
+};
+
+/*
+* class SimhashFileReader.
+* SimhashFileReader reads simhash values from a file. The file is mapped into
+* memory, and each Read parses the next threadNum chunks of CHUNK_BYTES in
+* parallel, one thread per chunk. A text chunk ends at a line end, and a line
+* is parsed by its length : WIDTH / 4 is hex digits, others are '0' and '1'
+* as in the former versions. The digits are not validated, a line of wrong
+* chars gives a wrong value. Empty lines are skipped, and "\r\n" is accepted.
+* A binary file starting with SNAPSHOT_MAGIC is read as a snapshot : each Read
+* checks and decodes the next threadNum runs of blocks in parallel, as many
+* values per run as a chunk of the raw format.
+*/
+template <typename HashT>
+class SimhashFileReader
+{
+public :
+    static const uint_t WIDTH = HashTraits<HashT>::WIDTH;
+    static const size_t CHUNK_BYTES = 16U << 20;
+public :
+    SimhashFileReader();
+    ~SimhashFileReader();
+private :
+    SimhashFileReader(const SimhashFileReader &another);
+    SimhashFileReader& operator=(const SimhashFileReader &another);
+public :
+    /*
+    *   @brief      This func opens a file.
+    *   @author     Zhongping Liang
+    *   @date       2016-07-21
+    *   @param      filename : the input filename.
+    *   @param      binary   : if true, the file is SIMHASH_FILE_BINARY or
+    *           SIMHASH_FILE_SNAPSHOT; otherwise, it is one of the text formats.
+    *   @param      threadNum: the threads of parsing, 0 is the number of
+    *           CPUs, at most 16.
+    *   @return     true, if success; false, otherwise, also if the header or
+    *           the index of a snapshot is malformed.
+    */
+    bool Open(const std::string &filename, bool binary, uint_t threadNum = 0U);
+    /*
+    *   @brief      This func parses the next chunks of the file.
+    *   @author     Zhongping Liang
+    *   @date       2016-07-21
+    *   @param      values: the output values, in the order of file.
+    *   @return     false, if the end of file is reached, or a block of
+    *           snapshot is corrupted; true, otherwise.
+    */
+    bool Read(std::vector<HashT> &values);
+    /* Returns false if a block of snapshot is corrupted. */
+    bool Good() const
+    {
+        return !mFailed;
+    }
+    /* Unmaps and closes the file. */
+    void Close();
+    /* Decodes hex digits at data, size should be WIDTH / 4, or 0 returns. */
+    static HashT DecodeHex(const char *data, size_t size);
+    /* Decodes '0' and '1' at data, the last WIDTH of them are kept. */
+    static HashT DecodeBitString(const char *data, size_t size);
+    /* Parses the values in data[0, size) into values. */
+    static void Parse(const char *data, size_t size, bool binary,
+        std::vector<HashT> &values);
+private :
+    /* Checks the header and loads the index of a snapshot. */
+    bool OpenSnapshot();
+    /* Parses the next chunks into mParts, returns the number of them. */
+    size_t ReadChunks();
+    /* Decodes the next runs of blocks into mParts, likewise. */
+    size_t ReadSnapshot();
+private :
+    int mFd;
+    const char *mData;
+    size_t mSize;
+    size_t mPos;                // The bytes parsed, or the blocks decoded.
+    bool mBinary;
+    bool mSnapshot;
+    bool mFailed;
+    uint_t mThreadNum;
+    std::vector<std::vector<HashT> > mParts;    // The values of each chunk.
+    std::vector<SimhashSnapshotBlock> mBlocks;  // The index of snapshot.
+};
+
+} // namespace simhash
+
+#endif  //SIMHASH_SIMHASH_FILE_H_
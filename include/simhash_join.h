@@ -0,0 +1,99 @@
+/*==============================================================================
+*   Copyright (C) 2016 All rights reserved.
+*
+*  File Name    : simhash_join.h
+*  Author       : Zhongping Liang
+*  Date         : 2016-07-22
+*  Version      : 1.0
+*  Description  : This file provides the near-duplicate join of two sets of
+*           simhash values.
+==============================================================================*/
+
+#ifndef SIMHASH_SIMHASH_JOIN_H_
+#define SIMHASH_SIMHASH_JOIN_H_
+
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "wide_hash.h"
+
+namespace simhash
+{
+
+/*
+* class BasicSimhashJoinCallback.
+* The receiver of the matches of a join. The calls come from the threads of
+* the join, one at a time, so OnMatch needs no lock of its own.
+*/
+template <typename HashT>
+class BasicSimhashJoinCallback
+{
+public :
+    virtual ~BasicSimhashJoinCallback() {}
+    /*
+    *   @brief      This func receives a match.
+    *   @author     Zhongping Liang
+    *   @date       2016-07-22
+    *   @param      query   : the query value.
+    *   @param      match   : the value within maxHamDist bits of query.
+    *   @param      distance: the Hamming distance between them.
+    *   @return     void.
+    */
+    virtual void OnMatch(HashT query, HashT match, uint_t distance) = 0;
+};
+
+typedef BasicSimhashJoinCallback<hash_t>    SimhashJoinCallback;
+typedef BasicSimhashJoinCallback<hash128_t> SimhashJoinCallback128;
+typedef BasicSimhashJoinCallback<hash256_t> SimhashJoinCallback256;
+
+/*
+*   @brief      This func finds all the pairs of a query and a value within
+*           maxHamDist bits, by sort-merge.
+*   @author     Zhongping Liang
+*   @date       2016-07-22
+*   @param      queries   : the queries.
+*   @param      values    : the values.
+*   @param      maxHamDist: the max Hamming distance.
+*   @param      callback  : it receives each pair once.
+*   @param      threadNum : the threads, 0 is the number of CPUs.
+*   @return     void.
+*   @desc       The bits are split into maxHamDist + 1 blocks as in the
+*           SimhashTable, and a pair within maxHamDist bits has a block in
+*           common. For each block, the queries and the values are sorted by
+*           the block, and merged, the ones with the same block are compared.
+*           A pair is taken only under the first block they have in common,
+*           so it is called back once. The blocks are joined in parallel, each
+*           sorts the 4-byte indexes of queries and values instead of copies
+*           of them, by counting their top 16 bits of the block first, so a
+*           join of 64 bits values takes about
+*           min(threadNum, maxHamDist + 1) / 2 + 1 times their memory, and
+*           less for the wider ones. Each vector has fewer than 2^32 values.
+*           The duplicate values give duplicate pairs.
+*/
+template <typename HashT>
+void JoinSimhash(const std::vector<HashT> &queries,
+    const std::vector<HashT> &values, uint_t maxHamDist,
+    BasicSimhashJoinCallback<HashT> &callback, uint_t threadNum = 0U);
+
+/*
+*   @brief      This func joins the values of two files, see JoinSimhash.
+*   @author     Zhongping Liang
+*   @date       2016-07-22
+*   @param      queryFile : the file of queries.
+*   @param      valueFile : the file of values.
+*   @param      binary    : the mode of both files, see SimhashFileReader.
+*   @param      maxHamDist: the max Hamming distance.
+*   @param      callback  : it receives each pair once.
+*   @param      threadNum : the threads, 0 is the number of CPUs.
+*   @return     false, if a file fails to be read, and nothing is joined;
+*           true, otherwise.
+*/
+template <typename HashT>
+bool JoinSimhashFiles(const std::string &queryFile,
+    const std::string &valueFile, bool binary, uint_t maxHamDist,
+    BasicSimhashJoinCallback<HashT> &callback, uint_t threadNum = 0U);
+
+} // namespace simhash
+
+#endif // SIMHASH_SIMHASH_JOIN_H_
@@ -0,0 +1,118 @@
+/*==============================================================================
+*   Copyright (C) 2016 All rights reserved.
+*
+*  File Name    : simhash_protocol.h
+*  Author       : Zhongping Liang
+*  Date         : 2016-07-19
+*  Version      : 1.0
+*  Description  : This file provides the binary protocol of the simhash server
+*           and the socket helpers shared by the server and the client.
+==============================================================================*/
+
+#ifndef SIMHASH_SIMHASH_PROTOCOL_H_
+#define SIMHASH_SIMHASH_PROTOCOL_H_
+
+#include <string>
+#include <vector>
+
+#include "common.h"
+
+namespace simhash
+{
+
+/*
+* The protocol of the simhash server.
+* A request is REQUEST_BYTES bytes, an op code and a 64 bits simhash value :
+*     | op (1 byte) | hash (8 bytes, little endian) |
+* A response is RESPONSE_HEAD_BYTES bytes, and num values after it :
+*     | status (1 byte) | num (4 bytes, little endian) | num * hash (8 bytes) |
+* The status is SIMHASH_STATUS_FALSE or SIMHASH_STATUS_TRUE for the result of
+* the op, or SIMHASH_STATUS_BAD_REQUEST for an unknown op. num is the number
+* of near-duplicates for SIMHASH_OP_CODE_FIND_NEAR_DUPS, 1 for
+* SIMHASH_OP_CODE_GET_SIZE which returns the size as the value, and 0 for the
+* others. A client may send many requests without waiting (pipelining), the
+* responses of a connection come back in the order of its requests.
+* The ops of the whole table take no simhash value :
+* SIMHASH_OP_CODE_SAVE_TO_FILE and SIMHASH_OP_CODE_START_SAVE are followed by
+* a file name on the host of server, the low 32 bits of hash are the
+* SimhashFileFormat, and the high 32 bits are the bytes of the name, at most
+* MAX_NAME_BYTES, see EncodeNamedRequest. SIMHASH_OP_CODE_GET_SAVE_STATE
+* returns the SimhashSaveState as the value, it never waits. GET_STATS,
+* GET_BUCKET_REPORT and GET_MEMORY_USAGE return the reports encoded as values,
+* see SimhashTableStats::Encode.
+*/
+enum SimhashOpCode
+{
+    SIMHASH_OP_CODE_INSERT          = 1,
+    SIMHASH_OP_CODE_REMOVE          = 2,
+    SIMHASH_OP_CODE_SEARCH          = 3,
+    SIMHASH_OP_CODE_HAS_NEAR_DUPS   = 4,
+    SIMHASH_OP_CODE_FIND_NEAR_DUPS  = 5,
+    SIMHASH_OP_CODE_GET_SIZE        = 6,
+    SIMHASH_OP_CODE_CLEAR           = 7,
+    SIMHASH_OP_CODE_SAVE_TO_FILE    = 8,
+    SIMHASH_OP_CODE_START_SAVE      = 9,
+    SIMHASH_OP_CODE_GET_SAVE_STATE  = 10,
+    SIMHASH_OP_CODE_FREEZE          = 11,
+    SIMHASH_OP_CODE_GET_STATS       = 12,
+    SIMHASH_OP_CODE_RESET_STATS     = 13,
+    SIMHASH_OP_CODE_GET_BUCKET_REPORT = 14,
+    SIMHASH_OP_CODE_GET_MEMORY_USAGE  = 15
+};
+
+enum SimhashStatus
+{
+    SIMHASH_STATUS_FALSE        = 0,
+    SIMHASH_STATUS_TRUE         = 1,
+    SIMHASH_STATUS_BAD_REQUEST  = 2
+};
+
+const uint_t REQUEST_BYTES          = 9U;
+const uint_t RESPONSE_HEAD_BYTES    = 5U;
+const uint_t MAX_NAME_BYTES         = 4096U;
+
+/* Appends a request to buffer. */
+void EncodeRequest(uint_t op, hash_t hash, std::string &buffer);
+/* Appends a request of op, arg and a name following it to buffer. */
+void EncodeNamedRequest(uint_t op, uint_t arg, const std::string &name,
+    std::string &buffer);
+/* Decodes a request from REQUEST_BYTES bytes at data. */
+void DecodeRequest(const char *data, uint_t &op, hash_t &hash);
+/* Returns the bytes of the name following a request, 0 if it has none. */
+uint64_t GetRequestNameBytes(uint_t op, hash_t hash);
+/* Appends a response to buffer. */
+void EncodeResponse(uint_t status, const std::vector<hash_t> &values,
+    std::string &buffer);
+/* Appends a little endian integer of the given bytes to buffer. */
+void EncodeUint(uint64_t value, uint_t bytes, std::string &buffer);
+/* Decodes a little endian integer of the given bytes at data. */
+uint64_t DecodeUint(const char *data, uint_t bytes);
+
+/*
+*   @brief      This func opens a listening socket.
+*   @author     Zhongping Liang
+*   @date       2016-07-19
+*   @param      address: "unix:<path>" for a unix socket, or "<host>:<port>"
+*           for a TCP socket, where an empty host listens on all addresses.
+*   @param      backlog: the backlog of listen.
+*   @return     the non-blocking socket, or -1 if failed.
+*/
+int ListenSimhashAddress(const std::string &address, int backlog = 1024);
+
+/*
+*   @brief      This func connects to a server.
+*   @author     Zhongping Liang
+*   @date       2016-07-19
+*   @param      address: the same as ListenSimhashAddress.
+*   @return     the blocking socket, or -1 if failed.
+*/
+int ConnectSimhashAddress(const std::string &address);
+
+/* Writes all bytes to a blocking socket, returns false if failed. */
+bool WriteAll(int fd, const char *data, size_t size);
+/* Reads exactly size bytes from a blocking socket, returns false if failed. */
+bool ReadAll(int fd, char *data, size_t size);
+
+} // namespace simhash
+
+#endif  //SIMHASH_SIMHASH_PROTOCOL_H_
@@ -0,0 +1,124 @@
+/*==============================================================================
+*   Copyright (C) 2016 All rights reserved.
+*
+*  File Name    : simhash_server.h
+*  Author       : Zhongping Liang
+*  Date         : 2016-07-19
+*  Version      : 1.0
+*  Description  : This file provides declaration of the SimhashServer, which
+*           serves a SimhashTable over sockets.
+==============================================================================*/
+
+#ifndef SIMHASH_SIMHASH_SERVER_H_
+#define SIMHASH_SIMHASH_SERVER_H_
+
+#include <string>
+#include <tr1/memory>   //for shared_ptr
+
+#include "common.h"
+#include "simhash_table.h"
+#include "simhash_protocol.h"
+
+namespace simhash
+{
+
+/*
+* struct SimhashServerOptions.
+* address is where the server listens, see ListenSimhashAddress.
+* The server reads all the requests ready on its connections at each wakeup of
+* epoll, and runs the consecutive HasNearDups and FindNearDups requests among
+* them in one FindNearDupsBatch of batchDepth, if there are at least
+* minBatchSize of them. Inserts and removes are run in the order they arrive,
+* so a query always sees the inserts sent before it on any connection.
+* A connection is not read while it has more than maxOutputBytes of responses
+* not sent, so a client which does not read its responses cannot blow up the
+* memory of server.
+*/
+struct SimhashServerOptions
+{
+    std::string address;        // The listening address.
+    uint_t maxEvents;           // The max events of each epoll_wait.
+    uint_t minBatchSize;        // The min queries run as a batch.
+    uint_t maxBatchSize;        // The max queries of a batch.
+    uint_t batchDepth;          // The depth of FindNearDupsBatch.
+    uint_t maxOutputBytes;      // The max bytes not sent of a connection.
+
+    SimhashServerOptions();
+};
+
+/*
+* struct SimhashServerStats.
+* The counters of a SimhashServer.
+*/
+struct SimhashServerStats
+{
+    uint64_t connections;       // The connections accepted.
+    uint64_t requests;          // The requests served.
+    uint64_t batches;           // The batches of queries run.
+    uint64_t batchedQueries;    // The queries run in batches.
+    uint64_t wakeups;           // The wakeups of epoll with requests.
+
+    SimhashServerStats();
+    /* Returns a one line summary. */
+    std::string ToString() const;
+};
+
+/*
+* class SimhashServer.
+* SimhashServer serves a SimhashTable with one thread, the table is accessed
+* only by the thread calling Run, so the table needs no lock.
+*/
+class SimhashServer
+{
+//constructors
+public :
+    virtual ~SimhashServer();
+protected :
+    SimhashServer();
+private :
+    SimhashServer(const SimhashServer &another);
+    SimhashServer& operator=(const SimhashServer &another);
+//public functions
+public:
+    /*
+    *   @brief      This func runs the event loop until Stop is called.
+    *   @author     Zhongping Liang
+    *   @date       2016-07-19
+    *   @return     false, if the event loop fails; true, otherwise.
+    */
+    virtual bool Run() = 0;
+    /*
+    *   @brief      This func stops the event loop, it can be called from
+    *           any thread or a signal handler.
+    *   @author     Zhongping Liang
+    *   @date       2016-07-19
+    *   @return     void.
+    */
+    virtual void Stop() = 0;
+    /*
+    *   @brief      This func gets the counters of server, it should be called
+    *           by the thread calling Run, or after Run returns.
+    *   @author     Zhongping Liang
+    *   @date       2016-07-19
+    *   @param      stats: the output counters.
+    *   @return     void.
+    */
+    virtual void GetStats(SimhashServerStats &stats) = 0;
+};
+
+typedef std::tr1::shared_ptr<SimhashServer> SimhashServerPtr;
+
+/*
+*   @brief      This func creates a server of table, which listens at once.
+*   @author     Zhongping Liang
+*   @date       2016-07-19
+*   @param      tablePtr: the table to serve.
+*   @param      options : the options of server.
+*   @return     the server, or an empty pointer if it fails to listen.
+*/
+SimhashServerPtr CreateSimhashServer(SimhashTablePtr tablePtr,
+    const SimhashServerOptions &options);
+
+} // namespace simhash
+
+#endif  //SIMHASH_SIMHASH_SERVER_H_
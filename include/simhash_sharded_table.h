@@ -0,0 +1,92 @@
+/*==============================================================================
+*   Copyright (C) 2016 All rights reserved.
+*
+*  File Name    : simhash_sharded_table.h
+*  Author       : Zhongping Liang
+*  Date         : 2016-07-20
+*  Version      : 1.0
+*  Description  : This file provides declaration of the sharded SimhashTable,
+*           which spreads the simhash values over many SimhashServers.
+==============================================================================*/
+
+#ifndef SIMHASH_SIMHASH_SHARDED_TABLE_H_
+#define SIMHASH_SIMHASH_SHARDED_TABLE_H_
+
+#include <string>
+#include <vector>
+#include <tr1/memory>   //for shared_ptr
+
+#include "common.h"
+#include "simhash_table.h"
+
+namespace simhash
+{
+
+/*
+* class SimhashShardedTable.
+* The simhash values are partitioned over 2^s shards by their top s bits, i.e.
+* the top bits of the first block of the permutations, and each shard is a
+* SimhashServer with its own SimhashTable, which can be a process on the same
+* host or another one. Insert, Remove and Search go to the shard of the value.
+* A near-duplicate differs from the query in at most maxHamDist bits, so it
+* can only be in the shards whose ids are within maxHamDist bits of the top s
+* bits of the query, the queries are sent to these shards at once, and the
+* answers are merged. E.g. with 64 shards and maxHamDist 3, a query goes to
+* 42 shards, with 8 shards and maxHamDist 3, it goes to all of them. Each
+* shard holds 1/2^s of the values, so a query costs each shard about 1/2^s of
+* the buckets of one table, and the shards run in parallel.
+* The batches of FindNearDupsBatch are sent to each shard as one pipeline, so
+* the server batches them again. Join runs the queries as such batches, and
+* passes the matches to the callback from the calling thread.
+* The ops of the whole table are sent to all shards: SaveToFile and StartSave
+* make shard i save to filename + "." + i on its own host, Freeze freezes all
+* shards, and GetStats, GetBucketReport and GetMemoryUsage sum the reports of
+* shards. LoadFromFile reads a file saved by a SimhashTable on this host, and
+* inserts its values to the shards.
+* If the connection to a shard fails, the table is broken for good, see
+* IsBroken. The ops return false then, and a query returns no answer rather
+* than the answers of the other shards, so a broken table can't be taken as
+* one without near-duplicates unless IsBroken is checked.
+* The table is not thread-safe, as a SimhashTable.
+*/
+class SimhashShardedTable : public SimhashTable
+{
+//constructors
+public :
+    virtual ~SimhashShardedTable();
+protected :
+    SimhashShardedTable();
+private :
+    SimhashShardedTable(const SimhashShardedTable &another);
+    SimhashShardedTable& operator=(const SimhashShardedTable &another);
+//public functions
+public:
+    /*
+    *   @brief      This func tells whether the connection to some shard has
+    *           failed, after which the answers of table are not complete.
+    *   @author     agent
+    *   @date       2026-10-19
+    *   @return     true, if some shard has failed; false, otherwise.
+    */
+    virtual bool IsBroken() = 0;
+};
+
+typedef std::tr1::shared_ptr<SimhashShardedTable> SimhashShardedTablePtr;
+
+/*
+*   @brief      This func creates a sharded SimhashTable.
+*   @author     Zhongping Liang
+*   @date       2016-07-20
+*   @param      addresses   : the addresses of shards, addresses[i] serves
+*           the values whose top bits are i. The number of shards must be a
+*           power of two.
+*   @param      maxHamDist  : the max Hamming distance of the shards.
+*   @return     the table, or an empty pointer if the number of shards is not
+*           a power of two, or some shard fails to connect.
+*/
+SimhashShardedTablePtr CreateSimhashShardedTable(
+    const std::vector<std::string> &addresses, uint_t maxHamDist = 3U);
+
+} // namespace simhash
+
+#endif  //SIMHASH_SIMHASH_SHARDED_TABLE_H_
@@ -0,0 +1,257 @@
+/*==============================================================================
+*   Copyright (C) 2016 All rights reserved.
+*
+*  File Name    : simhash_stats.h
+*  Author       : Zhongping Liang
+*  Date         : 2016-06-15
+*  Version      : 1.0
+*  Description  : This file provides declaration of the statistics of the
+*           SimhashTable.
+==============================================================================*/
+
+#ifndef SIMHASH_SIMHASH_STATS_H_
+#define SIMHASH_SIMHASH_STATS_H_
+
+#include <time.h>
+#include <string>
+#include <vector>
+
+#include "common.h"
+
+/*
+* The statistics are collected only when SIMHASH_ENABLE_STATS is defined when
+* compiling the library, otherwise SIMHASH_STATS expands to nothing, and no
+* counter or clock is touched in the query path.
+*/
+#ifdef SIMHASH_ENABLE_STATS
+#define SIMHASH_STATS(x) do { x; } while (false)
+#else
+#define SIMHASH_STATS(x) do {} while (false)
+#endif
+
+namespace simhash
+{
+
+/*
+* class LatencyHistogram.
+* LatencyHistogram is a HDR-style histogram of latencies in nanoseconds. The
+* values less than 2^SUB_BITS are counted exactly, and each greater power of
+* two range is split into 2^(SUB_BITS-1) linear buckets, so the relative error
+* is less than 1/2^(SUB_BITS-1) in the whole range of uint64_t, with a fixed
+* memory of BUCKET_NUM counters.
+*/
+class LatencyHistogram
+{
+public :
+    static const uint_t VALUE_BITS  = 64U;  // The bits of a uint64_t value.
+    static const uint_t SUB_BITS    = 6U;
+    static const uint_t BUCKET_NUM  = (1U << (SUB_BITS - 1U))
+        * (VALUE_BITS - SUB_BITS + 2U);
+//constructors
+public :
+    LatencyHistogram();
+//public functions
+public :
+    /* Records a latency value. */
+    void Record(uint64_t value);
+    /* Adds all the values recorded by another histogram. */
+    void Merge(const LatencyHistogram &another);
+    /* Clears all the values. */
+    void Clear();
+    /* Returns the number of values recorded. */
+    uint64_t GetCount() const;
+    /* Returns the max value recorded. */
+    uint64_t GetMax() const;
+    /* Returns the mean of values recorded. */
+    double GetMean() const;
+    /*
+    *   @brief      This func returns the value at the given percentile.
+    *   @author     Zhongping Liang
+    *   @date       2016-06-15
+    *   @param      percentile: the percentile, in [0, 100].
+    *   @return     the value, which is the middle of the bucket it falls in.
+    */
+    uint64_t GetPercentile(double percentile) const;
+    /* Returns a one line summary, such as "count=.. mean=.. p50=..". */
+    std::string ToString() const;
+    /* Appends the histogram to values, the non-empty buckets only. */
+    void Encode(std::vector<uint64_t> &values) const;
+    /*
+    * Adds the histogram encoded at values[pos] to this one, and moves pos
+    * past it, returns false if values is malformed.
+    */
+    bool Decode(const std::vector<uint64_t> &values, size_t &pos);
+private :
+    static uint_t GetBucket(uint64_t value);
+    static uint64_t GetBucketLow(uint_t bucket);
+private :
+    std::vector<uint64_t> mCounts;
+    uint64_t mCount;
+    uint64_t mSum;
+    uint64_t mMax;
+};
+
+/* Returns the monotonic clock in nanoseconds. */
+inline uint64_t GetNanoTime()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000UL
+        + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+/*
+* class ScopedLatencyTimer.
+* ScopedLatencyTimer records the time from its construction to its destruction
+* into a histogram.
+*/
+class ScopedLatencyTimer
+{
+public :
+    explicit ScopedLatencyTimer(LatencyHistogram &histogram)
+        : mHistogram(histogram)
+        , mStart(GetNanoTime())
+    {}
+    ~ScopedLatencyTimer()
+    {
+        mHistogram.Record(GetNanoTime() - mStart);
+    }
+private :
+    ScopedLatencyTimer(const ScopedLatencyTimer &another);
+    ScopedLatencyTimer& operator=(const ScopedLatencyTimer &another);
+private :
+    LatencyHistogram &mHistogram;
+    uint64_t mStart;
+};
+
+/*
+* enum SimhashOperation.
+* The operations of SimhashTable with latencies recorded.
+*/
+enum SimhashOperation
+{
+    SIMHASH_OP_INSERT = 0,
+    SIMHASH_OP_REMOVE,
+    SIMHASH_OP_SEARCH,
+    SIMHASH_OP_HAS_NEAR_DUPS,
+    SIMHASH_OP_FIND_FIRST_NEAR_DUP,
+    SIMHASH_OP_FIND_NEAR_DUPS,
+    SIMHASH_OP_UPDATE,
+    SIMHASH_OP_NUM
+};
+
+/*
+* struct SimhashLevelStats.
+* The counters of all containers at one level. For an indexed container, a
+* probe is a permuted container descended into, and a filter reject is a
+* permuted container skipped by the prefilter. For a sequential container
+* (level 0), a probe is a range lookup of a bucket.
+*/
+struct SimhashLevelStats
+{
+    uint64_t bucketsProbed;         // The buckets or containers probed.
+    uint64_t filterRejects;         // The containers skipped by prefilter.
+    uint64_t candidatesCompared;    // The calls of Simhash::IsNearDups.
+    uint64_t matches;               // The near-duplicates found.
+
+    SimhashLevelStats();
+};
+
+/*
+* struct SimhashTableStats.
+* The statistics of a SimhashTable, levels[i] holds the counters of the
+* containers at level i, where level 0 is the leaf level.
+*/
+struct SimhashTableStats
+{
+    uint64_t inserts;               // The successful inserts.
+    uint64_t removes;               // The successful removes.
+    uint64_t duplicatesRemoved;     // The repeated answers of FindNearDups.
+    std::vector<SimhashLevelStats> levels;
+    LatencyHistogram latencies[SIMHASH_OP_NUM];
+
+    SimhashTableStats();
+    /* Clears all counters, the number of levels is kept. */
+    void Clear();
+    /* Returns a multi-line report. */
+    std::string ToString() const;
+    /* Appends the statistics to values, e.g. to be sent by a server. */
+    void Encode(std::vector<uint64_t> &values) const;
+    /*
+    * Adds the statistics encoded in values to this one, so the statistics
+    * of many tables are summed by decoding them in turn. Returns false if
+    * values is malformed.
+    */
+    bool Decode(const std::vector<uint64_t> &values);
+};
+
+/*
+* struct SimhashBucketReport.
+* The distribution of bucket sizes in the leaf containers of a SimhashTable. A
+* bucket is the simhash values in one leaf container which share the key, i.e.
+* the bits fixed by the permutations above it. sizeDistribution[i] is the
+* number of buckets with size in [2^i, 2^(i+1)).
+*/
+struct SimhashBucketReport
+{
+    uint64_t containerNum;          // The number of leaf containers.
+    uint64_t bucketNum;             // The number of non-empty buckets.
+    uint64_t elementNum;            // The number of simhash values in leaves.
+    uint64_t largestBucket;         // The size of the largest bucket.
+    std::vector<uint64_t> sizeDistribution;
+
+    SimhashBucketReport();
+    /* Counts a bucket of the given size. */
+    void AddBucket(uint64_t size);
+    /* Returns a multi-line report. */
+    std::string ToString() const;
+    /* Appends the report to values, see SimhashTableStats::Encode. */
+    void Encode(std::vector<uint64_t> &values) const;
+    /* Adds the report encoded in values to this one. */
+    bool Decode(const std::vector<uint64_t> &values);
+};
+
+/*
+* struct SimhashContainerMemory.
+* The memory used by one container, not including its sub-containers. The
+* bytes of the index nodes are estimated from the node size of the container
+* and the chunk size of malloc, they are not measured.
+*/
+struct SimhashContainerMemory
+{
+    uint_t   level;                 // The level of the container.
+    uint64_t elementNum;            // The simhash values held.
+    uint64_t nodeBytes;             // The bytes of the index nodes.
+    uint64_t filterBytes;           // The bytes of the prefilters.
+    uint64_t overheadBytes;         // The bytes of the container itself.
+
+    SimhashContainerMemory();
+    /* Returns the sum of all bytes. */
+    uint64_t GetTotalBytes() const;
+};
+
+/*
+* struct SimhashMemoryUsage.
+* The memory used by a SimhashTable. containers holds each container in the
+* order of a pre-order walk, and levels[i] sums the containers at level i.
+*/
+struct SimhashMemoryUsage
+{
+    std::vector<SimhashContainerMemory> containers;
+    std::vector<SimhashContainerMemory> levels;
+
+    /* Adds a container, and sums it into its level. */
+    void AddContainer(const SimhashContainerMemory &container);
+    /* Returns the bytes of the whole table. */
+    uint64_t GetTotalBytes() const;
+    /* Returns a multi-line report by levels. */
+    std::string ToString() const;
+    /* Appends the containers to values, see SimhashTableStats::Encode. */
+    void Encode(std::vector<uint64_t> &values) const;
+    /* Adds the containers encoded in values to this one. */
+    bool Decode(const std::vector<uint64_t> &values);
+};
+
+} // namespace simhash
+
+#endif // SIMHASH_SIMHASH_STATS_H_
@@ -16,6 +16,10 @@
 #include <string>
 
 #include "common.h"
+#include "wide_hash.h"
+#include "simhash_stats.h"
+#include "simhash_file.h"
+#include "simhash_join.h"
 
 namespace simhash
 {
@@ -24,7 +28,25 @@ namespace simhash
 typedef std::vector<hash_t> FindAnswerType;
 
 /*
-* class SimhashTable.
+* enum SimhashSaveState.
+* The states of the background save of a table, see StartSave.
+*/
+enum SimhashSaveState
+{
+    SIMHASH_SAVE_IDLE = 0,          // No save is started.
+    SIMHASH_SAVE_RUNNING,
+    SIMHASH_SAVE_DONE,              // The last save succeeded.
+    SIMHASH_SAVE_FAILED             // The last save failed.
+};
+
+/*
+* class BasicSimhashTable.
+* BasicSimhashTable is a container of simhash values of type HashT, which can
+* be hash_t, hash128_t or hash256_t. SimhashTable, SimhashTable128 and
+* SimhashTable256 are the instances, and HASH_WIDTH below is the width of HashT.
+* With 64 bits and a large mMaxHamDist, the blocks are narrow, so that the
+* buckets are large and the false positive rate is high, the wider types give
+* wider blocks with the same mMaxHamDist.
 * SimhashTable is a container of simhash values. It provides several methods to
 * access the table. User can insert a simhash value into the table; remove a
 * simhash value from the table; search a simhash value from the table; find all
@@ -77,18 +99,27 @@ typedef std::vector<hash_t> FindAnswerType;
 *       2 - use two levels index.
 *       ...
 * Note that, when level is higher, the space will have a exponential growth, the
-* suggested value is 1 or 2.
+* suggested value is 1 or 2. Each simhash value costs about (mBlockNum^level)
+* tree nodes of 40 bytes, 48 with malloc, see SimhashTableOptions::
+* useNodeArena. GetMemoryUsage reports the real usage, and the
+* overload of CreateSimhashTable taking a memory budget chooses the level.
 */
-class SimhashTable
+template <typename HashT>
+class BasicSimhashTable
 {
+//typedefs
+public :
+    typedef HashT HashType;
+    // type of FindNearDups result
+    typedef std::vector<HashT> AnswerType;
 //constructors
 public :
-    virtual ~SimhashTable();
+    virtual ~BasicSimhashTable();
 protected :
-    SimhashTable();
+    BasicSimhashTable();
 private :
-    SimhashTable(const SimhashTable &another);
-    SimhashTable& operator=(const SimhashTable &another);
+    BasicSimhashTable(const BasicSimhashTable &another);
+    BasicSimhashTable& operator=(const BasicSimhashTable &another);
 //public functions
 public:
     /*
@@ -98,7 +129,7 @@ public:
     *   @param      hash: the input simhash value to be inserted.
     *   @return     false, if hash is already in the table; true, otherwise.
     */
-    virtual bool Insert         (hash_t hash) = 0;
+    virtual bool Insert         (HashT hash) = 0;
     /*
     *   @brief      This func removes a simhash value from table.
     *   @author     Zhongping Liang
@@ -106,7 +137,25 @@ public:
     *   @param      hash: the input simhash value to be removed.
     *   @return     false, if hash is not in the table; true, otherwise.
     */
-    virtual bool Remove         (hash_t hash) = 0;
+    virtual bool Remove         (HashT hash) = 0;
+    /*
+    *   @brief      This func replaces a simhash value by another, e.g. when
+    *           a document is edited, see BasicSimhashAccumulator.
+    *   @author     Zhongping Liang
+    *   @date       2016-07-22
+    *   @param      oldHash: the simhash value to be removed.
+    *   @param      newHash: the simhash value to be inserted.
+    *   @return     true, if oldHash is in the table, and newHash is not or
+    *           equals oldHash; false otherwise, and the table is unchanged.
+    *   @desc       Each permuted container still stores the value, so it is
+    *           looked up in all of them. When the key of a permutation is
+    *           unchanged and no value lies between, the new value takes the
+    *           node of the old one, otherwise it is inserted and the old one
+    *           removed. The lookups dominate, so it costs about a Remove and
+    *           an Insert, but it is atomic, and only the changed keys are
+    *           added to the prefilters.
+    */
+    virtual bool Update         (HashT oldHash, HashT newHash) = 0;
     /*
     *   @brief      This func searches a simhash value from table. The condition
     *           of this func is equal, but not is near-duplicate.
@@ -115,7 +164,7 @@ public:
     *   @param      hash: the input simhash value to be searched.
     *   @return     false, if hash is not in the table; true, otherwise.
     */
-    virtual bool Search         (hash_t hash) = 0;
+    virtual bool Search         (HashT hash) = 0;
     /*
     *   @brief      This func judges whether a simhash value has any near-
     *           duplicate in table.
@@ -124,7 +173,7 @@ public:
     *   @param      hash: the input simhash value.
     *   @return     true, if there is some near-duplicates; false, otherwise.
     */
-    virtual bool HasNearDups    (hash_t hash) = 0;
+    virtual bool HasNearDups    (HashT hash) = 0;
     /*
     *   @brief      This func judges whether a simhash value has any near
     *           duplicate in table, if true, the near duplicate first found
@@ -135,7 +184,7 @@ public:
     *   @param      nearDup: the output near duplicate value.
     *   @return     true, if there is some near-duplicates; false, otherwise.
     */
-    virtual bool FindFirstNearDup(hash_t hash, hash_t &nearDup) = 0;
+    virtual bool FindFirstNearDup(HashT hash, HashT &nearDup) = 0;
     /*
     *   @brief      This func finds all simhash values from table that is near-
     *           duplicate with the given simhash value.
@@ -145,7 +194,79 @@ public:
     *   @param      ans : the simhash values found.
     *   @return     true, if there is some near-duplicates; false, otherwise.
     */
-    virtual bool FindNearDups   (hash_t hash, FindAnswerType &ans) = 0;
+    virtual bool FindNearDups   (HashT hash, AnswerType &ans) = 0;
+    /*
+    *   @brief      This func judges whether a simhash value has any value in
+    *           table within hamDist bits, a stricter radius than the table.
+    *   @author     Zhongping Liang
+    *   @date       2016-07-22
+    *   @param      hash   : the input simhash value.
+    *   @param      hamDist: the radius, at most the maxHamDist of table.
+    *   @return     true, if there is some; false, otherwise, also if hamDist
+    *           is larger than the maxHamDist of table.
+    *   @desc       Of the maxHamDist + 1 blocks, a value within hamDist bits
+    *           equals the query on at least one of any hamDist + 1 blocks,
+    *           so each indexed container probes only the first hamDist + 1
+    *           permuted containers, and the leaves compare within hamDist.
+    *           A lookup costs about (hamDist + 1)^level buckets instead of
+    *           (maxHamDist + 1)^level, e.g. a table of maxHamDist 6 answers
+    *           hamDist 2 in 3 of the 7 top containers.
+    */
+    virtual bool HasNearDupsWithin(HashT hash, uint_t hamDist) = 0;
+    /*
+    *   @brief      This func finds all simhash values from table whose
+    *           Hamming distances to the given one are in [minHamDist,
+    *           maxHamDist], probing as HasNearDupsWithin by maxHamDist.
+    *   @author     Zhongping Liang
+    *   @date       2016-07-22
+    *   @param      hash      : the input simhash value.
+    *   @param      minHamDist: the min distance, e.g. 1 to skip hash itself.
+    *   @param      maxHamDist: the max distance, at most the maxHamDist of
+    *           table.
+    *   @param      ans       : the simhash values found.
+    *   @return     true, if there is some; false, otherwise, also if
+    *           maxHamDist is larger than the maxHamDist of table.
+    */
+    virtual bool FindNearDupsWithin(HashT hash, uint_t minHamDist,
+        uint_t maxHamDist, AnswerType &ans) = 0;
+    /*
+    *   @brief      This func finds the near-duplicates of a batch of simhash
+    *           values, the same as FindNearDups for each one.
+    *   @author     Zhongping Liang
+    *   @date       2016-07-18
+    *   @param      hashes  : the input simhash values.
+    *   @param      answers : answers[i] is the values found for hashes[i].
+    *   @param      depth   : the number of lookups interleaved.
+    *   @return     the number of hashes with some near-duplicates.
+    *   @desc       With SIMHASH_LEAF_SORTED_ARRAY leaves, the binary searches
+    *           of depth queries advance in turn, and each step prefetches
+    *           the next probe of its query, so that the cache misses of
+    *           different queries overlap. A depth of 8 to 32 is usually
+    *           best. The frozen leaves, see Freeze, descend their trees
+    *           likewise. Other leaves just look up the queries one by one.
+    */
+    virtual uint_t FindNearDupsBatch(const std::vector<HashT> &hashes,
+        std::vector<AnswerType> &answers, uint_t depth = 16U) = 0;
+    /*
+    *   @brief      This func joins a set of queries against the table, it
+    *           finds the same pairs as FindNearDups for each query.
+    *   @author     Zhongping Liang
+    *   @date       2016-07-22
+    *   @param      queries  : the queries.
+    *   @param      callback : it receives each pair of a query and its
+    *           near-duplicate in the table once.
+    *   @param      threadNum: the threads, 0 is the number of CPUs.
+    *   @return     true, if joined; false, if the table doesn't support it.
+    *   @desc       For each block of the table, the queries are permuted
+    *           and sorted as the permuted container of the block, and merged
+    *           with its values as they are traversed in order, the ones with
+    *           the same block are compared, so the values are not copied. A
+    *           table of level 0, or saving in the background, is copied out
+    *           and joined by JoinSimhash, see simhash_join.h. It pays for
+    *           large batches of queries, e.g. a batch of 5% of the table.
+    */
+    virtual bool Join(const std::vector<HashT> &queries,
+        BasicSimhashJoinCallback<HashT> &callback, uint_t threadNum = 0U) = 0;
     /*
     *   @brief      This func clears table.
     *   @author     Zhongping Liang
@@ -169,22 +290,223 @@ public:
     *           save to file in string mode.
     *   @return     true, if success; false, otherwise.
     */
-    virtual bool SaveToFile(const std::string &filename, bool binary = true)
-        = 0;
+    bool SaveToFile(const std::string &filename, bool binary = true)
+    {
+        return SaveToFile(filename, binary ? SIMHASH_FILE_BINARY
+            : SIMHASH_FILE_BIT_STRING);
+    }
+    /*
+    *   @brief      This func saves all simhash values into file.
+    *   @author     Zhongping Liang
+    *   @date       2016-07-21
+    *   @param      filename: the output filename.
+    *   @param      format  : the format of file, see SimhashFileFormat. The
+    *           hex format is a quarter of the string mode, and the snapshot
+    *           is the smallest one.
+    *   @return     true, if success; false, otherwise.
+    */
+    virtual bool SaveToFile(const std::string &filename,
+        SimhashFileFormat format) = 0;
     /*
     *   @brief      This func loads all simhash values from file.
     *   @author     Zhongping Liang
     *   @date       2016-05-19
     *   @param      filename: the input filename.
     *   @param      binary  : if true, load from file in binary mode; otherwise
-    *           load from file in string mode.
-    *   @return     true, if success; false, otherwise.
+    *           load from file in string mode, where each line is told to be
+    *           hex or '0' and '1' by its length. A snapshot is loaded in
+    *           binary mode.
+    *   @return     true, if success; false, otherwise, also if a block of
+    *           snapshot is corrupted, after the blocks before it are loaded.
+    *   @desc       The file is parsed by all CPUs, see SimhashFileReader.
     */
     virtual bool LoadFromFile(const std::string &filename, bool binary = true)
         = 0;
+    /*
+    *   @brief      This func starts to save all simhash values into file in
+    *           background, while the table keeps serving. A child process
+    *           is forked, which shares the memory of table copy-on-write, so
+    *           it sees the table at this call, and the later writes are not
+    *           in the file. The child writes filename + ".tmp" at the lowest
+    *           priority, and renames it to filename when done, so filename
+    *           is always a whole file.
+    *   @author     Zhongping Liang
+    *   @date       2016-07-22
+    *   @param      filename: the output filename.
+    *   @param      format  : the format of file, see SimhashFileFormat.
+    *   @return     true, if the save is started; false, if the last save is
+    *           still running, or the fork fails.
+    *   @desc       Until the child exits, the inserts go to a small delta
+    *           index and the removes to a set, so the pages shared with the
+    *           child are only read and never copied. The queries look up
+    *           both. GetSaveState applies them to the table when it finds
+    *           the child done, so it should be called periodically. The fork
+    *           itself copies the page tables, about 2ms per GB of table.
+    *           Only the calling thread runs in the child, so no other thread
+    *           should be inside the table during this call.
+    */
+    virtual bool StartSave(const std::string &filename,
+        SimhashFileFormat format = SIMHASH_FILE_BINARY) = 0;
+    /*
+    *   @brief      This func gets the state of the background save.
+    *   @author     Zhongping Liang
+    *   @date       2016-07-22
+    *   @param      wait: if true, waits until the save is done.
+    *   @return     the state, see SimhashSaveState.
+    *   @desc       When the save is found done, the writes made during it are
+    *           applied to the table here, in one pass which costs about as
+    *           much as inserting the values again, so that Insert and Remove
+    *           carry no merge.
+    */
+    virtual SimhashSaveState GetSaveState(bool wait = false) = 0;
+    /*
+    *   @brief      This func freezes the table for read-only queries.
+    *   @author     Zhongping Liang
+    *   @date       2016-07-22
+    *   @return     true, if the table is frozen; false, if a save is running.
+    *   @desc       Each leaf container is rebuilt as a sorted array with a
+    *           static search tree of 8 keys per node over it, the nodes
+    *           aligned to cache lines and compared by SIMD. A bucket is
+    *           found in one cache miss per level of the tree, e.g. 7 for a
+    *           million values instead of 20 in a binary search, and the
+    *           arrays take the memory of the values only. Insert, Remove and
+    *           Update return false on a frozen table, Clear and LoadFromFile
+    *           thaw it to the options it was created with.
+    */
+    virtual bool Freeze() = 0;
+    /*
+    *   @brief      This func gets the statistics of table, see
+    *           SimhashTableStats. The statistics are collected only when the
+    *           library is compiled with SIMHASH_ENABLE_STATS defined.
+    *   @author     Zhongping Liang
+    *   @date       2016-06-15
+    *   @param      stats: the output statistics.
+    *   @return     true, if the statistics are collected; false, otherwise.
+    */
+    virtual bool GetStats(SimhashTableStats &stats) = 0;
+    /*
+    *   @brief      This func clears the statistics of table.
+    *   @author     Zhongping Liang
+    *   @date       2016-06-15
+    *   @return     void.
+    */
+    virtual void ResetStats() = 0;
+    /*
+    *   @brief      This func walks all the leaf containers, and reports the
+    *           distribution of bucket sizes. It costs a full scan of table,
+    *           and it is available whether or not SIMHASH_ENABLE_STATS is
+    *           defined.
+    *   @author     Zhongping Liang
+    *   @date       2016-06-15
+    *   @param      report: the output report.
+    *   @return     void.
+    */
+    virtual void GetBucketReport(SimhashBucketReport &report) = 0;
+    /*
+    *   @brief      This func reports the memory used by table, for each
+    *           container and each level, see SimhashMemoryUsage.
+    *   @author     Zhongping Liang
+    *   @date       2016-06-22
+    *   @param      usage: the output memory usage.
+    *   @return     void.
+    */
+    virtual void GetMemoryUsage(SimhashMemoryUsage &usage) = 0;
 };
 
-typedef std::tr1::shared_ptr<SimhashTable> SimhashTablePtr;
+typedef BasicSimhashTable<hash_t>    SimhashTable;
+typedef BasicSimhashTable<hash128_t> SimhashTable128;
+typedef BasicSimhashTable<hash256_t> SimhashTable256;
+typedef std::tr1::shared_ptr<SimhashTable>      SimhashTablePtr;
+typedef std::tr1::shared_ptr<SimhashTable128>   SimhashTable128Ptr;
+typedef std::tr1::shared_ptr<SimhashTable256>   SimhashTable256Ptr;
+
+/*
+* enum SimhashLeafType.
+* The layouts of the leaf containers, see SimhashTableOptions.
+*/
+enum SimhashLeafType
+{
+    SIMHASH_LEAF_SET = 0,           // A std::set, the default.
+    SIMHASH_LEAF_SORTED_ARRAY       // A sorted array and a small delta.
+};
+
+/*
+* struct SimhashTableOptions.
+* SimhashTableOptions gathers the knobs of a SimhashTable. The meanings of
+* maxHamDist and level are the same as in CreateSimhashTable.
+* When usePrefilter is true, each indexed container below the top one keeps a
+* blocked bloom filter for each permutation, keyed by the fixed (indexed) bits
+* of that permutation. A query checks the filter before descending into the
+* permuted container, so that a query without near-duplicates mostly costs a
+* handful of cache lines. The keys of the top container are too dense for a
+* filter, so it takes effect only when level >= 2. With 1M random values,
+* maxHamDist 3 and level 2, a query without near-duplicates takes about 2us
+* instead of 99us. Each filter costs prefilterBitsPerKey bits per simhash
+* value, and the false positive rate is about 1% with the default 10 bits.
+* The blocks of the indexed containers have equal widths by default. When the
+* bits of the simhash values are biased, a block may have few distinct values
+* and its buckets get huge. bitEntropies, one for each bit, makes the indexed
+* containers choose the widths maximizing the entropy of the lowest block, and
+* bitOrder reorders the bits of all simhash values before they are indexed, so
+* that the biased bits are spread over the blocks. Both are usually filled by
+* ChooseBlockLayout from a sample of the data.
+* When hotBucketSize is not 0, an insert which grows a leaf bucket to more
+* than hotBucketSize values moves the bucket into an index of its own, so the
+* worst query stays bounded on skewed data. A bucket is sub-indexed only when
+* that really splits it, the sub-indexes are nested when needed, and a remove
+* merges a sub-index back when it falls below hotBucketSize / 4 values.
+* When bitSliceSize is not 0, an insert which grows a leaf bucket to
+* bitSliceSize values mirrors it in a BitSlicedBucket, which compares a query
+* with 256 values at once, and a remove drops the mirror below half of that.
+* The mirror costs about 2 * sizeof(hash) bytes per value, 256 is a good
+* choice. Both are maintained by the writes only, a query never changes the
+* table.
+* leafType chooses the layout of the leaf containers. A sorted array leaf
+* keeps new values and removed values in small sets, and merges them into the
+* array when they exceed 1/16 of it, so a value costs sizeof(hash) bytes
+* instead of a tree node, and the lookups can be interleaved by
+* FindNearDupsBatch. It ignores hotBucketSize and bitSliceSize, the scan of an
+* array is fast already.
+* When useNodeArena is true, the default, each set leaf allocates its tree
+* nodes from a SlabArena of its own, see slab_arena.h, instead of malloc. The
+* nodes have no malloc header, the nodes inserted together are adjacent, a
+* removed node is reused by the next insert, and Clear frees the slabs at
+* once.
+*/
+struct SimhashTableOptions
+{
+    uint_t maxHamDist;          // The max Hamming distance can be tolerated.
+    uint_t level;               // The index level.
+    bool   usePrefilter;        // Whether to use the bloom filter prefilter.
+    uint_t prefilterBitsPerKey; // The bits per key of the bloom filter.
+    uint_t hotBucketSize;       // The bucket size to sub-index, 0 is never.
+    uint_t bitSliceSize;        // The bucket size to bit-slice, 0 is never.
+    SimhashLeafType leafType;   // The layout of the leaf containers.
+    bool   useNodeArena;        // Whether the set leaves use slab arenas.
+    std::vector<real_t> bitEntropies;   // The entropy of each bit, or empty.
+    std::vector<uint_t> bitOrder;   // Bit i is taken from bitOrder[i], or empty.
+
+    SimhashTableOptions(uint_t maxHamDist = 3U, uint_t level = 1U);
+};
+
+/*
+*   @brief      This func chooses the block layout of options from a sample of
+*           the simhash values to be inserted.
+*   @author     Zhongping Liang
+*   @date       2016-07-04
+*   @param      sample      : the sample, a few thousands values are enough.
+*   @param      reorderBits : whether to fill options.bitOrder too.
+*   @param      options     : the options, maxHamDist and level should be set,
+*           bitEntropies and bitOrder are filled.
+*   @return     void.
+*   @desc       The entropy of a bit is measured alone, so the correlation
+*           between bits is not taken into account. With reorderBits, the
+*           bits are dealt to the blocks in order of entropy, the same way as
+*           picking teams, then the widths are chosen by the entropies.
+*/
+template <typename HashT>
+void ChooseBlockLayout(const std::vector<HashT> &sample, bool reorderBits,
+    SimhashTableOptions &options);
 
 /*
 *   @brief      This func creates a SimhashTable instance.
@@ -200,6 +522,94 @@ typedef std::tr1::shared_ptr<SimhashTable> SimhashTablePtr;
 */
 SimhashTablePtr CreateSimhashTable(uint_t maxHamDist = 3U, uint_t level = 1U);
 
+/*
+*   @brief      This func creates a SimhashTable instance by options.
+*   @author     Zhongping Liang
+*   @date       2016-06-08
+*   @param      options     : the options of table, see SimhashTableOptions.
+*   @return     SimhashTable instance.
+*/
+SimhashTablePtr CreateSimhashTable(const SimhashTableOptions &options);
+
+/*
+*   @brief      This func creates a BasicSimhashTable instance of any width,
+*           e.g. CreateBasicSimhashTable<hash128_t>(options).
+*   @author     Zhongping Liang
+*   @date       2016-06-29
+*   @param      options     : the options of table, see SimhashTableOptions.
+*   @return     BasicSimhashTable instance.
+*/
+template <typename HashT>
+std::tr1::shared_ptr<BasicSimhashTable<HashT> > CreateBasicSimhashTable(
+    const SimhashTableOptions &options);
+
+/*
+* struct SimhashTableEstimate.
+* The estimated cost of a SimhashTable. The query time is the time of a
+* HasNearDups without near-duplicates, which is the common case of dedup, on a
+* table much larger than the CPU cache. The model counts the tree nodes or the
+* binary search probes visited, the candidates compared and the prefilters
+* checked, each costs about a cache miss, but the candidates of an array,
+* which are read in order. The constants are fitted by
+* TestSimhashTableCostModel in test/test_simhash_table.cpp.
+*/
+struct SimhashTableEstimate
+{
+    uint64_t memoryBytes;       // The estimated bytes of table.
+    double   queryNanos;        // The estimated nanoseconds of a query.
+
+    SimhashTableEstimate();
+};
+
+/*
+*   @brief      This func estimates the cost of a SimhashTable.
+*   @author     Zhongping Liang
+*   @date       2016-06-22
+*   @param      options     : the options of table, its level, prefilter and
+*           leafType are modeled.
+*   @param      expectedSize: the expected number of simhash values.
+*   @param      estimate    : the output estimate.
+*   @param      frozen      : if true, the table is estimated after Freeze,
+*           and the memory is the peak while it's built and frozen.
+*   @return     true, if success; false, if a block of the options would have
+*           no bits.
+*/
+bool EstimateSimhashTable(const SimhashTableOptions &options,
+    uint64_t expectedSize, SimhashTableEstimate &estimate,
+    bool frozen = false);
+
+/*
+*   @brief      This func chooses the options of a SimhashTable, which has the
+*           least estimated query time and fits in the memory budget. The
+*           level, the prefilter and the leafType are chosen.
+*   @author     Zhongping Liang
+*   @date       2016-06-22
+*   @param      expectedSize: the expected number of simhash values.
+*   @param      maxHamDist  : the max Hamming distance can be tolerated.
+*   @param      memoryBudget: the max bytes the table can use.
+*   @param      options     : the output options. If nothing fits, it is the
+*           one uses the least memory, level 0 of SIMHASH_LEAF_SORTED_ARRAY.
+*   @param      frozen      : if true, the table is to be frozen once it's
+*           built, see EstimateSimhashTable, and of the options as fast, the
+*           one of the least memory is chosen.
+*   @return     true, if the options fit in the budget; false, otherwise.
+*/
+bool ChooseSimhashTableOptions(uint64_t expectedSize, uint_t maxHamDist,
+    uint64_t memoryBudget, SimhashTableOptions &options, bool frozen = false);
+
+/*
+*   @brief      This func creates a SimhashTable instance, whose options are
+*           chosen by ChooseSimhashTableOptions.
+*   @author     Zhongping Liang
+*   @date       2016-06-22
+*   @param      expectedSize: the expected number of simhash values.
+*   @param      maxHamDist  : the max Hamming distance can be tolerated.
+*   @param      memoryBudget: the max bytes the table can use.
+*   @return     SimhashTable instance.
+*/
+SimhashTablePtr CreateSimhashTable(uint64_t expectedSize, uint_t maxHamDist,
+    uint64_t memoryBudget);
+
 } // namespace simhash
 
 #endif // SIMHASH_SIMHASH_TABLE_H_
@@ -0,0 +1,178 @@
+/*==============================================================================
+ *   Copyright (C) 2016 All rights reserved.
+ *
+ *  File Name    : simhash_tenant_table.h
+ *  Author       : Zhongping Liang
+ *  Date         : 2016-07-22
+ *  Version      : 1.0
+ *  Description  : This file provides declaration of the SimhashTenantTable.
+ * ============================================================================*/
+
+#ifndef SIMHASH_SIMHASH_TENANT_TABLE_H_
+#define SIMHASH_SIMHASH_TENANT_TABLE_H_
+
+#include <tr1/memory>   //for shared_ptr
+
+#include "common.h"
+#include "simhash_table.h"
+
+namespace simhash
+{
+
+// type of tenant ids, e.g. the id of a website.
+typedef uint64_t tenant_t;
+
+/*
+* class SimhashTenantTable.
+* SimhashTenantTable holds the simhash values of many tenants, each tenant is
+* a separate dedup table: the queries of a tenant only see its own values.
+* A SimhashTable per tenant costs a tree of containers, one for each
+* permutation and level, and the fixed cost exceeds the data of a small
+* tenant. SimhashTenantTable keeps all tenants in one tree of containers
+* instead, keyed by the 128 bits value (tenant, hash), the tenant in the high
+* 64 bits. The blocks are taken from the low 64 bits only, and the tenant bits
+* are fixed the same way as the bits fixed by a parent container, so a bucket
+* is the values of one tenant with the same key block, and a tenant costs
+* nothing but its values.
+* The options are the same as SimhashTableOptions. With level 0, a query scans
+* all values of its tenant, which is the cheapest for tenants of a few hundred
+* values, and hotBucketSize moves the large tenants into indexes of their own.
+* With level 1 or more, all tenants share the permuted containers. The sorted
+* array leaf costs 16 bytes per value and permutation, a tree node costs 64.
+* bitEntropies and bitOrder are of the 64 bits of hash.
+*/
+class SimhashTenantTable
+{
+//constructors
+public :
+    virtual ~SimhashTenantTable();
+protected :
+    SimhashTenantTable();
+private :
+    SimhashTenantTable(const SimhashTenantTable &another);
+    SimhashTenantTable& operator=(const SimhashTenantTable &another);
+//public functions
+public:
+    /*
+    *   @brief      This func inserts a simhash value into a tenant.
+    *   @author     Zhongping Liang
+    *   @date       2016-07-22
+    *   @param      tenant: the tenant.
+    *   @param      hash  : the input simhash value to be inserted.
+    *   @return     false, if hash is already in the tenant; true, otherwise.
+    */
+    virtual bool Insert         (tenant_t tenant, hash_t hash) = 0;
+    /*
+    *   @brief      This func removes a simhash value from a tenant.
+    *   @author     Zhongping Liang
+    *   @date       2016-07-22
+    *   @param      tenant: the tenant.
+    *   @param      hash  : the input simhash value to be removed.
+    *   @return     false, if hash is not in the tenant; true, otherwise.
+    */
+    virtual bool Remove         (tenant_t tenant, hash_t hash) = 0;
+    /*
+    *   @brief      This func searches a simhash value from a tenant. The
+    *           condition of this func is equal, but not is near-duplicate.
+    *   @author     Zhongping Liang
+    *   @date       2016-07-22
+    *   @param      tenant: the tenant.
+    *   @param      hash  : the input simhash value to be searched.
+    *   @return     false, if hash is not in the tenant; true, otherwise.
+    */
+    virtual bool Search         (tenant_t tenant, hash_t hash) = 0;
+    /*
+    *   @brief      This func judges whether a simhash value has any near-
+    *           duplicate in a tenant.
+    *   @author     Zhongping Liang
+    *   @date       2016-07-22
+    *   @param      tenant: the tenant.
+    *   @param      hash  : the input simhash value.
+    *   @return     true, if there is some near-duplicates; false, otherwise.
+    */
+    virtual bool HasNearDups    (tenant_t tenant, hash_t hash) = 0;
+    /*
+    *   @brief      This func judges whether a simhash value has any near
+    *           duplicate in a tenant, if true, the near duplicate first found
+    *           is saved in nearDup.
+    *   @author     Zhongping Liang
+    *   @date       2016-07-22
+    *   @param      tenant : the tenant.
+    *   @param      hash   : the input simhash value.
+    *   @param      nearDup: the output near duplicate value.
+    *   @return     true, if there is some near-duplicates; false, otherwise.
+    */
+    virtual bool FindFirstNearDup(tenant_t tenant, hash_t hash,
+        hash_t &nearDup) = 0;
+    /*
+    *   @brief      This func finds all simhash values of a tenant that is
+    *           near-duplicate with the given simhash value.
+    *   @author     Zhongping Liang
+    *   @date       2016-07-22
+    *   @param      tenant: the tenant.
+    *   @param      hash  : the input simhash value.
+    *   @param      ans   : the simhash values found, sorted and unique.
+    *   @return     true, if there is some near-duplicates; false, otherwise.
+    */
+    virtual bool FindNearDups   (tenant_t tenant, hash_t hash,
+        FindAnswerType &ans) = 0;
+    /*
+    *   @brief      This func removes all simhash values of a tenant.
+    *   @author     Zhongping Liang
+    *   @date       2016-07-22
+    *   @param      tenant: the tenant.
+    *   @return     the number of values removed.
+    */
+    virtual uint_t ClearTenant(tenant_t tenant) = 0;
+    /*
+    *   @brief      This func returns the number of simhash values of a tenant,
+    *           which are counted by a range scan, since no count is kept for
+    *           each tenant.
+    *   @author     Zhongping Liang
+    *   @date       2016-07-22
+    *   @param      tenant: the tenant.
+    *   @return     the size of tenant.
+    */
+    virtual uint_t GetTenantSize(tenant_t tenant) = 0;
+    /*
+    *   @brief      This func clears all tenants.
+    *   @author     Zhongping Liang
+    *   @date       2016-07-22
+    *   @return     void.
+    */
+    virtual void Clear() = 0;
+    /*
+    *   @brief      This func returns the number of simhash values of all
+    *           tenants.
+    *   @author     Zhongping Liang
+    *   @date       2016-07-22
+    *   @return     the size.
+    */
+    virtual uint_t GetSize() = 0;
+    /*
+    *   @brief      This func reports the memory used by table, see
+    *           SimhashMemoryUsage.
+    *   @author     Zhongping Liang
+    *   @date       2016-07-22
+    *   @param      usage: the output memory usage.
+    *   @return     void.
+    */
+    virtual void GetMemoryUsage(SimhashMemoryUsage &usage) = 0;
+};
+
+typedef std::tr1::shared_ptr<SimhashTenantTable> SimhashTenantTablePtr;
+
+/*
+*   @brief      This func creates a SimhashTenantTable instance.
+*   @author     Zhongping Liang
+*   @date       2016-07-22
+*   @param      options     : the options of all tenants, see
+*           SimhashTableOptions.
+*   @return     SimhashTenantTable instance.
+*/
+SimhashTenantTablePtr CreateSimhashTenantTable(
+    const SimhashTableOptions &options);
+
+} // namespace simhash
+
+#endif // SIMHASH_SIMHASH_TENANT_TABLE_H_
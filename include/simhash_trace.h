@@ -0,0 +1,254 @@
+/*==============================================================================
+*   Copyright (C) 2016 All rights reserved.
+*
+*  File Name    : simhash_trace.h
+*  Author       : Zhongping Liang
+*  Date         : 2016-07-22
+*  Version      : 1.0
+*  Description  : This file provides the recorder of the operations of a
+*           SimhashTable into a trace file, and the replay of a trace.
+==============================================================================*/
+
+#ifndef SIMHASH_SIMHASH_TRACE_H_
+#define SIMHASH_SIMHASH_TRACE_H_
+
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "simhash_table.h"
+#include "simhash_stats.h"
+
+namespace simhash
+{
+
+/*
+* The trace format.
+* A trace is the operations of a SimhashTable in the order they are called :
+*     | header | record 0 | record 1 | ... |
+* A record is :
+*     | op (1 byte) | time (varint) | operands |
+* where time is the nanoseconds since the previous record, or since the trace
+* is opened for the first one, in the varint of 7 bits per byte, low first.
+* The operands are the hash for Insert, Remove, Search and the queries, the
+* old and the new hash for Update, the depth and the number of hashes (both
+* varint) and the hashes for FindNearDupsBatch, and none for Clear and
+* Freeze. A hash is 8 bytes in host order, as SIMHASH_FILE_BINARY, so a
+* query costs 10 bytes at about 100K operations per second.
+*/
+const char TRACE_MAGIC[8] = {'S', 'H', 'T', 'R', 'A', 'C', 'E', '1'};
+const uint32_t TRACE_VERSION = 1U;
+
+/* The header of a trace file. */
+struct SimhashTraceHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t width;             // The bits of values.
+    uint64_t startTime;         // The wall clock of the first record, in ns.
+};
+
+/*
+* enum SimhashTraceOperation.
+* The operations of a trace besides SimhashOperation, which are recorded by
+* the same codes.
+*/
+enum SimhashTraceOperation
+{
+    SIMHASH_TRACE_FIND_NEAR_DUPS_BATCH = SIMHASH_OP_NUM,
+    SIMHASH_TRACE_CLEAR,
+    SIMHASH_TRACE_FREEZE,
+    SIMHASH_TRACE_OP_NUM
+};
+
+/* Returns the name of an operation of trace, such as "HasNearDups". */
+const char* GetTraceOperationName(uint_t op);
+
+/*
+* struct SimhashTraceRecord.
+* An operation of a trace, time is the nanoseconds since the first record.
+*/
+struct SimhashTraceRecord
+{
+    uint_t op;                  // A SimhashOperation or SimhashTraceOperation.
+    uint64_t time;
+    hash_t hash;                // The old hash of Update.
+    hash_t newHash;             // The new hash of Update.
+    uint_t depth;               // The depth of FindNearDupsBatch.
+    std::vector<hash_t> hashes; // The hashes of FindNearDupsBatch.
+
+    SimhashTraceRecord();
+};
+
+/*
+* class SimhashTraceWriter.
+* SimhashTraceWriter appends records to a trace file. The records are encoded
+* into a buffer of BUFFER_BYTES, which is written by one write call when it
+* is full, as SimhashFileWriter, so a record costs a clock read and a few
+* stores. It is not thread-safe.
+*/
+class SimhashTraceWriter
+{
+public :
+    static const size_t BUFFER_BYTES = 1U << 20;
+public :
+    SimhashTraceWriter();
+    ~SimhashTraceWriter();
+private :
+    SimhashTraceWriter(const SimhashTraceWriter &another);
+    SimhashTraceWriter& operator=(const SimhashTraceWriter &another);
+public :
+    /* Creates or truncates the file and writes the header, false if failed. */
+    bool Open(const std::string &filename);
+    /* Appends a record of op at now, newHash is used by Update only. */
+    void Write(uint_t op, hash_t hash = 0UL, hash_t newHash = 0UL);
+    /* Appends a record of FindNearDupsBatch at now. */
+    void WriteBatch(const std::vector<hash_t> &hashes, uint_t depth);
+    /* Writes the buffer to the file, false if any write failed. */
+    bool Flush();
+    /* Flushes and closes the file, returns false if any failed. */
+    bool Close();
+    /* Returns the number of records written. */
+    uint64_t GetRecordNum() const
+    {
+        return mRecordNum;
+    }
+private :
+    /* Flushes if the buffer has less than bytes left, and starts a record. */
+    char* Reserve(uint_t op, size_t bytes);
+private :
+    int mFd;
+    std::vector<char> mBuffer;
+    size_t mSize;               // The bytes of buffer used.
+    uint64_t mLastTime;         // The monotonic clock of the last record.
+    uint64_t mRecordNum;
+    bool mFailed;
+};
+
+/*
+* class SimhashTraceReader.
+* SimhashTraceReader reads the records of a trace file, which is mapped into
+* memory. A record cut by the end of file, e.g. of a process killed while
+* recording, ends the trace.
+*/
+class SimhashTraceReader
+{
+public :
+    SimhashTraceReader();
+    ~SimhashTraceReader();
+private :
+    SimhashTraceReader(const SimhashTraceReader &another);
+    SimhashTraceReader& operator=(const SimhashTraceReader &another);
+public :
+    /* Opens a trace, returns false if it fails or the header is malformed. */
+    bool Open(const std::string &filename);
+    /* Reads the next record, returns false at the end of trace. */
+    bool Read(SimhashTraceRecord &record);
+    /* Returns false if the trace ends in a malformed record. */
+    bool Good() const
+    {
+        return !mFailed;
+    }
+    /* Returns the header of trace. */
+    const SimhashTraceHeader& GetHeader() const
+    {
+        return mHeader;
+    }
+    /* Unmaps and closes the file. */
+    void Close();
+private :
+    int mFd;
+    const char *mData;
+    size_t mSize;
+    size_t mPos;                // The offset of the next record.
+    uint64_t mTime;             // The time of the last record.
+    bool mFailed;
+    SimhashTraceHeader mHeader;
+};
+
+/*
+*   @brief      This func creates a table which records the operations into a
+*           trace, and passes them to another table.
+*   @author     Zhongping Liang
+*   @date       2016-07-22
+*   @param      tablePtr : the table recorded, which serves the operations.
+*   @param      filename : the trace file, created or truncated.
+*   @return     the table, or an empty pointer if the file fails to open.
+*   @desc       The writes, the queries, Clear and Freeze are recorded,
+*           before they are passed to tablePtr. LoadFromFile is recorded as
+*           a Clear, the values loaded are not, so a trace of a loaded table
+*           is replayed from a file saved at its start. HasNearDupsWithin,
+*           FindNearDupsWithin and Join are passed but not recorded. The
+*           trace is flushed every BUFFER_BYTES, and when the table is
+*           destroyed. The table is not thread-safe, as a SimhashTable.
+*/
+SimhashTablePtr CreateSimhashTraceRecorder(SimhashTablePtr tablePtr,
+    const std::string &filename);
+
+/*
+* struct SimhashReplayOptions.
+* A trace is replayed by threadNum threads, the thread i runs the records i,
+* i + threadNum, ..., so the order of records of a thread is kept, and the
+* order between threads is not. With speed 0, each thread runs its records
+* as fast as it can, and the latency of a record is its call. Otherwise, a
+* record is run at its time of trace divided by speed, 1 is the original
+* rate, and the latency is measured from that time, so a slow table is not
+* hidden by the records it delays.
+* With more than one thread, the table is shared under a read-write lock, a
+* write holds it alone. With sharedReads, the queries share it : a query of
+* SimhashTable never changes the table, the hot buckets and the bit-sliced
+* mirrors are maintained by the writes. The counters of SIMHASH_ENABLE_STATS
+* are not atomic, so a build with them ignores sharedReads, and the sharded
+* table serves one connection at a time, it must not set it. Otherwise the
+* queries hold the lock alone as the writes.
+*/
+struct SimhashReplayOptions
+{
+    uint_t threadNum;
+    double speed;
+    bool sharedReads;
+
+    SimhashReplayOptions();
+};
+
+/*
+* struct SimhashReplayReport.
+* The result of a replay, the latencies are in nanoseconds, and the memory is
+* measured after the replay. residentBytes is the growth of the resident
+* memory of process during the replay.
+*/
+struct SimhashReplayReport
+{
+    uint64_t recordNum;         // The records replayed.
+    uint64_t queryNum;          // The queries, a batch counts its hashes.
+    uint64_t hitNum;            // The queries with some near-duplicates.
+    uint64_t failedWrites;      // The writes which returned false.
+    uint64_t elapsedNanos;
+    uint64_t tableBytes;        // See SimhashMemoryUsage::GetTotalBytes.
+    uint64_t residentBytes;
+    LatencyHistogram latencies[SIMHASH_TRACE_OP_NUM];
+    LatencyHistogram total;     // The latencies of all records.
+
+    SimhashReplayReport();
+    /* Returns a multi-line report. */
+    std::string ToString() const;
+};
+
+/*
+*   @brief      This func replays a trace on a table.
+*   @author     Zhongping Liang
+*   @date       2016-07-22
+*   @param      filename : the trace file.
+*   @param      tablePtr : the table, which can be of any options, or the
+*           sharded table.
+*   @param      options  : the options, see SimhashReplayOptions.
+*   @param      report   : the output report.
+*   @return     true, if the trace is replayed to its end; false, if it fails
+*           to open, or it has a malformed record.
+*/
+bool ReplaySimhashTrace(const std::string &filename, SimhashTablePtr tablePtr,
+    const SimhashReplayOptions &options, SimhashReplayReport &report);
+
+} // namespace simhash
+
+#endif  //SIMHASH_SIMHASH_TRACE_H_
@@ -0,0 +1,165 @@
+/*==============================================================================
+ *   Copyright (C) 2016 All rights reserved.
+ *
+ *  File Name    : simhash_window_table.h
+ *  Author       : Zhongping Liang
+ *  Date         : 2016-06-02
+ *  Version      : 1.0
+ *  Description  : This file provides declaration of the SimhashWindowTable.
+ * ============================================================================*/
+
+#ifndef SIMHASH_SIMHASH_WINDOW_TABLE_H_
+#define SIMHASH_SIMHASH_WINDOW_TABLE_H_
+
+#include <tr1/memory>   //for shared_ptr
+
+#include "common.h"
+#include "simhash_table.h"
+
+namespace simhash
+{
+
+// type of timestamps, the unit is chosen by user (seconds, ms, ...).
+typedef uint64_t timestamp_t;
+
+/*
+* class SimhashWindowTable.
+* SimhashWindowTable is a sliding-window container of simhash values. Only the
+* simhash values inserted within the last mWindowSpan time units are visible to
+* queries, older ones are expired automatically.
+* The window is partitioned into mSegmentNum segments, each covers mSegmentSpan
+* = ceil(mWindowSpan / mSegmentNum) time units and owns its own SimhashTable.
+* A simhash value inserted at timestamp t goes into the segment of epoch
+* t / mSegmentSpan, and queries visit every live segment. When the time moves
+* forward, the segments falling out of the window are dropped as a whole, so no
+* Remove (and no permutation work) is paid for expired simhash values. Clearing
+* a segment still frees every node of its (k+1)^level permuted containers, so
+* a dropped segment is swapped for an empty spare table, and a reaper thread
+* clears it in the background and keeps it as the next spare. The call which
+* crosses a segment boundary only pays the swap. The segments are reused in a
+* ring, so the memory stays flat under a steady stream, one segment being
+* cleared and one spare above the window.
+* As an example, mWindowSpan=6h, mSegmentNum=6, the current epoch is 9 :
+*     |  epoch 4  |  epoch 5  |  epoch 6  |  epoch 7  |  epoch 8  |  epoch 9  |
+*     | slot 4    | slot 5    | slot 0    | slot 1    | slot 2    | slot 3    |
+* When a timestamp of epoch 10 arrives, slot 4 is swapped for a spare and
+* reused by epoch 10. So a simhash value lives between mWindowSpan - mSegmentSpan and
+* mWindowSpan time units, the bigger mSegmentNum, the more precise the window.
+*/
+class SimhashWindowTable
+{
+//constructors
+public :
+    virtual ~SimhashWindowTable();
+protected :
+    SimhashWindowTable();
+private :
+    SimhashWindowTable(const SimhashWindowTable &another);
+    SimhashWindowTable& operator=(const SimhashWindowTable &another);
+//public functions
+public:
+    /*
+    *   @brief      This func inserts a simhash value into table.
+    *   @author     Zhongping Liang
+    *   @date       2016-06-02
+    *   @param      hash: the input simhash value to be inserted.
+    *   @param      timestamp: the time when hash arrives.
+    *   @return     false, if hash is already in the segment of timestamp, or
+    *           timestamp is already out of the window; true, otherwise.
+    *   @desc       A simhash value which is in an older segment is inserted
+    *           again, so that its lifetime is refreshed.
+    */
+    virtual bool Insert         (hash_t hash, timestamp_t timestamp) = 0;
+    /*
+    *   @brief      This func searches a simhash value from the live segments.
+    *           The condition of this func is equal, but not is near-duplicate.
+    *   @author     Zhongping Liang
+    *   @date       2016-06-02
+    *   @param      hash: the input simhash value to be searched.
+    *   @param      timestamp: the time of the query, which moves the window.
+    *   @return     false, if hash is not in the table; true, otherwise.
+    */
+    virtual bool Search         (hash_t hash, timestamp_t timestamp) = 0;
+    /*
+    *   @brief      This func judges whether a simhash value has any near-
+    *           duplicate in the live segments.
+    *   @author     Zhongping Liang
+    *   @date       2016-06-02
+    *   @param      hash: the input simhash value.
+    *   @param      timestamp: the time of the query, which moves the window.
+    *   @return     true, if there is some near-duplicates; false, otherwise.
+    */
+    virtual bool HasNearDups    (hash_t hash, timestamp_t timestamp) = 0;
+    /*
+    *   @brief      This func judges whether a simhash value has any near
+    *           duplicate in the live segments, if true, the near duplicate
+    *           first found is saved in nearDup. The newest segment is visited
+    *           first.
+    *   @author     Zhongping Liang
+    *   @date       2016-06-02
+    *   @param      hash: the input simhash value.
+    *   @param      timestamp: the time of the query, which moves the window.
+    *   @param      nearDup: the output near duplicate value.
+    *   @return     true, if there is some near-duplicates; false, otherwise.
+    */
+    virtual bool FindFirstNearDup(hash_t hash, timestamp_t timestamp,
+        hash_t &nearDup) = 0;
+    /*
+    *   @brief      This func finds all simhash values from the live segments
+    *           that is near-duplicate with the given simhash value.
+    *   @author     Zhongping Liang
+    *   @date       2016-06-02
+    *   @param      hash: the input simhash value.
+    *   @param      timestamp: the time of the query, which moves the window.
+    *   @param      ans : the simhash values found, sorted and unique.
+    *   @return     true, if there is some near-duplicates; false, otherwise.
+    */
+    virtual bool FindNearDups   (hash_t hash, timestamp_t timestamp,
+        FindAnswerType &ans) = 0;
+    /*
+    *   @brief      This func moves the window to timestamp, and drops all the
+    *           segments fall out of the window.
+    *   @author     Zhongping Liang
+    *   @date       2016-06-02
+    *   @param      timestamp: the current time.
+    *   @return     the number of segments dropped.
+    */
+    virtual uint_t Expire(timestamp_t timestamp) = 0;
+    /*
+    *   @brief      This func clears table.
+    *   @author     Zhongping Liang
+    *   @date       2016-06-02
+    *   @return     void.
+    */
+    virtual void Clear() = 0;
+    /*
+    *   @brief      This func returns the number of simhash values in all the
+    *           live segments. A value refreshed in a newer segment is counted
+    *           once for each segment holding it.
+    *   @author     Zhongping Liang
+    *   @date       2016-06-02
+    *   @return     the size.
+    */
+    virtual uint_t GetSize() = 0;
+};
+
+typedef std::tr1::shared_ptr<SimhashWindowTable> SimhashWindowTablePtr;
+
+/*
+*   @brief      This func creates a SimhashWindowTable instance.
+*   @author     Zhongping Liang
+*   @date       2016-06-02
+*   @param      maxHamDist  : the max Hamming distance can be tolerated.
+*   @param      level       : the index level of each segment, see
+*           CreateSimhashTable.
+*   @param      windowSpan  : the time span of the window, should be positive.
+*   @param      segmentNum  : the number of segments the window is split to,
+*           should be positive.
+*   @return     SimhashWindowTable instance.
+*/
+SimhashWindowTablePtr CreateSimhashWindowTable(uint_t maxHamDist,
+    uint_t level, timestamp_t windowSpan, uint_t segmentNum);
+
+} // namespace simhash
+
+#endif // SIMHASH_SIMHASH_WINDOW_TABLE_H_
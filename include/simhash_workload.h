@@ -0,0 +1,113 @@
+/*==============================================================================
+*   Copyright (C) 2016 All rights reserved.
+*
+*  File Name    : simhash_workload.h
+*  Author       : Zhongping Liang
+*  Date         : 2016-07-22
+*  Version      : 1.0
+*  Description  : This file provides the generator of clustered corpora of
+*           simhash values, with the ground truth of their near-duplicates.
+==============================================================================*/
+
+#ifndef SIMHASH_SIMHASH_WORKLOAD_H_
+#define SIMHASH_SIMHASH_WORKLOAD_H_
+
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "simhash_file.h"
+
+namespace simhash
+{
+
+/*
+* struct SimhashWorkloadOptions.
+* The corpus is valueNum simhash values in clusterNum clusters, e.g. the
+* versions of a page or the copies of a news. A cluster is a center and its
+* members, the cluster of rank i has 1 + a share of the other values
+* proportional to 1 / (i + 1)^zipfExponent, so 0 gives clusters of the same
+* size and 1 or more a few huge clusters and a long tail of singletons. A
+* member is the center with d bits flipped, d drawn by the weights of
+* distanceWeights (distanceWeights[d] for d bits), or with duplicateRate it
+* is an exact copy of an earlier value of its cluster. The bit i of a center
+* is 1 with the probability bitBiases[i], 0.5 for all bits if it is empty, as
+* the skewed bits of real simhash values, see SimhashTableOptions::
+* bitEntropies.
+* The values of a cluster depend only on seed and the rank of cluster, so the
+* corpus is the same with any threadNum; 0 is the number of CPUs.
+*/
+struct SimhashWorkloadOptions
+{
+    uint64_t valueNum;
+    uint64_t clusterNum;        // At most valueNum, and less than 2^32.
+    real_t zipfExponent;
+    std::vector<real_t> distanceWeights;
+    real_t duplicateRate;
+    std::vector<real_t> bitBiases;
+    uint64_t seed;
+    uint_t threadNum;
+
+    SimhashWorkloadOptions();
+};
+
+/*
+* struct SimhashWorkloadPair.
+* A record of the ground truth : a member, the center of its cluster and the
+* Hamming distance between them. The file of ground truth is an array of
+* them in host order, one per member in the order of the values file. The
+* members of a cluster are within the sum of their distances of each other,
+* so the pairs between members follow from cluster.
+*/
+struct SimhashWorkloadPair
+{
+    hash_t value;
+    hash_t center;
+    uint32_t cluster;           // The rank of cluster.
+    uint32_t distance;
+};
+
+/*
+* struct SimhashWorkloadReport.
+* The counts of a generated corpus, distanceCounts[d] is the number of
+* members d bits from their centers.
+*/
+struct SimhashWorkloadReport
+{
+    uint64_t valueNum;
+    uint64_t duplicateNum;      // The members copied from earlier values.
+    uint64_t largestCluster;    // The values of the largest cluster.
+    std::vector<uint64_t> distanceCounts;
+    uint64_t elapsedNanos;
+
+    SimhashWorkloadReport();
+};
+
+/*
+*   @brief      This func generates a corpus of clustered simhash values.
+*   @author     Zhongping Liang
+*   @date       2016-07-22
+*   @param      options  : the options, see SimhashWorkloadOptions.
+*   @param      valueFile: the file of values, with the center first in each
+*           cluster and the clusters by rank.
+*   @param      pairFile : the file of ground truth, see SimhashWorkloadPair,
+*           or empty for none.
+*   @param      report   : the output report.
+*   @param      format   : the format of valueFile, SIMHASH_FILE_BINARY is
+*           loaded by SimhashTable::LoadFromFile directly.
+*   @return     true, if success; false, if the options are invalid, or a
+*           file fails to write.
+*   @desc       The clusters are generated in rounds, each thread generates a
+*           run of clusters of about a million values, and the runs are
+*           written in order, so the memory is bounded by the threads, not
+*           by valueNum, except the snapshot format which is kept in memory
+*           to be sorted.
+*/
+bool GenerateSimhashWorkload(const SimhashWorkloadOptions &options,
+    const std::string &valueFile, const std::string &pairFile,
+    SimhashWorkloadReport &report,
+    SimhashFileFormat format = SIMHASH_FILE_BINARY);
+
+} // namespace simhash
+
+#endif  //SIMHASH_SIMHASH_WORKLOAD_H_
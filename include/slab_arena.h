@@ -0,0 +1,225 @@
+/*==============================================================================
+*   Copyright (C) 2016 All rights reserved.
+*
+*  File Name    : slab_arena.h
+*  Author       : Zhongping Liang
+*  Date         : 2016-07-22
+*  Version      : 1.0
+*  Description  : This file provides declaration of the SlabArena, and the
+*           SlabAllocator of the STL containers on it.
+==============================================================================*/
+
+#ifndef SIMHASH_SLAB_ARENA_H_
+#define SIMHASH_SLAB_ARENA_H_
+
+#include <vector>
+#include <new>
+#include <cstddef>
+
+#include "common.h"
+
+namespace simhash
+{
+
+/*
+* class SlabArena.
+* SlabArena allocates objects of one size from large slabs, e.g. the nodes of
+* a std::set. The objects are cut from the current slab in turn, so the
+* objects allocated together are adjacent, and a freed object is kept in a
+* free list to be reused first. No object has a malloc header, and Release
+* frees all slabs at once. The slabs double from a few objects up to
+* slabBytes, so a small arena stays small. The size is fixed by the first
+* Allocate, the requests of other sizes go to operator new.
+* The arena is not thread-safe, as the containers using it.
+*/
+class SlabArena
+{
+public :
+    static const size_t DEFAULT_SLAB_BYTES = 64U * 1024U;
+//constructors
+public :
+    explicit SlabArena(size_t slabBytes = DEFAULT_SLAB_BYTES);
+    ~SlabArena();
+private :
+    SlabArena(const SlabArena &another);
+    SlabArena& operator=(const SlabArena &another);
+//public functions
+public :
+    /*
+    *   @brief      This func allocates an object.
+    *   @author     Zhongping Liang
+    *   @date       2016-07-22
+    *   @param      bytes: the bytes of object.
+    *   @return     the object, it throws std::bad_alloc if out of memory.
+    */
+    inline void* Allocate(size_t bytes)
+    {
+        if (mFreeList && bytes == mRequestBytes)
+        {
+            void *ans = mFreeList;
+            mFreeList = *static_cast<void**>(mFreeList);
+            ++mObjectNum;
+            return ans;
+        }
+        if (mCursor + mObjectBytes <= mEnd && bytes == mRequestBytes)
+        {
+            void *ans = mCursor;
+            mCursor += mObjectBytes;
+            ++mObjectNum;
+            return ans;
+        }
+        return AllocateSlow(bytes);
+    }
+    /*
+    *   @brief      This func frees an object to the free list.
+    *   @author     Zhongping Liang
+    *   @date       2016-07-22
+    *   @param      ptr  : the object.
+    *   @param      bytes: the bytes of object, the same as allocated.
+    *   @return     void.
+    */
+    inline void Deallocate(void *ptr, size_t bytes)
+    {
+        if (bytes != mRequestBytes)
+        {
+            ::operator delete(ptr);
+            return;
+        }
+        *static_cast<void**>(ptr) = mFreeList;
+        mFreeList = ptr;
+        --mObjectNum;
+    }
+    /*
+    *   @brief      This func frees all slabs, no object should be in use.
+    *   @author     Zhongping Liang
+    *   @date       2016-07-22
+    *   @return     void.
+    */
+    void Release();
+    /*
+    *   @brief      This func returns the number of objects in use.
+    *   @author     Zhongping Liang
+    *   @date       2016-07-22
+    *   @return     the number.
+    */
+    size_t GetObjectNum() const
+    {
+        return mObjectNum;
+    }
+    /*
+    *   @brief      This func returns the bytes of all slabs, the objects in
+    *           use take GetObjectNum() * the object size, and the rest is
+    *           in the free list or not cut yet.
+    *   @author     Zhongping Liang
+    *   @date       2016-07-22
+    *   @return     the bytes.
+    */
+    uint64_t GetMemoryUsage() const;
+private :
+    /* Starts a new slab, or goes to operator new for other sizes. */
+    void* AllocateSlow(size_t bytes);
+private :
+    size_t mSlabBytes;
+    size_t mRequestBytes;       // The size of objects, 0 before the first.
+    size_t mObjectBytes;        // The size rounded up for the free list.
+    std::vector<char*> mSlabs;
+    char *mCursor;              // The next object in the current slab.
+    char *mEnd;                 // The end of the current slab.
+    uint64_t mTotalBytes;       // The bytes of all slabs.
+    void *mFreeList;            // The freed objects, linked by their heads.
+    size_t mObjectNum;          // The objects in use.
+};
+
+/*
+* class SlabAllocator.
+* SlabAllocator is an STL allocator on a SlabArena. The single objects, i.e.
+* the nodes of node-based containers, come from the arena, and the arrays
+* from operator new. Without an arena, all come from operator new, so the
+* same container type can be used either way. Two allocators are equal if
+* they share the arena.
+*/
+template <typename T>
+class SlabAllocator
+{
+public :
+    typedef T           value_type;
+    typedef T*          pointer;
+    typedef const T*    const_pointer;
+    typedef T&          reference;
+    typedef const T&    const_reference;
+    typedef size_t      size_type;
+    typedef ptrdiff_t   difference_type;
+    template <typename U>
+    struct rebind
+    {
+        typedef SlabAllocator<U> other;
+    };
+public :
+    explicit SlabAllocator(SlabArena *arena = NULL)
+        : mArena(arena)
+    {}
+    template <typename U>
+    SlabAllocator(const SlabAllocator<U> &another)
+        : mArena(another.GetArena())
+    {}
+public :
+    inline pointer allocate(size_type n, const void* = NULL)
+    {
+        if (mArena && 1U == n)
+        {
+            return static_cast<pointer>(mArena->Allocate(sizeof(T)));
+        }
+        return static_cast<pointer>(::operator new(n * sizeof(T)));
+    }
+    inline void deallocate(pointer ptr, size_type n)
+    {
+        if (mArena && 1U == n)
+        {
+            mArena->Deallocate(ptr, sizeof(T));
+            return;
+        }
+        ::operator delete(ptr);
+    }
+    inline void construct(pointer ptr, const T &value)
+    {
+        new (static_cast<void*>(ptr)) T(value);
+    }
+    inline void destroy(pointer ptr)
+    {
+        ptr->~T();
+    }
+    inline pointer address(reference value) const
+    {
+        return &value;
+    }
+    inline const_pointer address(const_reference value) const
+    {
+        return &value;
+    }
+    inline size_type max_size() const
+    {
+        return static_cast<size_type>(-1) / sizeof(T);
+    }
+    inline SlabArena* GetArena() const
+    {
+        return mArena;
+    }
+private :
+    SlabArena *mArena;
+};
+
+template <typename T, typename U>
+inline bool operator==(const SlabAllocator<T> &lhs, const SlabAllocator<U> &rhs)
+{
+    return lhs.GetArena() == rhs.GetArena();
+}
+
+template <typename T, typename U>
+inline bool operator!=(const SlabAllocator<T> &lhs, const SlabAllocator<U> &rhs)
+{
+    return lhs.GetArena() != rhs.GetArena();
+}
+
+} // namespace simhash
+
+#endif // SIMHASH_SLAB_ARENA_H_
@@ -0,0 +1,186 @@
+/*==============================================================================
+*   Copyright (C) 2016 All rights reserved.
+*
+*  File Name    : tf_idf.h
+*  Author       : Zhongping Liang
+*  Date         : 2016-07-22
+*  Version      : 1.0
+*  Description  : This file provides declaration of the IdfDictionary and the
+*           BasicTfIdfWeighter, which weigh the features by TF-IDF.
+==============================================================================*/
+
+#ifndef SIMHASH_TF_IDF_H_
+#define SIMHASH_TF_IDF_H_
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstddef>
+
+#include "common.h"
+#include "wide_hash.h"
+
+namespace simhash
+{
+
+/*
+* The IDF dictionary file.
+* The terms are keyed by their JenkinsHash, which is also the lowest word of
+* JenkinsHash128 and JenkinsHash256, so a key is the lowest word of the hash
+* of a feature, whatever its width. The file is a perfect hash table of the
+* hash and displace kind : a key falls in a bucket by its high bits, each
+* bucket has a displacement d, and the key of the bucket is at the slot
+*     (f1 + d * f2) % slotNum,
+* where f1 and f2 are from the key and slotNum is a prime, so d walks all the
+* slots. The builder finds a d for each bucket, the largest buckets first,
+* such that no two keys share a slot. A lookup reads a displacement and a
+* slot, and checks the key in the slot, the terms not in the dictionary get
+* the default IDF. The file is :
+*     | header | displacements (4 bytes each, padded to 8) | slots |
+* All the integers are in host order. The file is mapped as it is, so the
+* processes which open it share one copy, and opening it parses nothing.
+*/
+const char IDF_DICTIONARY_MAGIC[8] = {'S', 'H', 'I', 'D', 'F', '0', '0', '1'};
+const uint32_t IDF_DICTIONARY_VERSION = 1U;
+
+/* The header of an IDF dictionary file. */
+struct IdfDictionaryHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t keyNum;            // The number of terms.
+    uint64_t bucketNum;
+    uint64_t slotNum;           // A prime, at least keyNum.
+    real_t defaultIdf;          // The IDF of the terms not in the dictionary.
+};
+
+/* A slot of an IDF dictionary file, the key is 0 if it is empty. */
+struct IdfDictionarySlot
+{
+    uint64_t key;
+    real_t idf;
+};
+
+/*
+* class IdfDictionary.
+* IdfDictionary is a read-only IDF dictionary mapped from a file, see above.
+*/
+class IdfDictionary
+{
+//constructors
+public :
+    IdfDictionary();
+    ~IdfDictionary();
+//public functions
+public :
+    /*
+    *   @brief      This func builds a dictionary file.
+    *   @author     Zhongping Liang
+    *   @date       2016-07-22
+    *   @param      terms     : the pairs of the JenkinsHash of a term and its
+    *           IDF, the keys should be unique.
+    *   @param      defaultIdf: the IDF of the terms not in the dictionary.
+    *   @param      filename  : the file to write.
+    *   @return     false, if the keys are not unique, or failed to write;
+    *           true, otherwise.
+    */
+    static bool Build(const std::vector<std::pair<hash_t, real_t> > &terms,
+        real_t defaultIdf, const std::string &filename);
+    /*
+    *   @brief      This func maps a dictionary file, read only.
+    *   @author     Zhongping Liang
+    *   @date       2016-07-22
+    *   @param      filename: the dictionary file.
+    *   @return     false, if failed to map or the file is malformed; true,
+    *           otherwise.
+    */
+    bool Open(const std::string &filename);
+    /* Unmaps the file, all terms get 0 then. */
+    void Close();
+    /*
+    *   @brief      This func looks up the IDF of a term.
+    *   @author     Zhongping Liang
+    *   @date       2016-07-22
+    *   @param      key: the JenkinsHash of the term, or the lowest word of its
+    *           wider hash.
+    *   @return     The IDF of the term, or the default IDF if it is not in the
+    *           dictionary.
+    */
+    real_t GetIdf(hash_t key) const;
+    /* Returns the number of terms. */
+    inline uint64_t GetSize() const
+    {
+        return mHeader ? mHeader->keyNum : 0UL;
+    }
+private :
+    IdfDictionary(const IdfDictionary&);
+    IdfDictionary& operator=(const IdfDictionary&);
+private :
+    const char *mData;          // The mapped file.
+    size_t mSize;
+    const IdfDictionaryHeader *mHeader;
+    const uint32_t *mDisplacements;
+    const IdfDictionarySlot *mSlots;
+};
+
+/*
+* class BasicTfIdfWeighter.
+* BasicTfIdfWeighter turns the tokens of a document into the features weighted
+* by TF-IDF, the term frequency in the document times the IDF of the term. The
+* tokens are hashed once, and counted in a small open addressing map of their
+* hashes, which is kept between the documents, so a document costs no
+* allocation once the map is large enough. A weighter is not thread safe, each
+* thread should own one, and they can share one dictionary.
+*/
+template <typename HashT>
+class BasicTfIdfWeighter
+{
+public :
+    typedef HashT (*HashFunc) (const std::string &);
+    typedef std::pair<HashT, real_t> HashFeatureType;
+//constructors
+public :
+    /*
+    *   @brief      This func constructs a weighter.
+    *   @author     Zhongping Liang
+    *   @date       2016-07-22
+    *   @param      dictionary: the IDF dictionary, it should outlive the
+    *           weighter.
+    *   @param      hasher    : the hash function of tokens, JenkinsHash,
+    *           JenkinsHash128 or JenkinsHash256 to match the dictionary.
+    */
+    BasicTfIdfWeighter(const IdfDictionary &dictionary, HashFunc hasher);
+    ~BasicTfIdfWeighter();
+//public functions
+public :
+    /*
+    *   @brief      This func weighs the tokens of a document.
+    *   @author     Zhongping Liang
+    *   @date       2016-07-22
+    *   @param      tokens  : the tokens of the document.
+    *   @param      features: the distinct tokens with their TF-IDF, in the
+    *           order of their first occurrences, for BasicSimhash::Build.
+    *   @return     void.
+    */
+    void Weigh(const std::vector<std::string> &tokens,
+        std::vector<HashFeatureType> &features);
+private :
+    BasicTfIdfWeighter(const BasicTfIdfWeighter&);
+    BasicTfIdfWeighter& operator=(const BasicTfIdfWeighter&);
+private :
+    const IdfDictionary &mDictionary;
+    HashFunc mHasher;
+    // The map of the hashes of tokens to their indexes in features plus 1, 0
+    // is empty, its size is a power of 2, at least twice the tokens.
+    std::vector<uint32_t> mIndexes;
+    std::vector<uint32_t> mCounts;  // The term frequencies of features.
+};
+
+typedef BasicTfIdfWeighter<hash_t>      TfIdfWeighter;
+typedef BasicTfIdfWeighter<hash128_t>   TfIdfWeighter128;
+typedef BasicTfIdfWeighter<hash256_t>   TfIdfWeighter256;
+
+} // namespace simhash
+
+#endif // SIMHASH_TF_IDF_H_
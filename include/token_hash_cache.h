@@ -0,0 +1,121 @@
+/*==============================================================================
+*   Copyright (C) 2016 All rights reserved.
+*
+*  File Name    : token_hash_cache.h
+*  Author       : Zhongping Liang
+*  Date         : 2016-07-22
+*  Version      : 1.0
+*  Description  : This file provides declaration of the BasicTokenHashCache.
+==============================================================================*/
+
+#ifndef SIMHASH_TOKEN_HASH_CACHE_H_
+#define SIMHASH_TOKEN_HASH_CACHE_H_
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+#include "common.h"
+#include "wide_hash.h"
+
+namespace simhash
+{
+
+/*
+* class BasicTokenHashCache.
+* BasicTokenHashCache memoizes the hashes of short tokens, since most tokens
+* of a text come from a small vocabulary. It is a fixed size table of open
+* addressing, a token is looked up in PROBE_NUM slots from its home slot, and
+* a miss takes the first empty one of them, or evicts the home slot. The token
+* bytes are kept in the slot and compared, so the hashes are always the same
+* as the hasher's. Tokens longer than MAX_TOKEN_BYTES are hashed directly.
+* A lookup costs about as much as a JenkinsHash of a short token, so the cache
+* pays for the wider hashes, whose hashers run the Jenkins hash once per word.
+* A cache is not thread safe, each thread should own one.
+*/
+template <typename HashT>
+class BasicTokenHashCache
+{
+public :
+    typedef HashT (*HashFunc) (const std::string &);
+    static const uint_t MAX_TOKEN_BYTES = 24U;  // The longest cached token.
+    static const uint_t PROBE_NUM = 4U;         // The slots to look up.
+//constructors
+public :
+    /*
+    *   @brief      This func constructs a cache.
+    *   @author     Zhongping Liang
+    *   @date       2016-07-22
+    *   @param      hasher  : the hash function of tokens, not NULL.
+    *   @param      slotBits: there are 2^slotBits slots, the default 2^16
+    *           slots cost 2.5MB for hash_t and 4MB for hash256_t.
+    */
+    explicit BasicTokenHashCache(HashFunc hasher, uint_t slotBits = 16U);
+    ~BasicTokenHashCache();
+//public functions
+public :
+    /*
+    *   @brief      This func returns the hash of a token.
+    *   @author     Zhongping Liang
+    *   @date       2016-07-22
+    *   @param      token: the token.
+    *   @return     hasher(token).
+    */
+    HashT Hash(const std::string &token);
+    /* Returns the hash function. */
+    inline HashFunc GetHasher() const
+    {
+        return mHasher;
+    }
+    /* Returns the lookups found in the cache. */
+    inline uint64_t GetHits() const
+    {
+        return mHits;
+    }
+    /* Returns the lookups hashed by the hasher, the long tokens included. */
+    inline uint64_t GetMisses() const
+    {
+        return mMisses;
+    }
+    /*
+    *   @brief      This func returns the rate of lookups found in the cache.
+    *   @author     Zhongping Liang
+    *   @date       2016-07-22
+    *   @return     hits / (hits + misses), 0 if there is no lookup.
+    */
+    real_t GetHitRate() const;
+    /* Resets the hits and misses, the tokens are kept. */
+    void ResetStats();
+    /* Drops all tokens, and resets the stats. */
+    void Clear();
+    /* Returns the bytes used by the slots. */
+    size_t GetMemoryUsage() const;
+private :
+    BasicTokenHashCache(const BasicTokenHashCache&);
+    BasicTokenHashCache& operator=(const BasicTokenHashCache&);
+private :
+    /* A slot of a token. */
+    struct Slot
+    {
+        uint64_t head;              // The first 8 bytes, zero padded.
+        uint64_t middle;            // The 8 bytes after head, if above 16.
+        uint64_t tail;              // The last 8 bytes, if at least 8.
+        uint32_t length;            // The token bytes plus 1, 0 is empty.
+        HashT hash;
+    };
+private :
+    HashFunc mHasher;
+    std::vector<Slot> mSlots;
+    uint64_t mMask;                 // The number of slots minus 1.
+    uint_t mShift;                  // The mixed token >> mShift is its slot.
+    uint64_t mHits;
+    uint64_t mMisses;
+};
+
+typedef BasicTokenHashCache<hash_t>     TokenHashCache;
+typedef BasicTokenHashCache<hash128_t>  TokenHashCache128;
+typedef BasicTokenHashCache<hash256_t>  TokenHashCache256;
+
+} // namespace simhash
+
+#endif // SIMHASH_TOKEN_HASH_CACHE_H_
@@ -0,0 +1,94 @@
+/*==============================================================================
+*   Copyright (C) 2016 All rights reserved.
+*
+*  File Name    : tokenizer.h
+*  Author       : Zhongping Liang
+*  Date         : 2016-07-22
+*  Version      : 1.0
+*  Description  : This file provides declaration of the Tokenizer of UTF-8
+*           text.
+==============================================================================*/
+
+#ifndef SIMHASH_TOKENIZER_H_
+#define SIMHASH_TOKENIZER_H_
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstring>
+
+#include "common.h"
+
+namespace simhash
+{
+
+/* A token, the bytes are in the text, or in the buffer of the Tokenizer. */
+struct TokenSpan
+{
+    const char *data;
+    size_t size;
+    inline std::string ToString() const
+    {
+        return std::string(data, size);
+    }
+};
+
+/*
+* class Tokenizer.
+* Tokenizer splits UTF-8 text into tokens without copying them :
+*     1. The words are the runs of letters and digits, in any script, they are
+* split by the white spaces and the punctuations, of ASCII and of Unicode (the
+* Latin-1 ones, the general punctuations, the CJK symbols and punctuations,
+* and the fullwidth forms).
+*     2. The runs of CJK chars (the CJK ideographs, Hiragana and Katakana),
+* which have no spaces between words, give their overlapping bigrams, e.g.
+* "我爱成都" gives "我爱", "爱成", "成都", and a single CJK char gives itself.
+*     3. The invalid bytes of UTF-8 are taken as letters, one by one.
+* The ASCII text is classified 16 bytes at a time by SSE2, where it's built
+* with, and the other chars are decoded one by one.
+* With lowercase, the ASCII and the Latin-1 letters are lowered, the text is
+* lowered into the buffer of the tokenizer, and the tokens are in the buffer,
+* which is kept until the next Tokenize.
+*/
+class Tokenizer
+{
+//constructors
+public :
+    /*
+    *   @brief      This func constructs a tokenizer.
+    *   @author     Zhongping Liang
+    *   @date       2016-07-22
+    *   @param      lowercase: whether to lower the ASCII and Latin-1 letters.
+    */
+    explicit Tokenizer(bool lowercase = false);
+    ~Tokenizer();
+//public functions
+public :
+    /*
+    *   @brief      This func splits text into tokens.
+    *   @author     Zhongping Liang
+    *   @date       2016-07-22
+    *   @param      text  : the UTF-8 text.
+    *   @param      size  : the bytes of text.
+    *   @param      tokens: the tokens in the order of text, they point into
+    *           text, or into the buffer with lowercase.
+    *   @return     void.
+    */
+    void Tokenize(const char *text, size_t size, std::vector<TokenSpan> &tokens);
+    inline void Tokenize(const std::string &text,
+        std::vector<TokenSpan> &tokens)
+    {
+        Tokenize(text.data(), text.size(), tokens);
+    }
+    inline void Tokenize(const char *text, std::vector<TokenSpan> &tokens)
+    {
+        Tokenize(text, strlen(text), tokens);
+    }
+private :
+    bool mLowercase;
+    std::string mBuffer;        // The lowered text.
+};
+
+} // namespace simhash
+
+#endif // SIMHASH_TOKENIZER_H_
@@ -0,0 +1,360 @@
+/*==============================================================================
+*   Copyright (C) 2016 All rights reserved.
+*
+*  File Name    : wide_hash.h
+*  Author       : Zhongping Liang
+*  Date         : 2016-06-29
+*  Version      : 1.0
+*  Description  : This file provides the WideHash, simhash values wider than
+*           64 bits, and the traits of all hash types.
+==============================================================================*/
+
+#ifndef SIMHASH_WIDE_HASH_H_
+#define SIMHASH_WIDE_HASH_H_
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "common.h"
+
+namespace simhash
+{
+
+/*
+* class WideHash.
+* WideHash is an unsigned integer of WORDS * 64 bits, which supports the
+* operators the simhash containers apply on hash_t: bitwise operators, shifts
+* and comparisons. mWords[0] holds the lowest 64 bits. The bitwise operators of
+* 128 and 256 bits are implemented with SSE2 and AVX2 when they are enabled by
+* the compiler, e.g. -msse2 or -mavx2.
+*/
+template <uint_t WORDS>
+class WideHash
+{
+public :
+    static const uint_t WIDTH = WORDS * 64U;
+//constructors
+public :
+    WideHash()
+    {
+        for (uint_t i = 0; i < WORDS; ++i)
+        {
+            mWords[i] = 0UL;
+        }
+    }
+    /* Constructs from a 64-bit value, the higher words are zero. */
+    WideHash(uint64_t low)
+    {
+        mWords[0] = low;
+        for (uint_t i = 1U; i < WORDS; ++i)
+        {
+            mWords[i] = 0UL;
+        }
+    }
+//public functions
+public :
+    inline uint64_t GetWord(uint_t i) const
+    {
+        return mWords[i];
+    }
+    inline void SetWord(uint_t i, uint64_t word)
+    {
+        mWords[i] = word;
+    }
+
+    inline WideHash operator& (const WideHash &rhs) const
+    {
+        WideHash ans;
+        for (uint_t i = 0; i < WORDS; ++i)
+        {
+            ans.mWords[i] = mWords[i] & rhs.mWords[i];
+        }
+        return ans;
+    }
+    inline WideHash operator| (const WideHash &rhs) const
+    {
+        WideHash ans;
+        for (uint_t i = 0; i < WORDS; ++i)
+        {
+            ans.mWords[i] = mWords[i] | rhs.mWords[i];
+        }
+        return ans;
+    }
+    inline WideHash operator^ (const WideHash &rhs) const
+    {
+        WideHash ans;
+        for (uint_t i = 0; i < WORDS; ++i)
+        {
+            ans.mWords[i] = mWords[i] ^ rhs.mWords[i];
+        }
+        return ans;
+    }
+    inline WideHash operator~ () const
+    {
+        WideHash ans;
+        for (uint_t i = 0; i < WORDS; ++i)
+        {
+            ans.mWords[i] = ~mWords[i];
+        }
+        return ans;
+    }
+    inline WideHash operator<< (uint_t n) const
+    {
+        WideHash ans;
+        const uint_t words = n / 64U;
+        const uint_t bits = n % 64U;
+        for (uint_t i = words; i < WORDS; ++i)
+        {
+            ans.mWords[i] = mWords[i - words] << bits;
+            if (bits && i > words)
+            {
+                ans.mWords[i] |= mWords[i - words - 1U] >> (64U - bits);
+            }
+        }
+        return ans;
+    }
+    inline WideHash operator>> (uint_t n) const
+    {
+        WideHash ans;
+        const uint_t words = n / 64U;
+        const uint_t bits = n % 64U;
+        for (uint_t i = words; i < WORDS; ++i)
+        {
+            ans.mWords[i - words] = mWords[i] >> bits;
+            if (bits && i + 1U < WORDS)
+            {
+                ans.mWords[i - words] |= mWords[i + 1U] << (64U - bits);
+            }
+        }
+        return ans;
+    }
+    inline WideHash& operator&= (const WideHash &rhs)
+    {
+        return *this = *this & rhs;
+    }
+    inline WideHash& operator|= (const WideHash &rhs)
+    {
+        return *this = *this | rhs;
+    }
+    inline WideHash& operator^= (const WideHash &rhs)
+    {
+        return *this = *this ^ rhs;
+    }
+    inline WideHash& operator<<= (uint_t n)
+    {
+        return *this = *this << n;
+    }
+    inline WideHash& operator>>= (uint_t n)
+    {
+        return *this = *this >> n;
+    }
+    inline bool operator== (const WideHash &rhs) const
+    {
+        for (uint_t i = 0; i < WORDS; ++i)
+        {
+            if (mWords[i] != rhs.mWords[i])
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+    inline bool operator!= (const WideHash &rhs) const
+    {
+        return !(*this == rhs);
+    }
+    /* Compares from the highest word, as unsigned integers. */
+    inline bool operator< (const WideHash &rhs) const
+    {
+        for (uint_t i = WORDS; i > 0; --i)
+        {
+            if (mWords[i - 1U] != rhs.mWords[i - 1U])
+            {
+                return mWords[i - 1U] < rhs.mWords[i - 1U];
+            }
+        }
+        return false;
+    }
+    inline bool operator> (const WideHash &rhs) const
+    {
+        return rhs < *this;
+    }
+    inline bool operator<= (const WideHash &rhs) const
+    {
+        return !(rhs < *this);
+    }
+    inline bool operator>= (const WideHash &rhs) const
+    {
+        return !(*this < rhs);
+    }
+private :
+    uint64_t mWords[WORDS];
+};
+
+#ifdef __SSE2__
+/* The bitwise operators of 128 bits in one SSE2 instruction. */
+template <>
+inline WideHash<2U> WideHash<2U>::operator& (const WideHash<2U> &rhs) const
+{
+    WideHash<2U> ans;
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(ans.mWords), _mm_and_si128(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(mWords)),
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(rhs.mWords))));
+    return ans;
+}
+template <>
+inline WideHash<2U> WideHash<2U>::operator| (const WideHash<2U> &rhs) const
+{
+    WideHash<2U> ans;
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(ans.mWords), _mm_or_si128(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(mWords)),
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(rhs.mWords))));
+    return ans;
+}
+template <>
+inline WideHash<2U> WideHash<2U>::operator^ (const WideHash<2U> &rhs) const
+{
+    WideHash<2U> ans;
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(ans.mWords), _mm_xor_si128(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(mWords)),
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(rhs.mWords))));
+    return ans;
+}
+#endif // __SSE2__
+
+#ifdef __AVX2__
+/* The bitwise operators of 256 bits in one AVX2 instruction. */
+template <>
+inline WideHash<4U> WideHash<4U>::operator& (const WideHash<4U> &rhs) const
+{
+    WideHash<4U> ans;
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(ans.mWords),
+        _mm256_and_si256(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(mWords)),
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rhs.mWords))));
+    return ans;
+}
+template <>
+inline WideHash<4U> WideHash<4U>::operator| (const WideHash<4U> &rhs) const
+{
+    WideHash<4U> ans;
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(ans.mWords),
+        _mm256_or_si256(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(mWords)),
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rhs.mWords))));
+    return ans;
+}
+template <>
+inline WideHash<4U> WideHash<4U>::operator^ (const WideHash<4U> &rhs) const
+{
+    WideHash<4U> ans;
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(ans.mWords),
+        _mm256_xor_si256(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(mWords)),
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rhs.mWords))));
+    return ans;
+}
+#endif // __AVX2__
+
+typedef WideHash<2U> hash128_t;     //128-bit hash type
+typedef WideHash<4U> hash256_t;     //256-bit hash type
+
+/*
+* struct HashTraits.
+* HashTraits gives the width of a hash type.
+*/
+template <typename HashT>
+struct HashTraits
+{
+    static const uint_t WIDTH = static_cast<uint_t>(sizeof(HashT) * 8U);
+};
+
+/* Returns the number of 1 bits. */
+inline uint_t PopCount(uint64_t hash)
+{
+    return static_cast<uint_t>(__builtin_popcountll(hash));
+}
+
+/*
+* A word is counted by one popcnt with -mpopcnt. For 2 or 4 words that is
+* faster than the SIMD count by a nibble table, which needs a shuffle, two
+* adds and a horizontal sum for a single value.
+*/
+template <uint_t WORDS>
+inline uint_t PopCount(const WideHash<WORDS> &hash)
+{
+    uint_t ans = 0U;
+    for (uint_t i = 0; i < WORDS; ++i)
+    {
+        ans += static_cast<uint_t>(__builtin_popcountll(hash.GetWord(i)));
+    }
+    return ans;
+}
+
+/* Folds a hash into 64 bits, e.g. for the key of a bloom filter. */
+inline uint64_t FoldHash(uint64_t hash)
+{
+    return hash;
+}
+
+template <uint_t WORDS>
+inline uint64_t FoldHash(const WideHash<WORDS> &hash)
+{
+    uint64_t ans = hash.GetWord(WORDS - 1U);
+    for (uint_t i = WORDS - 1U; i > 0; --i)
+    {
+        ans = ans * 0x9e3779b97f4a7c15ULL ^ hash.GetWord(i - 1U);
+    }
+    return ans;
+}
+
+/* Returns the i-th byte, byte 0 is the lowest. */
+inline uint_t GetByte(uint64_t hash, uint_t i)
+{
+    return static_cast<uint_t>(hash >> (i * 8U)) & 0xFFU;
+}
+
+template <uint_t WORDS>
+inline uint_t GetByte(const WideHash<WORDS> &hash, uint_t i)
+{
+    return static_cast<uint_t>(hash.GetWord(i / 8U) >> (i % 8U * 8U)) & 0xFFU;
+}
+
+/* Returns the i-th 64 bits word, word 0 is the lowest, a uint64_t is word 0. */
+inline uint64_t GetWord(uint64_t hash, uint_t)
+{
+    return hash;
+}
+
+template <uint_t WORDS>
+inline uint64_t GetWord(const WideHash<WORDS> &hash, uint_t i)
+{
+    return hash.GetWord(i);
+}
+
+/* Sets the i-th 64 bits word, word 0 is the lowest, a uint64_t is word 0. */
+inline void SetWord(uint64_t &hash, uint_t, uint64_t word)
+{
+    hash = word;
+}
+
+template <uint_t WORDS>
+inline void SetWord(WideHash<WORDS> &hash, uint_t i, uint64_t word)
+{
+    hash.SetWord(i, word);
+}
+
+/* Returns the hash whose lowest n bits are 1, n can be the width. */
+template <typename HashT>
+inline HashT GetLowMask(uint_t n)
+{
+    return n ? ~HashT(0U) >> (HashTraits<HashT>::WIDTH - n) : HashT(0U);
+}
+
+} // namespace simhash
+
+#endif // SIMHASH_WIDE_HASH_H_
@@ -0,0 +1,238 @@
+/*==============================================================================
+*   Copyright (C) 2016 All rights reserved.
+*
+*  File Name    : bit_sliced_bucket.cpp
+*  Author       : Zhongping Liang
+*  Date         : 2016-07-11
+*  Version      : 1.0
+*  Description  : This file provides implement of the BitSlicedBucket.
+==============================================================================*/
+
+#include "bit_sliced_bucket.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+
+namespace simhash
+{
+
+/* The bits of a counter, enough for a distance of 256 bits. */
+static const uint_t MAX_COUNTER_BITS = 9U;
+
+/*
+* ScanBlock: counts the distances of a block of 256 lanes by the planes, and
+* sets survivors to the valid lanes with distance not exceeding the max, which
+* is given by the counterBits and the init value of the counters. Returns false
+* when no lane survives.
+*/
+#ifdef __AVX2__
+static bool ScanBlock(const uint64_t *planes, uint_t planeNum,
+    const uint64_t *queryMasks, uint_t counterBits, uint_t init,
+    const uint64_t *valid, uint64_t *survivors)
+{
+    const __m256i ones = _mm256_set1_epi64x(-1LL);
+    __m256i counters[MAX_COUNTER_BITS];
+    for (uint_t c = 0; c < counterBits; ++c)
+    {
+        counters[c] = (init >> c) & 1U ? ones : _mm256_setzero_si256();
+    }
+    //The invalid lanes are taken as carried.
+    __m256i over = _mm256_andnot_si256(_mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(valid)), ones);
+    for (uint_t p = 0; p < planeNum; ++p, planes += 4U)
+    {
+        __m256i carry = _mm256_xor_si256(_mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(planes)),
+            _mm256_set1_epi64x(static_cast<long long>(queryMasks[p])));
+        for (uint_t c = 0; c < counterBits; ++c)
+        {
+            const __m256i next = _mm256_and_si256(counters[c], carry);
+            counters[c] = _mm256_xor_si256(counters[c], carry);
+            carry = next;
+        }
+        over = _mm256_or_si256(over, carry);
+        if (3U == (p & 3U) && _mm256_testc_si256(over, ones))
+        {
+            return false;
+        }
+    }
+    const __m256i left = _mm256_andnot_si256(over, ones);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(survivors), left);
+    return !_mm256_testz_si256(left, left);
+}
+#else
+static bool ScanBlock(const uint64_t *planes, uint_t planeNum,
+    const uint64_t *queryMasks, uint_t counterBits, uint_t init,
+    const uint64_t *valid, uint64_t *survivors)
+{
+    static const uint_t WORDS = 4U;
+    uint64_t counters[MAX_COUNTER_BITS][WORDS];
+    uint64_t over[WORDS];
+    for (uint_t w = 0; w < WORDS; ++w)
+    {
+        for (uint_t c = 0; c < counterBits; ++c)
+        {
+            counters[c][w] = (init >> c) & 1U ? ~0UL : 0UL;
+        }
+        over[w] = ~valid[w];
+    }
+    for (uint_t p = 0; p < planeNum; ++p, planes += WORDS)
+    {
+        for (uint_t w = 0; w < WORDS; ++w)
+        {
+            uint64_t carry = planes[w] ^ queryMasks[p];
+            for (uint_t c = 0; c < counterBits; ++c)
+            {
+                const uint64_t next = counters[c][w] & carry;
+                counters[c][w] ^= carry;
+                carry = next;
+            }
+            over[w] |= carry;
+        }
+        if (3U == (p & 3U) && !~(over[0] & over[1] & over[2] & over[3]))
+        {
+            return false;
+        }
+    }
+    uint64_t any = 0UL;
+    for (uint_t w = 0; w < WORDS; ++w)
+    {
+        survivors[w] = ~over[w];
+        any |= survivors[w];
+    }
+    return 0UL != any;
+}
+#endif // __AVX2__
+
+template <typename HashT>
+BitSlicedBucket<HashT>::BitSlicedBucket(uint_t planeNum)
+    : mPlaneNum(planeNum)
+{}
+
+template <typename HashT>
+uint_t BitSlicedBucket<HashT>::GetSize() const
+{
+    return static_cast<uint_t>(mValues.size());
+}
+
+template <typename HashT>
+void BitSlicedBucket<HashT>::SetLane(uint_t lane, HashT hash)
+{
+    const uint_t block = lane / LANES;
+    const uint_t word = lane % LANES / 64U;
+    const uint64_t bit = static_cast<uint64_t>(1UL) << (lane % 64U);
+    for (uint_t p = 0; p < mPlaneNum; ++p)
+    {
+        uint64_t &plane = GetPlane(block, p)[word];
+        if ((GetByte(hash, p / 8U) >> (p % 8U)) & 1U)
+        {
+            plane |= bit;
+        }
+        else
+        {
+            plane &= ~bit;
+        }
+    }
+}
+
+template <typename HashT>
+void BitSlicedBucket<HashT>::Add(HashT hash)
+{
+    const uint_t lane = GetSize();
+    if (0 == lane % LANES)
+    {
+        mPlanes.resize(mPlanes.size() + mPlaneNum * LANE_WORDS, 0UL);
+    }
+    mValues.push_back(hash);
+    SetLane(lane, hash);
+}
+
+template <typename HashT>
+bool BitSlicedBucket<HashT>::Remove(HashT hash)
+{
+    //Find the lane by the values, and move the last lane into it.
+    typename std::vector<HashT>::iterator it
+        = std::find(mValues.begin(), mValues.end(), hash);
+    if (mValues.end() == it)
+    {
+        return false;
+    }
+    const uint_t last = GetSize() - 1U;
+    *it = mValues.back();
+    SetLane(static_cast<uint_t>(it - mValues.begin()), mValues.back());
+    SetLane(last, HashT(0U));
+    mValues.pop_back();
+    if (0 == last % LANES)
+    {
+        mPlanes.resize(mPlanes.size() - mPlaneNum * LANE_WORDS);
+    }
+    return true;
+}
+
+template <typename HashT>
+uint_t BitSlicedBucket<HashT>::FindNearDups(HashT hash, uint_t maxHamDist,
+    bool firstOnly, std::vector<HashT> &ans) const
+{
+    //The counters carry out when the distance reaches maxHamDist + 1.
+    maxHamDist = std::min(maxHamDist, mPlaneNum);
+    uint_t counterBits = 1U;
+    while ((1U << counterBits) < maxHamDist + 1U)
+    {
+        ++counterBits;
+    }
+    const uint_t init = (1U << counterBits) - 1U - maxHamDist;
+    std::vector<uint64_t> queryMasks(mPlaneNum);
+    for (uint_t p = 0; p < mPlaneNum; ++p)
+    {
+        queryMasks[p] = (GetByte(hash, p / 8U) >> (p % 8U)) & 1U ? ~0UL : 0UL;
+    }
+    uint_t found = 0U;
+    const uint_t size = GetSize();
+    for (uint_t block = 0; block * LANES < size; ++block)
+    {
+        uint64_t valid[LANE_WORDS];
+        for (uint_t w = 0; w < LANE_WORDS; ++w)
+        {
+            const uint_t begin = block * LANES + w * 64U;
+            valid[w] = begin >= size ? 0UL : begin + 64U <= size ? ~0UL
+                : (static_cast<uint64_t>(1UL) << (size - begin)) - 1UL;
+        }
+        uint64_t survivors[LANE_WORDS];
+        if (!ScanBlock(&mPlanes[static_cast<size_t>(block) * mPlaneNum
+            * LANE_WORDS], mPlaneNum, &queryMasks.front(), counterBits, init,
+            valid, survivors))
+        {
+            continue;
+        }
+        for (uint_t w = 0; w < LANE_WORDS; ++w)
+        {
+            for (uint64_t bits = survivors[w]; bits; bits &= bits - 1UL)
+            {
+                ans.push_back(mValues[block * LANES + w * 64U
+                    + static_cast<uint_t>(__builtin_ctzll(bits))]);
+                ++found;
+                if (firstOnly)
+                {
+                    return found;
+                }
+            }
+        }
+    }
+    return found;
+}
+
+template <typename HashT>
+uint64_t BitSlicedBucket<HashT>::GetMemoryUsage() const
+{
+    return mValues.capacity() * sizeof(HashT)
+        + mPlanes.capacity() * sizeof(uint64_t);
+}
+
+template class BitSlicedBucket<hash_t>;
+template class BitSlicedBucket<hash128_t>;
+template class BitSlicedBucket<hash256_t>;
+
+} // namespace simhash
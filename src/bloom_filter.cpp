@@ -0,0 +1,137 @@
+/*==============================================================================
+*   Copyright (C) 2016 All rights reserved.
+*
+*  File Name    : bloom_filter.cpp
+*  Author       : Zhongping Liang
+*  Date         : 2016-06-08
+*  Version      : 1.0
+*  Description  : This file provides implement of the BlockedBloomFilter.
+==============================================================================*/
+
+#include "bloom_filter.h"
+
+#include <algorithm>
+
+namespace simhash
+{
+
+/*
+* Mix: the finalizer of MurmurHash3, spreads every input bit to all output
+* bits, so that masked keys with many zero bits are fine.
+*/
+static inline uint64_t Mix(uint64_t key)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return key;
+}
+
+BlockedBloomFilter::BlockedBloomFilter()
+    : mBlocks(      NULL    )
+    , mBlockNum(    0UL     )
+    , mProbeNum(    0U      )
+{}
+
+BlockedBloomFilter::~BlockedBloomFilter()
+{}
+
+BlockedBloomFilter::BlockedBloomFilter(const BlockedBloomFilter &another)
+    : mBlocks(      NULL    )
+    , mBlockNum(    0UL     )
+    , mProbeNum(    0U      )
+{
+    *this = another;
+}
+
+BlockedBloomFilter& BlockedBloomFilter::operator=(
+    const BlockedBloomFilter &another)
+{
+    if (this != &another)
+    {
+        mBuff.resize(another.mBlockNum * BLOCK_WORDS + BLOCK_WORDS);
+        mBlocks = mBuff.empty() ? NULL : &mBuff.front();
+        while (reinterpret_cast<size_t>(mBlocks) % (BLOCK_BITS / 8U))
+        {
+            ++mBlocks;
+        }
+        mBlockNum = another.mBlockNum;
+        mProbeNum = another.mProbeNum;
+        if (mBlockNum)
+        {
+            std::copy(another.mBlocks, another.mBlocks
+                + mBlockNum * BLOCK_WORDS, mBlocks);
+        }
+    }
+    return *this;
+}
+
+void BlockedBloomFilter::Reset(uint_t expectedKeys, uint_t bitsPerKey)
+{
+    //Probes = bitsPerKey * ln(2), which minimizes the false positive rate.
+    mProbeNum = std::min(std::max(bitsPerKey * 69U / 100U, 1U), 16U);
+    mBlockNum = (static_cast<uint64_t>(std::max(expectedKeys, 1U))
+        * bitsPerKey + BLOCK_BITS - 1U) / BLOCK_BITS;
+    //Keep a block of room, so that the blocks can be aligned to cache line.
+    mBuff.assign(mBlockNum * BLOCK_WORDS + BLOCK_WORDS, 0UL);
+    mBlocks = &mBuff.front();
+    while (reinterpret_cast<size_t>(mBlocks) % (BLOCK_BITS / 8U))
+    {
+        ++mBlocks;
+    }
+}
+
+void BlockedBloomFilter::Add(uint64_t key)
+{
+    if (!mBlockNum)
+    {
+        return;
+    }
+    key = Mix(key);
+    uint64_t *block = GetBlock(key);
+    //The low 32 bits choose the bits in the block, each probe takes the top
+    //9 bits and then remixes by a multiplication.
+    uint32_t h = static_cast<uint32_t>(key);
+    for (uint_t i = 0; i < mProbeNum; ++i, h *= 0x9e3779b9U)
+    {
+        const uint32_t bit = h >> 23;
+        block[bit >> 6] |= HASH_1 << (bit & 63U);
+    }
+}
+
+bool BlockedBloomFilter::MayContain(uint64_t key) const
+{
+    if (!mBlockNum)
+    {
+        return true;
+    }
+    key = Mix(key);
+    const uint64_t *block = GetBlock(key);
+    uint32_t h = static_cast<uint32_t>(key);
+    for (uint_t i = 0; i < mProbeNum; ++i, h *= 0x9e3779b9U)
+    {
+        const uint32_t bit = h >> 23;
+        if (!(block[bit >> 6] & (HASH_1 << (bit & 63U))))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void BlockedBloomFilter::Clear()
+{
+    if (mBlockNum)
+    {
+        std::fill(mBlocks, mBlocks + mBlockNum * BLOCK_WORDS, 0UL);
+    }
+}
+
+size_t BlockedBloomFilter::GetMemoryUsage() const
+{
+    return mBuff.capacity() * sizeof(uint64_t);
+}
+
+} // namespace simhash
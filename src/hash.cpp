@@ -84,11 +84,41 @@ namespace simhash {
         *pc = c; *pb = b;
     }
 
-    hash_t JenkinsHash(const std::string &str)
+    /*
+    * SeededJenkinsHash: JenkinsHash with seed, seed 0 gives JenkinsHash.
+    */
+    static inline uint64_t SeededJenkinsHash(const std::string &str,
+        uint32_t seed)
     {
-        uint32_t a = 0, b = 0;
+        uint32_t a = seed, b = 0;
         HashLittle(reinterpret_cast<const void*>(str.c_str()),
             static_cast<uint32_t>(str.size()), &a, &b);
         return static_cast<uint64_t>(a) | (static_cast<uint64_t>(b) << 32);
     }
+
+    hash_t JenkinsHash(const std::string &str)
+    {
+        return SeededJenkinsHash(str, 0U);
+    }
+
+    template <uint_t WORDS>
+    static inline WideHash<WORDS> WideJenkinsHash(const std::string &str)
+    {
+        WideHash<WORDS> ans;
+        for (uint_t i = 0; i < WORDS; ++i)
+        {
+            ans.SetWord(i, SeededJenkinsHash(str, 0x9e3779b9U * i));
+        }
+        return ans;
+    }
+
+    hash128_t JenkinsHash128(const std::string &str)
+    {
+        return WideJenkinsHash<2U>(str);
+    }
+
+    hash256_t JenkinsHash256(const std::string &str)
+    {
+        return WideJenkinsHash<4U>(str);
+    }
 }
@@ -1,114 +1,337 @@
 #include "simhash.h"
 
 #include <string>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#include <pthread.h>
+#include <unistd.h>
 
 namespace simhash
 {
 
-bool Simhash::IsNearDups(hash_t lhs, hash_t rhs, uint_t d)
+template <typename HashT>
+bool BasicSimhash<HashT>::IsNearDups(const HashT &lhs, const HashT &rhs,
+    uint_t d)
 {
-    for (lhs ^= rhs; lhs && d; --d)
-    {
-        lhs &= lhs - 1;
-    }
-    if (!d && lhs)  //d == 0 and lhs != 0
-    {
-        return false;
-    }
-    return true;
+    return PopCount(lhs ^ rhs) <= d;
 }
 
-uint_t Simhash::GetHammingDistance(hash_t lhs, hash_t rhs)
+template <typename HashT>
+uint_t BasicSimhash<HashT>::GetHammingDistance(const HashT &lhs,
+    const HashT &rhs)
 {
-    uint_t ans = 0U;
-    for (lhs ^= rhs; lhs; ++ans)
-    {
-        lhs &= lhs - 1;
-    }
-    return ans;
+    return PopCount(lhs ^ rhs);
 }
 
-hash_t Simhash::Build(const std::vector<HashFeatureType> &features)
+template <typename HashT>
+HashT BasicSimhash<HashT>::Build(const std::vector<HashFeatureType> &features)
 {
-    std::vector<real_t> holds(HASH_WIDTH, 0.0);
-    for (std::vector<HashFeatureType>::const_iterator iter = features.begin();
-        features.end() != iter; ++iter)
+    std::vector<real_t> holds(WIDTH, 0.0);
+    for (typename std::vector<HashFeatureType>::const_iterator iter
+        = features.begin(); features.end() != iter; ++iter)
     {
         FlushHolds(iter->first, iter->second, holds);
     }
     return Build(holds);
 }
 
-hash_t Simhash::Build(const std::vector<StringFeatureType> &features,
+template <typename HashT>
+HashT BasicSimhash<HashT>::Build(const std::vector<StringFeatureType> &features,
     HashFunc hasher)
 {
     if (!hasher)    //Don't put a nullptr, or will do nothing.
     {
-        return 0UL;
+        return HashT(0U);
     }
-    std::vector<real_t> holds(HASH_WIDTH, 0.0);
-    for (std::vector<StringFeatureType>::const_iterator iter = features.begin();
-        features.end() != iter; ++iter)
+    std::vector<real_t> holds(WIDTH, 0.0);
+    for (typename std::vector<StringFeatureType>::const_iterator iter
+        = features.begin(); features.end() != iter; ++iter)
     {
         FlushHolds(hasher(iter->first), iter->second, holds);
     }
     return Build(holds);
 }
 
-hash_t Simhash::Build(const std::vector<real_t> &holds)
+template <typename HashT>
+HashT BasicSimhash<HashT>::Build(const std::vector<StringFeatureType> &features,
+    BasicTokenHashCache<HashT> &cache)
 {
-    if (HASH_WIDTH != holds.size()) //In no case, this will happen.
+    if (!cache.GetHasher())     //Don't put a nullptr, or will do nothing.
+    {
+        return HashT(0U);
+    }
+    std::vector<real_t> holds(WIDTH, 0.0);
+    for (typename std::vector<StringFeatureType>::const_iterator iter
+        = features.begin(); features.end() != iter; ++iter)
     {
-        return 0UL;
+        FlushHolds(cache.Hash(iter->first), iter->second, holds);
     }
-    hash_t ret = 0UL;
-    for (uint_t i = 0; i < HASH_WIDTH; ++i)
+    return Build(holds);
+}
+
+/* The arguments shared by the threads of BuildBatch. */
+template <typename HashT>
+struct BasicSimhash<HashT>::BatchContext
+{
+    const HashFeatureType *hashFeatures;    // One of the two is NULL.
+    const StringFeatureType *stringFeatures;
+    HashFunc hasher;
+    const size_t *offsets;
+    size_t docNum;
+    HashT *out;
+    std::vector<size_t> tasks;  // Task i is documents [tasks[i], tasks[i+1]).
+    char pad[64];               // Keeps next off the cache line of the above.
+    volatile size_t next;       // The next task to be taken.
+};
+
+template <typename HashT>
+void* BasicSimhash<HashT>::RunBatch(void *arg)
+{
+    BatchContext &context = *static_cast<BatchContext*>(arg);
+    const size_t taskNum = context.tasks.size() - 1U;
+    std::vector<real_t> holds(WIDTH);
+    for (size_t task = __sync_fetch_and_add(&context.next, 1U);
+        task < taskNum; task = __sync_fetch_and_add(&context.next, 1U))
     {
-        if (holds[i] > 0.0)         //If holds at i greater than 0, sets bit
+        for (size_t doc = context.tasks[task]; doc < context.tasks[task + 1U];
+            ++doc)
         {
-            ret |= (HASH_1 << i);
+            holds.assign(WIDTH, 0.0);
+            for (size_t i = context.offsets[doc];
+                i < context.offsets[doc + 1U]; ++i)
+            {
+                if (context.hashFeatures)
+                {
+                    FlushHolds(context.hashFeatures[i].first,
+                        context.hashFeatures[i].second, holds);
+                }
+                else
+                {
+                    FlushHolds(context.hasher(context.stringFeatures[i].first),
+                        context.stringFeatures[i].second, holds);
+                }
+            }
+            context.out[doc] = Build(holds);
         }
     }
-    return ret;
+    return NULL;
 }
 
-void Simhash::FlushHolds(hash_t hash, real_t weight, std::vector<real_t> &holds)
+template <typename HashT>
+void BasicSimhash<HashT>::BuildBatch(BatchContext &context, uint_t threadNum)
 {
-    for (uint_t i = 0U; i < HASH_WIDTH; ++i)
+    //Cut the documents into tasks by their features.
+    context.tasks.clear();
+    context.tasks.push_back(0U);
+    for (size_t doc = 0; doc < context.docNum; ++doc)
     {
-        if (((HASH_1 << i) & hash)) //If bit at j is 1, ++
+        if (context.offsets[doc + 1U] - context.offsets[context.tasks.back()]
+            >= TASK_FEATURES)
         {
-            holds[i] += weight;
+            context.tasks.push_back(doc + 1U);
         }
-        else
+    }
+    if (context.tasks.back() != context.docNum)
+    {
+        context.tasks.push_back(context.docNum);
+    }
+    context.next = 0U;
+    if (!threadNum)
+    {
+        threadNum = static_cast<uint_t>(std::max(sysconf(_SC_NPROCESSORS_ONLN),
+            1L));
+    }
+    threadNum = static_cast<uint_t>(std::min(static_cast<size_t>(threadNum),
+        context.tasks.size() - 1U));
+    //The calling thread is one of them, also if a thread fails to start.
+    std::vector<pthread_t> threads(threadNum);
+    std::vector<bool> started(threadNum, false);
+    for (uint_t i = 1; i < threadNum; ++i)
+    {
+        started[i] = !pthread_create(&threads[i], NULL, RunBatch, &context);
+    }
+    RunBatch(&context);
+    for (uint_t i = 1; i < threadNum; ++i)
+    {
+        if (started[i])
         {
-            holds[i] -= weight;     //If bit at j is 0, --
+            pthread_join(threads[i], NULL);
         }
     }
 }
 
-void Simhash::HashToBinaryString(hash_t hash, std::string& ans)
+template <typename HashT>
+void BasicSimhash<HashT>::BuildBatch(const HashFeatureType *features,
+    const size_t *offsets, size_t docNum, HashT *out, uint_t threadNum)
 {
-    ans.resize(HASH_WIDTH);
-    uint_t i = HASH_WIDTH;
+    BatchContext context;
+    context.hashFeatures = features;
+    context.stringFeatures = NULL;
+    context.hasher = NULL;
+    context.offsets = offsets;
+    context.docNum = docNum;
+    context.out = out;
+    BuildBatch(context, threadNum);
+}
+
+template <typename HashT>
+void BasicSimhash<HashT>::BuildBatch(const StringFeatureType *features,
+    const size_t *offsets, size_t docNum, HashFunc hasher, HashT *out,
+    uint_t threadNum)
+{
+    if (!hasher)    //Don't put a nullptr, or will do nothing.
+    {
+        return;
+    }
+    BatchContext context;
+    context.hashFeatures = NULL;
+    context.stringFeatures = features;
+    context.hasher = hasher;
+    context.offsets = offsets;
+    context.docNum = docNum;
+    context.out = out;
+    BuildBatch(context, threadNum);
+}
+
+template <typename HashT>
+template <typename HoldT>
+HashT BasicSimhash<HashT>::Build(const std::vector<HoldT> &holds)
+{
+    if (WIDTH != holds.size())      //In no case, this will happen.
+    {
+        return HashT(0U);
+    }
+    HashT ret(0U);
+    for (uint_t w = 0; w < WIDTH / 64U; ++w)
+    {
+        uint64_t word = 0UL;
+        for (uint_t i = 0; i < 64U; ++i)
+        {
+            //If holds at i greater than 0, sets bit
+            word |= static_cast<uint64_t>(holds[w * 64U + i] > HoldT(0)) << i;
+        }
+        SetWord(ret, w, word);
+    }
+    return ret;
+}
+
+template <typename HashT>
+template <typename HoldT>
+void BasicSimhash<HashT>::FlushHolds(const HashT &hash, HoldT weight,
+    std::vector<HoldT> &holds)
+{
+    //Word by word, the shifts of a wide hash are not paid for each bit.
+    for (uint_t w = 0; w < WIDTH / 64U; ++w)
+    {
+        uint64_t bits = GetWord(hash, w);
+        HoldT *hold = &holds[w * 64U];
+        for (uint_t i = 0U; i < 64U; ++i, bits >>= 1)
+        {
+            //If bit at i is 1, ++; otherwise, --
+            hold[i] += bits & 1UL ? weight : -weight;
+        }
+    }
+}
+
+template <typename HashT>
+void BasicSimhash<HashT>::HashToBinaryString(HashT hash, std::string& ans)
+{
+    ans.resize(WIDTH);
+    uint_t i = WIDTH;
     do
     {
-        ans.at(--i) = hash & HASH_1 ? '1' : '0';
-        hash >>= HASH_1;
+        ans.at(--i) = (hash & HashT(1U)) != HashT(0U) ? '1' : '0';
+        hash >>= 1U;
     } while (i);
 }
 
-hash_t Simhash::BinaryStringToHash(const std::string& str)
+template <typename HashT>
+HashT BasicSimhash<HashT>::BinaryStringToHash(const std::string& str)
 {
-    hash_t ans = 0UL;
+    HashT ans(0U);
     for (std::string::const_iterator it = str.begin(); str.end() != it; ++it)
     {
-        ans <<= HASH_1;
+        ans <<= 1U;
         if ('1' == *it)
         {
-            ans |= HASH_1;
+            ans |= HashT(1U);
         }
     }
     return ans;
 }
+
+template <typename HashT>
+BasicSimhashAccumulator<HashT>::BasicSimhashAccumulator()
+    : mHolds(WIDTH, 0)
+{}
+
+template <typename HashT>
+int32_t BasicSimhashAccumulator<HashT>::Quantize(real_t weight)
+{
+    return static_cast<int32_t>(floor(weight * WEIGHT_SCALE + 0.5));
+}
+
+template <typename HashT>
+void BasicSimhashAccumulator<HashT>::AddFeature(const HashT &hash,
+    real_t weight)
+{
+    BasicSimhash<HashT>::FlushHolds(hash, Quantize(weight), mHolds);
+}
+
+template <typename HashT>
+void BasicSimhashAccumulator<HashT>::RemoveFeature(const HashT &hash,
+    real_t weight)
+{
+    BasicSimhash<HashT>::FlushHolds(hash, -Quantize(weight), mHolds);
+}
+
+template <typename HashT>
+void BasicSimhashAccumulator<HashT>::AddFeatures(
+    const std::vector<HashFeatureType> &features)
+{
+    for (typename std::vector<HashFeatureType>::const_iterator iter
+        = features.begin(); features.end() != iter; ++iter)
+    {
+        AddFeature(iter->first, iter->second);
+    }
+}
+
+template <typename HashT>
+HashT BasicSimhashAccumulator<HashT>::GetHash() const
+{
+    return BasicSimhash<HashT>::Build(mHolds);
+}
+
+template <typename HashT>
+void BasicSimhashAccumulator<HashT>::Clear()
+{
+    mHolds.assign(WIDTH, 0);
+}
+
+template <typename HashT>
+void BasicSimhashAccumulator<HashT>::Serialize(std::string &out) const
+{
+    out.append(reinterpret_cast<const char*>(&mHolds[0]), SERIALIZED_BYTES);
+}
+
+template <typename HashT>
+bool BasicSimhashAccumulator<HashT>::Deserialize(const char *data,
+    size_t size)
+{
+    if (SERIALIZED_BYTES != size)
+    {
+        return false;
+    }
+    memcpy(&mHolds[0], data, SERIALIZED_BYTES);
+    return true;
+}
+
+template class BasicSimhash<hash_t>;
+template class BasicSimhash<hash128_t>;
+template class BasicSimhash<hash256_t>;
+template class BasicSimhashAccumulator<hash_t>;
+template class BasicSimhashAccumulator<hash128_t>;
+template class BasicSimhashAccumulator<hash256_t>;
 }
@@ -0,0 +1,187 @@
+/*==============================================================================
+*   Copyright (C) 2016 All rights reserved.
+*
+*  File Name    : simhash_client.cpp
+*  Author       : Zhongping Liang
+*  Date         : 2016-07-19
+*  Version      : 1.0
+*  Description  : This file provides implement of the SimhashClient.
+==============================================================================*/
+
+#include "simhash_client.h"
+
+#include <unistd.h>
+
+namespace simhash
+{
+
+SimhashClient::SimhashClient()
+{}
+
+SimhashClient::~SimhashClient()
+{}
+
+class SimhashClientImpl : public SimhashClient
+{
+private:
+    explicit SimhashClientImpl(int fd);
+    SimhashClientImpl(const SimhashClientImpl&);
+    SimhashClientImpl& operator=(const SimhashClientImpl&);
+public :
+    virtual ~SimhashClientImpl();
+public :
+    virtual bool Insert         (hash_t hash);
+    virtual bool Remove         (hash_t hash);
+    virtual bool Search         (hash_t hash);
+    virtual bool HasNearDups    (hash_t hash);
+    virtual bool FindNearDups   (hash_t hash, FindAnswerType &ans);
+    virtual uint_t GetSize();
+    virtual void Clear();
+    virtual bool SendRequest(uint_t op, hash_t hash);
+    virtual bool SendNamedRequest(uint_t op, uint_t arg,
+        const std::string &name);
+    virtual bool Flush();
+    virtual bool ReceiveResponse(SimhashResponse &response);
+    virtual bool IsBroken();
+private :
+    /* Sends a request and waits for its response. */
+    bool Call(uint_t op, hash_t hash);
+private :
+    static const size_t MAX_BUFFER_BYTES = 64U * 1024U;
+    int mFd;
+    std::string mOutput;        // The requests not sent.
+    char mHead[RESPONSE_HEAD_BYTES];
+    std::string mValues;        // The buffer of response values.
+    SimhashResponse mResponse;  // The response of Call.
+    volatile bool mBroken;
+    friend SimhashClientPtr CreateSimhashClient(const std::string &address);
+};
+
+SimhashClientImpl::SimhashClientImpl(int fd)
+    : mFd(      fd      )
+    , mBroken(  false   )
+{}
+
+SimhashClientImpl::~SimhashClientImpl()
+{
+    close(mFd);
+}
+
+bool SimhashClientImpl::SendRequest(uint_t op, hash_t hash)
+{
+    EncodeRequest(op, hash, mOutput);
+    return mOutput.size() < MAX_BUFFER_BYTES || Flush();
+}
+
+bool SimhashClientImpl::SendNamedRequest(uint_t op, uint_t arg,
+    const std::string &name)
+{
+    if (name.size() > MAX_NAME_BYTES)
+    {
+        return false;
+    }
+    EncodeNamedRequest(op, arg, name, mOutput);
+    return mOutput.size() < MAX_BUFFER_BYTES || Flush();
+}
+
+bool SimhashClientImpl::Flush()
+{
+    if (!mBroken && !mOutput.empty()
+        && !WriteAll(mFd, mOutput.data(), mOutput.size()))
+    {
+        mBroken = true;
+    }
+    mOutput.clear();
+    return !mBroken;
+}
+
+bool SimhashClientImpl::ReceiveResponse(SimhashResponse &response)
+{
+    response.values.clear();
+    if (mBroken || !ReadAll(mFd, mHead, RESPONSE_HEAD_BYTES))
+    {
+        mBroken = true;
+        return false;
+    }
+    response.status = static_cast<uint_t>(DecodeUint(mHead, 1U));
+    size_t num = static_cast<size_t>(DecodeUint(mHead + 1, 4U));
+    if (num)
+    {
+        mValues.resize(num * 8U);
+        if (!ReadAll(mFd, &mValues[0], mValues.size()))
+        {
+            mBroken = true;
+            return false;
+        }
+        response.values.resize(num);
+        for (size_t i = 0; i < num; ++i)
+        {
+            response.values[i] = DecodeUint(mValues.data() + i * 8U, 8U);
+        }
+    }
+    return true;
+}
+
+bool SimhashClientImpl::IsBroken()
+{
+    return mBroken;
+}
+
+bool SimhashClientImpl::Call(uint_t op, hash_t hash)
+{
+    return SendRequest(op, hash) && Flush() && ReceiveResponse(mResponse)
+        && SIMHASH_STATUS_TRUE == mResponse.status;
+}
+
+bool SimhashClientImpl::Insert(hash_t hash)
+{
+    return Call(SIMHASH_OP_CODE_INSERT, hash);
+}
+
+bool SimhashClientImpl::Remove(hash_t hash)
+{
+    return Call(SIMHASH_OP_CODE_REMOVE, hash);
+}
+
+bool SimhashClientImpl::Search(hash_t hash)
+{
+    return Call(SIMHASH_OP_CODE_SEARCH, hash);
+}
+
+bool SimhashClientImpl::HasNearDups(hash_t hash)
+{
+    return Call(SIMHASH_OP_CODE_HAS_NEAR_DUPS, hash);
+}
+
+bool SimhashClientImpl::FindNearDups(hash_t hash, FindAnswerType &ans)
+{
+    bool ret = Call(SIMHASH_OP_CODE_FIND_NEAR_DUPS, hash);
+    ans.swap(mResponse.values);
+    return ret;
+}
+
+uint_t SimhashClientImpl::GetSize()
+{
+    if (!Call(SIMHASH_OP_CODE_GET_SIZE, 0UL) || mResponse.values.empty())
+    {
+        return 0U;
+    }
+    return static_cast<uint_t>(mResponse.values.front());
+}
+
+void SimhashClientImpl::Clear()
+{
+    Call(SIMHASH_OP_CODE_CLEAR, 0UL);
+}
+
+SimhashClientPtr CreateSimhashClient(const std::string &address)
+{
+    int fd = ConnectSimhashAddress(address);
+    if (fd < 0)
+    {
+        return SimhashClientPtr();
+    }
+    return SimhashClientPtr(new SimhashClientImpl(fd));
+}
+
+} // namespace simhash
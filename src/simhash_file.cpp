@@ -0,0 +1,655 @@
+/*==============================================================================
+*   Copyright (C) 2016 All rights reserved.
+*
+*  File Name    : simhash_file.cpp
+*  Author       : Zhongping Liang
+*  Date         : 2016-07-21
+*  Version      : 1.0
+*  Description  : This file provides implement of the reader and the writer of
+*           the files of simhash values.
+==============================================================================*/
+
+#include "simhash_file.h"
+
+#include <algorithm>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace simhash
+{
+
+/*
+* The tables of encoding, BIT_CHARS[b] is the 8 chars of byte b, and
+* HEX_CHARS[b] is the 2 hex digits of byte b, in the order of memory.
+*/
+static char BIT_CHARS[256][8];
+static char HEX_CHARS[256][2];
+
+struct SimhashFileTables
+{
+    SimhashFileTables()
+    {
+        static const char DIGITS[] = "0123456789abcdef";
+        for (uint_t b = 0; b < 256U; ++b)
+        {
+            for (uint_t i = 0; i < 8U; ++i)
+            {
+                BIT_CHARS[b][i] = (b >> (7U - i)) & 1U ? '1' : '0';
+            }
+            HEX_CHARS[b][0] = DIGITS[b >> 4];
+            HEX_CHARS[b][1] = DIGITS[b & 0xFU];
+        }
+    }
+};
+
+static SimhashFileTables gSimhashFileTables;
+
+/* Loads 8 chars as a little endian word. */
+static inline uint64_t LoadChars(const char *data)
+{
+    uint64_t word = 0UL;
+    memcpy(&word, data, sizeof(word));
+    return word;
+}
+
+/*
+* Decodes 8 chars of '0' and '1', the first is the highest bit. The lowest
+* bits of the chars are gathered to the top byte by one multiply, no two of
+* the partial products overlap there.
+*/
+static inline uint64_t DecodeBitChars(const char *data)
+{
+    return ((LoadChars(data) & 0x0101010101010101UL)
+        * 0x8040201008040201UL) >> 56;
+}
+
+/*
+* Decodes 8 hex digits of either case, the first is the highest. A digit is
+* its low 4 bits, plus 9 for a letter, whose bit 6 is set. Then the nibbles
+* are packed in 3 steps of halving.
+*/
+static inline uint64_t DecodeHexChars(const char *data)
+{
+    uint64_t word = __builtin_bswap64(LoadChars(data));
+    word = (word & 0x0F0F0F0F0F0F0F0FUL)
+        + ((word >> 6) & 0x0101010101010101UL) * 9U;
+    word = (word | (word >> 4)) & 0x00FF00FF00FF00FFUL;
+    word = (word | (word >> 8)) & 0x0000FFFF0000FFFFUL;
+    return (word | (word >> 16)) & 0x00000000FFFFFFFFUL;
+}
+
+template <typename HashT>
+SimhashFileWriter<HashT>::SimhashFileWriter()
+    : mFd(      -1                      )
+    , mFormat(  SIMHASH_FILE_BINARY     )
+    , mSize(    0                       )
+    , mFailed(  false                   )
+    , mSorted(  true                    )
+    , mLast(    0U                      )
+    , mOffset(  0                       )
+{}
+
+template <typename HashT>
+SimhashFileWriter<HashT>::~SimhashFileWriter()
+{
+    Close();
+}
+
+template <typename HashT>
+bool SimhashFileWriter<HashT>::Open(const std::string &filename,
+    SimhashFileFormat format)
+{
+    Close();
+    //A snapshot may read its blocks back, see Unsort.
+    const int mode = SIMHASH_FILE_SNAPSHOT == format ? O_RDWR : O_WRONLY;
+    mFd = open(filename.c_str(), mode | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    mFormat = format;
+    mBuffer.resize(BUFFER_BYTES);
+    mSize = 0;
+    mValues.clear();
+    mFailed = mFd < 0;
+    mSorted = true;
+    mLast = HashT(0U);
+    mBlocks.clear();
+    if (SIMHASH_FILE_SNAPSHOT == format)
+    {
+        //The header is written at Close, a file not closed is no snapshot.
+        SimhashSnapshotHeader header;
+        memset(&header, 0, sizeof(header));
+        Append(reinterpret_cast<const char*>(&header), sizeof(header));
+        mOffset = sizeof(header);
+    }
+    return !mFailed;
+}
+
+template <typename HashT>
+void SimhashFileWriter<HashT>::Flush()
+{
+    const char *data = &mBuffer[0];
+    size_t size = mSize;
+    while (size && !mFailed)
+    {
+        ssize_t ret = write(mFd, data, size);
+        if (ret < 0 && EINTR == errno)
+        {
+            continue;
+        }
+        if (ret <= 0)
+        {
+            mFailed = true;
+            break;
+        }
+        data += ret;
+        size -= ret;
+    }
+    mSize = 0;
+}
+
+template <typename HashT>
+void SimhashFileWriter<HashT>::Append(const char *data, size_t size)
+{
+    if (mBuffer.size() - mSize < size)
+    {
+        Flush();
+    }
+    memcpy(&mBuffer[mSize], data, size);
+    mSize += size;
+}
+
+template <typename HashT>
+void SimhashFileWriter<HashT>::WriteBlock(const HashT *values, size_t count)
+{
+    mBlock.clear();
+    EncodeSnapshotBlock(values, count, mBlock);
+    Append(mBlock.data(), mBlock.size());
+    SimhashSnapshotBlock block;
+    block.offset = mOffset;
+    block.bytes = static_cast<uint32_t>(mBlock.size());
+    block.count = static_cast<uint32_t>(count);
+    block.crc = Crc32(mBlock.data(), mBlock.size());
+    block.reserved = 0U;
+    mBlocks.push_back(block);
+    mOffset += mBlock.size();
+}
+
+template <typename HashT>
+void SimhashFileWriter<HashT>::Unsort()
+{
+    Flush();
+    std::vector<HashT> values;
+    values.reserve(mBlocks.size() * SNAPSHOT_BLOCK_SIZE + mValues.size());
+    for (size_t b = 0; b < mBlocks.size() && !mFailed; ++b)
+    {
+        const SimhashSnapshotBlock &block = mBlocks[b];
+        mBlock.resize(block.bytes);
+        mFailed = pread(mFd, &mBlock[0], block.bytes, block.offset)
+            != static_cast<ssize_t>(block.bytes)
+            || !DecodeSnapshotBlock(mBlock.data(), block.bytes, block.count,
+            values);
+    }
+    values.insert(values.end(), mValues.begin(), mValues.end());
+    mValues.swap(values);
+    mSorted = false;
+    mBlocks.clear();
+    mOffset = sizeof(SimhashSnapshotHeader);
+    if (ftruncate(mFd, mOffset) || lseek(mFd, mOffset, SEEK_SET) < 0)
+    {
+        mFailed = true;
+    }
+}
+
+template <typename HashT>
+void SimhashFileWriter<HashT>::WriteSnapshot()
+{
+    if (!mSorted)
+    {
+        std::sort(mValues.begin(), mValues.end());
+    }
+    for (size_t begin = 0; begin < mValues.size();
+        begin += SNAPSHOT_BLOCK_SIZE)
+    {
+        WriteBlock(&mValues[begin], std::min(mValues.size() - begin,
+            static_cast<size_t>(SNAPSHOT_BLOCK_SIZE)));
+    }
+    std::vector<HashT>().swap(mValues);
+    SimhashSnapshotHeader header;
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.width = WIDTH;
+    header.count = 0;
+    header.blockSize = SNAPSHOT_BLOCK_SIZE;
+    header.blockNum = static_cast<uint32_t>(mBlocks.size());
+    header.indexOffset = mOffset;
+    for (size_t b = 0; b < mBlocks.size(); ++b)
+    {
+        header.count += mBlocks[b].count;
+        Append(reinterpret_cast<const char*>(&mBlocks[b]), sizeof(mBlocks[b]));
+    }
+    Flush();
+    std::vector<SimhashSnapshotBlock>().swap(mBlocks);
+    //The index offset is known at last, the header is written again.
+    if (!mFailed && pwrite(mFd, &header, sizeof(header), 0)
+        != static_cast<ssize_t>(sizeof(header)))
+    {
+        mFailed = true;
+    }
+}
+
+template <typename HashT>
+bool SimhashFileWriter<HashT>::Close()
+{
+    if (mFd < 0)
+    {
+        return false;
+    }
+    if (SIMHASH_FILE_SNAPSHOT == mFormat)
+    {
+        WriteSnapshot();
+    }
+    Flush();
+    mFailed = close(mFd) || mFailed;
+    mFd = -1;
+    std::vector<char>().swap(mBuffer);
+    std::string().swap(mBlock);
+    return !mFailed;
+}
+
+template <typename HashT>
+void SimhashFileWriter<HashT>::EncodeHex(const HashT &hash, char *out)
+{
+    for (uint_t i = WIDTH / 8U; i > 0; --i)
+    {
+        memcpy(out, HEX_CHARS[GetByte(hash, i - 1U)], 2U);
+        out += 2;
+    }
+}
+
+template <typename HashT>
+void SimhashFileWriter<HashT>::EncodeBitString(const HashT &hash, char *out)
+{
+    for (uint_t i = WIDTH / 8U; i > 0; --i)
+    {
+        memcpy(out, BIT_CHARS[GetByte(hash, i - 1U)], 8U);
+        out += 8;
+    }
+}
+
+template <typename HashT>
+SimhashFileReader<HashT>::SimhashFileReader()
+    : mFd(          -1      )
+    , mData(        NULL    )
+    , mSize(        0       )
+    , mPos(         0       )
+    , mBinary(      true    )
+    , mSnapshot(    false   )
+    , mFailed(      false   )
+    , mThreadNum(   1U      )
+{}
+
+template <typename HashT>
+SimhashFileReader<HashT>::~SimhashFileReader()
+{
+    Close();
+}
+
+template <typename HashT>
+bool SimhashFileReader<HashT>::Open(const std::string &filename, bool binary,
+    uint_t threadNum)
+{
+    static const uint_t MAX_THREAD_NUM = 16U;
+    Close();
+    mFd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (mFd < 0 || fstat(mFd, &st))
+    {
+        Close();
+        return false;
+    }
+    mSize = static_cast<size_t>(st.st_size);
+    if (mSize)
+    {
+        void *data = mmap(NULL, mSize, PROT_READ, MAP_PRIVATE, mFd, 0);
+        if (MAP_FAILED == data)
+        {
+            Close();
+            return false;
+        }
+        madvise(data, mSize, MADV_SEQUENTIAL);
+        mData = static_cast<const char*>(data);
+    }
+    if (!threadNum)
+    {
+        threadNum = static_cast<uint_t>(std::max(sysconf(_SC_NPROCESSORS_ONLN),
+            1L));
+    }
+    mPos = 0;
+    mBinary = binary;
+    mThreadNum = std::min(threadNum, MAX_THREAD_NUM);
+    mParts.resize(mThreadNum);
+    mSnapshot = binary && mSize >= sizeof(SimhashSnapshotHeader)
+        && !memcmp(mData, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    if (mSnapshot && !OpenSnapshot())
+    {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+template <typename HashT>
+bool SimhashFileReader<HashT>::OpenSnapshot()
+{
+    SimhashSnapshotHeader header;
+    memcpy(&header, mData, sizeof(header));
+    if (SNAPSHOT_VERSION != header.version || WIDTH != header.width
+        || header.indexOffset > mSize || mSize - header.indexOffset
+        != static_cast<uint64_t>(header.blockNum)
+        * sizeof(SimhashSnapshotBlock))
+    {
+        return false;
+    }
+    mBlocks.resize(header.blockNum);
+    if (header.blockNum)
+    {
+        memcpy(&mBlocks[0], mData + header.indexOffset,
+            mBlocks.size() * sizeof(SimhashSnapshotBlock));
+    }
+    uint64_t count = 0;
+    for (size_t b = 0; b < mBlocks.size(); ++b)
+    {
+        if (mBlocks[b].offset < sizeof(header)
+            || mBlocks[b].offset > header.indexOffset
+            || header.indexOffset - mBlocks[b].offset < mBlocks[b].bytes)
+        {
+            return false;
+        }
+        count += mBlocks[b].count;
+    }
+    return count == header.count;
+}
+
+template <typename HashT>
+void SimhashFileReader<HashT>::Close()
+{
+    if (mData)
+    {
+        munmap(const_cast<char*>(mData), mSize);
+        mData = NULL;
+    }
+    if (mFd >= 0)
+    {
+        close(mFd);
+        mFd = -1;
+    }
+    mSize = 0;
+    mPos = 0;
+    mSnapshot = false;
+    mFailed = false;
+    std::vector<SimhashSnapshotBlock>().swap(mBlocks);
+}
+
+template <typename HashT>
+HashT SimhashFileReader<HashT>::DecodeHex(const char *data, size_t size)
+{
+    HashT ans(0U);
+    if (WIDTH / 4U != size)
+    {
+        return ans;
+    }
+    for (uint_t i = WIDTH / 64U; i > 0; --i, data += 16)
+    {
+        SetWord(ans, i - 1U, DecodeHexChars(data) << 32
+            | DecodeHexChars(data + 8));
+    }
+    return ans;
+}
+
+template <typename HashT>
+HashT SimhashFileReader<HashT>::DecodeBitString(const char *data, size_t size)
+{
+    HashT ans(0U);
+    if (WIDTH != size)
+    {
+        //The former versions accept any length, bit by bit.
+        for (size_t i = 0; i < size; ++i)
+        {
+            ans <<= 1U;
+            if ('1' == data[i])
+            {
+                ans |= HashT(1U);
+            }
+        }
+        return ans;
+    }
+    for (uint_t i = WIDTH / 64U; i > 0; --i)
+    {
+        uint64_t word = 0UL;
+        for (uint_t j = 0; j < 8U; ++j, data += 8)
+        {
+            word = word << 8 | DecodeBitChars(data);
+        }
+        SetWord(ans, i - 1U, word);
+    }
+    return ans;
+}
+
+template <typename HashT>
+void SimhashFileReader<HashT>::Parse(const char *data, size_t size,
+    bool binary, std::vector<HashT> &values)
+{
+    values.clear();
+    if (binary)
+    {
+        values.resize(size / sizeof(HashT));
+        if (!values.empty())
+        {
+            memcpy(&values[0], data, values.size() * sizeof(HashT));
+        }
+        return;
+    }
+    values.reserve(size / (WIDTH / 4U + 1U));
+    const char *end = data + size;
+    while (data < end)
+    {
+        const char *lineEnd = static_cast<const char*>(
+            memchr(data, '\n', end - data));
+        if (!lineEnd)
+        {
+            lineEnd = end;
+        }
+        size_t length = lineEnd - data;
+        if (length && '\r' == data[length - 1])
+        {
+            --length;
+        }
+        if (WIDTH / 4U == length)
+        {
+            values.push_back(DecodeHex(data, length));
+        }
+        else if (length)
+        {
+            values.push_back(DecodeBitString(data, length));
+        }
+        data = lineEnd + 1;
+    }
+}
+
+/* The arguments of a thread of SimhashFileReader<HashT>::Read. */
+template <typename HashT>
+struct SimhashParseTask
+{
+    const char *data;
+    size_t size;
+    bool binary;
+    std::vector<HashT> *values;
+
+    static void* Run(void *arg)
+    {
+        SimhashParseTask *task = static_cast<SimhashParseTask*>(arg);
+        SimhashFileReader<HashT>::Parse(task->data, task->size, task->binary,
+            *task->values);
+        return NULL;
+    }
+};
+
+/* The arguments of a thread decoding a run of blocks of snapshot. */
+template <typename HashT>
+struct SimhashDecodeTask
+{
+    const char *data;
+    const SimhashSnapshotBlock *blocks;
+    size_t blockNum;
+    std::vector<HashT> *values;
+    bool failed;
+
+    static void* Run(void *arg)
+    {
+        SimhashDecodeTask *task = static_cast<SimhashDecodeTask*>(arg);
+        std::vector<HashT> &values = *task->values;
+        values.clear();
+        size_t count = 0;
+        for (size_t b = 0; b < task->blockNum; ++b)
+        {
+            count += task->blocks[b].count;
+        }
+        values.reserve(count);
+        for (size_t b = 0; b < task->blockNum && !task->failed; ++b)
+        {
+            const SimhashSnapshotBlock &block = task->blocks[b];
+            const char *data = task->data + block.offset;
+            task->failed = Crc32(data, block.bytes) != block.crc
+                || !DecodeSnapshotBlock(data, block.bytes, block.count, values);
+        }
+        return NULL;
+    }
+};
+
+/*
+* Runs the tasks, one thread per task but the first one, which runs in the
+* calling thread, as does any task whose thread fails to start.
+*/
+template <typename TaskT>
+static void RunTasks(std::vector<TaskT> &tasks)
+{
+    std::vector<pthread_t> threads(tasks.size());
+    std::vector<bool> started(tasks.size(), false);
+    for (size_t i = 1; i < tasks.size(); ++i)
+    {
+        started[i] = !pthread_create(&threads[i], NULL, TaskT::Run, &tasks[i]);
+    }
+    for (size_t i = 0; i < tasks.size(); ++i)
+    {
+        if (!started[i])
+        {
+            TaskT::Run(&tasks[i]);
+        }
+    }
+    for (size_t i = 0; i < tasks.size(); ++i)
+    {
+        if (started[i])
+        {
+            pthread_join(threads[i], NULL);
+        }
+    }
+}
+
+template <typename HashT>
+size_t SimhashFileReader<HashT>::ReadSnapshot()
+{
+    //A run has as many values as a chunk of the raw format.
+    static const size_t RUN_BLOCKS = CHUNK_BYTES / sizeof(HashT)
+        / SNAPSHOT_BLOCK_SIZE;
+    std::vector<SimhashDecodeTask<HashT> > tasks;
+    for (uint_t i = 0; i < mThreadNum && mPos < mBlocks.size(); ++i)
+    {
+        SimhashDecodeTask<HashT> task;
+        task.data = mData;
+        task.blocks = &mBlocks[mPos];
+        task.blockNum = std::min(mBlocks.size() - mPos, RUN_BLOCKS);
+        task.values = &mParts[i];
+        task.failed = false;
+        tasks.push_back(task);
+        mPos += task.blockNum;
+    }
+    RunTasks(tasks);
+    for (size_t i = 0; i < tasks.size(); ++i)
+    {
+        mFailed = mFailed || tasks[i].failed;
+    }
+    return tasks.size();
+}
+
+template <typename HashT>
+size_t SimhashFileReader<HashT>::ReadChunks()
+{
+    //Cut the chunks, a text chunk ends after a line end.
+    std::vector<SimhashParseTask<HashT> > tasks;
+    for (uint_t i = 0; i < mThreadNum && mPos < mSize; ++i)
+    {
+        size_t end = std::min(mSize, mPos + CHUNK_BYTES);
+        if (mBinary)
+        {
+            end = mSize == end ? end : end - end % sizeof(HashT);
+        }
+        else if (end < mSize)
+        {
+            const char *lineEnd = static_cast<const char*>(
+                memchr(mData + end, '\n', mSize - end));
+            end = lineEnd ? lineEnd - mData + 1 : mSize;
+        }
+        SimhashParseTask<HashT> task;
+        task.data = mData + mPos;
+        task.size = end - mPos;
+        task.binary = mBinary;
+        task.values = &mParts[i];
+        tasks.push_back(task);
+        mPos = end;
+    }
+    RunTasks(tasks);
+    return tasks.size();
+}
+
+template <typename HashT>
+bool SimhashFileReader<HashT>::Read(std::vector<HashT> &values)
+{
+    values.clear();
+    if (mFailed || mPos >= (mSnapshot ? mBlocks.size() : mSize))
+    {
+        return false;
+    }
+    size_t partNum = mSnapshot ? ReadSnapshot() : ReadChunks();
+    if (mFailed)
+    {
+        return false;
+    }
+    if (1U == partNum)
+    {
+        values.swap(mParts[0]);
+        return true;
+    }
+    size_t total = 0;
+    for (size_t i = 0; i < partNum; ++i)
+    {
+        total += mParts[i].size();
+    }
+    values.reserve(total);
+    for (size_t i = 0; i < partNum; ++i)
+    {
+        values.insert(values.end(), mParts[i].begin(), mParts[i].end());
+    }
+    return true;
+}
+
+template class SimhashFileWriter<hash_t>;
+template class SimhashFileWriter<hash128_t>;
+template class SimhashFileWriter<hash256_t>;
+template class SimhashFileReader<hash_t>;
+template class SimhashFileReader<hash128_t>;
+template class SimhashFileReader<hash256_t>;
+
+} // namespace simhash
@@ -0,0 +1,344 @@
+/*==============================================================================
+*   Copyright (C) 2016 All rights reserved.
+*
+*  File Name    : simhash_join.cpp
+*  Author       : Zhongping Liang
+*  Date         : 2016-07-22
+*  Version      : 1.0
+*  Description  : This file provides implement of the near-duplicate join.
+==============================================================================*/
+
+#include "simhash_join.h"
+
+#include <algorithm>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "simhash_file.h"
+
+namespace simhash
+{
+
+/* The matches buffered by a thread before they are called back. */
+static const size_t JOIN_FLUSH_SIZE = 4096U;
+
+template <typename HashT>
+struct SimhashJoinMatch
+{
+    HashT query;
+    HashT match;
+    uint_t distance;
+};
+
+/* The arguments shared by the threads of a join. */
+template <typename HashT>
+struct SimhashJoinContext
+{
+    const std::vector<HashT> *queries;
+    const std::vector<HashT> *values;
+    uint_t maxHamDist;
+    std::vector<HashT> masks;           // masks[b] is the bits of block b.
+    BasicSimhashJoinCallback<HashT> *callback;
+    pthread_mutex_t mutex;              // Serializes the callback.
+    volatile uint_t next;               // The next block to be joined.
+};
+
+/* Compares the indexes of values by the bits of a block of the values. */
+template <typename HashT>
+struct SimhashMaskedLess
+{
+    SimhashMaskedLess(const std::vector<HashT> &values, HashT mask)
+        : mValues(values)
+        , mMask(mask)
+    {}
+    bool operator()(uint_t lhs, uint_t rhs) const
+    {
+        return (mValues[lhs] & mMask) < (mValues[rhs] & mMask);
+    }
+    const std::vector<HashT> &mValues;
+    HashT mMask;
+};
+
+/* The top bits of a block bucketed by the counting sort of SortByMask. */
+static const uint_t JOIN_SORT_BITS = 16U;
+
+/*
+* Sorts the indexes of values by the contiguous bits of mask: a counting sort
+* by the top bits of the block, then each bucket by the rest of the block.
+*/
+template <typename HashT>
+static void SortByMask(const std::vector<HashT> &values, HashT mask,
+    std::vector<uint_t> &order)
+{
+    order.resize(values.size());
+    const uint_t width = PopCount(mask);
+    if (!width)
+    {
+        for (size_t i = 0; i < values.size(); ++i)
+        {
+            order[i] = static_cast<uint_t>(i);
+        }
+        return;
+    }
+    uint_t low = 0;
+    while (((mask >> low) & HashT(1U)) == HashT(0U))
+    {
+        ++low;
+    }
+    const uint_t bits = std::min(width, JOIN_SORT_BITS);
+    const uint_t shift = low + width - bits;
+    const uint64_t bucketMask = (1ULL << bits) - 1ULL;
+    std::vector<uint_t> starts((1U << bits) + 1U, 0U);
+    for (size_t i = 0; i < values.size(); ++i)
+    {
+        ++starts[(GetWord(values[i] >> shift, 0U) & bucketMask) + 1U];
+    }
+    for (size_t b = 1; b < starts.size(); ++b)
+    {
+        starts[b] += starts[b - 1U];
+    }
+    std::vector<uint_t> next(starts.begin(), starts.end() - 1);
+    for (size_t i = 0; i < values.size(); ++i)
+    {
+        order[next[GetWord(values[i] >> shift, 0U) & bucketMask]++]
+            = static_cast<uint_t>(i);
+    }
+    if (width == bits)
+    {
+        return;
+    }
+    for (size_t b = 0; b + 1U < starts.size(); ++b)
+    {
+        if (starts[b + 1U] - starts[b] > 1U)
+        {
+            std::sort(order.begin() + starts[b], order.begin() + starts[b + 1U],
+                SimhashMaskedLess<HashT>(values, mask));
+        }
+    }
+}
+
+template <typename HashT>
+static void FlushMatches(SimhashJoinContext<HashT> &context,
+    std::vector<SimhashJoinMatch<HashT> > &matches)
+{
+    pthread_mutex_lock(&context.mutex);
+    for (size_t i = 0; i < matches.size(); ++i)
+    {
+        context.callback->OnMatch(matches[i].query, matches[i].match,
+            matches[i].distance);
+    }
+    pthread_mutex_unlock(&context.mutex);
+    matches.clear();
+}
+
+/* Joins the queries and the values with the same bits of block. */
+template <typename HashT>
+static void JoinBlock(SimhashJoinContext<HashT> &context, uint_t block)
+{
+    //The queries and the values are shared, each block sorts indexes.
+    const HashT mask = context.masks[block];
+    const std::vector<HashT> &queries = *context.queries;
+    const std::vector<HashT> &values = *context.values;
+    std::vector<uint_t> queryOrder, valueOrder;
+    SortByMask(queries, mask, queryOrder);
+    SortByMask(values, mask, valueOrder);
+    std::vector<SimhashJoinMatch<HashT> > matches;
+    size_t i = 0, j = 0;
+    while (i < queryOrder.size() && j < valueOrder.size())
+    {
+        const HashT key = queries[queryOrder[i]] & mask;
+        const HashT valueKey = values[valueOrder[j]] & mask;
+        if (key < valueKey)
+        {
+            ++i;
+            continue;
+        }
+        if (valueKey < key)
+        {
+            ++j;
+            continue;
+        }
+        size_t queryEnd = i + 1U;
+        while (queryEnd < queryOrder.size()
+            && (queries[queryOrder[queryEnd]] & mask) == key)
+        {
+            ++queryEnd;
+        }
+        size_t valueEnd = j + 1U;
+        while (valueEnd < valueOrder.size()
+            && (values[valueOrder[valueEnd]] & mask) == key)
+        {
+            ++valueEnd;
+        }
+        for (size_t q = i; q < queryEnd; ++q)
+        {
+            const HashT &query = queries[queryOrder[q]];
+            for (size_t v = j; v < valueEnd; ++v)
+            {
+                const HashT &value = values[valueOrder[v]];
+                const HashT diff = query ^ value;
+                const uint_t distance = PopCount(diff);
+                if (distance > context.maxHamDist)
+                {
+                    continue;
+                }
+                //The pair is taken under the first block they have in common.
+                bool first = true;
+                for (uint_t b = 0; b < block && first; ++b)
+                {
+                    first = (diff & context.masks[b]) != HashT(0U);
+                }
+                if (!first)
+                {
+                    continue;
+                }
+                SimhashJoinMatch<HashT> match;
+                match.query = query;
+                match.match = value;
+                match.distance = distance;
+                matches.push_back(match);
+                if (matches.size() >= JOIN_FLUSH_SIZE)
+                {
+                    FlushMatches(context, matches);
+                }
+            }
+        }
+        i = queryEnd;
+        j = valueEnd;
+    }
+    FlushMatches(context, matches);
+}
+
+template <typename HashT>
+static void* RunJoin(void *arg)
+{
+    SimhashJoinContext<HashT> &context
+        = *static_cast<SimhashJoinContext<HashT>*>(arg);
+    const uint_t blockNum = static_cast<uint_t>(context.masks.size());
+    for (uint_t block = __sync_fetch_and_add(&context.next, 1U);
+        block < blockNum; block = __sync_fetch_and_add(&context.next, 1U))
+    {
+        JoinBlock(context, block);
+    }
+    return NULL;
+}
+
+template <typename HashT>
+void JoinSimhash(const std::vector<HashT> &queries,
+    const std::vector<HashT> &values, uint_t maxHamDist,
+    BasicSimhashJoinCallback<HashT> &callback, uint_t threadNum)
+{
+    static const uint_t WIDTH = HashTraits<HashT>::WIDTH;
+    if (queries.empty() || values.empty())
+    {
+        return;
+    }
+    SimhashJoinContext<HashT> context;
+    context.queries = &queries;
+    context.values = &values;
+    context.maxHamDist = maxHamDist;
+    context.callback = &callback;
+    context.next = 0U;
+    //The blocks of equal widths, from the highest, the wider ones first. If
+    //there are too few bits, all pairs are compared under an empty block.
+    if (maxHamDist >= WIDTH)
+    {
+        context.masks.push_back(HashT(0U));
+    }
+    else
+    {
+        const uint_t blockNum = maxHamDist + 1U;
+        uint_t end = WIDTH;
+        for (uint_t b = 0; b < blockNum; ++b)
+        {
+            const uint_t width = WIDTH / blockNum
+                + (b < WIDTH % blockNum ? 1U : 0U);
+            HashT mask(0U);
+            for (uint_t bit = end - width; bit < end; ++bit)
+            {
+                mask |= HashT(1U) << bit;
+            }
+            context.masks.push_back(mask);
+            end -= width;
+        }
+    }
+    if (!threadNum)
+    {
+        threadNum = static_cast<uint_t>(std::max(sysconf(_SC_NPROCESSORS_ONLN),
+            1L));
+    }
+    threadNum = std::min(threadNum, static_cast<uint_t>(context.masks.size()));
+    pthread_mutex_init(&context.mutex, NULL);
+    //The calling thread is one of them, also if a thread fails to start.
+    std::vector<pthread_t> threads(threadNum);
+    std::vector<bool> started(threadNum, false);
+    for (uint_t i = 1; i < threadNum; ++i)
+    {
+        started[i] = !pthread_create(&threads[i], NULL, RunJoin<HashT>,
+            &context);
+    }
+    RunJoin<HashT>(&context);
+    for (uint_t i = 1; i < threadNum; ++i)
+    {
+        if (started[i])
+        {
+            pthread_join(threads[i], NULL);
+        }
+    }
+    pthread_mutex_destroy(&context.mutex);
+}
+
+/* Reads all values of a file. */
+template <typename HashT>
+static bool ReadSimhashFile(const std::string &filename, bool binary,
+    std::vector<HashT> &values)
+{
+    SimhashFileReader<HashT> reader;
+    if (!reader.Open(filename, binary))
+    {
+        return false;
+    }
+    values.clear();
+    std::vector<HashT> buff;
+    while (reader.Read(buff))
+    {
+        values.insert(values.end(), buff.begin(), buff.end());
+    }
+    return reader.Good();
+}
+
+template <typename HashT>
+bool JoinSimhashFiles(const std::string &queryFile,
+    const std::string &valueFile, bool binary, uint_t maxHamDist,
+    BasicSimhashJoinCallback<HashT> &callback, uint_t threadNum)
+{
+    std::vector<HashT> queries, values;
+    if (!ReadSimhashFile(queryFile, binary, queries)
+        || !ReadSimhashFile(valueFile, binary, values))
+    {
+        return false;
+    }
+    JoinSimhash(queries, values, maxHamDist, callback, threadNum);
+    return true;
+}
+
+template void JoinSimhash<hash_t>(const std::vector<hash_t>&,
+    const std::vector<hash_t>&, uint_t, BasicSimhashJoinCallback<hash_t>&,
+    uint_t);
+template void JoinSimhash<hash128_t>(const std::vector<hash128_t>&,
+    const std::vector<hash128_t>&, uint_t,
+    BasicSimhashJoinCallback<hash128_t>&, uint_t);
+template void JoinSimhash<hash256_t>(const std::vector<hash256_t>&,
+    const std::vector<hash256_t>&, uint_t,
+    BasicSimhashJoinCallback<hash256_t>&, uint_t);
+template bool JoinSimhashFiles<hash_t>(const std::string&, const std::string&,
+    bool, uint_t, BasicSimhashJoinCallback<hash_t>&, uint_t);
+template bool JoinSimhashFiles<hash128_t>(const std::string&,
+    const std::string&, bool, uint_t, BasicSimhashJoinCallback<hash128_t>&,
+    uint_t);
+template bool JoinSimhashFiles<hash256_t>(const std::string&,
+    const std::string&, bool, uint_t, BasicSimhashJoinCallback<hash256_t>&,
+    uint_t);
+
+} // namespace simhash
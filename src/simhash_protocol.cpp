@@ -0,0 +1,237 @@
+/*==============================================================================
+*   Copyright (C) 2016 All rights reserved.
+*
+*  File Name    : simhash_protocol.cpp
+*  Author       : Zhongping Liang
+*  Date         : 2016-07-19
+*  Version      : 1.0
+*  Description  : This file provides implement of the protocol of the simhash
+*           server.
+==============================================================================*/
+
+#include "simhash_protocol.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+namespace simhash
+{
+
+void EncodeUint(uint64_t value, uint_t bytes, std::string &buffer)
+{
+    for (uint_t i = 0; i < bytes; ++i)
+    {
+        buffer.push_back(static_cast<char>((value >> (i * 8U)) & 0xFFU));
+    }
+}
+
+uint64_t DecodeUint(const char *data, uint_t bytes)
+{
+    uint64_t value = 0UL;
+    for (uint_t i = 0; i < bytes; ++i)
+    {
+        value |= static_cast<uint64_t>(static_cast<unsigned char>(data[i]))
+            << (i * 8U);
+    }
+    return value;
+}
+
+void EncodeRequest(uint_t op, hash_t hash, std::string &buffer)
+{
+    EncodeUint(op, 1U, buffer);
+    EncodeUint(hash, 8U, buffer);
+}
+
+void EncodeNamedRequest(uint_t op, uint_t arg, const std::string &name,
+    std::string &buffer)
+{
+    EncodeRequest(op, (static_cast<uint64_t>(name.size()) << 32U) | arg,
+        buffer);
+    buffer.append(name);
+}
+
+void DecodeRequest(const char *data, uint_t &op, hash_t &hash)
+{
+    op = static_cast<uint_t>(DecodeUint(data, 1U));
+    hash = DecodeUint(data + 1, 8U);
+}
+
+uint64_t GetRequestNameBytes(uint_t op, hash_t hash)
+{
+    if (SIMHASH_OP_CODE_SAVE_TO_FILE != op && SIMHASH_OP_CODE_START_SAVE != op)
+    {
+        return 0UL;
+    }
+    return hash >> 32U;
+}
+
+void EncodeResponse(uint_t status, const std::vector<hash_t> &values,
+    std::string &buffer)
+{
+    EncodeUint(status, 1U, buffer);
+    EncodeUint(values.size(), 4U, buffer);
+    for (std::vector<hash_t>::const_iterator it = values.begin();
+        values.end() != it; ++it)
+    {
+        EncodeUint(*it, 8U, buffer);
+    }
+}
+
+/*
+* Resolves address into a socket address, returns the socket family, or -1 if
+* the address is invalid.
+*/
+static int ResolveAddress(const std::string &address, bool passive,
+    struct sockaddr_storage &storage, socklen_t &length)
+{
+    memset(&storage, 0, sizeof(storage));
+    const std::string unixPrefix = "unix:";
+    if (0 == address.compare(0, unixPrefix.size(), unixPrefix))
+    {
+        std::string path = address.substr(unixPrefix.size());
+        struct sockaddr_un *addr = reinterpret_cast<struct sockaddr_un*>(
+            &storage);
+        if (path.empty() || path.size() >= sizeof(addr->sun_path))
+        {
+            return -1;
+        }
+        addr->sun_family = AF_UNIX;
+        memcpy(addr->sun_path, path.c_str(), path.size() + 1);
+        length = sizeof(struct sockaddr_un);
+        return AF_UNIX;
+    }
+    std::string::size_type colon = address.rfind(':');
+    if (std::string::npos == colon)
+    {
+        return -1;
+    }
+    std::string host = address.substr(0, colon);
+    std::string port = address.substr(colon + 1);
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = passive ? AI_PASSIVE : 0;
+    struct addrinfo *result = NULL;
+    if (getaddrinfo(host.empty() ? NULL : host.c_str(), port.c_str(), &hints,
+        &result) || !result)
+    {
+        return -1;
+    }
+    memcpy(&storage, result->ai_addr, result->ai_addrlen);
+    length = result->ai_addrlen;
+    int family = result->ai_family;
+    freeaddrinfo(result);
+    return family;
+}
+
+int ListenSimhashAddress(const std::string &address, int backlog)
+{
+    struct sockaddr_storage storage;
+    socklen_t length = 0;
+    int family = ResolveAddress(address, true, storage, length);
+    if (family < 0)
+    {
+        return -1;
+    }
+    int fd = socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (AF_UNIX == family)
+    {
+        //Remove the socket file left by a former server.
+        unlink(reinterpret_cast<struct sockaddr_un*>(&storage)->sun_path);
+    }
+    else
+    {
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    }
+    if (bind(fd, reinterpret_cast<struct sockaddr*>(&storage), length)
+        || listen(fd, backlog))
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int ConnectSimhashAddress(const std::string &address)
+{
+    struct sockaddr_storage storage;
+    socklen_t length = 0;
+    int family = ResolveAddress(address, false, storage, length);
+    if (family < 0)
+    {
+        return -1;
+    }
+    int fd = socket(family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (connect(fd, reinterpret_cast<struct sockaddr*>(&storage), length))
+    {
+        close(fd);
+        return -1;
+    }
+    if (AF_UNIX != family)
+    {
+        //The requests are small, do not wait for more bytes to send.
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+    return fd;
+}
+
+bool WriteAll(int fd, const char *data, size_t size)
+{
+    while (size)
+    {
+        //A lost peer fails the call, instead of raising SIGPIPE.
+        ssize_t ret = send(fd, data, size, MSG_NOSIGNAL);
+        if (ret < 0 && EINTR == errno)
+        {
+            continue;
+        }
+        if (ret <= 0)
+        {
+            return false;
+        }
+        data += ret;
+        size -= ret;
+    }
+    return true;
+}
+
+bool ReadAll(int fd, char *data, size_t size)
+{
+    while (size)
+    {
+        ssize_t ret = read(fd, data, size);
+        if (ret < 0 && EINTR == errno)
+        {
+            continue;
+        }
+        if (ret <= 0)
+        {
+            return false;
+        }
+        data += ret;
+        size -= ret;
+    }
+    return true;
+}
+
+} // namespace simhash
@@ -0,0 +1,578 @@
+/*==============================================================================
+*   Copyright (C) 2016 All rights reserved.
+*
+*  File Name    : simhash_server.cpp
+*  Author       : Zhongping Liang
+*  Date         : 2016-07-19
+*  Version      : 1.0
+*  Description  : This file provides implement of the SimhashServer.
+==============================================================================*/
+
+#include "simhash_server.h"
+
+#include <map>
+#include <algorithm>
+#include <vector>
+#include <sstream>
+#include <cerrno>
+
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+namespace simhash
+{
+
+SimhashServerOptions::SimhashServerOptions()
+    : address(          "127.0.0.1:7733"    )
+    , maxEvents(        256U                )
+    , minBatchSize(     8U                  )
+    , maxBatchSize(     1024U               )
+    , batchDepth(       16U                 )
+    , maxOutputBytes(   4U << 20            )
+{}
+
+SimhashServerStats::SimhashServerStats()
+    : connections(      0UL )
+    , requests(         0UL )
+    , batches(          0UL )
+    , batchedQueries(   0UL )
+    , wakeups(          0UL )
+{}
+
+std::string SimhashServerStats::ToString() const
+{
+    std::ostringstream oss;
+    oss << "connections=" << connections << " requests=" << requests
+        << " batches=" << batches << " batchedQueries=" << batchedQueries
+        << " wakeups=" << wakeups;
+    return oss.str();
+}
+
+SimhashServer::SimhashServer()
+{}
+
+SimhashServer::~SimhashServer()
+{}
+
+class SimhashServerImpl : public SimhashServer
+{
+private:
+    SimhashServerImpl(SimhashTablePtr tablePtr,
+        const SimhashServerOptions &options);
+    SimhashServerImpl(const SimhashServerImpl&);
+    SimhashServerImpl& operator=(const SimhashServerImpl&);
+public :
+    virtual ~SimhashServerImpl();
+public :
+    virtual bool Run();
+    virtual void Stop();
+    virtual void GetStats(SimhashServerStats &stats);
+private :
+    /*
+    * A connection. The requests of a closed connection may still refer to
+    * it, they are run but their responses are dropped.
+    */
+    struct Connection
+    {
+        int fd;
+        std::string input;      // The bytes of incomplete requests.
+        std::string output;     // The responses not sent.
+        size_t outputPos;       // The bytes of output sent.
+        bool reading;           // Whether EPOLLIN is registered.
+        bool writing;           // Whether EPOLLOUT is registered.
+        bool touched;           // Whether it has new responses.
+        bool closed;
+    };
+    typedef std::tr1::shared_ptr<Connection> ConnectionPtr;
+    typedef std::map<int, ConnectionPtr> ConnectionsType;
+    /* A request read from a connection. */
+    struct Request
+    {
+        ConnectionPtr conn;
+        uint_t op;
+        hash_t hash;
+        std::string name;       // The file name of a save.
+    };
+    typedef std::vector<Request> RequestsType;
+private :
+    bool Listen();
+    void Accept();
+    /* Reads the ready bytes of conn, and parses its requests. */
+    void Read(const ConnectionPtr &conn);
+    /* Sends the responses of conn as much as the socket takes. */
+    void Flush(const ConnectionPtr &conn);
+    /* Registers the events of conn according to its buffers. */
+    void UpdateEvents(const ConnectionPtr &conn);
+    void Close(const ConnectionPtr &conn);
+    /* Runs the requests, and appends the responses to their connections. */
+    void Execute();
+    /* Runs the queries in mRequests[begin, end) as a batch. */
+    void ExecuteBatch(size_t begin, size_t end);
+    void ExecuteOne(const Request &request);
+    static bool IsQuery(uint_t op)
+    {
+        return SIMHASH_OP_CODE_HAS_NEAR_DUPS == op
+            || SIMHASH_OP_CODE_FIND_NEAR_DUPS == op;
+    }
+private :
+    SimhashTablePtr mTablePtr;
+    SimhashServerOptions mOptions;
+    int mListenFd;
+    int mEpollFd;
+    int mStopFd;                // An eventfd to wake up the event loop.
+    volatile bool mStopped;
+    ConnectionsType mConnections;
+    RequestsType mRequests;     // The requests of the current wakeup.
+    std::vector<ConnectionPtr> mTouched;    // The connections with responses.
+    SimhashServerStats mStats;
+    // The buffers of batches, kept to avoid allocations.
+    std::vector<hash_t> mHashes;
+    std::vector<FindAnswerType> mAnswers;
+    FindAnswerType mAnswer;
+    friend SimhashServerPtr CreateSimhashServer(SimhashTablePtr tablePtr,
+        const SimhashServerOptions &options);
+};
+
+SimhashServerImpl::SimhashServerImpl(SimhashTablePtr tablePtr,
+    const SimhashServerOptions &options)
+    : mTablePtr(    tablePtr    )
+    , mOptions(     options     )
+    , mListenFd(    -1          )
+    , mEpollFd(     -1          )
+    , mStopFd(      -1          )
+    , mStopped(     false       )
+{}
+
+SimhashServerImpl::~SimhashServerImpl()
+{
+    for (ConnectionsType::iterator it = mConnections.begin();
+        mConnections.end() != it; ++it)
+    {
+        close(it->first);
+    }
+    if (mListenFd >= 0)
+    {
+        close(mListenFd);
+    }
+    if (mEpollFd >= 0)
+    {
+        close(mEpollFd);
+    }
+    if (mStopFd >= 0)
+    {
+        close(mStopFd);
+    }
+}
+
+bool SimhashServerImpl::Listen()
+{
+    mListenFd = ListenSimhashAddress(mOptions.address);
+    mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+    mStopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (mListenFd < 0 || mEpollFd < 0 || mStopFd < 0)
+    {
+        return false;
+    }
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = mListenFd;
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mListenFd, &event))
+    {
+        return false;
+    }
+    event.data.fd = mStopFd;
+    return 0 == epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mStopFd, &event);
+}
+
+void SimhashServerImpl::Stop()
+{
+    mStopped = true;
+    uint64_t one = 1UL;
+    ssize_t ret = write(mStopFd, &one, sizeof(one));
+    (void)ret;
+}
+
+void SimhashServerImpl::GetStats(SimhashServerStats &stats)
+{
+    stats = mStats;
+}
+
+bool SimhashServerImpl::Run()
+{
+    std::vector<struct epoll_event> events(std::max(mOptions.maxEvents, 1U));
+    while (!mStopped)
+    {
+        int num = epoll_wait(mEpollFd, &events[0],
+            static_cast<int>(events.size()), -1);
+        if (num < 0)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            return false;
+        }
+        for (int i = 0; i < num; ++i)
+        {
+            int fd = events[i].data.fd;
+            if (mListenFd == fd)
+            {
+                Accept();
+                continue;
+            }
+            ConnectionsType::iterator it = mConnections.find(fd);
+            if (mStopFd == fd || mConnections.end() == it)
+            {
+                continue;
+            }
+            ConnectionPtr conn = it->second;
+            if (events[i].events & EPOLLOUT)
+            {
+                Flush(conn);
+            }
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+            {
+                Read(conn);
+            }
+        }
+        Execute();
+    }
+    return true;
+}
+
+void SimhashServerImpl::Accept()
+{
+    while (true)
+    {
+        int fd = accept4(mListenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            //EAGAIN when no more connection, or an error of one connection.
+            return;
+        }
+        ConnectionPtr conn(new Connection());
+        conn->fd = fd;
+        conn->outputPos = 0;
+        conn->reading = true;
+        conn->writing = false;
+        conn->touched = false;
+        conn->closed = false;
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, &event))
+        {
+            close(fd);
+            continue;
+        }
+        mConnections[fd] = conn;
+        ++mStats.connections;
+    }
+}
+
+void SimhashServerImpl::Read(const ConnectionPtr &conn)
+{
+    char buffer[64 * 1024];
+    while (!conn->closed)
+    {
+        ssize_t ret = read(conn->fd, buffer, sizeof(buffer));
+        if (ret < 0 && EINTR == errno)
+        {
+            continue;
+        }
+        if (ret < 0 && (EAGAIN == errno || EWOULDBLOCK == errno))
+        {
+            break;
+        }
+        if (ret <= 0)
+        {
+            Close(conn);
+            break;
+        }
+        conn->input.append(buffer, ret);
+        if (static_cast<size_t>(ret) < sizeof(buffer))
+        {
+            break;
+        }
+    }
+    size_t pos = 0;
+    while (pos + REQUEST_BYTES <= conn->input.size())
+    {
+        Request request;
+        request.conn = conn;
+        DecodeRequest(conn->input.data() + pos, request.op, request.hash);
+        const uint64_t nameBytes = GetRequestNameBytes(request.op,
+            request.hash);
+        if (nameBytes > MAX_NAME_BYTES)
+        {
+            Close(conn);
+            break;
+        }
+        if (pos + REQUEST_BYTES + nameBytes > conn->input.size())
+        {
+            break;
+        }
+        request.name.assign(conn->input, pos + REQUEST_BYTES, nameBytes);
+        mRequests.push_back(request);
+        pos += REQUEST_BYTES + nameBytes;
+    }
+    conn->input.erase(0, pos);
+}
+
+void SimhashServerImpl::Flush(const ConnectionPtr &conn)
+{
+    while (!conn->closed && conn->outputPos < conn->output.size())
+    {
+        ssize_t ret = send(conn->fd, conn->output.data() + conn->outputPos,
+            conn->output.size() - conn->outputPos, MSG_NOSIGNAL);
+        if (ret < 0 && EINTR == errno)
+        {
+            continue;
+        }
+        if (ret < 0 && (EAGAIN == errno || EWOULDBLOCK == errno))
+        {
+            break;
+        }
+        if (ret <= 0)
+        {
+            Close(conn);
+            return;
+        }
+        conn->outputPos += ret;
+    }
+    if (conn->outputPos == conn->output.size())
+    {
+        conn->output.clear();
+        conn->outputPos = 0;
+    }
+    else if (conn->outputPos >= conn->output.size() / 2U)
+    {
+        //Drop the bytes sent, amortized against the bytes left.
+        conn->output.erase(0, conn->outputPos);
+        conn->outputPos = 0;
+    }
+    UpdateEvents(conn);
+}
+
+void SimhashServerImpl::UpdateEvents(const ConnectionPtr &conn)
+{
+    if (conn->closed)
+    {
+        return;
+    }
+    size_t pending = conn->output.size() - conn->outputPos;
+    bool reading = pending <= mOptions.maxOutputBytes;
+    bool writing = pending > 0;
+    if (reading == conn->reading && writing == conn->writing)
+    {
+        return;
+    }
+    struct epoll_event event;
+    event.events = (reading ? EPOLLIN : 0U) | (writing ? EPOLLOUT : 0U);
+    event.data.fd = conn->fd;
+    epoll_ctl(mEpollFd, EPOLL_CTL_MOD, conn->fd, &event);
+    conn->reading = reading;
+    conn->writing = writing;
+}
+
+void SimhashServerImpl::Close(const ConnectionPtr &conn)
+{
+    if (conn->closed)
+    {
+        return;
+    }
+    conn->closed = true;
+    epoll_ctl(mEpollFd, EPOLL_CTL_DEL, conn->fd, NULL);
+    mConnections.erase(conn->fd);
+    close(conn->fd);
+}
+
+void SimhashServerImpl::Execute()
+{
+    if (mRequests.empty())
+    {
+        return;
+    }
+    ++mStats.wakeups;
+    mStats.requests += mRequests.size();
+    size_t i = 0;
+    while (i < mRequests.size())
+    {
+        size_t end = i;
+        while (end < mRequests.size() && end - i < mOptions.maxBatchSize
+            && IsQuery(mRequests[end].op))
+        {
+            ++end;
+        }
+        if (end - i >= std::max(mOptions.minBatchSize, 1U))
+        {
+            ExecuteBatch(i, end);
+            i = end;
+        }
+        else
+        {
+            ExecuteOne(mRequests[i]);
+            ++i;
+        }
+    }
+    for (RequestsType::iterator it = mRequests.begin();
+        mRequests.end() != it; ++it)
+    {
+        if (!it->conn->touched && !it->conn->closed)
+        {
+            it->conn->touched = true;
+            mTouched.push_back(it->conn);
+        }
+    }
+    mRequests.clear();
+    for (std::vector<ConnectionPtr>::iterator it = mTouched.begin();
+        mTouched.end() != it; ++it)
+    {
+        (*it)->touched = false;
+        Flush(*it);
+    }
+    mTouched.clear();
+}
+
+void SimhashServerImpl::ExecuteBatch(size_t begin, size_t end)
+{
+    ++mStats.batches;
+    mStats.batchedQueries += end - begin;
+    mHashes.clear();
+    for (size_t i = begin; i < end; ++i)
+    {
+        mHashes.push_back(mRequests[i].hash);
+    }
+    mTablePtr->FindNearDupsBatch(mHashes, mAnswers, mOptions.batchDepth);
+    for (size_t i = begin; i < end; ++i)
+    {
+        const Request &request = mRequests[i];
+        FindAnswerType &ans = mAnswers[i - begin];
+        if (request.conn->closed)
+        {
+            continue;
+        }
+        uint_t status = ans.empty() ? SIMHASH_STATUS_FALSE : SIMHASH_STATUS_TRUE;
+        if (SIMHASH_OP_CODE_HAS_NEAR_DUPS == request.op)
+        {
+            ans.clear();
+        }
+        EncodeResponse(status, ans, request.conn->output);
+    }
+}
+
+void SimhashServerImpl::ExecuteOne(const Request &request)
+{
+    uint_t status = SIMHASH_STATUS_FALSE;
+    bool ret = false;
+    mAnswer.clear();
+    switch (request.op)
+    {
+    case SIMHASH_OP_CODE_INSERT :
+        ret = mTablePtr->Insert(request.hash);
+        break;
+    case SIMHASH_OP_CODE_REMOVE :
+        ret = mTablePtr->Remove(request.hash);
+        break;
+    case SIMHASH_OP_CODE_SEARCH :
+        ret = mTablePtr->Search(request.hash);
+        break;
+    case SIMHASH_OP_CODE_HAS_NEAR_DUPS :
+        ret = mTablePtr->HasNearDups(request.hash);
+        break;
+    case SIMHASH_OP_CODE_FIND_NEAR_DUPS :
+        ret = mTablePtr->FindNearDups(request.hash, mAnswer);
+        break;
+    case SIMHASH_OP_CODE_GET_SIZE :
+        mAnswer.push_back(mTablePtr->GetSize());
+        ret = true;
+        break;
+    case SIMHASH_OP_CODE_CLEAR :
+        mTablePtr->Clear();
+        ret = true;
+        break;
+    case SIMHASH_OP_CODE_SAVE_TO_FILE :
+    case SIMHASH_OP_CODE_START_SAVE :
+    {
+        const uint_t format = static_cast<uint_t>(request.hash & 0xFFFFFFFFUL);
+        if (format > SIMHASH_FILE_SNAPSHOT || request.name.empty())
+        {
+            status = SIMHASH_STATUS_BAD_REQUEST;
+            break;
+        }
+        //A save blocks the event loop until the file is written, a
+        //background save only for the fork.
+        ret = SIMHASH_OP_CODE_SAVE_TO_FILE == request.op
+            ? mTablePtr->SaveToFile(request.name,
+                static_cast<SimhashFileFormat>(format))
+            : mTablePtr->StartSave(request.name,
+                static_cast<SimhashFileFormat>(format));
+        break;
+    }
+    case SIMHASH_OP_CODE_GET_SAVE_STATE :
+        mAnswer.push_back(mTablePtr->GetSaveState(false));
+        ret = true;
+        break;
+    case SIMHASH_OP_CODE_FREEZE :
+        ret = mTablePtr->Freeze();
+        break;
+    case SIMHASH_OP_CODE_GET_STATS :
+    {
+        SimhashTableStats stats;
+        ret = mTablePtr->GetStats(stats);
+        if (ret)
+        {
+            stats.Encode(mAnswer);
+        }
+        break;
+    }
+    case SIMHASH_OP_CODE_RESET_STATS :
+        mTablePtr->ResetStats();
+        ret = true;
+        break;
+    case SIMHASH_OP_CODE_GET_BUCKET_REPORT :
+    {
+        SimhashBucketReport report;
+        mTablePtr->GetBucketReport(report);
+        report.Encode(mAnswer);
+        ret = true;
+        break;
+    }
+    case SIMHASH_OP_CODE_GET_MEMORY_USAGE :
+    {
+        SimhashMemoryUsage usage;
+        mTablePtr->GetMemoryUsage(usage);
+        usage.Encode(mAnswer);
+        ret = true;
+        break;
+    }
+    default :
+        status = SIMHASH_STATUS_BAD_REQUEST;
+        break;
+    }
+    if (ret)
+    {
+        status = SIMHASH_STATUS_TRUE;
+    }
+    //The writes of a closed connection are still applied.
+    if (!request.conn->closed)
+    {
+        EncodeResponse(status, mAnswer, request.conn->output);
+    }
+}
+
+SimhashServerPtr CreateSimhashServer(SimhashTablePtr tablePtr,
+    const SimhashServerOptions &options)
+{
+    SimhashServerImpl *server = new SimhashServerImpl(tablePtr, options);
+    SimhashServerPtr serverPtr(server);
+    if (!tablePtr || !server->Listen())
+    {
+        return SimhashServerPtr();
+    }
+    return serverPtr;
+}
+
+} // namespace simhash
@@ -0,0 +1,611 @@
+/*==============================================================================
+*   Copyright (C) 2016 All rights reserved.
+*
+*  File Name    : simhash_sharded_table.cpp
+*  Author       : Zhongping Liang
+*  Date         : 2016-07-20
+*  Version      : 1.0
+*  Description  : This file provides implement of the sharded SimhashTable.
+==============================================================================*/
+
+#include "simhash_sharded_table.h"
+
+#include <algorithm>
+#include <sstream>
+
+#include <unistd.h>
+
+#include "simhash.h"
+#include "simhash_client.h"
+
+namespace simhash
+{
+
+SimhashShardedTable::SimhashShardedTable()
+{}
+
+SimhashShardedTable::~SimhashShardedTable()
+{}
+
+class SimhashShardedTableImpl : public SimhashShardedTable
+{
+private:
+    SimhashShardedTableImpl(uint_t shardBits, uint_t maxHamDist);
+    SimhashShardedTableImpl(const SimhashShardedTableImpl&);
+    SimhashShardedTableImpl& operator=(const SimhashShardedTableImpl&);
+public :
+    virtual ~SimhashShardedTableImpl();
+public :
+    virtual bool Insert         (hash_t hash);
+    virtual bool Remove         (hash_t hash);
+    virtual bool Update         (hash_t oldHash, hash_t newHash);
+    virtual bool Search         (hash_t hash);
+    virtual bool HasNearDups    (hash_t hash);
+    virtual bool FindFirstNearDup(hash_t hash, hash_t &nearDup);
+    virtual bool FindNearDups   (hash_t hash, FindAnswerType &ans);
+    virtual bool HasNearDupsWithin(hash_t hash, uint_t hamDist);
+    virtual bool FindNearDupsWithin(hash_t hash, uint_t minHamDist,
+        uint_t maxHamDist, FindAnswerType &ans);
+    virtual uint_t FindNearDupsBatch(const std::vector<hash_t> &hashes,
+        std::vector<FindAnswerType> &answers, uint_t depth);
+    virtual bool Join(const std::vector<hash_t> &queries,
+        SimhashJoinCallback &callback, uint_t threadNum);
+    virtual void Clear();
+    virtual uint_t GetSize();
+    virtual bool SaveToFile(const std::string &filename,
+        SimhashFileFormat format);
+    virtual bool LoadFromFile(const std::string &filename, bool binary);
+    virtual bool StartSave(const std::string &filename,
+        SimhashFileFormat format);
+    virtual SimhashSaveState GetSaveState(bool wait);
+    virtual bool Freeze();
+    virtual bool GetStats(SimhashTableStats &stats);
+    virtual void ResetStats();
+    virtual void GetBucketReport(SimhashBucketReport &report);
+    virtual void GetMemoryUsage(SimhashMemoryUsage &usage);
+    virtual bool IsBroken();
+private :
+    /* Returns the shard of hash. */
+    inline uint_t GetShard(hash_t hash) const
+    {
+        return mShardBits ? static_cast<uint_t>(hash >> (HASH_WIDTH
+            - mShardBits)) : 0U;
+    }
+    /* Returns the shards within mMaxHamDist bits of the shard of hash. */
+    inline const std::vector<uint_t>& GetNearShards(hash_t hash) const
+    {
+        return mNearShards[GetShard(hash)];
+    }
+    /* Sends a request to a shard, and waits for the response. */
+    bool Call(uint_t shard, uint_t op, hash_t hash);
+    /*
+    * Sends a request to all shards at once, and receives the responses into
+    * mResponses. A non-empty filename is sent as the name of request, with
+    * "." and the shard id appended. Returns false if some shard fails or
+    * answers false.
+    */
+    bool CallAll(uint_t op, hash_t hash, const std::string &filename = "");
+    /* Sends a query to the near shards, and merges the responses. */
+    bool Query(uint_t op, hash_t hash, FindAnswerType &ans);
+    /* The same as FindNearDupsBatch, returns false if some shard fails. */
+    bool QueryBatch(const std::vector<hash_t> &hashes,
+        std::vector<FindAnswerType> &answers);
+    /* Inserts the values to their shards in pipelines. */
+    void InsertBatch(const std::vector<hash_t> &hashes);
+private :
+    /*
+    * The max requests sent before their responses are read. The server stops
+    * reading a client which does not read its responses, so an unbounded
+    * pipeline could block both of them.
+    */
+    static const uint_t MAX_PIPELINE = 4096U;
+    /* The interval of polling the shards in GetSaveState(true). */
+    static const uint_t SAVE_POLL_MICROS = 10000U;
+    uint_t mShardBits;
+    uint_t mMaxHamDist;
+    std::vector<SimhashClientPtr> mShards;
+    // mNearShards[i] is the shards within mMaxHamDist bits of shard i.
+    std::vector<std::vector<uint_t> > mNearShards;
+    SimhashResponse mResponse;
+    std::vector<SimhashResponse> mResponses;    // The responses of CallAll.
+    friend SimhashShardedTablePtr CreateSimhashShardedTable(
+        const std::vector<std::string> &addresses, uint_t maxHamDist);
+};
+
+SimhashShardedTableImpl::SimhashShardedTableImpl(uint_t shardBits,
+    uint_t maxHamDist)
+    : mShardBits(   shardBits   )
+    , mMaxHamDist(  maxHamDist  )
+    , mNearShards(  1U << shardBits )
+{
+    for (uint_t i = 0; i < mNearShards.size(); ++i)
+    {
+        for (uint_t j = 0; j < mNearShards.size(); ++j)
+        {
+            if (Simhash::GetHammingDistance(i, j) <= maxHamDist)
+            {
+                mNearShards[i].push_back(j);
+            }
+        }
+    }
+}
+
+SimhashShardedTableImpl::~SimhashShardedTableImpl()
+{}
+
+bool SimhashShardedTableImpl::Call(uint_t shard, uint_t op, hash_t hash)
+{
+    SimhashClientPtr &client = mShards[shard];
+    return client->SendRequest(op, hash) && client->Flush()
+        && client->ReceiveResponse(mResponse)
+        && SIMHASH_STATUS_TRUE == mResponse.status;
+}
+
+bool SimhashShardedTableImpl::CallAll(uint_t op, hash_t hash,
+    const std::string &filename)
+{
+    for (uint_t s = 0; s < mShards.size(); ++s)
+    {
+        if (filename.empty())
+        {
+            mShards[s]->SendRequest(op, hash);
+        }
+        else
+        {
+            std::ostringstream oss;
+            oss << filename << "." << s;
+            mShards[s]->SendNamedRequest(op, static_cast<uint_t>(hash),
+                oss.str());
+        }
+        mShards[s]->Flush();
+    }
+    mResponses.resize(mShards.size());
+    bool ret = true;
+    for (uint_t s = 0; s < mShards.size(); ++s)
+    {
+        if (!mShards[s]->ReceiveResponse(mResponses[s])
+            || SIMHASH_STATUS_TRUE != mResponses[s].status)
+        {
+            mResponses[s].status = SIMHASH_STATUS_FALSE;
+            ret = false;
+        }
+    }
+    return ret;
+}
+
+bool SimhashShardedTableImpl::Insert(hash_t hash)
+{
+    return Call(GetShard(hash), SIMHASH_OP_CODE_INSERT, hash);
+}
+
+bool SimhashShardedTableImpl::Remove(hash_t hash)
+{
+    return Call(GetShard(hash), SIMHASH_OP_CODE_REMOVE, hash);
+}
+
+bool SimhashShardedTableImpl::Update(hash_t oldHash, hash_t newHash)
+{
+    //The protocol has no update, the two values may be in two shards.
+    if (!Search(oldHash))
+    {
+        return false;
+    }
+    if (oldHash == newHash)
+    {
+        return true;
+    }
+    return !Search(newHash) && Remove(oldHash) && Insert(newHash);
+}
+
+bool SimhashShardedTableImpl::Search(hash_t hash)
+{
+    return Call(GetShard(hash), SIMHASH_OP_CODE_SEARCH, hash);
+}
+
+bool SimhashShardedTableImpl::Query(uint_t op, hash_t hash,
+    FindAnswerType &ans)
+{
+    ans.clear();
+    const std::vector<uint_t> &shards = GetNearShards(hash);
+    //Send to all shards before waiting for any, so they work in parallel.
+    for (std::vector<uint_t>::const_iterator it = shards.begin();
+        shards.end() != it; ++it)
+    {
+        mShards[*it]->SendRequest(op, hash);
+        mShards[*it]->Flush();
+    }
+    bool ret = false;
+    bool failed = false;
+    for (std::vector<uint_t>::const_iterator it = shards.begin();
+        shards.end() != it; ++it)
+    {
+        //Every response is read, so the other connections stay in order.
+        if (!mShards[*it]->ReceiveResponse(mResponse)
+            || SIMHASH_STATUS_BAD_REQUEST == mResponse.status)
+        {
+            failed = true;
+        }
+        else if (SIMHASH_STATUS_TRUE == mResponse.status)
+        {
+            ret = true;
+            ans.insert(ans.end(), mResponse.values.begin(),
+                mResponse.values.end());
+        }
+    }
+    //The answers of the other shards are not the whole answer.
+    if (failed)
+    {
+        ans.clear();
+        return false;
+    }
+    std::sort(ans.begin(), ans.end());
+    return ret;
+}
+
+bool SimhashShardedTableImpl::HasNearDups(hash_t hash)
+{
+    FindAnswerType ans;
+    return Query(SIMHASH_OP_CODE_HAS_NEAR_DUPS, hash, ans);
+}
+
+bool SimhashShardedTableImpl::FindFirstNearDup(hash_t hash, hash_t &nearDup)
+{
+    FindAnswerType ans;
+    if (!Query(SIMHASH_OP_CODE_FIND_NEAR_DUPS, hash, ans) || ans.empty())
+    {
+        return false;
+    }
+    nearDup = ans.front();
+    return true;
+}
+
+bool SimhashShardedTableImpl::FindNearDups(hash_t hash, FindAnswerType &ans)
+{
+    return Query(SIMHASH_OP_CODE_FIND_NEAR_DUPS, hash, ans);
+}
+
+bool SimhashShardedTableImpl::HasNearDupsWithin(hash_t hash, uint_t hamDist)
+{
+    FindAnswerType ans;
+    return FindNearDupsWithin(hash, 0U, hamDist, ans);
+}
+
+bool SimhashShardedTableImpl::FindNearDupsWithin(hash_t hash,
+    uint_t minHamDist, uint_t maxHamDist, FindAnswerType &ans)
+{
+    //The shards answer within mMaxHamDist, the answers are filtered here.
+    ans.clear();
+    if (maxHamDist > mMaxHamDist
+        || !Query(SIMHASH_OP_CODE_FIND_NEAR_DUPS, hash, ans))
+    {
+        return false;
+    }
+    size_t num = 0;
+    for (size_t i = 0; i < ans.size(); ++i)
+    {
+        const uint_t dist = PopCount(ans[i] ^ hash);
+        if (dist >= minHamDist && dist <= maxHamDist)
+        {
+            ans[num++] = ans[i];
+        }
+    }
+    ans.resize(num);
+    return !ans.empty();
+}
+
+uint_t SimhashShardedTableImpl::FindNearDupsBatch(
+    const std::vector<hash_t> &hashes, std::vector<FindAnswerType> &answers,
+    uint_t)
+{
+    //The requests in flight, MAX_PIPELINE per shard, hide the latency as the
+    //depth of a local batch does, so depth is not used.
+    if (!QueryBatch(hashes, answers))
+    {
+        answers.assign(hashes.size(), FindAnswerType());
+        return 0U;
+    }
+    uint_t found = 0U;
+    for (uint_t i = 0; i < answers.size(); ++i)
+    {
+        found += answers[i].empty() ? 0U : 1U;
+    }
+    return found;
+}
+
+bool SimhashShardedTableImpl::QueryBatch(const std::vector<hash_t> &hashes,
+    std::vector<FindAnswerType> &answers)
+{
+    bool failed = false;
+    answers.assign(hashes.size(), FindAnswerType());
+    //queries[s] is the queries sent to shard s, in the order of responses.
+    std::vector<std::vector<uint_t> > queries(mShards.size());
+    for (uint_t begin = 0; begin < hashes.size(); begin += MAX_PIPELINE)
+    {
+        uint_t end = std::min(static_cast<uint_t>(hashes.size()),
+            begin + MAX_PIPELINE);
+        for (uint_t i = begin; i < end; ++i)
+        {
+            const std::vector<uint_t> &shards = GetNearShards(hashes[i]);
+            for (std::vector<uint_t>::const_iterator it = shards.begin();
+                shards.end() != it; ++it)
+            {
+                mShards[*it]->SendRequest(SIMHASH_OP_CODE_FIND_NEAR_DUPS,
+                    hashes[i]);
+                queries[*it].push_back(i);
+            }
+        }
+        for (uint_t s = 0; s < mShards.size(); ++s)
+        {
+            mShards[s]->Flush();
+        }
+        for (uint_t s = 0; s < mShards.size(); ++s)
+        {
+            for (std::vector<uint_t>::iterator it = queries[s].begin();
+                queries[s].end() != it; ++it)
+            {
+                if (!mShards[s]->ReceiveResponse(mResponse)
+                    || SIMHASH_STATUS_BAD_REQUEST == mResponse.status)
+                {
+                    failed = true;
+                    continue;
+                }
+                answers[*it].insert(answers[*it].end(),
+                    mResponse.values.begin(), mResponse.values.end());
+            }
+            queries[s].clear();
+        }
+    }
+    if (failed)
+    {
+        return false;
+    }
+    for (uint_t i = 0; i < answers.size(); ++i)
+    {
+        std::sort(answers[i].begin(), answers[i].end());
+    }
+    return true;
+}
+
+bool SimhashShardedTableImpl::Join(const std::vector<hash_t> &queries,
+    SimhashJoinCallback &callback, uint_t)
+{
+    //The queries go to the shards in batches, the shards run their shares in
+    //parallel, so threadNum is not used, and the matches are passed to
+    //callback from this thread.
+    std::vector<hash_t> batch;
+    std::vector<FindAnswerType> answers;
+    for (size_t begin = 0; begin < queries.size(); begin += MAX_PIPELINE)
+    {
+        batch.assign(queries.begin() + begin, queries.begin()
+            + std::min(queries.size(), begin + MAX_PIPELINE));
+        if (!QueryBatch(batch, answers))
+        {
+            return false;
+        }
+        for (size_t i = 0; i < batch.size(); ++i)
+        {
+            for (FindAnswerType::iterator it = answers[i].begin();
+                answers[i].end() != it; ++it)
+            {
+                callback.OnMatch(batch[i], *it, PopCount(batch[i] ^ *it));
+            }
+        }
+    }
+    return true;
+}
+
+void SimhashShardedTableImpl::Clear()
+{
+    CallAll(SIMHASH_OP_CODE_CLEAR, 0UL);
+}
+
+uint_t SimhashShardedTableImpl::GetSize()
+{
+    uint_t size = 0U;
+    for (uint_t s = 0; s < mShards.size(); ++s)
+    {
+        if (Call(s, SIMHASH_OP_CODE_GET_SIZE, 0UL) && !mResponse.values.empty())
+        {
+            size += static_cast<uint_t>(mResponse.values.front());
+        }
+    }
+    return size;
+}
+
+void SimhashShardedTableImpl::InsertBatch(const std::vector<hash_t> &hashes)
+{
+    std::vector<uint_t> counts(mShards.size(), 0U);
+    for (std::vector<hash_t>::const_iterator it = hashes.begin();
+        hashes.end() != it; ++it)
+    {
+        uint_t shard = GetShard(*it);
+        mShards[shard]->SendRequest(SIMHASH_OP_CODE_INSERT, *it);
+        ++counts[shard];
+    }
+    for (uint_t s = 0; s < mShards.size(); ++s)
+    {
+        mShards[s]->Flush();
+    }
+    for (uint_t s = 0; s < mShards.size(); ++s)
+    {
+        for (uint_t i = 0; i < counts[s]; ++i)
+        {
+            mShards[s]->ReceiveResponse(mResponse);
+        }
+    }
+}
+
+bool SimhashShardedTableImpl::SaveToFile(const std::string &filename,
+    SimhashFileFormat format)
+{
+    return !filename.empty()
+        && CallAll(SIMHASH_OP_CODE_SAVE_TO_FILE, format, filename);
+}
+
+bool SimhashShardedTableImpl::LoadFromFile(const std::string &filename,
+    bool binary)
+{
+    SimhashFileReader<hash_t> reader;
+    if (!reader.Open(filename, binary))
+    {
+        return false;
+    }
+    Clear();
+    std::vector<hash_t> values, buff;
+    while (reader.Read(values))
+    {
+        //The values are inserted in pipelines of MAX_PIPELINE.
+        for (size_t i = 0; i < values.size(); i += MAX_PIPELINE)
+        {
+            buff.assign(values.begin() + i, values.begin()
+                + std::min(values.size(), i + MAX_PIPELINE));
+            InsertBatch(buff);
+        }
+    }
+    return reader.Good() && !IsBroken();
+}
+
+bool SimhashShardedTableImpl::StartSave(const std::string &filename,
+    SimhashFileFormat format)
+{
+    //If some shard fails to start, the others still save, and GetSaveState
+    //reports the save failed.
+    return !filename.empty()
+        && CallAll(SIMHASH_OP_CODE_START_SAVE, format, filename);
+}
+
+SimhashSaveState SimhashShardedTableImpl::GetSaveState(bool wait)
+{
+    //A server never waits for its save, it is polled.
+    while (true)
+    {
+        CallAll(SIMHASH_OP_CODE_GET_SAVE_STATE, 0UL);
+        bool running = false, failed = false, same = true;
+        for (uint_t s = 0; s < mShards.size(); ++s)
+        {
+            const SimhashResponse &response = mResponses[s];
+            if (SIMHASH_STATUS_TRUE != response.status
+                || response.values.empty())
+            {
+                failed = true;
+                continue;
+            }
+            const hash_t state = response.values.front();
+            running = running || SIMHASH_SAVE_RUNNING == state;
+            failed = failed || SIMHASH_SAVE_FAILED == state;
+            same = same && (mResponses[0].values.empty()
+                || mResponses[0].values.front() == state);
+        }
+        //A failed shard doesn't stop the wait, the others still save.
+        if (running && wait)
+        {
+            usleep(SAVE_POLL_MICROS);
+            continue;
+        }
+        if (running)
+        {
+            return SIMHASH_SAVE_RUNNING;
+        }
+        //Some shards idle and some done means the others missed the save.
+        if (failed || !same)
+        {
+            return SIMHASH_SAVE_FAILED;
+        }
+        return static_cast<SimhashSaveState>(mResponses[0].values.front());
+    }
+}
+
+bool SimhashShardedTableImpl::Freeze()
+{
+    return CallAll(SIMHASH_OP_CODE_FREEZE, 0UL);
+}
+
+bool SimhashShardedTableImpl::GetStats(SimhashTableStats &stats)
+{
+    stats = SimhashTableStats();
+    if (!CallAll(SIMHASH_OP_CODE_GET_STATS, 0UL))
+    {
+        return false;
+    }
+    for (uint_t s = 0; s < mShards.size(); ++s)
+    {
+        if (!stats.Decode(mResponses[s].values))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void SimhashShardedTableImpl::ResetStats()
+{
+    CallAll(SIMHASH_OP_CODE_RESET_STATS, 0UL);
+}
+
+void SimhashShardedTableImpl::GetBucketReport(SimhashBucketReport &report)
+{
+    report = SimhashBucketReport();
+    CallAll(SIMHASH_OP_CODE_GET_BUCKET_REPORT, 0UL);
+    for (uint_t s = 0; s < mShards.size(); ++s)
+    {
+        if (SIMHASH_STATUS_TRUE == mResponses[s].status)
+        {
+            report.Decode(mResponses[s].values);
+        }
+    }
+}
+
+void SimhashShardedTableImpl::GetMemoryUsage(SimhashMemoryUsage &usage)
+{
+    usage = SimhashMemoryUsage();
+    CallAll(SIMHASH_OP_CODE_GET_MEMORY_USAGE, 0UL);
+    for (uint_t s = 0; s < mShards.size(); ++s)
+    {
+        if (SIMHASH_STATUS_TRUE == mResponses[s].status)
+        {
+            usage.Decode(mResponses[s].values);
+        }
+    }
+}
+
+bool SimhashShardedTableImpl::IsBroken()
+{
+    for (uint_t s = 0; s < mShards.size(); ++s)
+    {
+        if (mShards[s]->IsBroken())
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+SimhashShardedTablePtr CreateSimhashShardedTable(
+    const std::vector<std::string> &addresses, uint_t maxHamDist)
+{
+    uint_t shardBits = 0U;
+    while ((static_cast<size_t>(1U) << shardBits) < addresses.size())
+    {
+        ++shardBits;
+    }
+    if (addresses.empty() || (1U << shardBits) != addresses.size()
+        || shardBits > 16U)
+    {
+        return SimhashShardedTablePtr();
+    }
+    SimhashShardedTableImpl *table = new SimhashShardedTableImpl(shardBits,
+        maxHamDist);
+    SimhashShardedTablePtr tablePtr(table);
+    for (size_t i = 0; i < addresses.size(); ++i)
+    {
+        SimhashClientPtr clientPtr = CreateSimhashClient(addresses[i]);
+        if (!clientPtr)
+        {
+            return SimhashShardedTablePtr();
+        }
+        table->mShards.push_back(clientPtr);
+    }
+    return tablePtr;
+}
+
+} // namespace simhash
@@ -0,0 +1,245 @@
+/*==============================================================================
+*   Copyright (C) 2016 All rights reserved.
+*
+*  File Name    : simhash_snapshot.cpp
+*  Author       : Zhongping Liang
+*  Date         : 2016-07-22
+*  Version      : 1.0
+*  Description  : This file provides implement of the compressed snapshot
+*           format.
+==============================================================================*/
+
+#include "simhash_snapshot.h"
+
+#include <cstring>
+
+#ifdef __SSE4_2__
+#include <nmmintrin.h>
+#endif
+
+namespace simhash
+{
+
+/*
+* The tables of CRC-32C by slicing-by-8, CRC_TABLES[0] is the common table of
+* one byte, and CRC_TABLES[k][b] is the CRC of byte b followed by k zeros.
+* They serve the builds without SSE4.2, whose crc32 instruction is CRC-32C.
+*/
+static uint32_t CRC_TABLES[8][256];
+
+struct SimhashCrcTables
+{
+    SimhashCrcTables()
+    {
+        for (uint32_t b = 0; b < 256U; ++b)
+        {
+            uint32_t crc = b;
+            for (uint_t i = 0; i < 8U; ++i)
+            {
+                crc = crc & 1U ? (crc >> 1) ^ 0x82F63B78U : crc >> 1;
+            }
+            CRC_TABLES[0][b] = crc;
+        }
+        for (uint32_t b = 0; b < 256U; ++b)
+        {
+            for (uint_t k = 1; k < 8U; ++k)
+            {
+                uint32_t crc = CRC_TABLES[k - 1U][b];
+                CRC_TABLES[k][b] = (crc >> 8) ^ CRC_TABLES[0][crc & 0xFFU];
+            }
+        }
+    }
+};
+
+static SimhashCrcTables gSimhashCrcTables;
+
+uint32_t Crc32(const char *data, size_t size, uint32_t crc)
+{
+    const unsigned char *p = reinterpret_cast<const unsigned char*>(data);
+    crc = ~crc;
+#ifdef __SSE4_2__
+    uint64_t crc64 = crc;
+    for (; size >= 8U; size -= 8U, p += 8)
+    {
+        uint64_t word = 0UL;
+        memcpy(&word, p, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = static_cast<uint32_t>(crc64);
+#endif
+    for (; size >= 8U; size -= 8U, p += 8)
+    {
+        uint32_t low = 0U, high = 0U;
+        memcpy(&low, p, 4U);
+        memcpy(&high, p + 4, 4U);
+        low ^= crc;
+        crc = CRC_TABLES[7][low & 0xFFU] ^ CRC_TABLES[6][(low >> 8) & 0xFFU]
+            ^ CRC_TABLES[5][(low >> 16) & 0xFFU] ^ CRC_TABLES[4][low >> 24]
+            ^ CRC_TABLES[3][high & 0xFFU] ^ CRC_TABLES[2][(high >> 8) & 0xFFU]
+            ^ CRC_TABLES[1][(high >> 16) & 0xFFU] ^ CRC_TABLES[0][high >> 24];
+    }
+    for (; size; --size, ++p)
+    {
+        crc = (crc >> 8) ^ CRC_TABLES[0][(crc ^ *p) & 0xFFU];
+    }
+    return ~crc;
+}
+
+/* Appends a word of 64 bits to out. */
+static inline void AppendWord(uint64_t word, std::string &out)
+{
+    out.append(reinterpret_cast<const char*>(&word), sizeof(word));
+}
+
+/* Loads the i-th word of 64 bits at data. */
+static inline uint64_t LoadWord(const char *data, size_t i)
+{
+    uint64_t word = 0UL;
+    memcpy(&word, data + i * 8U, sizeof(word));
+    return word;
+}
+
+template <typename HashT>
+void EncodeSnapshotBlock(const HashT *values, size_t count, std::string &out)
+{
+    static const uint_t WORDS = HashTraits<HashT>::WIDTH / 64U;
+    const uint64_t first = GetWord(values[0], WORDS - 1U);
+    const size_t num = count - 1U;
+    const uint64_t maxDelta = GetWord(values[num], WORDS - 1U) - first;
+    //L is floor(log2(maxDelta / num)), which costs at most 2 bits of unary.
+    uint32_t lowBits = 0U;
+    if (num && maxDelta / num > 0UL)
+    {
+        lowBits = 63U - static_cast<uint32_t>(__builtin_clzll(maxDelta / num));
+    }
+    const uint64_t lowMask = lowBits ? ~0UL >> (64U - lowBits) : 0UL;
+    std::vector<uint64_t> lows((num * lowBits + 63U) / 64U, 0UL);
+    std::vector<uint64_t> highs((num + (maxDelta >> lowBits) + 63U) / 64U,
+        0UL);
+    for (size_t i = 0; i < num; ++i)
+    {
+        const uint64_t delta = GetWord(values[i + 1U], WORDS - 1U) - first;
+        if (lowBits)
+        {
+            const uint64_t low = delta & lowMask;
+            const size_t pos = i * lowBits;
+            const uint_t shift = pos % 64U;
+            lows[pos / 64U] |= low << shift;
+            if (shift + lowBits > 64U)
+            {
+                lows[pos / 64U + 1U] |= low >> (64U - shift);
+            }
+        }
+        const uint64_t pos = (delta >> lowBits) + i;
+        highs[pos / 64U] |= 1UL << (pos % 64U);
+    }
+    out.append(reinterpret_cast<const char*>(&values[0]), sizeof(HashT));
+    uint32_t highWords = static_cast<uint32_t>(highs.size());
+    out.append(reinterpret_cast<const char*>(&highWords), sizeof(highWords));
+    out.push_back(static_cast<char>(lowBits));
+    out.append(3U, '\0');
+    for (size_t i = 0; i < lows.size(); ++i)
+    {
+        AppendWord(lows[i], out);
+    }
+    for (size_t i = 0; i < highs.size(); ++i)
+    {
+        AppendWord(highs[i], out);
+    }
+    for (size_t i = 1; i < count; ++i)
+    {
+        for (uint_t w = 0; w + 1U < WORDS; ++w)
+        {
+            AppendWord(GetWord(values[i], w), out);
+        }
+    }
+}
+
+template <typename HashT>
+bool DecodeSnapshotBlock(const char *data, size_t size, size_t count,
+    std::vector<HashT> &values)
+{
+    static const uint_t WORDS = HashTraits<HashT>::WIDTH / 64U;
+    static const size_t HEAD_BYTES = sizeof(HashT) + 8U;
+    if (!count || size < HEAD_BYTES)
+    {
+        return false;
+    }
+    HashT hash;
+    memcpy(&hash, data, sizeof(HashT));
+    const uint64_t first = GetWord(hash, WORDS - 1U);
+    uint32_t highWords = 0U;
+    memcpy(&highWords, data + sizeof(HashT), sizeof(highWords));
+    const uint32_t lowBits
+        = static_cast<unsigned char>(data[sizeof(HashT) + 4U]);
+    const size_t num = count - 1U;
+    const size_t lowWords = (num * lowBits + 63U) / 64U;
+    if (lowBits > 63U || size != HEAD_BYTES + (lowWords + highWords
+        + num * (WORDS - 1U)) * 8U)
+    {
+        return false;
+    }
+    const char *lows = data + HEAD_BYTES;
+    const char *highs = lows + lowWords * 8U;
+    const char *rest = highs + highWords * 8U;
+    const uint64_t lowMask = lowBits ? ~0UL >> (64U - lowBits) : 0UL;
+    size_t begin = values.size();
+    values.resize(begin + count);
+    HashT *out = &values[begin];
+    out[0] = hash;
+    //Walk the 1 bits of the unary parts, the i-th one gives the i-th delta.
+    size_t i = 0;
+    for (uint32_t w = 0; w < highWords && i < num; ++w)
+    {
+        uint64_t bits = LoadWord(highs, w);
+        while (bits && i < num)
+        {
+            const uint64_t pos = w * 64UL + __builtin_ctzll(bits);
+            bits &= bits - 1UL;
+            const size_t lowPos = i * lowBits;
+            uint64_t low = 0UL;
+            if (lowBits <= 56U)
+            {
+                memcpy(&low, lows + lowPos / 8U, sizeof(low));
+                low = (low >> (lowPos % 8U)) & lowMask;
+            }
+            else
+            {
+                const uint_t shift = lowPos % 64U;
+                low = LoadWord(lows, lowPos / 64U) >> shift;
+                if (shift + lowBits > 64U)
+                {
+                    low |= LoadWord(lows, lowPos / 64U + 1U) << (64U - shift);
+                }
+                low &= lowMask;
+            }
+            HashT &value = out[i + 1U];
+            SetWord(value, WORDS - 1U, first + (((pos - i) << lowBits) | low));
+            for (uint_t k = 0; k + 1U < WORDS; ++k)
+            {
+                SetWord(value, k, LoadWord(rest, i * (WORDS - 1U) + k));
+            }
+            ++i;
+        }
+    }
+    if (i != num)
+    {
+        values.resize(begin);
+        return false;
+    }
+    return true;
+}
+
+template void EncodeSnapshotBlock<hash_t>(const hash_t*, size_t, std::string&);
+template void EncodeSnapshotBlock<hash128_t>(const hash128_t*, size_t,
+    std::string&);
+template void EncodeSnapshotBlock<hash256_t>(const hash256_t*, size_t,
+    std::string&);
+template bool DecodeSnapshotBlock<hash_t>(const char*, size_t, size_t,
+    std::vector<hash_t>&);
+template bool DecodeSnapshotBlock<hash128_t>(const char*, size_t, size_t,
+    std::vector<hash128_t>&);
+template bool DecodeSnapshotBlock<hash256_t>(const char*, size_t, size_t,
+    std::vector<hash256_t>&);
+
+} // namespace simhash
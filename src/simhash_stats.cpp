@@ -0,0 +1,445 @@
+/*==============================================================================
+*   Copyright (C) 2016 All rights reserved.
+*
+*  File Name    : simhash_stats.cpp
+*  Author       : Zhongping Liang
+*  Date         : 2016-06-15
+*  Version      : 1.0
+*  Description  : This file provides implement of the statistics of the
+*           SimhashTable.
+==============================================================================*/
+
+#include "simhash_stats.h"
+
+#include <algorithm>
+#include <sstream>
+
+namespace simhash
+{
+
+static const char *OPERATION_NAMES[SIMHASH_OP_NUM] = {
+    "Insert",
+    "Remove",
+    "Search",
+    "HasNearDups",
+    "FindFirstNearDup",
+    "FindNearDups",
+    "Update"
+};
+
+LatencyHistogram::LatencyHistogram()
+    : mCounts(  BUCKET_NUM, 0UL )
+    , mCount(   0UL )
+    , mSum(     0UL )
+    , mMax(     0UL )
+{}
+
+uint_t LatencyHistogram::GetBucket(uint64_t value)
+{
+    static const uint64_t SUB_COUNT = 1UL << SUB_BITS;
+    if (value < SUB_COUNT)
+    {
+        return static_cast<uint_t>(value);
+    }
+    //Keep the SUB_BITS most significant bits of value.
+    const uint_t shift = VALUE_BITS - SUB_BITS
+        - static_cast<uint_t>(__builtin_clzll(value));
+    return static_cast<uint_t>((SUB_COUNT >> 1U) * shift + (value >> shift));
+}
+
+uint64_t LatencyHistogram::GetBucketLow(uint_t bucket)
+{
+    static const uint_t SUB_COUNT = 1U << SUB_BITS;
+    if (bucket < SUB_COUNT)
+    {
+        return bucket;
+    }
+    const uint_t shift = bucket / (SUB_COUNT >> 1U) - 1U;
+    return static_cast<uint64_t>(bucket - (SUB_COUNT >> 1U) * shift) << shift;
+}
+
+void LatencyHistogram::Record(uint64_t value)
+{
+    ++mCounts[GetBucket(value)];
+    ++mCount;
+    mSum += value;
+    mMax = std::max(mMax, value);
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram &another)
+{
+    for (uint_t i = 0; i < BUCKET_NUM; ++i)
+    {
+        mCounts[i] += another.mCounts[i];
+    }
+    mCount += another.mCount;
+    mSum += another.mSum;
+    mMax = std::max(mMax, another.mMax);
+}
+
+void LatencyHistogram::Clear()
+{
+    std::fill(mCounts.begin(), mCounts.end(), 0UL);
+    mCount = 0UL;
+    mSum = 0UL;
+    mMax = 0UL;
+}
+
+uint64_t LatencyHistogram::GetCount() const
+{
+    return mCount;
+}
+
+uint64_t LatencyHistogram::GetMax() const
+{
+    return mMax;
+}
+
+double LatencyHistogram::GetMean() const
+{
+    return mCount ? static_cast<double>(mSum) / mCount : 0.0;
+}
+
+uint64_t LatencyHistogram::GetPercentile(double percentile) const
+{
+    if (!mCount)
+    {
+        return 0UL;
+    }
+    uint64_t rank = static_cast<uint64_t>(percentile / 100.0 * mCount + 0.5);
+    rank = std::min(std::max(rank, static_cast<uint64_t>(1UL)), mCount);
+    uint64_t seen = 0UL;
+    for (uint_t i = 0; i < BUCKET_NUM; ++i)
+    {
+        seen += mCounts[i];
+        if (seen >= rank)
+        {
+            const uint64_t low = GetBucketLow(i);
+            const uint64_t high = i + 1U < BUCKET_NUM
+                ? GetBucketLow(i + 1U) : mMax + 1U;
+            return std::min(low + (high - low) / 2U, mMax);
+        }
+    }
+    return mMax;
+}
+
+std::string LatencyHistogram::ToString() const
+{
+    std::ostringstream oss;
+    oss << "count=" << mCount << " mean=" << static_cast<uint64_t>(GetMean())
+        << " p50=" << GetPercentile(50.0) << " p99=" << GetPercentile(99.0)
+        << " p999=" << GetPercentile(99.9) << " max=" << mMax;
+    return oss.str();
+}
+
+void LatencyHistogram::Encode(std::vector<uint64_t> &values) const
+{
+    values.push_back(mCount);
+    values.push_back(mSum);
+    values.push_back(mMax);
+    const size_t numPos = values.size();
+    values.push_back(0UL);
+    for (uint_t i = 0; i < BUCKET_NUM; ++i)
+    {
+        if (mCounts[i])
+        {
+            values.push_back(i);
+            values.push_back(mCounts[i]);
+            ++values[numPos];
+        }
+    }
+}
+
+bool LatencyHistogram::Decode(const std::vector<uint64_t> &values,
+    size_t &pos)
+{
+    if (pos + 4U > values.size())
+    {
+        return false;
+    }
+    const uint64_t num = values[pos + 3U];
+    if (num > BUCKET_NUM || pos + 4U + num * 2U > values.size())
+    {
+        return false;
+    }
+    for (uint64_t i = 0; i < num; ++i)
+    {
+        const uint64_t bucket = values[pos + 4U + i * 2U];
+        if (bucket >= BUCKET_NUM)
+        {
+            return false;
+        }
+        mCounts[bucket] += values[pos + 5U + i * 2U];
+    }
+    mCount += values[pos];
+    mSum += values[pos + 1U];
+    mMax = std::max(mMax, values[pos + 2U]);
+    pos += 4U + num * 2U;
+    return true;
+}
+
+SimhashLevelStats::SimhashLevelStats()
+    : bucketsProbed(        0UL )
+    , filterRejects(        0UL )
+    , candidatesCompared(   0UL )
+    , matches(              0UL )
+{}
+
+SimhashTableStats::SimhashTableStats()
+    : inserts(          0UL )
+    , removes(          0UL )
+    , duplicatesRemoved(0UL )
+{}
+
+void SimhashTableStats::Clear()
+{
+    inserts = 0UL;
+    removes = 0UL;
+    duplicatesRemoved = 0UL;
+    std::fill(levels.begin(), levels.end(), SimhashLevelStats());
+    for (uint_t i = 0; i < SIMHASH_OP_NUM; ++i)
+    {
+        latencies[i].Clear();
+    }
+}
+
+std::string SimhashTableStats::ToString() const
+{
+    std::ostringstream oss;
+    oss << "inserts=" << inserts << " removes=" << removes
+        << " duplicatesRemoved=" << duplicatesRemoved << std::endl;
+    for (uint_t i = static_cast<uint_t>(levels.size()); i > 0; --i)
+    {
+        const SimhashLevelStats &level = levels[i - 1U];
+        oss << "level " << i - 1U << ": bucketsProbed=" << level.bucketsProbed
+            << " filterRejects=" << level.filterRejects
+            << " candidatesCompared=" << level.candidatesCompared
+            << " matches=" << level.matches << std::endl;
+    }
+    for (uint_t i = 0; i < SIMHASH_OP_NUM; ++i)
+    {
+        if (latencies[i].GetCount())
+        {
+            oss << OPERATION_NAMES[i] << " (ns): " << latencies[i].ToString()
+                << std::endl;
+        }
+    }
+    return oss.str();
+}
+
+void SimhashTableStats::Encode(std::vector<uint64_t> &values) const
+{
+    values.push_back(inserts);
+    values.push_back(removes);
+    values.push_back(duplicatesRemoved);
+    values.push_back(levels.size());
+    for (uint_t i = 0; i < levels.size(); ++i)
+    {
+        values.push_back(levels[i].bucketsProbed);
+        values.push_back(levels[i].filterRejects);
+        values.push_back(levels[i].candidatesCompared);
+        values.push_back(levels[i].matches);
+    }
+    for (uint_t i = 0; i < SIMHASH_OP_NUM; ++i)
+    {
+        latencies[i].Encode(values);
+    }
+}
+
+bool SimhashTableStats::Decode(const std::vector<uint64_t> &values)
+{
+    if (values.size() < 4U || values[3] > (values.size() - 4U) / 4U)
+    {
+        return false;
+    }
+    inserts += values[0];
+    removes += values[1];
+    duplicatesRemoved += values[2];
+    const size_t levelNum = static_cast<size_t>(values[3]);
+    if (levels.size() < levelNum)
+    {
+        levels.resize(levelNum);
+    }
+    size_t pos = 4U;
+    for (size_t i = 0; i < levelNum; ++i, pos += 4U)
+    {
+        levels[i].bucketsProbed += values[pos];
+        levels[i].filterRejects += values[pos + 1U];
+        levels[i].candidatesCompared += values[pos + 2U];
+        levels[i].matches += values[pos + 3U];
+    }
+    for (uint_t i = 0; i < SIMHASH_OP_NUM; ++i)
+    {
+        if (!latencies[i].Decode(values, pos))
+        {
+            return false;
+        }
+    }
+    return pos == values.size();
+}
+
+SimhashBucketReport::SimhashBucketReport()
+    : containerNum( 0UL )
+    , bucketNum(    0UL )
+    , elementNum(   0UL )
+    , largestBucket(0UL )
+{}
+
+void SimhashBucketReport::AddBucket(uint64_t size)
+{
+    if (!size)
+    {
+        return;
+    }
+    const uint_t log = LatencyHistogram::VALUE_BITS - 1U
+        - static_cast<uint_t>(__builtin_clzll(size));
+    if (sizeDistribution.size() <= log)
+    {
+        sizeDistribution.resize(log + 1U, 0UL);
+    }
+    ++sizeDistribution[log];
+    ++bucketNum;
+    elementNum += size;
+    largestBucket = std::max(largestBucket, size);
+}
+
+std::string SimhashBucketReport::ToString() const
+{
+    std::ostringstream oss;
+    oss << "containers=" << containerNum << " buckets=" << bucketNum
+        << " elements=" << elementNum << " largestBucket=" << largestBucket
+        << std::endl;
+    for (uint_t i = 0; i < sizeDistribution.size(); ++i)
+    {
+        if (sizeDistribution[i])
+        {
+            oss << "[" << (1UL << i) << ", " << (1UL << (i + 1U))
+                << "): " << sizeDistribution[i] << std::endl;
+        }
+    }
+    return oss.str();
+}
+
+void SimhashBucketReport::Encode(std::vector<uint64_t> &values) const
+{
+    values.push_back(containerNum);
+    values.push_back(bucketNum);
+    values.push_back(elementNum);
+    values.push_back(largestBucket);
+    values.insert(values.end(), sizeDistribution.begin(),
+        sizeDistribution.end());
+}
+
+bool SimhashBucketReport::Decode(const std::vector<uint64_t> &values)
+{
+    if (values.size() < 4U || values.size() - 4U > LatencyHistogram::VALUE_BITS)
+    {
+        return false;
+    }
+    containerNum += values[0];
+    bucketNum += values[1];
+    elementNum += values[2];
+    largestBucket = std::max(largestBucket, values[3]);
+    if (sizeDistribution.size() < values.size() - 4U)
+    {
+        sizeDistribution.resize(values.size() - 4U, 0UL);
+    }
+    for (size_t i = 4U; i < values.size(); ++i)
+    {
+        sizeDistribution[i - 4U] += values[i];
+    }
+    return true;
+}
+
+SimhashContainerMemory::SimhashContainerMemory()
+    : level(        0U  )
+    , elementNum(   0UL )
+    , nodeBytes(    0UL )
+    , filterBytes(  0UL )
+    , overheadBytes(0UL )
+{}
+
+uint64_t SimhashContainerMemory::GetTotalBytes() const
+{
+    return nodeBytes + filterBytes + overheadBytes;
+}
+
+void SimhashMemoryUsage::AddContainer(const SimhashContainerMemory &container)
+{
+    containers.push_back(container);
+    if (levels.size() <= container.level)
+    {
+        levels.resize(container.level + 1U);
+    }
+    SimhashContainerMemory &level = levels[container.level];
+    level.level = container.level;
+    level.elementNum += container.elementNum;
+    level.nodeBytes += container.nodeBytes;
+    level.filterBytes += container.filterBytes;
+    level.overheadBytes += container.overheadBytes;
+}
+
+uint64_t SimhashMemoryUsage::GetTotalBytes() const
+{
+    uint64_t total = 0UL;
+    for (uint_t i = 0; i < levels.size(); ++i)
+    {
+        total += levels[i].GetTotalBytes();
+    }
+    return total;
+}
+
+void SimhashMemoryUsage::Encode(std::vector<uint64_t> &values) const
+{
+    for (std::vector<SimhashContainerMemory>::const_iterator it
+        = containers.begin(); containers.end() != it; ++it)
+    {
+        values.push_back(it->level);
+        values.push_back(it->elementNum);
+        values.push_back(it->nodeBytes);
+        values.push_back(it->filterBytes);
+        values.push_back(it->overheadBytes);
+    }
+}
+
+bool SimhashMemoryUsage::Decode(const std::vector<uint64_t> &values)
+{
+    if (values.size() % 5U)
+    {
+        return false;
+    }
+    SimhashContainerMemory container;
+    for (size_t i = 0; i < values.size(); i += 5U)
+    {
+        //The level indexes the levels, a bad one would blow them up.
+        if (values[i] > LatencyHistogram::VALUE_BITS)
+        {
+            return false;
+        }
+        container.level = static_cast<uint_t>(values[i]);
+        container.elementNum = values[i + 1U];
+        container.nodeBytes = values[i + 2U];
+        container.filterBytes = values[i + 3U];
+        container.overheadBytes = values[i + 4U];
+        AddContainer(container);
+    }
+    return true;
+}
+
+std::string SimhashMemoryUsage::ToString() const
+{
+    std::ostringstream oss;
+    oss << "containers=" << containers.size() << " totalBytes="
+        << GetTotalBytes() << std::endl;
+    for (uint_t i = static_cast<uint_t>(levels.size()); i > 0; --i)
+    {
+        const SimhashContainerMemory &level = levels[i - 1U];
+        oss << "level " << i - 1U << ": elements=" << level.elementNum
+            << " nodeBytes=" << level.nodeBytes
+            << " filterBytes=" << level.filterBytes
+            << " overheadBytes=" << level.overheadBytes << std::endl;
+    }
+    return oss.str();
+}
+
+} // namespace simhash
@@ -1,20 +1,169 @@
 #include "simhash_table.h"
+#include "simhash_tenant_table.h"
 
 #include <map>
 #include <set>
 #include <algorithm>
+#include <cmath>
 #include <cstdio>
-#include <fstream>
+#include <stdexcept>
+#include <cerrno>
+
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
 
 #include "simhash.h"
+#include "bloom_filter.h"
+#include "bit_sliced_bucket.h"
+#include "slab_arena.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+
+/*
+* SIMHASH_STATS_TIMER records the latency of the current scope into the
+* histogram of operation op of the table.
+*/
+#ifdef SIMHASH_ENABLE_STATS
+#define SIMHASH_STATS_TIMER(op) \
+    ScopedLatencyTimer statsTimer(mStats.latencies[op])
+#else
+#define SIMHASH_STATS_TIMER(op) do {} while (false)
+#endif
 
 namespace simhash
 {
+/*
+* The chunk size of glibc malloc for a request of bytes, which has 8 bytes of
+* header, and is aligned to 16 bytes with a minimum of 32 bytes.
+*/
+static inline uint64_t GetMallocChunkBytes(uint64_t bytes)
+{
+    return std::max(static_cast<uint64_t>(32UL), (bytes + 8UL + 15UL)
+        & ~static_cast<uint64_t>(15UL));
+}
+
+/* The bytes of a std::set node: the color, 3 pointers and the value. */
+template <typename HashT>
+static inline uint64_t GetSetNodeBytes()
+{
+    return GetMallocChunkBytes(4UL * sizeof(void*) + sizeof(HashT));
+}
+static const uint64_t SET_NODE_BYTES = GetSetNodeBytes<hash_t>();
+/* The bytes of a std::set node in a SlabArena, which has no malloc header. */
+static const uint64_t ARENA_NODE_BYTES = 4UL * sizeof(void*) + sizeof(hash_t);
+
+/*
+ * class SimhashContainerVisitor
+ */
+template <typename HashT>
+class SimhashContainerVisitor
+{
+public :
+    virtual ~SimhashContainerVisitor() {}
+    virtual void Visit(HashT hash) = 0;
+};
+
+/*
+ * class SimhashRangeVisitor
+ * SimhashRangeVisitor passes the visited values in [lower, upper] to another
+ * visitor.
+ */
+template <typename HashT>
+class SimhashRangeVisitor : public SimhashContainerVisitor<HashT>
+{
+public :
+    SimhashRangeVisitor(HashT lower, HashT upper,
+        SimhashContainerVisitor<HashT> &visitor)
+        : mLower(lower)
+        , mUpper(upper)
+        , mVisitor(visitor)
+    {}
+    virtual void Visit(HashT hash)
+    {
+        if (!(hash < mLower) && !(mUpper < hash))
+        {
+            mVisitor.Visit(hash);
+        }
+    }
+private :
+    HashT mLower;
+    HashT mUpper;
+    SimhashContainerVisitor<HashT> &mVisitor;
+};
+
+/*
+* class SimhashValueCollector
+* SimhashValueCollector collects the visited simhash values.
+*/
+template <typename HashT>
+class SimhashValueCollector : public SimhashContainerVisitor<HashT>
+{
+public :
+    explicit SimhashValueCollector(std::vector<HashT> &values)
+        : mValues(values)
+    {}
+    virtual void Visit(HashT hash)
+    {
+        mValues.push_back(hash);
+    }
+private :
+    std::vector<HashT> &mValues;
+};
+
+/*
+* class SimhashBucketCounter
+* SimhashBucketCounter counts the sorted visited values into the buckets of
+* keyMask, a bucket is added to report when the next one starts, and the last
+* one by Finish.
+*/
+template <typename HashT>
+class SimhashBucketCounter : public SimhashContainerVisitor<HashT>
+{
+public :
+    SimhashBucketCounter(HashT keyMask, SimhashBucketReport &report)
+        : mKeyMask(keyMask)
+        , mKey(0U)
+        , mSize(0UL)
+        , mReport(report)
+    {}
+    virtual void Visit(HashT hash)
+    {
+        if (mSize && (hash & mKeyMask) == mKey)
+        {
+            ++mSize;
+            return;
+        }
+        mReport.AddBucket(mSize);
+        mKey = hash & mKeyMask;
+        mSize = 1UL;
+    }
+    void Finish()
+    {
+        mReport.AddBucket(mSize);
+    }
+private :
+    HashT mKeyMask;
+    HashT mKey;
+    uint64_t mSize;
+    SimhashBucketReport &mReport;
+};
+
 /*
  * class SimhashContainer
  */
+template <typename HashT>
 class SimhashContainer
 {
+public :
+    typedef std::vector<HashT> AnswerType;
+    static const uint_t WIDTH = HashTraits<HashT>::WIDTH;
+    static const uint_t TABLE_RADIUS = ~0U;
 public :
     virtual ~SimhashContainer();
 protected :
@@ -22,69 +171,330 @@ protected :
     SimhashContainer(const SimhashContainer &another);
     SimhashContainer& operator= (const SimhashContainer &another);
 public :
-    virtual bool Insert         (hash_t hash)                       = 0;
-    virtual bool Remove         (hash_t hash)                       = 0;
-    virtual bool Search         (hash_t hash)                       = 0;
-    virtual bool HasNearDups    (hash_t hash, hash_t mask = 0UL)    = 0;
-    virtual bool FindFirstNearDup(hash_t hash, hash_t &nearDup,
-        hash_t mask = 0UL)      = 0;
-    virtual bool FindNearDups   (hash_t hash, FindAnswerType &ans,
-        hash_t mask = 0UL)      = 0;
+    virtual bool Insert         (HashT hash)                       = 0;
+    virtual bool Remove         (HashT hash)                       = 0;
+    /*
+    * Replaces oldHash by newHash, returns false and changes nothing if
+    * oldHash is not in, or newHash is.
+    */
+    virtual bool Update         (HashT oldHash, HashT newHash);
+    virtual bool Search         (HashT hash)                       = 0;
+    /*
+    * The queries find the values within hamDist bits, which equal hash on
+    * the bits of mask. hamDist is at most mMaxHamDist, TABLE_RADIUS is
+    * mMaxHamDist.
+    */
+    virtual bool HasNearDups    (HashT hash, HashT mask = HashT(0U),
+        uint_t hamDist = TABLE_RADIUS)  = 0;
+    virtual bool FindFirstNearDup(HashT hash, HashT &nearDup,
+        HashT mask = HashT(0U), uint_t hamDist = TABLE_RADIUS) = 0;
+    virtual bool FindNearDups   (HashT hash, AnswerType &ans,
+        HashT mask = HashT(0U), uint_t hamDist = TABLE_RADIUS) = 0;
+    /* Finds for each hash, the containers may interleave the lookups. */
+    virtual void FindNearDupsBatch(const std::vector<HashT> &hashes,
+        HashT mask, std::vector<AnswerType> &answers, uint_t depth);
+    /*
+    * Calls back each pair of a query and a value within mMaxHamDist bits
+    * once, returns false if the container can't join, see
+    * SimhashIndexedContainer::Join.
+    */
+    virtual bool Join(const std::vector<HashT> &queries,
+        BasicSimhashJoinCallback<HashT> &callback, uint_t threadNum);
     virtual void    Clear()     = 0;
     virtual uint_t  GetSize()   = 0;
-    virtual bool SaveToFile(const std::string &filename, bool binary) = 0;
+    /* Visits all simhash values in ascending order. */
+    virtual void Traverse(SimhashContainerVisitor<HashT> &visitor) = 0;
+    /* Visits the simhash values in [lower, upper] in ascending order. */
+    virtual void TraverseRange(HashT lower, HashT upper,
+        SimhashContainerVisitor<HashT> &visitor);
+    /* Adds the buckets of all leaf containers into report. */
+    virtual void GetBucketReport(SimhashBucketReport &report) = 0;
+    /* Sets the statistics to be updated, can be NULL. */
+    virtual void SetStats(SimhashTableStats *stats);
+    /* Adds this container and all its sub-containers into usage. */
+    virtual void GetMemoryUsage(SimhashMemoryUsage &usage) = 0;
+    /*
+    * Freezes the leaf containers, see SimhashFrozenContainer. Returns the
+    * frozen container to replace this one, or an empty pointer if this one
+    * is kept.
+    */
+    virtual std::tr1::shared_ptr<SimhashContainer> Freeze();
 protected:
     uint_t mMaxHamDist;
     uint_t mLevel;
+    SimhashTableStats *mStats;
 };
-typedef std::tr1::shared_ptr<SimhashContainer> SimhashContainerPtr;
 
 /*
 * class SimhashContainerFactory
 */
+template <typename HashT>
 class SimhashContainerFactory
 {
 public:
-    static SimhashContainerPtr CreateSimhashContainer(uint_t maxHamDist,
-        uint_t level, uint_t maskBeginPos = 0U, uint_t maskEndPos = HASH_WIDTH);
+    typedef std::tr1::shared_ptr<SimhashContainer<HashT> > ContainerPtr;
+    static ContainerPtr CreateSimhashContainer(
+        const SimhashTableOptions &options, uint_t level,
+        uint_t maskBeginPos = 0U,
+        uint_t maskEndPos = SimhashContainer<HashT>::WIDTH);
 };
 
 
 /*
 * class SimhashSequentialContainner
+* The values are kept in a set, a bucket is a range of values with the same
+* key (the bits fixed by the parent containers). A hot bucket, see
+* SimhashTableOptions::hotBucketSize, is moved into an indexed container of
+* the bits below the key, and a large bucket, see
+* SimhashTableOptions::bitSliceSize, is mirrored in a BitSlicedBucket to be
+* scanned, the set is still used for the other operations. Both are done by
+* Insert and Remove when a bucket crosses the size, so a query never writes
+* the container. The size of a bucket with at least TRACKED_BUCKET_SIZE values
+* is kept in mBucketSizes, a smaller one is counted by walking the set. With
+* SimhashTableOptions::useNodeArena, the nodes of the set come from mArena.
 */
-class SimhashSequentialContainner : public SimhashContainer
+template <typename HashT>
+class SimhashSequentialContainner : public SimhashContainer<HashT>
 {
 public:
-    typedef std::set<hash_t> ContainerType;
+    typedef std::set<HashT, std::less<HashT>, SlabAllocator<HashT> >
+        ContainerType;
+    typedef typename SimhashContainer<HashT>::AnswerType AnswerType;
+    typedef typename SimhashContainerFactory<HashT>::ContainerPtr
+        SimhashContainerPtr;
+    typedef std::map<HashT, SimhashContainerPtr> HotBucketsType;
+    typedef std::map<HashT, BitSlicedBucket<HashT> > SlicedBucketsType;
+    typedef std::map<HashT, uint_t> BucketSizesType;
+    static const uint_t TRACKED_BUCKET_SIZE = 16U;
+protected:
+    /* This visitor moves the values of a sub-index back to the set. */
+    class BucketMerger : public SimhashContainerVisitor<HashT>
+    {
+    public :
+        explicit BucketMerger(ContainerType &container)
+            : mContainer(container)
+        {}
+        virtual void Visit(HashT hash)
+        {
+            mContainer.insert(mContainer.end(), hash);
+        }
+    private :
+        ContainerType &mContainer;
+    };
 public:
     virtual ~SimhashSequentialContainner();
 protected :
-    SimhashSequentialContainner(uint_t maxHamDist, uint_t level);
+    SimhashSequentialContainner(const SimhashTableOptions &options,
+        uint_t level, uint_t maskEndPos);
     SimhashSequentialContainner(const SimhashSequentialContainner &another);
     SimhashSequentialContainner& operator= (const SimhashSequentialContainner
         &another);
 public:
-    virtual bool Insert         (hash_t hash);
-    virtual bool Remove         (hash_t hash);
-    virtual bool Search         (hash_t hash);
-    virtual bool HasNearDups    (hash_t hash, hash_t mask = 0UL);
-    virtual bool FindFirstNearDup(hash_t hash, hash_t &nearDup,
-        hash_t mask = 0UL);
-    virtual bool FindNearDups   (hash_t hash, FindAnswerType &ans,
-        hash_t mask = 0UL);
+    virtual bool Insert         (HashT hash);
+    virtual bool Remove         (HashT hash);
+    virtual bool Update         (HashT oldHash, HashT newHash);
+    virtual bool Search         (HashT hash);
+    virtual bool HasNearDups    (HashT hash, HashT mask = HashT(0U),
+        uint_t hamDist = TABLE_RADIUS);
+    virtual bool FindFirstNearDup(HashT hash, HashT &nearDup,
+        HashT mask = HashT(0U), uint_t hamDist = TABLE_RADIUS);
+    virtual bool FindNearDups   (HashT hash, AnswerType &ans,
+        HashT mask = HashT(0U), uint_t hamDist = TABLE_RADIUS);
     virtual void    Clear();
     virtual uint_t  GetSize();
-    virtual bool SaveToFile(const std::string &filename, bool binary);
+    virtual void Traverse(SimhashContainerVisitor<HashT> &visitor);
+    virtual void TraverseRange(HashT lower, HashT upper,
+        SimhashContainerVisitor<HashT> &visitor);
+    virtual void GetBucketReport(SimhashBucketReport &report);
+    virtual void SetStats(SimhashTableStats *stats);
+    virtual void GetMemoryUsage(SimhashMemoryUsage &usage);
+    virtual SimhashContainerPtr Freeze();
+protected:
+    /* Counts the value at it into its bucket, returns the bucket size. */
+    uint_t GrowBucket(HashT key, typename ContainerType::iterator it);
+    /* Counts a value removed from the bucket of key out of it. */
+    void ShrinkBucket(HashT key);
+    /* Splits or mirrors the bucket of key when it has grown to size. */
+    void CheckBucket(HashT key, uint_t size);
+    /* Moves the bucket of key into a sub-index, if that splits it. */
+    bool SplitBucket(HashT key);
+    /* Moves the values of a sub-index back to the set. */
+    void MergeBucket(typename HotBucketsType::iterator it);
+    /* Scans the bucket of hash, by its bit-sliced mirror if there is. */
+    void ScanBucket(HashT hash, HashT mask, uint_t hamDist, bool firstOnly,
+        AnswerType &ans);
 protected:
+    using SimhashContainer<HashT>::mMaxHamDist;
+    using SimhashContainer<HashT>::mLevel;
+    using SimhashContainer<HashT>::mStats;
+    using SimhashContainer<HashT>::TABLE_RADIUS;
+    SlabArena mArena;               // The nodes of mContainer, if used.
     ContainerType mContainer;
-    friend class SimhashContainerFactory;
+    HashT mKeyMask;    // The bits fixed by the parent containers.
+    uint_t mMaskEndPos;
+    uint_t mHotBucketSize;
+    SimhashTableOptions mSubOptions;    // The options of sub-indexes.
+    HotBucketsType mHotBuckets;         // The sub-indexes by bucket keys.
+    std::set<HashT> mColdKeys;          // The buckets which can't be split.
+    uint_t mBitSliceSize;
+    SlicedBucketsType mSlicedBuckets;   // The mirrors by bucket keys.
+    BucketSizesType mBucketSizes;       // The sizes of large buckets.
+    friend class SimhashContainerFactory<HashT>;
+};
+
+/*
+* class SimhashSortedContainer
+* The values are kept in a sorted array, with the values inserted since the
+* last merge in mInserted, and the values removed from the array since then
+* in mRemoved. They are merged into the array when they exceed 1/16 of it, so
+* an insert copies 16 values in average. A bucket is a range of the array and
+* a range of mInserted.
+*/
+template <typename HashT>
+class SimhashSortedContainer : public SimhashContainer<HashT>
+{
+public:
+    typedef std::vector<HashT> ArrayType;
+    typedef std::set<HashT> DeltaType;
+    typedef typename SimhashContainer<HashT>::AnswerType AnswerType;
+public:
+    virtual ~SimhashSortedContainer();
+protected :
+    SimhashSortedContainer(const SimhashTableOptions &options, uint_t level,
+        uint_t maskEndPos);
+    SimhashSortedContainer(const SimhashSortedContainer &another);
+    SimhashSortedContainer& operator= (const SimhashSortedContainer
+        &another);
+public:
+    virtual bool Insert         (HashT hash);
+    virtual bool Remove         (HashT hash);
+    virtual bool Search         (HashT hash);
+    virtual bool HasNearDups    (HashT hash, HashT mask = HashT(0U),
+        uint_t hamDist = TABLE_RADIUS);
+    virtual bool FindFirstNearDup(HashT hash, HashT &nearDup,
+        HashT mask = HashT(0U), uint_t hamDist = TABLE_RADIUS);
+    virtual bool FindNearDups   (HashT hash, AnswerType &ans,
+        HashT mask = HashT(0U), uint_t hamDist = TABLE_RADIUS);
+    virtual void FindNearDupsBatch(const std::vector<HashT> &hashes,
+        HashT mask, std::vector<AnswerType> &answers, uint_t depth);
+    virtual void    Clear();
+    virtual uint_t  GetSize();
+    virtual void Traverse(SimhashContainerVisitor<HashT> &visitor);
+    virtual void TraverseRange(HashT lower, HashT upper,
+        SimhashContainerVisitor<HashT> &visitor);
+    virtual void GetBucketReport(SimhashBucketReport &report);
+    virtual void GetMemoryUsage(SimhashMemoryUsage &usage);
+    virtual std::tr1::shared_ptr<SimhashContainer<HashT> > Freeze();
+protected:
+    /* Returns whether hash is in the array, and not removed. */
+    inline bool InArray(HashT hash)
+    {
+        return std::binary_search(mArray.begin(), mArray.end(), hash)
+            && (mRemoved.empty() || !mRemoved.count(hash));
+    }
+    /* Merges mInserted and mRemoved into the array when they are large. */
+    void MergeDelta(bool force);
+    /*
+    * Scans the bucket of hash from lower, the first value of the array not
+    * less than the bucket, appends the values within hamDist into ans.
+    */
+    void ScanBucket(HashT hash, HashT mask, uint_t hamDist,
+        typename ArrayType::const_iterator lower, bool firstOnly,
+        AnswerType &ans);
+protected:
+    using SimhashContainer<HashT>::mMaxHamDist;
+    using SimhashContainer<HashT>::mLevel;
+    using SimhashContainer<HashT>::mStats;
+    using SimhashContainer<HashT>::TABLE_RADIUS;
+    ArrayType mArray;
+    DeltaType mInserted;
+    DeltaType mRemoved;
+    HashT mKeyMask;    // The bits fixed by the parent containers.
+    friend class SimhashContainerFactory<HashT>;
+};
+
+/*
+* class SimhashFrozenContainer
+* The read-only leaf of a frozen table, see SimhashTable::Freeze. The values
+* are kept in a sorted array, as in SimhashSortedContainer, and a static
+* search tree over the array finds the first value of a bucket. A node of the
+* tree is NODE_KEYS keys, the last values of its NODE_KEYS children, a node
+* of the lowest level covers NODE_KEYS values of the array. The levels are
+* kept from the root down in one array, and the nodes are aligned to the
+* cache lines, so a lookup reads one node, a cache line of hash_t, at each
+* level, i.e. log(N) / log(NODE_KEYS) of them instead of log(N) in a binary
+* search, and the top levels are shared by all lookups and stay cached. The
+* keys of a node are compared with the query at once by SIMD, where it's
+* built with AVX2 or SSE4.2.
+*/
+template <typename HashT>
+class SimhashFrozenContainer : public SimhashContainer<HashT>
+{
+public:
+    typedef std::vector<HashT> ArrayType;
+    typedef typename SimhashContainer<HashT>::AnswerType AnswerType;
+    static const size_t NODE_KEYS = 8U;
+public:
+    SimhashFrozenContainer(uint_t maxHamDist, HashT keyMask,
+        SimhashContainer<HashT> &source);
+    virtual ~SimhashFrozenContainer();
+private :
+    SimhashFrozenContainer(const SimhashFrozenContainer &another);
+    SimhashFrozenContainer& operator= (const SimhashFrozenContainer
+        &another);
+public:
+    virtual bool Insert         (HashT hash);
+    virtual bool Remove         (HashT hash);
+    virtual bool Update         (HashT oldHash, HashT newHash);
+    virtual bool Search         (HashT hash);
+    virtual bool HasNearDups    (HashT hash, HashT mask = HashT(0U),
+        uint_t hamDist = TABLE_RADIUS);
+    virtual bool FindFirstNearDup(HashT hash, HashT &nearDup,
+        HashT mask = HashT(0U), uint_t hamDist = TABLE_RADIUS);
+    virtual bool FindNearDups   (HashT hash, AnswerType &ans,
+        HashT mask = HashT(0U), uint_t hamDist = TABLE_RADIUS);
+    virtual void FindNearDupsBatch(const std::vector<HashT> &hashes,
+        HashT mask, std::vector<AnswerType> &answers, uint_t depth);
+    virtual void    Clear();
+    virtual uint_t  GetSize();
+    virtual void Traverse(SimhashContainerVisitor<HashT> &visitor);
+    virtual void TraverseRange(HashT lower, HashT upper,
+        SimhashContainerVisitor<HashT> &visitor);
+    virtual void GetBucketReport(SimhashBucketReport &report);
+    virtual void GetMemoryUsage(SimhashMemoryUsage &usage);
+protected:
+    /* Fills buff with num max values and more, returns the aligned first. */
+    HashT* AlignBuffer(ArrayType &buff, size_t num);
+    /* Builds the levels of the tree over the array. */
+    void BuildTree();
+    /* Returns the index of the first value of the array not less than key. */
+    size_t LowerBound(HashT key) const;
+    /*
+    * Scans the bucket of hash from lower, the first value of the array not
+    * less than the bucket, appends the values within hamDist into ans.
+    */
+    void ScanBucket(HashT hash, HashT mask, uint_t hamDist, size_t lower,
+        bool firstOnly, AnswerType &ans);
+protected:
+    using SimhashContainer<HashT>::mMaxHamDist;
+    using SimhashContainer<HashT>::mLevel;
+    using SimhashContainer<HashT>::mStats;
+    using SimhashContainer<HashT>::TABLE_RADIUS;
+    ArrayType mValueBuff;       // The storage of the values.
+    const HashT *mValues;       // The sorted values, aligned in mValueBuff.
+    size_t mSize;
+    ArrayType mTreeBuff;        // The storage of the tree.
+    const HashT *mTree;         // The levels of the tree, from the root.
+    std::vector<size_t> mLevelBegins;   // The first key of each level.
+    std::vector<size_t> mLevelSizes;    // The keys of each level, no pads.
+    HashT mKeyMask;             // The bits fixed by the parent containers.
 };
 
 /*
 * class SimhashIndexedContainer
 */
-class SimhashIndexedContainer : public SimhashContainer
+template <typename HashT>
+class SimhashIndexedContainer : public SimhashContainer<HashT>
 {
 protected:
     /*
@@ -104,47 +514,143 @@ protected:
     *          0 | 000 | 11 | 0000 | 00000
     *     surroundMask         =
     *          1 | 00 | 000 | 1111 | 11111
+    *     keyMask              =
+    *          1 | 111 | 00 | 0000 | 00000
     *     leftWidth            = 2
     *     rightWidth           = 3
+    * Where keyMask covers the bits fixed by the parent containers and the
+    * block moved to the front, it is the key of the prefilter.
     */
     typedef struct _SingleContainerProps
     {
-        hash_t leftForwardMask;
-        hash_t rightForwardMask;
-        hash_t leftBackwardMask;
-        hash_t rightBackwardMask;   //also the index mask
-        hash_t surroundMask;
+        HashT leftForwardMask;
+        HashT rightForwardMask;
+        HashT leftBackwardMask;
+        HashT rightBackwardMask;   //also the index mask
+        HashT surroundMask;
+        HashT keyMask;
         uint_t leftWidth;
         uint_t rightWidth;
     } SingleContainerProps;
+    /* This visitor adds keys of the visited simhash values to prefilters. */
+    class FilterBuilder : public SimhashContainerVisitor<HashT>
+    {
+    public :
+        explicit FilterBuilder(SimhashIndexedContainer &owner)
+            : mOwner(owner)
+        {}
+        virtual void Visit(HashT hash)
+        {
+            mOwner.AddFilterKeys(hash);
+        }
+    private :
+        SimhashIndexedContainer &mOwner;
+    };
+    /* A match of a join, in the order of bits of the container. */
+    struct JoinMatch
+    {
+        HashT query;
+        HashT match;
+        uint_t distance;
+    };
+    /* The arguments shared by the threads of a join. */
+    struct JoinContext
+    {
+        SimhashIndexedContainer *owner;
+        const std::vector<HashT> *queries;
+        BasicSimhashJoinCallback<HashT> *callback;
+        pthread_mutex_t mutex;          // Serializes the callback.
+        volatile uint_t next;           // The next block to be joined.
+    };
+    /*
+    * This visitor merges the values of the permuted container of a block
+    * with the queries permuted and sorted the same way, the ones with the
+    * same key are compared.
+    */
+    class BlockJoiner : public SimhashContainerVisitor<HashT>
+    {
+    public :
+        BlockJoiner(JoinContext &context, uint_t block,
+            const std::vector<HashT> &permutes);
+        virtual void Visit(HashT hash);
+        /* Calls back the buffered matches. */
+        void Flush();
+    private :
+        /* The matches buffered before they are called back. */
+        static const size_t FLUSH_SIZE = 4096U;
+        JoinContext &mContext;
+        SimhashIndexedContainer &mOwner;
+        uint_t mBlock;
+        const std::vector<HashT> &mPermutes;
+        size_t mNext;                   // The first query of the key.
+        std::vector<JoinMatch> mMatches;
+    };
 public:
+    typedef typename SimhashContainerFactory<HashT>::ContainerPtr
+        SimhashContainerPtr;
     typedef std::vector<SimhashContainerPtr> ContainerType;
     typedef std::vector<SingleContainerProps> PropsType;
+    typedef std::vector<BlockedBloomFilter> FiltersType;
+    typedef typename SimhashContainer<HashT>::AnswerType AnswerType;
 public:
     virtual ~SimhashIndexedContainer();
 protected:
-    SimhashIndexedContainer(uint_t maxHamDist, uint_t level,
+    SimhashIndexedContainer(const SimhashTableOptions &options, uint_t level,
         uint_t maskBeginPos, uint_t maskEndPos);
     SimhashIndexedContainer(const SimhashIndexedContainer &another);
     SimhashIndexedContainer& operator= (const SimhashIndexedContainer
         &another);
 public:
-    virtual bool Insert         (hash_t hash);
-    virtual bool Remove         (hash_t hash);
-    virtual bool Search         (hash_t hash);
-    virtual bool HasNearDups    (hash_t hash, hash_t mask = 0UL);
-    virtual bool FindFirstNearDup(hash_t hash, hash_t &nearDup,
-        hash_t mask = 0UL);
-    virtual bool FindNearDups   (hash_t hash, FindAnswerType &ans,
-        hash_t mask = 0UL);
+    virtual bool Insert         (HashT hash);
+    virtual bool Remove         (HashT hash);
+    virtual bool Update         (HashT oldHash, HashT newHash);
+    virtual bool Search         (HashT hash);
+    virtual bool HasNearDups    (HashT hash, HashT mask = HashT(0U),
+        uint_t hamDist = TABLE_RADIUS);
+    virtual bool FindFirstNearDup(HashT hash, HashT &nearDup,
+        HashT mask = HashT(0U), uint_t hamDist = TABLE_RADIUS);
+    virtual bool FindNearDups   (HashT hash, AnswerType &ans,
+        HashT mask = HashT(0U), uint_t hamDist = TABLE_RADIUS);
+    virtual void FindNearDupsBatch(const std::vector<HashT> &hashes,
+        HashT mask, std::vector<AnswerType> &answers, uint_t depth);
+    virtual bool Join(const std::vector<HashT> &queries,
+        BasicSimhashJoinCallback<HashT> &callback, uint_t threadNum);
     virtual void    Clear();
     virtual uint_t  GetSize();
-    virtual bool SaveToFile(const std::string &filename, bool binary);
+    virtual void Traverse(SimhashContainerVisitor<HashT> &visitor);
+    virtual void TraverseRange(HashT lower, HashT upper,
+        SimhashContainerVisitor<HashT> &visitor);
+    virtual void GetBucketReport(SimhashBucketReport &report);
+    virtual void SetStats(SimhashTableStats *stats);
+    virtual void GetMemoryUsage(SimhashMemoryUsage &usage);
+    virtual SimhashContainerPtr Freeze();
 protected:
-    bool Init();
-    void GetForwardPermutes(hash_t hash, std::vector<hash_t> &ans);
+    bool Init(const SimhashTableOptions &options);
+    /* Joins the queries of context with the permuted container of block. */
+    void JoinBlock(JoinContext &context, uint_t block);
+    /* The thread of Join, it joins the blocks until none is left. */
+    static void* RunJoin(void *arg);
+    /* Chooses the block widths, from the highest block to the lowest. */
+    void GetBlockWidths(const std::vector<real_t> &entropies,
+        std::vector<uint_t> &widths);
+    void GetForwardPermutes(HashT hash, std::vector<HashT> &ans);
+    void RebuildFilters(uint_t capacity);
+    void AddFilterKeys(HashT hash);
+
+    /* Returns false if the permuted container i surely has no candidate. */
+    inline bool MayContain(uint_t i, HashT permute)
+    {
+        if (mFilters.empty()
+            || mFilters[i].MayContain(FoldHash(permute & mProps[i].keyMask)))
+        {
+            SIMHASH_STATS(if (mStats) ++mStats->levels[mLevel].bucketsProbed);
+            return true;
+        }
+        SIMHASH_STATS(if (mStats) ++mStats->levels[mLevel].filterRejects);
+        return false;
+    }
 
-    inline hash_t ForwardPermute(hash_t hash, const SingleContainerProps &props)
+    inline HashT ForwardPermute(HashT hash, const SingleContainerProps &props)
     {
         //Generate forward permutes.
         /*
@@ -166,7 +672,7 @@ protected:
             | ((hash & props.rightForwardMask) << props.leftWidth)
             | (hash & props.surroundMask);
     }
-    inline hash_t BackwardPermute(hash_t hash, const SingleContainerProps 
+    inline HashT BackwardPermute(HashT hash, const SingleContainerProps 
         &props)
     {
         //Generate forward permutes.
@@ -190,6 +696,10 @@ protected:
             | (hash & props.surroundMask);
     }
 protected:
+    using SimhashContainer<HashT>::mMaxHamDist;
+    using SimhashContainer<HashT>::mLevel;
+    using SimhashContainer<HashT>::mStats;
+    using SimhashContainer<HashT>::TABLE_RADIUS;
     uint_t mBlockNum;           // The number of blocks, equals mMaxHammDist + 1
     ContainerType  mContainer;  // The containers.
     PropsType mProps;           // The property for each single container
@@ -201,477 +711,3484 @@ protected:
     */
     uint_t mMaskBeginPos;
     uint_t mMaskEndPos;
+    /*
+    * The prefilters, one for each permuted container, empty if not used. The
+    * filters are rebuilt from the front container when the keys exceed
+    * mFilterCapacity, or too many keys are removed.
+    */
+    FiltersType mFilters;
+    uint_t mFilterBitsPerKey;
+    uint_t mFilterCapacity;     // The number of keys the filters sized for.
+    uint_t mFilterKeys;         // The number of keys added since rebuilt.
+    uint_t mFilterStale;        // The number of keys removed since rebuilt.
 
-    friend class SimhashContainerFactory;
+    friend class SimhashContainerFactory<HashT>;
 };
 
-SimhashContainer::SimhashContainer(uint_t maxHamDist, uint_t level)
+template <typename HashT>
+SimhashContainer<HashT>::SimhashContainer(uint_t maxHamDist, uint_t level)
     : mMaxHamDist(maxHamDist)
     , mLevel(level)
+    , mStats(NULL)
 {}
 
-SimhashContainer::~SimhashContainer()
-{}
-
-SimhashSequentialContainner::SimhashSequentialContainner(uint_t maxHamDist,
-    uint_t level)
-    : SimhashContainer(maxHamDist, level)
+template <typename HashT>
+SimhashContainer<HashT>::~SimhashContainer()
 {}
 
-SimhashSequentialContainner::~SimhashSequentialContainner()
-{}
-
-void SimhashSequentialContainner::Clear()
+template <typename HashT>
+void SimhashContainer<HashT>::SetStats(SimhashTableStats *stats)
 {
-    mContainer.clear();
+    mStats = stats;
 }
 
-uint_t SimhashSequentialContainner::GetSize()
+template <typename HashT>
+bool SimhashContainer<HashT>::Update(HashT oldHash, HashT newHash)
 {
-    return static_cast<uint_t>(mContainer.size());
+    if (!Insert(newHash))
+    {
+        return false;
+    }
+    if (!Remove(oldHash))
+    {
+        Remove(newHash);
+        return false;
+    }
+    return true;
 }
 
-bool SimhashSequentialContainner::Insert(hash_t hash)
+template <typename HashT>
+void SimhashContainer<HashT>::FindNearDupsBatch(
+    const std::vector<HashT> &hashes, HashT mask,
+    std::vector<AnswerType> &answers, uint_t)
 {
-    return mContainer.insert(hash).second;
+    answers.resize(hashes.size());
+    for (size_t i = 0; i < hashes.size(); ++i)
+    {
+        FindNearDups(hashes[i], answers[i], mask);
+    }
 }
-bool SimhashSequentialContainner::Remove(hash_t hash)
+
+template <typename HashT>
+bool SimhashContainer<HashT>::Join(const std::vector<HashT>&,
+    BasicSimhashJoinCallback<HashT>&, uint_t)
 {
-    return 0 != mContainer.erase(hash);
+    return false;
 }
 
-bool SimhashSequentialContainner::Search(hash_t hash)
+template <typename HashT>
+void SimhashContainer<HashT>::TraverseRange(HashT lower, HashT upper,
+    SimhashContainerVisitor<HashT> &visitor)
 {
-    return mContainer.end() != mContainer.find(hash);
+    SimhashRangeVisitor<HashT> range(lower, upper, visitor);
+    Traverse(range);
 }
 
-bool SimhashSequentialContainner::HasNearDups(hash_t hash, hash_t mask)
+template <typename HashT>
+std::tr1::shared_ptr<SimhashContainer<HashT> >
+SimhashContainer<HashT>::Freeze()
 {
-    hash_t tmp;
-    return FindFirstNearDup(hash, tmp, mask);
+    return std::tr1::shared_ptr<SimhashContainer<HashT> >();
 }
 
-bool SimhashSequentialContainner::FindFirstNearDup(hash_t hash, hash_t &nearDup,
-    hash_t mask)
+template <typename HashT>
+SimhashSequentialContainner<HashT>::SimhashSequentialContainner(
+    const SimhashTableOptions &options, uint_t level, uint_t maskEndPos)
+    : SimhashContainer<HashT>(options.maxHamDist, level)
+    , mContainer(std::less<HashT>(), SlabAllocator<HashT>(
+        options.useNodeArena ? &mArena : NULL))
+    , mKeyMask(~GetLowMask<HashT>(maskEndPos))
+    , mMaskEndPos(maskEndPos)
+    , mHotBucketSize(options.hotBucketSize)
+    , mBitSliceSize(maskEndPos ? options.bitSliceSize : 0U)
 {
-    const ContainerType::iterator lower = mContainer.lower_bound(hash &  mask );
-    const ContainerType::iterator upper = mContainer.upper_bound(hash |(~mask));
-    for (ContainerType::iterator it = lower; upper != it; ++it)
+    if (mHotBucketSize)
     {
-        if (Simhash::IsNearDups(hash, *it, mMaxHamDist))
-        {
-            nearDup = *it;
-            return true;
-        }
+        mSubOptions = options;
+        mSubOptions.level = 1U;
+        mSubOptions.usePrefilter = false;
+        mSubOptions.bitOrder.clear();
     }
-    return false;
 }
 
-bool SimhashSequentialContainner::FindNearDups(hash_t hash, FindAnswerType &ans,
-    hash_t mask)
+template <typename HashT>
+SimhashSequentialContainner<HashT>::~SimhashSequentialContainner()
+{}
+
+template <typename HashT>
+void SimhashSequentialContainner<HashT>::Clear()
 {
-    ans.clear();
-    const ContainerType::iterator lower = mContainer.lower_bound(hash &  mask );
-    const ContainerType::iterator upper = mContainer.upper_bound(hash |(~mask));
-    for (ContainerType::iterator it = lower; upper != it; ++it)
+    //The nodes only go to the free list, and the slabs are freed at once.
+    mContainer.clear();
+    mArena.Release();
+    mHotBuckets.clear();
+    mColdKeys.clear();
+    mSlicedBuckets.clear();
+    mBucketSizes.clear();
+}
+
+template <typename HashT>
+uint_t SimhashSequentialContainner<HashT>::GetSize()
+{
+    uint_t size = static_cast<uint_t>(mContainer.size());
+    for (typename HotBucketsType::iterator it = mHotBuckets.begin();
+        mHotBuckets.end() != it; ++it)
     {
-        if (Simhash::IsNearDups(hash, *it, mMaxHamDist))
-        {
-            ans.push_back(*it);
-        }
+        size += it->second->GetSize();
     }
-    return !ans.empty();
+    return size;
 }
 
-bool SimhashSequentialContainner::SaveToFile(const std::string &filename,
-    bool binary)
+template <typename HashT>
+bool SimhashSequentialContainner<HashT>::Insert(HashT hash)
 {
-    std::ofstream fout(filename.c_str(),
-        std::fstream::out | std::fstream::binary);
-    if (!fout.good())
+    typename HotBucketsType::iterator hot = mHotBuckets.find(hash & mKeyMask);
+    if (mHotBuckets.end() != hot)
+    {
+        return hot->second->Insert(hash);
+    }
+    const std::pair<typename ContainerType::iterator, bool> inserted
+        = mContainer.insert(hash);
+    if (!inserted.second)
     {
         return false;
     }
-    if (binary)     //save in binary mode.
+    typename SlicedBucketsType::iterator sliced
+        = mSlicedBuckets.find(hash & mKeyMask);
+    if (mSlicedBuckets.end() != sliced)
     {
-        static const uint_t BYTES = static_cast<uint_t>(sizeof(hash_t));
-        static const uint_t BUFF_SIZE = 10000U;
-        hash_t buff[BUFF_SIZE];
-        uint_t count = 0U;
-        for (ContainerType::iterator it = mContainer.begin();
-            mContainer.end() != it; ++it)
+        sliced->second.Add(hash);
+    }
+    if (mHotBucketSize || mBitSliceSize)
+    {
+        CheckBucket(hash & mKeyMask, GrowBucket(hash & mKeyMask,
+            inserted.first));
+    }
+    return true;
+}
+template <typename HashT>
+bool SimhashSequentialContainner<HashT>::Remove(HashT hash)
+{
+    typename HotBucketsType::iterator hot = mHotBuckets.find(hash & mKeyMask);
+    if (mHotBuckets.end() != hot)
+    {
+        if (!hot->second->Remove(hash))
         {
-            buff[count++] = *it;
-            if (BUFF_SIZE == count)
-            {
-                fout.write(reinterpret_cast<char*>(buff), BYTES * BUFF_SIZE);
-                count = 0U;
-            }
+            return false;
         }
-        if (count > 0)
+        //Merge back when it is not hot any more.
+        if (hot->second->GetSize() < mHotBucketSize / 4U)
         {
-            fout.write(reinterpret_cast<char*>(buff), BYTES * count);
+            MergeBucket(hot);
         }
+        return true;
+    }
+    if (!mContainer.erase(hash))
+    {
+        return false;
     }
-    else            //save in string mode.
+    ShrinkBucket(hash & mKeyMask);
+    typename SlicedBucketsType::iterator sliced
+        = mSlicedBuckets.find(hash & mKeyMask);
+    if (mSlicedBuckets.end() != sliced)
     {
-        std::string binaryStr;
-        for (ContainerType::iterator it = mContainer.begin();
-            mContainer.end() != it; ++it)
+        sliced->second.Remove(hash);
+        if (sliced->second.GetSize() < mBitSliceSize / 2U)
         {
-            Simhash::HashToBinaryString(*it, binaryStr);
-            fout << binaryStr << std::endl;
+            mSlicedBuckets.erase(sliced);
         }
     }
-    fout.close();
     return true;
 }
 
-SimhashIndexedContainer::SimhashIndexedContainer(uint_t maxHamDist,
-    uint_t level,uint_t maskBeginPos, uint_t maskEndPos)
-    : SimhashContainer(maxHamDist, level)
-    , mBlockNum(        maxHamDist + 1U )
-    , mContainer(       maxHamDist + 1U )
-    , mProps(           maxHamDist + 1U )
-    , mMaskBeginPos(    maskBeginPos    )
-    , mMaskEndPos(      maskEndPos      )
+template <typename HashT>
+bool SimhashSequentialContainner<HashT>::Update(HashT oldHash, HashT newHash)
 {
-    bool ret = Init();
-    if (!ret)
+    const HashT key = oldHash & mKeyMask;
+    if ((newHash & mKeyMask) != key)
     {
-        throw std::bad_alloc();
+        return SimhashContainer<HashT>::Update(oldHash, newHash);
     }
-}
-
-SimhashIndexedContainer::~SimhashIndexedContainer()
-{}
-
-bool SimhashIndexedContainer::Init()
-{
-    uint_t maskWidth = mMaskEndPos - mMaskBeginPos;
-    uint_t blockWidth = maskWidth / mBlockNum;
-    uint_t remainLen = maskWidth - blockWidth * mBlockNum;
-    maskWidth = mMaskEndPos;
-    for (uint_t i = 0; i < mBlockNum; ++i)
+    //In the same bucket, no hot bucket or mirror is split or merged.
+    typename HotBucketsType::iterator hot = mHotBuckets.find(key);
+    if (mHotBuckets.end() != hot)
     {
-        //Set props.
-        if (0 == i)
-        {
-            mProps.at(i).leftWidth = 0U;
-            mProps.at(i).leftForwardMask = 0UL;
-        }
-        else
-        {
-            mProps.at(i).leftWidth = mProps.at(i - 1U).leftWidth
-                + mProps.at(i - 1U).rightWidth;
-            mProps.at(i).leftForwardMask = mProps.at(i - 1U).leftForwardMask
-                | mProps.at(i - 1U).rightForwardMask;
-        }
-        if (remainLen > 0)
-        {
-            mProps.at(i).rightWidth = blockWidth + 1U;
-            --remainLen;
-        }
-        else
-        {
-            mProps.at(i).rightWidth = blockWidth;
-        }
-        mProps.at(i).rightForwardMask = 0UL;
-        for (uint_t j = maskWidth - mProps.at(i).rightWidth; j < maskWidth; ++j)
-        {
-            mProps.at(i).rightForwardMask |= HASH_1 << j;
-        }
-        maskWidth -= mProps.at(i).rightWidth;
-        mProps.at(i).leftBackwardMask
-            = mProps.at(i).rightForwardMask << mProps.at(i).leftWidth;
-        mProps.at(i).rightBackwardMask
-            = mProps.at(i).leftForwardMask  >> mProps.at(i).rightWidth;
-        mProps.at(i).surroundMask
-            = ~(mProps.at(i).leftForwardMask | mProps.at(i).rightForwardMask);
-
-        //Create container.
-        mContainer.at(i) = SimhashContainerFactory::CreateSimhashContainer(
-            mMaxHamDist, mLevel - 1U, 0U,
-            mMaskEndPos - mProps.at(i).rightWidth);
-        if (!mContainer.at(i))
+        return hot->second->Update(oldHash, newHash);
+    }
+    typename ContainerType::iterator it = mContainer.find(oldHash);
+    if (mContainer.end() == it)
+    {
+        return false;
+    }
+    //When no value lies between, the new value takes the place of the old
+    //one in its node, which keeps the order of the set, so nothing is
+    //allocated or rebalanced. Otherwise the old value is the hint.
+    typename ContainerType::iterator prev = it, next = it;
+    ++next;
+    const bool inPlace = oldHash < newHash
+        ? mContainer.end() == next || newHash < *next
+        : newHash < oldHash && (mContainer.begin() == it || *--prev < newHash);
+    if (inPlace)
+    {
+        const_cast<HashT&>(*it) = newHash;
+    }
+    else
+    {
+        const size_t size = mContainer.size();
+        mContainer.insert(it, newHash);
+        if (mContainer.size() == size)
         {
-            throw std::bad_alloc();
             return false;
         }
+        mContainer.erase(it);
+    }
+    typename SlicedBucketsType::iterator sliced = mSlicedBuckets.find(key);
+    if (mSlicedBuckets.end() != sliced)
+    {
+        sliced->second.Remove(oldHash);
+        sliced->second.Add(newHash);
     }
     return true;
 }
 
-void SimhashIndexedContainer::Clear()
+template <typename HashT>
+bool SimhashSequentialContainner<HashT>::Search(HashT hash)
 {
-    for (ContainerType::iterator it = mContainer.begin();
-        it != mContainer.end(); ++it)
+    typename HotBucketsType::iterator hot = mHotBuckets.find(hash & mKeyMask);
+    if (mHotBuckets.end() != hot)
     {
-        (*it)->Clear();
+        return hot->second->Search(hash);
     }
+    return mContainer.end() != mContainer.find(hash);
 }
 
-uint_t SimhashIndexedContainer::GetSize()
+template <typename HashT>
+bool SimhashSequentialContainner<HashT>::HasNearDups(HashT hash, HashT mask,
+    uint_t hamDist)
 {
-    return static_cast<uint_t>(mContainer.front()->GetSize());
+    HashT tmp;
+    return FindFirstNearDup(hash, tmp, mask, hamDist);
 }
 
-bool SimhashIndexedContainer::Insert(hash_t hash)
+template <typename HashT>
+bool SimhashSequentialContainner<HashT>::FindFirstNearDup(HashT hash,
+    HashT &nearDup, HashT mask, uint_t hamDist)
 {
-    //Attempt insert hash into the front container.
-    if (!mContainer.front()->Insert(hash))
+    typename HotBucketsType::iterator hot = mHotBuckets.find(hash & mKeyMask);
+    if (mHotBuckets.end() != hot)
     {
-        return false;
+        return hot->second->FindFirstNearDup(hash, nearDup, mask, hamDist);
     }
-    //Insert into all redundancy containers.
-    //Generate forward permutes.
-    std::vector<hash_t> forwordPermutes;
-    GetForwardPermutes(hash, forwordPermutes);
-    //Insert hash into all redundancy containers.
-    for (uint_t i = 1U; i < mBlockNum; ++i)
+    AnswerType ans;
+    ScanBucket(hash, mask, std::min(hamDist, mMaxHamDist), true, ans);
+    if (ans.empty())
     {
-        //Should return true.
-        mContainer.at(i)->Insert(forwordPermutes.at(i));
+        return false;
     }
+    nearDup = ans.front();
     return true;
 }
 
-bool SimhashIndexedContainer::Remove(hash_t hash)
+template <typename HashT>
+bool SimhashSequentialContainner<HashT>::FindNearDups(HashT hash,
+    AnswerType &ans, HashT mask, uint_t hamDist)
 {
-    //Attempt remove hash from the front container.
-    if (!mContainer.front()->Remove(hash))
+    typename HotBucketsType::iterator hot = mHotBuckets.find(hash & mKeyMask);
+    if (mHotBuckets.end() != hot)
     {
-        return false;
+        return hot->second->FindNearDups(hash, ans, mask, hamDist);
     }
-    //Remove from all redundancy containers.
-    //Generate forward permutes.
-    std::vector<hash_t> forwordPermutes;
-    GetForwardPermutes(hash, forwordPermutes);
-    for (uint_t i = 1U; i < mBlockNum; ++i)
+    ans.clear();
+    ScanBucket(hash, mask, std::min(hamDist, mMaxHamDist), false, ans);
+    return !ans.empty();
+}
+
+template <typename HashT>
+void SimhashSequentialContainner<HashT>::ScanBucket(HashT hash, HashT mask,
+    uint_t hamDist, bool firstOnly, AnswerType &ans)
+{
+    SIMHASH_STATS(if (mStats) ++mStats->levels[0].bucketsProbed);
+    typename SlicedBucketsType::iterator sliced
+        = mSlicedBuckets.find(hash & mKeyMask);
+    if (mSlicedBuckets.end() != sliced)
     {
-        //Should return true.
-        mContainer.at(i)->Remove(forwordPermutes.at(i));
+        sliced->second.FindNearDups(hash, hamDist, firstOnly, ans);
+        SIMHASH_STATS(if (mStats) mStats->levels[0].candidatesCompared
+            += sliced->second.GetSize());
     }
-    return true;
+    else
+    {
+        const typename ContainerType::iterator lower
+            = mContainer.lower_bound(hash &  mask );
+        const typename ContainerType::iterator upper
+            = mContainer.upper_bound(hash |(~mask));
+        for (typename ContainerType::iterator it = lower; upper != it; ++it)
+        {
+            SIMHASH_STATS(if (mStats) ++mStats->levels[0].candidatesCompared);
+            if (BasicSimhash<HashT>::IsNearDups(hash, *it, hamDist))
+            {
+                ans.push_back(*it);
+                if (firstOnly)
+                {
+                    break;
+                }
+            }
+        }
+    }
+    SIMHASH_STATS(if (mStats) mStats->levels[0].matches += ans.size());
 }
 
-bool SimhashIndexedContainer::Search(hash_t hash)
+template <typename HashT>
+uint_t SimhashSequentialContainner<HashT>::GrowBucket(HashT key,
+    typename ContainerType::iterator it)
 {
-    //Find hash from the front container.
+    typename BucketSizesType::iterator counted = mBucketSizes.find(key);
+    if (mBucketSizes.end() != counted)
+    {
+        return ++counted->second;
+    }
+    //Walk the neighbours of it, a bucket found large is counted at once and
+    //kept in mBucketSizes from now on.
+    uint_t size = 1U;
+    typename ContainerType::iterator prev = it;
+    while (size < TRACKED_BUCKET_SIZE && mContainer.begin() != prev
+        && (*--prev & mKeyMask) == key)
+    {
+        ++size;
+    }
+    typename ContainerType::iterator next = it;
+    while (size < TRACKED_BUCKET_SIZE && mContainer.end() != ++next
+        && (*next & mKeyMask) == key)
+    {
+        ++size;
+    }
+    if (size >= TRACKED_BUCKET_SIZE)
+    {
+        size = static_cast<uint_t>(std::distance(mContainer.lower_bound(key),
+            mContainer.upper_bound(key | ~mKeyMask)));
+        mBucketSizes[key] = size;
+    }
+    return size;
+}
+
+template <typename HashT>
+void SimhashSequentialContainner<HashT>::ShrinkBucket(HashT key)
+{
+    typename BucketSizesType::iterator counted = mBucketSizes.find(key);
+    if (mBucketSizes.end() != counted
+        && --counted->second < TRACKED_BUCKET_SIZE / 2U)
+    {
+        mBucketSizes.erase(counted);
+    }
+}
+
+template <typename HashT>
+void SimhashSequentialContainner<HashT>::CheckBucket(HashT key, uint_t size)
+{
+    if (mHotBucketSize && size > mHotBucketSize && SplitBucket(key))
+    {
+        return;
+    }
+    //Mirror the bucket when it is large, a cold one included.
+    if (mBitSliceSize && size >= mBitSliceSize && !mSlicedBuckets.count(key))
+    {
+        BitSlicedBucket<HashT> &bucket = mSlicedBuckets.insert(
+            std::make_pair(key, BitSlicedBucket<HashT>(mMaskEndPos)))
+            .first->second;
+        const typename ContainerType::iterator upper
+            = mContainer.upper_bound(key | ~mKeyMask);
+        for (typename ContainerType::iterator it = mContainer.lower_bound(key);
+            upper != it; ++it)
+        {
+            bucket.Add(*it);
+        }
+    }
+}
+
+template <typename HashT>
+bool SimhashSequentialContainner<HashT>::SplitBucket(HashT key)
+{
+    //Each block of the sub-index needs a few bits.
+    if (mMaskEndPos < 2U * (mMaxHamDist + 1U) || mColdKeys.count(key))
+    {
+        return false;
+    }
+    const typename ContainerType::iterator lower
+        = mContainer.lower_bound(key);
+    const typename ContainerType::iterator upper
+        = mContainer.upper_bound(key | ~mKeyMask);
+    SimhashContainerPtr sub = SimhashContainerFactory<HashT>
+        ::CreateSimhashContainer(mSubOptions, 1U, 0U, mMaskEndPos);
+    for (typename ContainerType::iterator it = lower; upper != it; ++it)
+    {
+        sub->Insert(*it);
+    }
+    //Keep the sub-index only if every permutation halves the bucket at
+    //least, or some queries would still scan most of it.
+    SimhashBucketReport report;
+    sub->GetBucketReport(report);
+    if (2U * report.largestBucket > sub->GetSize())
+    {
+        mColdKeys.insert(key);
+        return false;
+    }
+    sub->SetStats(mStats);
+    mContainer.erase(lower, upper);
+    mSlicedBuckets.erase(key);
+    mBucketSizes.erase(key);
+    mHotBuckets[key] = sub;
+    return true;
+}
+
+template <typename HashT>
+void SimhashSequentialContainner<HashT>::MergeBucket(
+    typename HotBucketsType::iterator it)
+{
+    const HashT key = it->first;
+    const uint_t size = it->second->GetSize();
+    BucketMerger merger(mContainer);
+    it->second->Traverse(merger);
+    mHotBuckets.erase(it);
+    if (size >= TRACKED_BUCKET_SIZE)
+    {
+        mBucketSizes[key] = size;
+    }
+    CheckBucket(key, size);
+}
+
+template <typename HashT>
+void SimhashSequentialContainner<HashT>::Traverse(
+    SimhashContainerVisitor<HashT> &visitor)
+{
+    //The values of a hot bucket lie between the values of the smaller keys
+    //and the larger keys.
+    typename HotBucketsType::iterator hot = mHotBuckets.begin();
+    for (typename ContainerType::iterator it = mContainer.begin();
+        mContainer.end() != it; ++it)
+    {
+        for (; mHotBuckets.end() != hot && hot->first < *it; ++hot)
+        {
+            hot->second->Traverse(visitor);
+        }
+        visitor.Visit(*it);
+    }
+    for (; mHotBuckets.end() != hot; ++hot)
+    {
+        hot->second->Traverse(visitor);
+    }
+}
+
+template <typename HashT>
+void SimhashSequentialContainner<HashT>::TraverseRange(HashT lower,
+    HashT upper, SimhashContainerVisitor<HashT> &visitor)
+{
+    //The hot buckets from the one lower lies in.
+    typename HotBucketsType::iterator hot
+        = mHotBuckets.lower_bound(lower & mKeyMask);
+    const typename HotBucketsType::iterator hotEnd
+        = mHotBuckets.upper_bound(upper);
+    const typename ContainerType::iterator end = mContainer.upper_bound(upper);
+    for (typename ContainerType::iterator it = mContainer.lower_bound(lower);
+        end != it; ++it)
+    {
+        for (; hotEnd != hot && hot->first < *it; ++hot)
+        {
+            hot->second->TraverseRange(lower, upper, visitor);
+        }
+        visitor.Visit(*it);
+    }
+    for (; hotEnd != hot; ++hot)
+    {
+        hot->second->TraverseRange(lower, upper, visitor);
+    }
+}
+
+template <typename HashT>
+void SimhashSequentialContainner<HashT>::SetStats(SimhashTableStats *stats)
+{
+    SimhashContainer<HashT>::SetStats(stats);
+    for (typename HotBucketsType::iterator it = mHotBuckets.begin();
+        mHotBuckets.end() != it; ++it)
+    {
+        it->second->SetStats(stats);
+    }
+}
+
+template <typename HashT>
+typename SimhashSequentialContainner<HashT>::SimhashContainerPtr
+SimhashSequentialContainner<HashT>::Freeze()
+{
+    //The hot buckets are flattened with the set by Traverse, a frozen bucket
+    //is a range of the array, scanned as the sorted container does.
+    return SimhashContainerPtr(new SimhashFrozenContainer<HashT>(mMaxHamDist,
+        mKeyMask, *this));
+}
+
+template <typename HashT>
+void SimhashSequentialContainner<HashT>::GetMemoryUsage(
+    SimhashMemoryUsage &usage)
+{
+    SimhashContainerMemory memory;
+    memory.level = mLevel;
+    memory.elementNum = mContainer.size();
+    memory.nodeBytes = mContainer.get_allocator().GetArena()
+        ? mArena.GetMemoryUsage()
+        : mContainer.size() * GetSetNodeBytes<HashT>();
+    memory.overheadBytes = GetMallocChunkBytes(sizeof(*this))
+        + mColdKeys.size() * GetSetNodeBytes<HashT>()
+        + mHotBuckets.size() * GetMallocChunkBytes(4UL * sizeof(void*)
+        + sizeof(HashT) + sizeof(SimhashContainerPtr))
+        + mSubOptions.bitEntropies.capacity() * sizeof(real_t)
+        + mSlicedBuckets.size() * GetMallocChunkBytes(4UL * sizeof(void*)
+        + sizeof(HashT) + sizeof(BitSlicedBucket<HashT>))
+        + mBucketSizes.size() * GetMallocChunkBytes(4UL * sizeof(void*)
+        + sizeof(HashT) + sizeof(uint_t));
+    for (typename SlicedBucketsType::iterator it = mSlicedBuckets.begin();
+        mSlicedBuckets.end() != it; ++it)
+    {
+        memory.nodeBytes += it->second.GetMemoryUsage();
+    }
+    usage.AddContainer(memory);
+    //The sub-indexes are reported at their own levels, 1 and 0.
+    for (typename HotBucketsType::iterator it = mHotBuckets.begin();
+        mHotBuckets.end() != it; ++it)
+    {
+        it->second->GetMemoryUsage(usage);
+    }
+}
+
+template <typename HashT>
+void SimhashSequentialContainner<HashT>::GetBucketReport(
+    SimhashBucketReport &report)
+{
+    ++report.containerNum;
+    //The values are sorted, so a bucket is a run of values with the same key.
+    uint64_t size = 0UL;
+    HashT key(0U);
+    for (typename ContainerType::iterator it = mContainer.begin();
+        mContainer.end() != it; ++it)
+    {
+        if (size && (*it & mKeyMask) == key)
+        {
+            ++size;
+            continue;
+        }
+        report.AddBucket(size);
+        key = *it & mKeyMask;
+        size = 1UL;
+    }
+    report.AddBucket(size);
+    //A hot bucket is reported by the leaves of its sub-index.
+    for (typename HotBucketsType::iterator it = mHotBuckets.begin();
+        mHotBuckets.end() != it; ++it)
+    {
+        it->second->GetBucketReport(report);
+    }
+}
+
+template <typename HashT>
+SimhashSortedContainer<HashT>::SimhashSortedContainer(
+    const SimhashTableOptions &options, uint_t level, uint_t maskEndPos)
+    : SimhashContainer<HashT>(options.maxHamDist, level)
+    , mKeyMask(~GetLowMask<HashT>(maskEndPos))
+{}
+
+template <typename HashT>
+SimhashSortedContainer<HashT>::~SimhashSortedContainer()
+{}
+
+template <typename HashT>
+void SimhashSortedContainer<HashT>::Clear()
+{
+    ArrayType().swap(mArray);
+    mInserted.clear();
+    mRemoved.clear();
+}
+
+template <typename HashT>
+uint_t SimhashSortedContainer<HashT>::GetSize()
+{
+    return static_cast<uint_t>(mArray.size() - mRemoved.size()
+        + mInserted.size());
+}
+
+template <typename HashT>
+bool SimhashSortedContainer<HashT>::Insert(HashT hash)
+{
+    if (!mRemoved.empty() && mRemoved.erase(hash))
+    {
+        return true;
+    }
+    if (std::binary_search(mArray.begin(), mArray.end(), hash)
+        || !mInserted.insert(hash).second)
+    {
+        return false;
+    }
+    MergeDelta(false);
+    return true;
+}
+
+template <typename HashT>
+bool SimhashSortedContainer<HashT>::Remove(HashT hash)
+{
+    if (mInserted.erase(hash))
+    {
+        return true;
+    }
+    if (!std::binary_search(mArray.begin(), mArray.end(), hash)
+        || !mRemoved.insert(hash).second)
+    {
+        return false;
+    }
+    MergeDelta(false);
+    return true;
+}
+
+template <typename HashT>
+bool SimhashSortedContainer<HashT>::Search(HashT hash)
+{
+    return InArray(hash) || mInserted.count(hash);
+}
+
+template <typename HashT>
+void SimhashSortedContainer<HashT>::MergeDelta(bool force)
+{
+    static const size_t MIN_DELTA = 64U;
+    const size_t delta = mInserted.size() + mRemoved.size();
+    if (!delta || (!force && delta < std::max(MIN_DELTA, mArray.size() / 16U)))
+    {
+        return;
+    }
+    ArrayType merged;
+    merged.reserve(mArray.size() - mRemoved.size() + mInserted.size());
+    typename DeltaType::iterator removed = mRemoved.begin();
+    typename DeltaType::iterator inserted = mInserted.begin();
+    for (typename ArrayType::iterator it = mArray.begin();
+        mArray.end() != it; ++it)
+    {
+        for (; mInserted.end() != inserted && *inserted < *it; ++inserted)
+        {
+            merged.push_back(*inserted);
+        }
+        if (mRemoved.end() != removed && *removed == *it)
+        {
+            ++removed;
+            continue;
+        }
+        merged.push_back(*it);
+    }
+    merged.insert(merged.end(), inserted, mInserted.end());
+    mArray.swap(merged);
+    mInserted.clear();
+    mRemoved.clear();
+}
+
+template <typename HashT>
+bool SimhashSortedContainer<HashT>::HasNearDups(HashT hash, HashT mask,
+    uint_t hamDist)
+{
+    HashT tmp;
+    return FindFirstNearDup(hash, tmp, mask, hamDist);
+}
+
+template <typename HashT>
+bool SimhashSortedContainer<HashT>::FindFirstNearDup(HashT hash,
+    HashT &nearDup, HashT mask, uint_t hamDist)
+{
+    AnswerType ans;
+    ScanBucket(hash, mask, std::min(hamDist, mMaxHamDist), std::lower_bound(
+        mArray.begin(), mArray.end(), hash & mask), true, ans);
+    if (ans.empty())
+    {
+        return false;
+    }
+    nearDup = ans.front();
+    return true;
+}
+
+template <typename HashT>
+bool SimhashSortedContainer<HashT>::FindNearDups(HashT hash,
+    AnswerType &ans, HashT mask, uint_t hamDist)
+{
+    ans.clear();
+    ScanBucket(hash, mask, std::min(hamDist, mMaxHamDist), std::lower_bound(
+        mArray.begin(), mArray.end(), hash & mask), false, ans);
+    return !ans.empty();
+}
+
+template <typename HashT>
+void SimhashSortedContainer<HashT>::ScanBucket(HashT hash, HashT mask,
+    uint_t hamDist, typename ArrayType::const_iterator lower, bool firstOnly,
+    AnswerType &ans)
+{
+    SIMHASH_STATS(if (mStats) ++mStats->levels[0].bucketsProbed);
+    const HashT upper = hash | ~mask;
+    const size_t found = ans.size();
+    for (typename ArrayType::const_iterator it = lower;
+        mArray.end() != it && *it <= upper; ++it)
+    {
+        SIMHASH_STATS(if (mStats) ++mStats->levels[0].candidatesCompared);
+        if (BasicSimhash<HashT>::IsNearDups(hash, *it, hamDist)
+            && (mRemoved.empty() || !mRemoved.count(*it)))
+        {
+            ans.push_back(*it);
+            if (firstOnly)
+            {
+                break;
+            }
+        }
+    }
+    if (!mInserted.empty() && !(firstOnly && ans.size() > found))
+    {
+        const typename DeltaType::iterator end = mInserted.upper_bound(upper);
+        for (typename DeltaType::iterator it
+            = mInserted.lower_bound(hash & mask); end != it; ++it)
+        {
+            SIMHASH_STATS(if (mStats) ++mStats->levels[0].candidatesCompared);
+            if (BasicSimhash<HashT>::IsNearDups(hash, *it, hamDist))
+            {
+                ans.push_back(*it);
+                if (firstOnly)
+                {
+                    break;
+                }
+            }
+        }
+    }
+    SIMHASH_STATS(if (mStats) mStats->levels[0].matches += ans.size() - found);
+}
+
+template <typename HashT>
+void SimhashSortedContainer<HashT>::FindNearDupsBatch(
+    const std::vector<HashT> &hashes, HashT mask,
+    std::vector<AnswerType> &answers, uint_t depth)
+{
+    answers.assign(hashes.size(), AnswerType());
+    depth = std::max(depth, 1U);
+    const HashT *data = mArray.empty() ? NULL : &mArray.front();
+    std::vector<const HashT*> bases(depth);
+    for (size_t begin = 0; begin < hashes.size(); begin += depth)
+    {
+        const size_t num = std::min(static_cast<size_t>(depth),
+            hashes.size() - begin);
+        //The binary searches of num queries go in lockstep, as they search
+        //the same array. Each step prefetches the next middle of its query,
+        //which is loaded while the other queries step.
+        for (size_t j = 0; j < num; ++j)
+        {
+            bases[j] = data;
+        }
+        size_t len = mArray.size();
+        while (len > 1U)
+        {
+            const size_t half = len / 2U;
+            len -= half;
+            for (size_t j = 0; j < num; ++j)
+            {
+                const HashT key = hashes[begin + j] & mask;
+                bases[j] = bases[j][half] < key ? bases[j] + half : bases[j];
+                __builtin_prefetch(bases[j] + len / 2U);
+            }
+        }
+        for (size_t j = 0; j < num; ++j)
+        {
+            const HashT hash = hashes[begin + j];
+            typename ArrayType::const_iterator lower = mArray.begin();
+            if (data)
+            {
+                lower += bases[j] - data + (*bases[j] < (hash & mask) ? 1 : 0);
+            }
+            ScanBucket(hash, mask, mMaxHamDist, lower, false,
+                answers[begin + j]);
+        }
+    }
+}
+
+template <typename HashT>
+void SimhashSortedContainer<HashT>::Traverse(
+    SimhashContainerVisitor<HashT> &visitor)
+{
+    typename DeltaType::iterator inserted = mInserted.begin();
+    for (typename ArrayType::iterator it = mArray.begin();
+        mArray.end() != it; ++it)
+    {
+        for (; mInserted.end() != inserted && *inserted < *it; ++inserted)
+        {
+            visitor.Visit(*inserted);
+        }
+        if (mRemoved.empty() || !mRemoved.count(*it))
+        {
+            visitor.Visit(*it);
+        }
+    }
+    for (; mInserted.end() != inserted; ++inserted)
+    {
+        visitor.Visit(*inserted);
+    }
+}
+
+template <typename HashT>
+void SimhashSortedContainer<HashT>::TraverseRange(HashT lower, HashT upper,
+    SimhashContainerVisitor<HashT> &visitor)
+{
+    typename DeltaType::iterator inserted = mInserted.lower_bound(lower);
+    const typename DeltaType::iterator insertedEnd
+        = mInserted.upper_bound(upper);
+    const typename ArrayType::iterator end = std::upper_bound(mArray.begin(),
+        mArray.end(), upper);
+    for (typename ArrayType::iterator it = std::lower_bound(mArray.begin(),
+        mArray.end(), lower); end != it; ++it)
+    {
+        for (; insertedEnd != inserted && *inserted < *it; ++inserted)
+        {
+            visitor.Visit(*inserted);
+        }
+        if (mRemoved.empty() || !mRemoved.count(*it))
+        {
+            visitor.Visit(*it);
+        }
+    }
+    for (; insertedEnd != inserted; ++inserted)
+    {
+        visitor.Visit(*inserted);
+    }
+}
+
+template <typename HashT>
+void SimhashSortedContainer<HashT>::GetBucketReport(
+    SimhashBucketReport &report)
+{
+    //Count the buckets on the array and the delta as Traverse merges them,
+    //a report doesn't change the container.
+    ++report.containerNum;
+    SimhashBucketCounter<HashT> counter(mKeyMask, report);
+    Traverse(counter);
+    counter.Finish();
+}
+
+template <typename HashT>
+void SimhashSortedContainer<HashT>::GetMemoryUsage(SimhashMemoryUsage &usage)
+{
+    SimhashContainerMemory memory;
+    memory.level = mLevel;
+    memory.elementNum = GetSize();
+    memory.nodeBytes = mArray.capacity() * sizeof(HashT)
+        + (mInserted.size() + mRemoved.size()) * GetSetNodeBytes<HashT>();
+    memory.overheadBytes = GetMallocChunkBytes(sizeof(*this));
+    usage.AddContainer(memory);
+}
+
+template <typename HashT>
+std::tr1::shared_ptr<SimhashContainer<HashT> >
+SimhashSortedContainer<HashT>::Freeze()
+{
+    return std::tr1::shared_ptr<SimhashContainer<HashT> >(
+        new SimhashFrozenContainer<HashT>(mMaxHamDist, mKeyMask, *this));
+}
+
+/*
+* CountNodeLess: returns the number of keys of a node less than key. The
+* keys of a node are sorted, so this is the child to descend into.
+*/
+template <typename HashT>
+static inline size_t CountNodeLess(const HashT *node, HashT key)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < SimhashFrozenContainer<HashT>::NODE_KEYS; ++i)
+    {
+        count += node[i] < key ? 1U : 0U;
+    }
+    return count;
+}
+
+static inline size_t CountNodeLess(const hash_t *node, hash_t key)
+{
+#if defined(__AVX2__)
+    //The compares are signed, the sign bits are flipped to compare unsigned.
+    const __m256i sign = _mm256_set1_epi64x(static_cast<int64_t>(1ULL << 63));
+    const __m256i pivot = _mm256_xor_si256(_mm256_set1_epi64x(
+        static_cast<int64_t>(key)), sign);
+    const __m256i lo = _mm256_xor_si256(_mm256_load_si256(
+        reinterpret_cast<const __m256i*>(node)), sign);
+    const __m256i hi = _mm256_xor_si256(_mm256_load_si256(
+        reinterpret_cast<const __m256i*>(node + 4)), sign);
+    const int less = _mm256_movemask_pd(_mm256_castsi256_pd(
+        _mm256_cmpgt_epi64(pivot, lo))) | (_mm256_movemask_pd(
+        _mm256_castsi256_pd(_mm256_cmpgt_epi64(pivot, hi))) << 4);
+    return static_cast<size_t>(__builtin_popcount(less));
+#elif defined(__SSE4_2__)
+    const __m128i sign = _mm_set1_epi64x(static_cast<int64_t>(1ULL << 63));
+    const __m128i pivot = _mm_xor_si128(_mm_set1_epi64x(
+        static_cast<int64_t>(key)), sign);
+    int less = 0;
+    for (size_t i = 0; i < 4U; ++i)
+    {
+        const __m128i keys = _mm_xor_si128(_mm_load_si128(
+            reinterpret_cast<const __m128i*>(node + 2U * i)), sign);
+        less |= _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(pivot,
+            keys))) << (2U * i);
+    }
+    return static_cast<size_t>(__builtin_popcount(less));
+#else
+    size_t count = 0;
+    for (size_t i = 0; i < SimhashFrozenContainer<hash_t>::NODE_KEYS; ++i)
+    {
+        count += node[i] < key ? 1U : 0U;
+    }
+    return count;
+#endif
+}
+
+template <typename HashT>
+SimhashFrozenContainer<HashT>::SimhashFrozenContainer(uint_t maxHamDist,
+    HashT keyMask, SimhashContainer<HashT> &source)
+    : SimhashContainer<HashT>(maxHamDist, 0U)
+    , mValues(NULL)
+    , mSize(0)
+    , mTree(NULL)
+    , mKeyMask(keyMask)
+{
+    ArrayType values;
+    values.reserve(source.GetSize());
+    SimhashValueCollector<HashT> collector(values);
+    source.Traverse(collector);
+    mSize = values.size();
+    //The array is padded to whole nodes by the max value, which is not less
+    //than any key, so the last node is compared as the others.
+    const size_t padded = (mSize + NODE_KEYS - 1U) / NODE_KEYS * NODE_KEYS;
+    HashT *data = AlignBuffer(mValueBuff, padded);
+    std::copy(values.begin(), values.end(), data);
+    mValues = data;
+    BuildTree();
+}
+
+template <typename HashT>
+SimhashFrozenContainer<HashT>::~SimhashFrozenContainer()
+{}
+
+template <typename HashT>
+HashT* SimhashFrozenContainer<HashT>::AlignBuffer(ArrayType &buff,
+    size_t num)
+{
+    static const size_t CACHE_LINE = 64U;
+    const size_t extra = std::max(CACHE_LINE / sizeof(HashT),
+        static_cast<size_t>(1U));
+    buff.assign(num + extra, ~HashT(0U));
+    HashT *data = &buff.front();
+    for (size_t i = 0; i < extra; ++i)
+    {
+        if (!(reinterpret_cast<uintptr_t>(data + i) % CACHE_LINE))
+        {
+            return data + i;
+        }
+    }
+    return data;
+}
+
+template <typename HashT>
+void SimhashFrozenContainer<HashT>::BuildTree()
+{
+    mLevelBegins.clear();
+    mLevelSizes.clear();
+    if (!mSize)
+    {
+        return;
+    }
+    //The lowest level has a key for each node of the array, and each upper
+    //level a key for each node of the level below, up to a single root.
+    std::vector<size_t> sizes(1U, (mSize + NODE_KEYS - 1U) / NODE_KEYS);
+    while (sizes.back() > NODE_KEYS)
+    {
+        sizes.push_back((sizes.back() + NODE_KEYS - 1U) / NODE_KEYS);
+    }
+    mLevelSizes.assign(sizes.rbegin(), sizes.rend());
+    size_t total = 0;
+    for (size_t l = 0; l < mLevelSizes.size(); ++l)
+    {
+        mLevelBegins.push_back(total);
+        total += (mLevelSizes[l] + NODE_KEYS - 1U) / NODE_KEYS * NODE_KEYS;
+    }
+    HashT *tree = AlignBuffer(mTreeBuff, total);
+    //A key is the last value under it, i.e. the max of its child node.
+    const HashT *below = mValues;
+    size_t belowSize = mSize;
+    for (size_t l = mLevelSizes.size(); l-- > 0; )
+    {
+        HashT *level = tree + mLevelBegins[l];
+        for (size_t i = 0; i < mLevelSizes[l]; ++i)
+        {
+            level[i] = below[std::min((i + 1U) * NODE_KEYS, belowSize) - 1U];
+        }
+        below = level;
+        belowSize = mLevelSizes[l];
+    }
+    mTree = tree;
+}
+
+template <typename HashT>
+size_t SimhashFrozenContainer<HashT>::LowerBound(HashT key) const
+{
+    //Each level reads one node, and the child is the number of keys less
+    //than key, the key of the child is the first not less than key.
+    size_t node = 0;
+    for (size_t l = 0; l < mLevelSizes.size(); ++l)
+    {
+        node = node * NODE_KEYS + CountNodeLess(mTree + mLevelBegins[l]
+            + node * NODE_KEYS, key);
+        if (node >= mLevelSizes[l])
+        {
+            return mSize;
+        }
+    }
+    if (mLevelSizes.empty())
+    {
+        return 0;
+    }
+    return node * NODE_KEYS + CountNodeLess(mValues + node * NODE_KEYS, key);
+}
+
+template <typename HashT>
+bool SimhashFrozenContainer<HashT>::Insert(HashT)
+{
+    return false;
+}
+
+template <typename HashT>
+bool SimhashFrozenContainer<HashT>::Remove(HashT)
+{
+    return false;
+}
+
+template <typename HashT>
+bool SimhashFrozenContainer<HashT>::Update(HashT, HashT)
+{
+    return false;
+}
+
+template <typename HashT>
+void SimhashFrozenContainer<HashT>::Clear()
+{
+    ArrayType().swap(mValueBuff);
+    ArrayType().swap(mTreeBuff);
+    mValues = NULL;
+    mTree = NULL;
+    mSize = 0;
+    mLevelBegins.clear();
+    mLevelSizes.clear();
+}
+
+template <typename HashT>
+uint_t SimhashFrozenContainer<HashT>::GetSize()
+{
+    return static_cast<uint_t>(mSize);
+}
+
+template <typename HashT>
+bool SimhashFrozenContainer<HashT>::Search(HashT hash)
+{
+    const size_t pos = LowerBound(hash);
+    return pos < mSize && mValues[pos] == hash;
+}
+
+template <typename HashT>
+bool SimhashFrozenContainer<HashT>::HasNearDups(HashT hash, HashT mask,
+    uint_t hamDist)
+{
+    HashT tmp;
+    return FindFirstNearDup(hash, tmp, mask, hamDist);
+}
+
+template <typename HashT>
+bool SimhashFrozenContainer<HashT>::FindFirstNearDup(HashT hash,
+    HashT &nearDup, HashT mask, uint_t hamDist)
+{
+    AnswerType ans;
+    ScanBucket(hash, mask, std::min(hamDist, mMaxHamDist),
+        LowerBound(hash & mask), true, ans);
+    if (ans.empty())
+    {
+        return false;
+    }
+    nearDup = ans.front();
+    return true;
+}
+
+template <typename HashT>
+bool SimhashFrozenContainer<HashT>::FindNearDups(HashT hash,
+    AnswerType &ans, HashT mask, uint_t hamDist)
+{
+    ans.clear();
+    ScanBucket(hash, mask, std::min(hamDist, mMaxHamDist),
+        LowerBound(hash & mask), false, ans);
+    return !ans.empty();
+}
+
+template <typename HashT>
+void SimhashFrozenContainer<HashT>::ScanBucket(HashT hash, HashT mask,
+    uint_t hamDist, size_t lower, bool firstOnly, AnswerType &ans)
+{
+    SIMHASH_STATS(if (mStats) ++mStats->levels[0].bucketsProbed);
+    const HashT upper = hash | ~mask;
+    for (size_t i = lower; i < mSize && mValues[i] <= upper; ++i)
+    {
+        SIMHASH_STATS(if (mStats) ++mStats->levels[0].candidatesCompared);
+        if (BasicSimhash<HashT>::IsNearDups(hash, mValues[i], hamDist))
+        {
+            SIMHASH_STATS(if (mStats) ++mStats->levels[0].matches);
+            ans.push_back(mValues[i]);
+            if (firstOnly)
+            {
+                break;
+            }
+        }
+    }
+}
+
+template <typename HashT>
+void SimhashFrozenContainer<HashT>::FindNearDupsBatch(
+    const std::vector<HashT> &hashes, HashT mask,
+    std::vector<AnswerType> &answers, uint_t depth)
+{
+    answers.assign(hashes.size(), AnswerType());
+    depth = std::max(depth, 1U);
+    std::vector<size_t> nodes(depth);
+    for (size_t begin = 0; begin < hashes.size(); begin += depth)
+    {
+        const size_t num = std::min(static_cast<size_t>(depth),
+            hashes.size() - begin);
+        //The descents of num queries go in lockstep, a level at a time. Each
+        //step prefetches the node of the next level, which is loaded while
+        //the other queries step. A query past the end stays at mSize.
+        for (size_t j = 0; j < num; ++j)
+        {
+            nodes[j] = mLevelSizes.empty() ? mSize : 0U;
+        }
+        for (size_t l = 0; l < mLevelSizes.size(); ++l)
+        {
+            const HashT *level = mTree + mLevelBegins[l];
+            const HashT *next = l + 1U < mLevelSizes.size()
+                ? mTree + mLevelBegins[l + 1U] : mValues;
+            for (size_t j = 0; j < num; ++j)
+            {
+                if (nodes[j] >= mSize)
+                {
+                    continue;
+                }
+                const size_t node = nodes[j] * NODE_KEYS + CountNodeLess(
+                    level + nodes[j] * NODE_KEYS, hashes[begin + j] & mask);
+                if (node >= mLevelSizes[l])
+                {
+                    nodes[j] = mSize;
+                    continue;
+                }
+                nodes[j] = node;
+                __builtin_prefetch(next + node * NODE_KEYS);
+            }
+        }
+        for (size_t j = 0; j < num; ++j)
+        {
+            const HashT hash = hashes[begin + j];
+            size_t lower = nodes[j];
+            if (lower < mSize)
+            {
+                lower = lower * NODE_KEYS + CountNodeLess(mValues
+                    + lower * NODE_KEYS, hash & mask);
+            }
+            ScanBucket(hash, mask, mMaxHamDist, lower, false,
+                answers[begin + j]);
+        }
+    }
+}
+
+template <typename HashT>
+void SimhashFrozenContainer<HashT>::Traverse(
+    SimhashContainerVisitor<HashT> &visitor)
+{
+    for (size_t i = 0; i < mSize; ++i)
+    {
+        visitor.Visit(mValues[i]);
+    }
+}
+
+template <typename HashT>
+void SimhashFrozenContainer<HashT>::TraverseRange(HashT lower, HashT upper,
+    SimhashContainerVisitor<HashT> &visitor)
+{
+    for (size_t i = LowerBound(lower); i < mSize && mValues[i] <= upper; ++i)
+    {
+        visitor.Visit(mValues[i]);
+    }
+}
+
+template <typename HashT>
+void SimhashFrozenContainer<HashT>::GetBucketReport(
+    SimhashBucketReport &report)
+{
+    ++report.containerNum;
+    uint64_t size = 0UL;
+    HashT key(0U);
+    for (size_t i = 0; i < mSize; ++i)
+    {
+        if (size && (mValues[i] & mKeyMask) == key)
+        {
+            ++size;
+            continue;
+        }
+        report.AddBucket(size);
+        key = mValues[i] & mKeyMask;
+        size = 1UL;
+    }
+    report.AddBucket(size);
+}
+
+template <typename HashT>
+void SimhashFrozenContainer<HashT>::GetMemoryUsage(SimhashMemoryUsage &usage)
+{
+    SimhashContainerMemory memory;
+    memory.level = mLevel;
+    memory.elementNum = mSize;
+    memory.nodeBytes = (mValueBuff.capacity() + mTreeBuff.capacity())
+        * sizeof(HashT);
+    memory.overheadBytes = GetMallocChunkBytes(sizeof(*this))
+        + (mLevelBegins.capacity() + mLevelSizes.capacity()) * sizeof(size_t);
+    usage.AddContainer(memory);
+}
+
+template <typename HashT>
+SimhashIndexedContainer<HashT>::SimhashIndexedContainer(
+    const SimhashTableOptions &options, uint_t level, uint_t maskBeginPos,
+    uint_t maskEndPos)
+    : SimhashContainer<HashT>(options.maxHamDist, level)
+    , mBlockNum(        options.maxHamDist + 1U )
+    , mContainer(       options.maxHamDist + 1U )
+    , mProps(           options.maxHamDist + 1U )
+    , mMaskBeginPos(    maskBeginPos    )
+    , mMaskEndPos(      maskEndPos      )
+    , mFilterBitsPerKey(options.prefilterBitsPerKey )
+    , mFilterCapacity(  0U              )
+    , mFilterKeys(      0U              )
+    , mFilterStale(     0U              )
+{
+    bool ret = Init(options);
+    if (!ret)
+    {
+        throw std::bad_alloc();
+    }
+}
+
+template <typename HashT>
+SimhashIndexedContainer<HashT>::~SimhashIndexedContainer()
+{}
+
+template <typename HashT>
+bool SimhashIndexedContainer<HashT>::Init(const SimhashTableOptions &options)
+{
+    std::vector<uint_t> widths;
+    GetBlockWidths(options.bitEntropies, widths);
+    SimhashTableOptions subOptions(options);
+    uint_t maskWidth = mMaskEndPos;
+    for (uint_t i = 0; i < mBlockNum; ++i)
+    {
+        //Set props.
+        if (0 == i)
+        {
+            mProps.at(i).leftWidth = 0U;
+            mProps.at(i).leftForwardMask = HashT(0U);
+        }
+        else
+        {
+            mProps.at(i).leftWidth = mProps.at(i - 1U).leftWidth
+                + mProps.at(i - 1U).rightWidth;
+            mProps.at(i).leftForwardMask = mProps.at(i - 1U).leftForwardMask
+                | mProps.at(i - 1U).rightForwardMask;
+        }
+        mProps.at(i).rightWidth = widths.at(i);
+        mProps.at(i).rightForwardMask = HashT(0U);
+        for (uint_t j = maskWidth - mProps.at(i).rightWidth; j < maskWidth; ++j)
+        {
+            mProps.at(i).rightForwardMask |= HashT(1U) << j;
+        }
+        maskWidth -= mProps.at(i).rightWidth;
+        mProps.at(i).leftBackwardMask
+            = mProps.at(i).rightForwardMask << mProps.at(i).leftWidth;
+        mProps.at(i).rightBackwardMask
+            = mProps.at(i).leftForwardMask  >> mProps.at(i).rightWidth;
+        mProps.at(i).surroundMask
+            = ~(mProps.at(i).leftForwardMask | mProps.at(i).rightForwardMask);
+        mProps.at(i).keyMask = ~GetLowMask<HashT>(mMaskEndPos
+            - mProps.at(i).rightWidth);
+
+        //Permute the entropies the same way as the values, for the blocks
+        //of the sub-container.
+        if (!options.bitEntropies.empty())
+        {
+            const uint_t width = mProps.at(i).rightWidth;
+            for (uint_t j = maskWidth; j + width < mMaskEndPos; ++j)
+            {
+                subOptions.bitEntropies[j] = options.bitEntropies[j + width];
+            }
+            for (uint_t j = 0; j < width; ++j)
+            {
+                subOptions.bitEntropies[mMaskEndPos - width + j]
+                    = options.bitEntropies[maskWidth + j];
+            }
+        }
+
+        //Create container.
+        mContainer.at(i) = SimhashContainerFactory<HashT>::CreateSimhashContainer(
+            subOptions, mLevel - 1U, 0U, mMaskEndPos - mProps.at(i).rightWidth);
+        if (!mContainer.at(i))
+        {
+            throw std::bad_alloc();
+            return false;
+        }
+    }
+    //The keys of the top container are dense, e.g. 2^16 keys are all taken
+    //by 1M values, so only the containers below it keep filters.
+    if (options.usePrefilter && mMaskEndPos < SimhashContainer<HashT>::WIDTH)
+    {
+        mFilters.resize(mBlockNum);
+        RebuildFilters(0U);
+    }
+    return true;
+}
+
+template <typename HashT>
+void SimhashIndexedContainer<HashT>::GetBlockWidths(
+    const std::vector<real_t> &entropies, std::vector<uint_t> &widths)
+{
+    //Equal widths, the higher blocks take the remaining bits.
+    const uint_t maskWidth = mMaskEndPos - mMaskBeginPos;
+    widths.assign(mBlockNum, maskWidth / mBlockNum);
+    for (uint_t i = 0; i < maskWidth % mBlockNum; ++i)
+    {
+        ++widths[i];
+    }
+    if (entropies.empty() || maskWidth < mBlockNum)
+    {
+        return;
+    }
+    //sums[t] is the entropy of the highest t bits of the mask.
+    std::vector<real_t> sums(maskWidth + 1U, 0.0);
+    for (uint_t t = 0; t < maskWidth; ++t)
+    {
+        sums[t + 1U] = sums[t] + entropies[mMaskEndPos - 1U - t];
+    }
+    real_t equalMin = sums[maskWidth];
+    for (uint_t i = 0, t = 0; i < mBlockNum; t += widths[i++])
+    {
+        equalMin = std::min(equalMin, sums[t + widths[i]] - sums[t]);
+    }
+    //best[b][t] is the max of the lowest block entropy, when the highest t
+    //bits are split into b blocks, and from[b][t] is the bits of the first
+    //b - 1 blocks of that split.
+    const real_t NONE = -1.0;
+    std::vector<std::vector<real_t> > best(mBlockNum + 1U,
+        std::vector<real_t>(maskWidth + 1U, NONE));
+    std::vector<std::vector<uint_t> > from(mBlockNum + 1U,
+        std::vector<uint_t>(maskWidth + 1U, 0U));
+    best[0][0] = sums[maskWidth];
+    for (uint_t b = 1U; b <= mBlockNum; ++b)
+    {
+        for (uint_t t = b; t + mBlockNum - b <= maskWidth; ++t)
+        {
+            for (uint_t f = b - 1U; f < t; ++f)
+            {
+                if (NONE == best[b - 1U][f])
+                {
+                    continue;
+                }
+                const real_t value = std::min(best[b - 1U][f],
+                    sums[t] - sums[f]);
+                if (value > best[b][t])
+                {
+                    best[b][t] = value;
+                    from[b][t] = f;
+                }
+            }
+        }
+    }
+    //Keep the equal widths unless the entropy gets better clearly.
+    if (best[mBlockNum][maskWidth] <= equalMin + 1e-6)
+    {
+        return;
+    }
+    for (uint_t b = mBlockNum, t = maskWidth; b > 0; --b)
+    {
+        widths[b - 1U] = t - from[b][t];
+        t = from[b][t];
+    }
+}
+
+template <typename HashT>
+void SimhashIndexedContainer<HashT>::RebuildFilters(uint_t capacity)
+{
+    //At least 1024 keys, so that a small container is not rebuilt too often.
+    static const uint_t MIN_CAPACITY = 1024U;
+    mFilterCapacity = std::max(capacity, MIN_CAPACITY);
+    for (typename FiltersType::iterator it = mFilters.begin();
+        mFilters.end() != it; ++it)
+    {
+        it->Reset(mFilterCapacity, mFilterBitsPerKey);
+    }
+    mFilterKeys = 0U;
+    mFilterStale = 0U;
+    if (!capacity)
+    {
+        return;
+    }
+    //Add keys of all simhash values in the front container.
+    FilterBuilder builder(*this);
+    mContainer.front()->Traverse(builder);
+}
+
+template <typename HashT>
+void SimhashIndexedContainer<HashT>::AddFilterKeys(HashT hash)
+{
+    for (uint_t i = 0; i < mBlockNum; ++i)
+    {
+        mFilters[i].Add(FoldHash(ForwardPermute(hash, mProps[i])
+            & mProps[i].keyMask));
+    }
+    ++mFilterKeys;
+}
+
+template <typename HashT>
+void SimhashIndexedContainer<HashT>::Clear()
+{
+    for (typename ContainerType::iterator it = mContainer.begin();
+        it != mContainer.end(); ++it)
+    {
+        (*it)->Clear();
+    }
+    if (!mFilters.empty())
+    {
+        RebuildFilters(0U);
+    }
+}
+
+template <typename HashT>
+uint_t SimhashIndexedContainer<HashT>::GetSize()
+{
+    return static_cast<uint_t>(mContainer.front()->GetSize());
+}
+
+template <typename HashT>
+bool SimhashIndexedContainer<HashT>::Insert(HashT hash)
+{
+    //Attempt insert hash into the front container.
+    if (!mContainer.front()->Insert(hash))
+    {
+        return false;
+    }
+    //Insert into all redundancy containers.
+    //Generate forward permutes.
+    std::vector<HashT> forwordPermutes;
+    GetForwardPermutes(hash, forwordPermutes);
+    //Insert hash into all redundancy containers.
+    for (uint_t i = 1U; i < mBlockNum; ++i)
+    {
+        //Should return true.
+        mContainer.at(i)->Insert(forwordPermutes.at(i));
+    }
+    //Add keys into the prefilters, grow them when they are full.
+    if (!mFilters.empty())
+    {
+        if (mFilterKeys >= mFilterCapacity)
+        {
+            RebuildFilters(2U * GetSize());
+        }
+        else
+        {
+            AddFilterKeys(hash);
+        }
+    }
+    return true;
+}
+
+template <typename HashT>
+bool SimhashIndexedContainer<HashT>::Remove(HashT hash)
+{
+    //Attempt remove hash from the front container.
+    if (!mContainer.front()->Remove(hash))
+    {
+        return false;
+    }
+    //Remove from all redundancy containers.
+    //Generate forward permutes.
+    std::vector<HashT> forwordPermutes;
+    GetForwardPermutes(hash, forwordPermutes);
+    for (uint_t i = 1U; i < mBlockNum; ++i)
+    {
+        //Should return true.
+        mContainer.at(i)->Remove(forwordPermutes.at(i));
+    }
+    //Keys can't be removed from the prefilters, rebuild them when half of the
+    //keys are stale.
+    if (!mFilters.empty() && ++mFilterStale > mFilterCapacity / 2U)
+    {
+        RebuildFilters(2U * GetSize());
+    }
+    return true;
+}
+
+template <typename HashT>
+bool SimhashIndexedContainer<HashT>::Update(HashT oldHash, HashT newHash)
+{
+    if (!mContainer.front()->Update(oldHash, newHash))
+    {
+        return false;
+    }
+    std::vector<HashT> oldPermutes, newPermutes;
+    GetForwardPermutes(oldHash, oldPermutes);
+    GetForwardPermutes(newHash, newPermutes);
+    for (uint_t i = 1U; i < mBlockNum; ++i)
+    {
+        //Should return true.
+        mContainer.at(i)->Update(oldPermutes.at(i), newPermutes.at(i));
+    }
+    if (mFilters.empty())
+    {
+        return true;
+    }
+    //Only the changed keys are added, and each leaves a stale key.
+    bool changed = false;
+    for (uint_t i = 0; i < mBlockNum; ++i)
+    {
+        const HashT newKey = newPermutes[i] & mProps[i].keyMask;
+        if ((oldPermutes[i] & mProps[i].keyMask) != newKey)
+        {
+            mFilters[i].Add(FoldHash(newKey));
+            changed = true;
+        }
+    }
+    if (!changed)
+    {
+        return true;
+    }
+    ++mFilterKeys;
+    if (mFilterKeys >= mFilterCapacity || ++mFilterStale > mFilterCapacity / 2U)
+    {
+        RebuildFilters(2U * GetSize());
+    }
+    return true;
+}
+
+template <typename HashT>
+bool SimhashIndexedContainer<HashT>::Search(HashT hash)
+{
+    //Find hash from the front container.
     return mContainer.front()->Search(hash);
 }
 
-bool SimhashIndexedContainer::FindNearDups(hash_t hash, FindAnswerType &ans,
-    hash_t mask)
+template <typename HashT>
+bool SimhashIndexedContainer<HashT>::FindNearDups(HashT hash, AnswerType &ans,
+    HashT mask, uint_t hamDist)
+{
+    //Init.
+    ans.clear();
+    hamDist = std::min(hamDist, mMaxHamDist);
+    //Generate forward permutes.
+    std::vector<HashT> forwordPermutes;
+    GetForwardPermutes(hash, forwordPermutes);
+    //Find hash from the redundancy containers, a value within hamDist bits
+    //equals hash on at least one of any hamDist + 1 blocks.
+    AnswerType subAns;
+    for (uint_t i = 0; i <= hamDist; ++i)
+    {
+        if (!MayContain(i, forwordPermutes[i]))
+        {
+            continue;
+        }
+        mContainer.at(i)->FindNearDups(forwordPermutes.at(i), subAns,
+            mProps.at(i).leftBackwardMask | mask, hamDist);
+        for (typename AnswerType::iterator iter = subAns.begin();
+            subAns.end() != iter; ++iter)
+        {
+            ans.push_back(BackwardPermute(*iter, mProps.at(i)));
+        }
+    }
+    return !ans.empty();
+}
+
+template <typename HashT>
+void SimhashIndexedContainer<HashT>::FindNearDupsBatch(
+    const std::vector<HashT> &hashes, HashT mask,
+    std::vector<AnswerType> &answers, uint_t depth)
+{
+    answers.assign(hashes.size(), AnswerType());
+    //Pass the permutes of all hashes to each container as a batch.
+    std::vector<HashT> permutes;
+    std::vector<size_t> origins;
+    std::vector<AnswerType> subAnswers;
+    for (uint_t i = 0; i < mBlockNum; ++i)
+    {
+        permutes.clear();
+        origins.clear();
+        for (size_t j = 0; j < hashes.size(); ++j)
+        {
+            const HashT permute = ForwardPermute(hashes[j], mProps[i]);
+            if (MayContain(i, permute))
+            {
+                permutes.push_back(permute);
+                origins.push_back(j);
+            }
+        }
+        mContainer[i]->FindNearDupsBatch(permutes,
+            mProps[i].leftBackwardMask | mask, subAnswers, depth);
+        for (size_t j = 0; j < origins.size(); ++j)
+        {
+            AnswerType &ans = answers[origins[j]];
+            for (typename AnswerType::iterator it = subAnswers[j].begin();
+                subAnswers[j].end() != it; ++it)
+            {
+                ans.push_back(BackwardPermute(*it, mProps[i]));
+            }
+        }
+    }
+}
+
+template <typename HashT>
+SimhashIndexedContainer<HashT>::BlockJoiner::BlockJoiner(
+    JoinContext &context, uint_t block, const std::vector<HashT> &permutes)
+    : mContext(context)
+    , mOwner(*context.owner)
+    , mBlock(block)
+    , mPermutes(permutes)
+    , mNext(0U)
+{}
+
+template <typename HashT>
+void SimhashIndexedContainer<HashT>::BlockJoiner::Visit(HashT hash)
+{
+    const SingleContainerProps &props = mOwner.mProps[mBlock];
+    const HashT key = hash & props.keyMask;
+    //The values come in ascending order, so do the keys.
+    while (mNext < mPermutes.size() && (mPermutes[mNext] & props.keyMask) < key)
+    {
+        ++mNext;
+    }
+    for (size_t q = mNext; q < mPermutes.size()
+        && (mPermutes[q] & props.keyMask) == key; ++q)
+    {
+        const HashT diff = mPermutes[q] ^ hash;
+        const uint_t distance = PopCount(diff);
+        if (distance > mOwner.mMaxHamDist)
+        {
+            continue;
+        }
+        //The pair is taken under the first block they have in common, the
+        //permutation moves the bits of diff back as the values.
+        const HashT origin = mOwner.BackwardPermute(diff, props);
+        bool first = true;
+        for (uint_t b = 0; b < mBlock && first; ++b)
+        {
+            first = (origin & mOwner.mProps[b].rightForwardMask) != HashT(0U);
+        }
+        if (!first)
+        {
+            continue;
+        }
+        JoinMatch match;
+        match.query = mOwner.BackwardPermute(mPermutes[q], props);
+        match.match = mOwner.BackwardPermute(hash, props);
+        match.distance = distance;
+        mMatches.push_back(match);
+        if (mMatches.size() >= FLUSH_SIZE)
+        {
+            Flush();
+        }
+    }
+}
+
+template <typename HashT>
+void SimhashIndexedContainer<HashT>::BlockJoiner::Flush()
+{
+    pthread_mutex_lock(&mContext.mutex);
+    for (size_t i = 0; i < mMatches.size(); ++i)
+    {
+        mContext.callback->OnMatch(mMatches[i].query, mMatches[i].match,
+            mMatches[i].distance);
+    }
+    pthread_mutex_unlock(&mContext.mutex);
+    mMatches.clear();
+}
+
+template <typename HashT>
+bool SimhashIndexedContainer<HashT>::Join(const std::vector<HashT> &queries,
+    BasicSimhashJoinCallback<HashT> &callback, uint_t threadNum)
+{
+    //The blocks cover all bits only at the root.
+    if (mMaskEndPos != SimhashContainer<HashT>::WIDTH || mMaskBeginPos)
+    {
+        return false;
+    }
+    JoinContext context;
+    context.owner = this;
+    context.queries = &queries;
+    context.callback = &callback;
+    context.next = 0U;
+    if (!threadNum)
+    {
+        threadNum = static_cast<uint_t>(std::max(sysconf(_SC_NPROCESSORS_ONLN),
+            1L));
+    }
+    threadNum = std::min(threadNum, mBlockNum);
+    pthread_mutex_init(&context.mutex, NULL);
+    //The calling thread is one of them, also if a thread fails to start.
+    std::vector<pthread_t> threads(threadNum);
+    std::vector<bool> started(threadNum, false);
+    for (uint_t i = 1; i < threadNum; ++i)
+    {
+        started[i] = !pthread_create(&threads[i], NULL, RunJoin, &context);
+    }
+    RunJoin(&context);
+    for (uint_t i = 1; i < threadNum; ++i)
+    {
+        if (started[i])
+        {
+            pthread_join(threads[i], NULL);
+        }
+    }
+    pthread_mutex_destroy(&context.mutex);
+    return true;
+}
+
+template <typename HashT>
+void* SimhashIndexedContainer<HashT>::RunJoin(void *arg)
+{
+    JoinContext &context = *static_cast<JoinContext*>(arg);
+    const uint_t blockNum = context.owner->mBlockNum;
+    for (uint_t block = __sync_fetch_and_add(&context.next, 1U);
+        block < blockNum; block = __sync_fetch_and_add(&context.next, 1U))
+    {
+        context.owner->JoinBlock(context, block);
+    }
+    return NULL;
+}
+
+template <typename HashT>
+void SimhashIndexedContainer<HashT>::JoinBlock(JoinContext &context,
+    uint_t block)
+{
+    //The queries are permuted and sorted as the values of the container,
+    //which are merged with them as they are traversed, not copied.
+    const std::vector<HashT> &queries = *context.queries;
+    std::vector<HashT> permutes(queries.size());
+    for (size_t i = 0; i < queries.size(); ++i)
+    {
+        permutes[i] = ForwardPermute(queries[i], mProps[block]);
+    }
+    std::sort(permutes.begin(), permutes.end());
+    BlockJoiner joiner(context, block, permutes);
+    mContainer[block]->Traverse(joiner);
+    joiner.Flush();
+}
+
+template <typename HashT>
+bool SimhashIndexedContainer<HashT>::HasNearDups(HashT hash, HashT mask,
+    uint_t hamDist)
+{
+    HashT tmp;
+    return FindFirstNearDup(hash, tmp, mask, hamDist);
+}
+
+template <typename HashT>
+bool SimhashIndexedContainer<HashT>::FindFirstNearDup(HashT hash, HashT &nearDup,
+    HashT mask, uint_t hamDist)
+{
+    hamDist = std::min(hamDist, mMaxHamDist);
+    //Generate forward permutes.
+    std::vector<HashT> forwordPermutes;
+    GetForwardPermutes(hash, forwordPermutes);
+    //Find hash from the first hamDist + 1 redundancy containers.
+    for (uint_t i = 0; i <= hamDist; ++i)
+    {
+        if (MayContain(i, forwordPermutes[i])
+            && mContainer.at(i)->FindFirstNearDup(forwordPermutes.at(i),
+            nearDup, mProps.at(i).leftBackwardMask | mask, hamDist))
+        {
+            //The value found is permuted, permute it back.
+            nearDup = BackwardPermute(nearDup, mProps.at(i));
+            return true;
+        }
+    }
+    return false;
+}
+
+template <typename HashT>
+void SimhashIndexedContainer<HashT>::Traverse(
+    SimhashContainerVisitor<HashT> &visitor)
+{
+    mContainer.front()->Traverse(visitor);
+}
+
+template <typename HashT>
+void SimhashIndexedContainer<HashT>::TraverseRange(HashT lower, HashT upper,
+    SimhashContainerVisitor<HashT> &visitor)
+{
+    //The front container is not permuted.
+    mContainer.front()->TraverseRange(lower, upper, visitor);
+}
+
+template <typename HashT>
+void SimhashIndexedContainer<HashT>::GetBucketReport(SimhashBucketReport &report)
+{
+    for (typename ContainerType::iterator it = mContainer.begin();
+        mContainer.end() != it; ++it)
+    {
+        (*it)->GetBucketReport(report);
+    }
+}
+
+template <typename HashT>
+void SimhashIndexedContainer<HashT>::GetMemoryUsage(SimhashMemoryUsage &usage)
+{
+    SimhashContainerMemory memory;
+    memory.level = mLevel;
+    memory.elementNum = GetSize();
+    for (typename FiltersType::iterator it = mFilters.begin();
+        mFilters.end() != it; ++it)
+    {
+        memory.filterBytes += it->GetMemoryUsage();
+    }
+    //The object, the vectors, and the shared_ptr control blocks.
+    memory.overheadBytes = GetMallocChunkBytes(sizeof(*this))
+        + GetMallocChunkBytes(mContainer.capacity() * sizeof(SimhashContainerPtr))
+        + GetMallocChunkBytes(mProps.capacity() * sizeof(SingleContainerProps))
+        + GetMallocChunkBytes(mFilters.capacity() * sizeof(BlockedBloomFilter))
+        + mContainer.size() * GetMallocChunkBytes(3UL * sizeof(void*));
+    usage.AddContainer(memory);
+    for (typename ContainerType::iterator it = mContainer.begin();
+        mContainer.end() != it; ++it)
+    {
+        (*it)->GetMemoryUsage(usage);
+    }
+}
+
+template <typename HashT>
+void SimhashIndexedContainer<HashT>::SetStats(SimhashTableStats *stats)
+{
+    SimhashContainer<HashT>::SetStats(stats);
+    for (typename ContainerType::iterator it = mContainer.begin();
+        mContainer.end() != it; ++it)
+    {
+        (*it)->SetStats(stats);
+    }
+}
+
+template <typename HashT>
+typename SimhashIndexedContainer<HashT>::SimhashContainerPtr
+SimhashIndexedContainer<HashT>::Freeze()
+{
+    for (typename ContainerType::iterator it = mContainer.begin();
+        mContainer.end() != it; ++it)
+    {
+        SimhashContainerPtr frozen = (*it)->Freeze();
+        if (frozen)
+        {
+            frozen->SetStats(mStats);
+            *it = frozen;
+        }
+    }
+    return SimhashContainerPtr();
+}
+
+template <typename HashT>
+void SimhashIndexedContainer<HashT>::GetForwardPermutes(HashT hash,
+    std::vector<HashT> &ans)
+{
+    //Init.
+    ans.resize(mBlockNum);
+    //Generate forward permutes.
+    for (uint_t i = 0; i < mBlockNum; ++i)
+    {
+        ans.at(i) = ForwardPermute(hash, mProps.at(i));
+    }
+}
+
+/*
+* class SimhashOverlayContainer
+* SimhashOverlayContainer serves a base container which must not be written,
+* e.g. while a forked child saves it, see SimhashTable::StartSave. The values
+* inserted are kept in a delta container of the same options, and the values
+* removed from the base are kept in a set and filtered out of its answers. So
+* the pages of the base are only read, and no page shared with the child is
+* copied. When the child is done, Merge applies the removes and the delta to
+* the base in one pass, outside of the writes, and the overlay is dropped.
+*/
+template <typename HashT>
+class SimhashOverlayContainer : public SimhashContainer<HashT>
+{
+public:
+    typedef typename SimhashContainer<HashT>::AnswerType AnswerType;
+    typedef typename SimhashContainerFactory<HashT>::ContainerPtr
+        SimhashContainerPtr;
+    typedef std::set<HashT> RemovedType;
+protected:
+    /* This visitor collects the visited values which are not removed. */
+    class Collector : public SimhashContainerVisitor<HashT>
+    {
+    public :
+        Collector(const RemovedType &removed, AnswerType &values)
+            : mRemoved(removed)
+            , mValues(values)
+        {}
+        virtual void Visit(HashT hash)
+        {
+            if (mRemoved.empty() || !mRemoved.count(hash))
+            {
+                mValues.push_back(hash);
+            }
+        }
+    private :
+        const RemovedType &mRemoved;
+        AnswerType &mValues;
+    };
+    /*
+    * This visitor passes the ascending values of the base which are not
+    * removed to visitor, merged with the ascending values of the delta.
+    */
+    class Merger : public SimhashContainerVisitor<HashT>
+    {
+    public :
+        Merger(const RemovedType &removed, const AnswerType &delta,
+            SimhashContainerVisitor<HashT> &visitor)
+            : mRemoved(removed)
+            , mNextRemoved(removed.begin())
+            , mDelta(delta)
+            , mNextDelta(delta.begin())
+            , mVisitor(visitor)
+        {}
+        virtual void Visit(HashT hash)
+        {
+            for (; mDelta.end() != mNextDelta && *mNextDelta < hash;
+                ++mNextDelta)
+            {
+                mVisitor.Visit(*mNextDelta);
+            }
+            for (; mRemoved.end() != mNextRemoved && *mNextRemoved < hash;
+                ++mNextRemoved)
+            {}
+            if (mRemoved.end() == mNextRemoved || hash < *mNextRemoved)
+            {
+                mVisitor.Visit(hash);
+            }
+        }
+        /* Passes the values of the delta after the last one of the base. */
+        void Finish()
+        {
+            for (; mDelta.end() != mNextDelta; ++mNextDelta)
+            {
+                mVisitor.Visit(*mNextDelta);
+            }
+        }
+    private :
+        const RemovedType &mRemoved;
+        typename RemovedType::const_iterator mNextRemoved;
+        const AnswerType &mDelta;
+        typename AnswerType::const_iterator mNextDelta;
+        SimhashContainerVisitor<HashT> &mVisitor;
+    };
+public:
+    SimhashOverlayContainer(const SimhashTableOptions &options,
+        SimhashContainerPtr base);
+    virtual ~SimhashOverlayContainer();
+private :
+    SimhashOverlayContainer(const SimhashOverlayContainer &another);
+    SimhashOverlayContainer& operator= (const SimhashOverlayContainer
+        &another);
+public:
+    virtual bool Insert         (HashT hash);
+    virtual bool Remove         (HashT hash);
+    virtual bool Search         (HashT hash);
+    virtual bool HasNearDups    (HashT hash, HashT mask = HashT(0U),
+        uint_t hamDist = TABLE_RADIUS);
+    virtual bool FindFirstNearDup(HashT hash, HashT &nearDup,
+        HashT mask = HashT(0U), uint_t hamDist = TABLE_RADIUS);
+    virtual bool FindNearDups   (HashT hash, AnswerType &ans,
+        HashT mask = HashT(0U), uint_t hamDist = TABLE_RADIUS);
+    virtual void FindNearDupsBatch(const std::vector<HashT> &hashes,
+        HashT mask, std::vector<AnswerType> &answers, uint_t depth);
+    virtual void    Clear();
+    virtual uint_t  GetSize();
+    virtual void Traverse(SimhashContainerVisitor<HashT> &visitor);
+    virtual void GetBucketReport(SimhashBucketReport &report);
+    virtual void SetStats(SimhashTableStats *stats);
+    virtual void GetMemoryUsage(SimhashMemoryUsage &usage);
+    /* Applies the removes and the delta to the base, once it is writable. */
+    void Merge();
+    SimhashContainerPtr GetBase() const
+    {
+        return mBase;
+    }
+protected:
+    /* Removes the values removed from the base out of ans. */
+    void Filter(AnswerType &ans);
+    inline bool IsRemoved(HashT hash) const
+    {
+        return !mRemoved.empty() && mRemoved.count(hash);
+    }
+protected:
+    SimhashContainerPtr mBase;
+    SimhashContainerPtr mDelta;
+    RemovedType mRemoved;       // The values removed but still in the base.
+    using SimhashContainer<HashT>::mLevel;
+    using SimhashContainer<HashT>::TABLE_RADIUS;
+};
+
+template <typename HashT>
+SimhashOverlayContainer<HashT>::SimhashOverlayContainer(
+    const SimhashTableOptions &options, SimhashContainerPtr base)
+    : SimhashContainer<HashT>(options.maxHamDist, options.level)
+    , mBase(base)
+{
+    mDelta = SimhashContainerFactory<HashT>::CreateSimhashContainer(options,
+        options.level);
+}
+
+template <typename HashT>
+SimhashOverlayContainer<HashT>::~SimhashOverlayContainer()
+{}
+
+template <typename HashT>
+void SimhashOverlayContainer<HashT>::Filter(AnswerType &ans)
+{
+    if (mRemoved.empty())
+    {
+        return;
+    }
+    typename AnswerType::iterator out = ans.begin();
+    for (typename AnswerType::iterator it = ans.begin(); ans.end() != it; ++it)
+    {
+        if (!mRemoved.count(*it))
+        {
+            *out++ = *it;
+        }
+    }
+    ans.erase(out, ans.end());
+}
+
+template <typename HashT>
+bool SimhashOverlayContainer<HashT>::Insert(HashT hash)
+{
+    //A value is in one of the base and the delta.
+    if (!mRemoved.empty() && mRemoved.erase(hash))
+    {
+        return true;
+    }
+    return !mBase->Search(hash) && mDelta->Insert(hash);
+}
+
+template <typename HashT>
+bool SimhashOverlayContainer<HashT>::Remove(HashT hash)
+{
+    if (mDelta->Remove(hash))
+    {
+        return true;
+    }
+    if (IsRemoved(hash))
+    {
+        return false;
+    }
+    return mBase->Search(hash) && mRemoved.insert(hash).second;
+}
+
+template <typename HashT>
+bool SimhashOverlayContainer<HashT>::Search(HashT hash)
+{
+    return mDelta->Search(hash) || (mBase->Search(hash) && !IsRemoved(hash));
+}
+
+template <typename HashT>
+bool SimhashOverlayContainer<HashT>::HasNearDups(HashT hash, HashT mask,
+    uint_t hamDist)
+{
+    if (mDelta->HasNearDups(hash, mask, hamDist))
+    {
+        return true;
+    }
+    if (mRemoved.empty())
+    {
+        return mBase->HasNearDups(hash, mask, hamDist);
+    }
+    AnswerType ans;
+    mBase->FindNearDups(hash, ans, mask, hamDist);
+    Filter(ans);
+    return !ans.empty();
+}
+
+template <typename HashT>
+bool SimhashOverlayContainer<HashT>::FindFirstNearDup(HashT hash,
+    HashT &nearDup, HashT mask, uint_t hamDist)
+{
+    if (mDelta->FindFirstNearDup(hash, nearDup, mask, hamDist))
+    {
+        return true;
+    }
+    if (mRemoved.empty())
+    {
+        return mBase->FindFirstNearDup(hash, nearDup, mask, hamDist);
+    }
+    AnswerType ans;
+    mBase->FindNearDups(hash, ans, mask, hamDist);
+    Filter(ans);
+    if (ans.empty())
+    {
+        return false;
+    }
+    nearDup = ans.front();
+    return true;
+}
+
+template <typename HashT>
+bool SimhashOverlayContainer<HashT>::FindNearDups(HashT hash,
+    AnswerType &ans, HashT mask, uint_t hamDist)
+{
+    mBase->FindNearDups(hash, ans, mask, hamDist);
+    Filter(ans);
+    AnswerType delta;
+    mDelta->FindNearDups(hash, delta, mask, hamDist);
+    ans.insert(ans.end(), delta.begin(), delta.end());
+    return !ans.empty();
+}
+
+template <typename HashT>
+void SimhashOverlayContainer<HashT>::FindNearDupsBatch(
+    const std::vector<HashT> &hashes, HashT mask,
+    std::vector<AnswerType> &answers, uint_t depth)
+{
+    mBase->FindNearDupsBatch(hashes, mask, answers, depth);
+    std::vector<AnswerType> deltas;
+    mDelta->FindNearDupsBatch(hashes, mask, deltas, depth);
+    for (size_t i = 0; i < answers.size(); ++i)
+    {
+        Filter(answers[i]);
+        answers[i].insert(answers[i].end(), deltas[i].begin(),
+            deltas[i].end());
+    }
+}
+
+template <typename HashT>
+void SimhashOverlayContainer<HashT>::Clear()
+{
+    mBase->Clear();
+    mDelta->Clear();
+    mRemoved.clear();
+}
+
+template <typename HashT>
+uint_t SimhashOverlayContainer<HashT>::GetSize()
+{
+    return mBase->GetSize() - static_cast<uint_t>(mRemoved.size())
+        + mDelta->GetSize();
+}
+
+template <typename HashT>
+void SimhashOverlayContainer<HashT>::Traverse(
+    SimhashContainerVisitor<HashT> &visitor)
+{
+    //Only the delta, the values inserted since the overlay, is copied, the
+    //base is streamed and merged with it in ascending order.
+    AnswerType delta;
+    RemovedType none;
+    Collector collector(none, delta);
+    mDelta->Traverse(collector);
+    Merger merger(mRemoved, delta, visitor);
+    mBase->Traverse(merger);
+    merger.Finish();
+}
+
+template <typename HashT>
+void SimhashOverlayContainer<HashT>::GetBucketReport(
+    SimhashBucketReport &report)
+{
+    mBase->GetBucketReport(report);
+    mDelta->GetBucketReport(report);
+}
+
+template <typename HashT>
+void SimhashOverlayContainer<HashT>::SetStats(SimhashTableStats *stats)
+{
+    SimhashContainer<HashT>::SetStats(stats);
+    mBase->SetStats(stats);
+    mDelta->SetStats(stats);
+}
+
+template <typename HashT>
+void SimhashOverlayContainer<HashT>::GetMemoryUsage(SimhashMemoryUsage &usage)
+{
+    SimhashContainerMemory memory;
+    memory.level = mLevel;
+    memory.overheadBytes = GetMallocChunkBytes(sizeof(*this))
+        + mRemoved.size() * GetSetNodeBytes<HashT>();
+    usage.AddContainer(memory);
+    mBase->GetMemoryUsage(usage);
+    mDelta->GetMemoryUsage(usage);
+}
+
+template <typename HashT>
+void SimhashOverlayContainer<HashT>::Merge()
+{
+    for (typename RemovedType::iterator it = mRemoved.begin();
+        mRemoved.end() != it; ++it)
+    {
+        mBase->Remove(*it);
+    }
+    RemovedType().swap(mRemoved);
+    //The delta is freed whole, not value by value.
+    AnswerType values;
+    RemovedType none;
+    Collector collector(none, values);
+    mDelta->Traverse(collector);
+    mDelta->Clear();
+    for (typename AnswerType::iterator it = values.begin();
+        values.end() != it; ++it)
+    {
+        mBase->Insert(*it);
+    }
+}
+
+template <typename HashT>
+typename SimhashContainerFactory<HashT>::ContainerPtr
+SimhashContainerFactory<HashT>::CreateSimhashContainer(
+        const SimhashTableOptions &options, uint_t level, uint_t maskBeginPos,
+        uint_t maskEndPos)
+{
+    if (!level && SIMHASH_LEAF_SORTED_ARRAY == options.leafType)
+    {
+        return ContainerPtr(new SimhashSortedContainer<HashT>(
+            options, level, maskEndPos));
+    }
+    else if (!level)
+    {
+        return ContainerPtr(new SimhashSequentialContainner<HashT>(
+            options, level, maskEndPos));
+    }
+    else
+    {
+        return ContainerPtr(new SimhashIndexedContainer<HashT>(
+            options, level, maskBeginPos, maskEndPos));
+    }
+}
+
+SimhashTableOptions::SimhashTableOptions(uint_t maxHamDist, uint_t level)
+    : maxHamDist(           maxHamDist  )
+    , level(                level       )
+    , usePrefilter(         false       )
+    , prefilterBitsPerKey(  10U         )
+    , hotBucketSize(        0U          )
+    , bitSliceSize(         0U          )
+    , leafType(             SIMHASH_LEAF_SET    )
+    , useNodeArena(         true        )
+{}
+
+template <typename HashT>
+BasicSimhashTable<HashT>::BasicSimhashTable()
+{}
+
+template <typename HashT>
+BasicSimhashTable<HashT>::~BasicSimhashTable()
+{}
+
+/*
+* class BitPermutation
+* BitPermutation moves the bits of simhash values by a bit order, bit i of the
+* result is bit order[i] of the input. It looks up a table for each byte, so
+* that a permutation costs WIDTH / 8 loads. The empty order is the identity.
+*/
+template <typename HashT>
+class BitPermutation
+{
+public :
+    static const uint_t WIDTH = HashTraits<HashT>::WIDTH;
+    static const uint_t BYTES = WIDTH / 8U;
+public :
+    BitPermutation()
+        : mIdentity(true)
+    {}
+    /* Sets the order, throws std::invalid_argument if it isn't a permutation. */
+    void Reset(const std::vector<uint_t> &order);
+    inline HashT Forward(HashT hash) const
+    {
+        return mIdentity ? hash : Apply(mForward, hash);
+    }
+    inline HashT Backward(HashT hash) const
+    {
+        return mIdentity ? hash : Apply(mBackward, hash);
+    }
+    bool IsIdentity() const
+    {
+        return mIdentity;
+    }
+    uint64_t GetMemoryUsage() const
+    {
+        return (mForward.capacity() + mBackward.capacity()) * sizeof(HashT);
+    }
+private :
+    static inline HashT Apply(const std::vector<HashT> &tables, HashT hash)
+    {
+        HashT ans(0U);
+        for (uint_t i = 0; i < BYTES; ++i)
+        {
+            ans |= tables[i * 256U + GetByte(hash, i)];
+        }
+        return ans;
+    }
+private :
+    bool mIdentity;
+    std::vector<HashT> mForward;    // BYTES tables of 256 entries.
+    std::vector<HashT> mBackward;
+};
+
+template <typename HashT>
+void BitPermutation<HashT>::Reset(const std::vector<uint_t> &order)
+{
+    mIdentity = order.empty();
+    mForward.clear();
+    mBackward.clear();
+    if (mIdentity)
+    {
+        return;
+    }
+    //positions[j] is where bit j of the input goes.
+    std::vector<uint_t> positions(WIDTH, WIDTH);
+    for (uint_t i = 0; i < order.size(); ++i)
+    {
+        if (WIDTH != order.size() || order[i] >= WIDTH
+            || WIDTH != positions[order[i]])
+        {
+            throw std::invalid_argument("bitOrder is not a permutation");
+        }
+        positions[order[i]] = i;
+    }
+    mForward.assign(BYTES * 256U, HashT(0U));
+    mBackward.assign(BYTES * 256U, HashT(0U));
+    for (uint_t i = 0; i < BYTES; ++i)
+    {
+        for (uint_t value = 0; value < 256U; ++value)
+        {
+            for (uint_t j = 0; j < 8U; ++j)
+            {
+                if (value & (1U << j))
+                {
+                    mForward[i * 256U + value]
+                        |= HashT(1U) << positions[i * 8U + j];
+                    mBackward[i * 256U + value]
+                        |= HashT(1U) << order[i * 8U + j];
+                }
+            }
+        }
+    }
+}
+
+/*
+* class SimhashFileVisitor
+* SimhashFileVisitor writes the visited simhash values into a file, permuting
+* them back by the bit order of the table.
+*/
+template <typename HashT>
+class SimhashFileVisitor : public SimhashContainerVisitor<HashT>
+{
+public :
+    SimhashFileVisitor(SimhashFileWriter<HashT> &writer,
+        const BitPermutation<HashT> &bitOrder)
+        : mWriter(writer)
+        , mBitOrder(bitOrder)
+    {}
+    virtual void Visit(HashT hash)
+    {
+        mWriter.Write(mBitOrder.Backward(hash));
+    }
+private :
+    SimhashFileWriter<HashT> &mWriter;
+    const BitPermutation<HashT> &mBitOrder;
+};
+
+/*
+* class SimhashSortVisitor
+* SimhashSortVisitor permutes the visited simhash values back by the bit order
+* of the table, and sorts them into values by their top SORT_BITS bits. It is
+* passed to two traversals : the first counts the values of each bucket, and
+* after StartPlacing the second places them, so no second copy of them is
+* made. Finish sorts each bucket alone.
+*/
+template <typename HashT>
+class SimhashSortVisitor : public SimhashContainerVisitor<HashT>
+{
+public :
+    static const uint_t WIDTH = HashTraits<HashT>::WIDTH;
+    static const uint_t SORT_BITS = 16U;
+public :
+    SimhashSortVisitor(const BitPermutation<HashT> &bitOrder,
+        std::vector<HashT> &values)
+        : mBitOrder(bitOrder)
+        , mValues(values)
+        , mStarts((1U << SORT_BITS) + 1U, 0U)
+        , mPlacing(false)
+    {}
+    virtual void Visit(HashT hash)
+    {
+        const HashT value = mBitOrder.Backward(hash);
+        const uint_t bucket = static_cast<uint_t>(
+            GetWord(value >> (WIDTH - SORT_BITS), 0U));
+        if (mPlacing)
+        {
+            mValues[mNext[bucket]++] = value;
+        }
+        else
+        {
+            ++mStarts[bucket + 1U];
+        }
+    }
+    /* Ends the counting traversal. */
+    void StartPlacing()
+    {
+        for (size_t i = 1U; i < mStarts.size(); ++i)
+        {
+            mStarts[i] += mStarts[i - 1U];
+        }
+        mValues.resize(mStarts.back());
+        mNext.assign(mStarts.begin(), mStarts.end() - 1);
+        mPlacing = true;
+    }
+    /* Ends the placing traversal. */
+    void Finish()
+    {
+        for (size_t i = 0; i + 1U < mStarts.size(); ++i)
+        {
+            if (mStarts[i + 1U] - mStarts[i] > 1U)
+            {
+                std::sort(mValues.begin() + mStarts[i],
+                    mValues.begin() + mStarts[i + 1U]);
+            }
+        }
+    }
+private :
+    const BitPermutation<HashT> &mBitOrder;
+    std::vector<HashT> &mValues;
+    std::vector<size_t> mStarts;    // The start of each bucket, and the end.
+    std::vector<size_t> mNext;      // The next place of each bucket.
+    bool mPlacing;
+};
+
+/*
+* class SimhashJoinBackward
+* SimhashJoinBackward passes the matches of a join of the permuted values to
+* the callback, permuting them back by the bit order of the table.
+*/
+template <typename HashT>
+class SimhashJoinBackward : public BasicSimhashJoinCallback<HashT>
+{
+public :
+    SimhashJoinBackward(BasicSimhashJoinCallback<HashT> &callback,
+        const BitPermutation<HashT> &bitOrder)
+        : mCallback(callback)
+        , mBitOrder(bitOrder)
+    {}
+    virtual void OnMatch(HashT query, HashT match, uint_t distance)
+    {
+        mCallback.OnMatch(mBitOrder.Backward(query), mBitOrder.Backward(match),
+            distance);
+    }
+private :
+    BasicSimhashJoinCallback<HashT> &mCallback;
+    const BitPermutation<HashT> &mBitOrder;
+};
+
+template <typename HashT>
+class SimhashTableImpl : public BasicSimhashTable<HashT>
+{
+public :
+    typedef typename BasicSimhashTable<HashT>::AnswerType AnswerType;
+private:
+    SimhashTableImpl(const SimhashTableOptions &options);
+    SimhashTableImpl(const SimhashTableImpl&);
+    SimhashTableImpl& operator=(const SimhashTableImpl&);
+public :
+    virtual ~SimhashTableImpl();
+public : 
+    virtual bool Insert         (HashT hash);
+    virtual bool Remove         (HashT hash);
+    virtual bool Update         (HashT oldHash, HashT newHash);
+    virtual bool Search         (HashT hash);
+    virtual bool HasNearDups    (HashT hash);
+    virtual bool FindFirstNearDup(HashT hash, HashT &nearDup);
+    virtual bool FindNearDups   (HashT hash, AnswerType &ans);
+    virtual bool HasNearDupsWithin(HashT hash, uint_t hamDist);
+    virtual bool FindNearDupsWithin(HashT hash, uint_t minHamDist,
+        uint_t maxHamDist, AnswerType &ans);
+    virtual uint_t FindNearDupsBatch(const std::vector<HashT> &hashes,
+        std::vector<AnswerType> &answers, uint_t depth);
+    virtual bool Join           (const std::vector<HashT> &queries,
+        BasicSimhashJoinCallback<HashT> &callback, uint_t threadNum);
+    virtual void Clear();
+    virtual uint_t GetSize();
+    virtual bool SaveToFile     (const std::string &filename,
+        SimhashFileFormat format);
+    virtual bool LoadFromFile   (const std::string &filename, bool binary);
+    virtual bool StartSave      (const std::string &filename,
+        SimhashFileFormat format);
+    virtual SimhashSaveState GetSaveState(bool wait);
+    virtual bool Freeze();
+    virtual bool GetStats(SimhashTableStats &stats);
+    virtual void ResetStats();
+    virtual void GetBucketReport(SimhashBucketReport &report);
+    virtual void GetMemoryUsage(SimhashMemoryUsage &usage);
+private :
+    /* Merges the overlay of a save into the table, once the child is done. */
+    void MergeOverlay();
+    /* Replaces the frozen containers by empty ones of mOptions. */
+    void Thaw();
+private :
+    typename SimhashContainerFactory<HashT>::ContainerPtr mContainerPtr;
+    BitPermutation<HashT> mBitOrder;    // Applied before values are indexed.
+    SimhashTableStats mStats;
+    SimhashTableOptions mOptions;
+    pid_t mSavePid;                     // The child of the running save.
+    SimhashSaveState mSaveState;
+    // Serves the table while mSavePid runs, see SimhashOverlayContainer.
+    std::tr1::shared_ptr<SimhashOverlayContainer<HashT> > mOverlayPtr;
+    bool mFrozen;                       // Whether Freeze is called.
+    friend std::tr1::shared_ptr<BasicSimhashTable<HashT> >
+        CreateBasicSimhashTable<HashT>(const SimhashTableOptions &options);
+};
+
+template <typename HashT>
+SimhashTableImpl<HashT>::SimhashTableImpl(const SimhashTableOptions &options)
+    : mOptions(     options             )
+    , mSavePid(     -1                  )
+    , mSaveState(   SIMHASH_SAVE_IDLE   )
+    , mFrozen(      false               )
+{
+    if (!options.bitEntropies.empty()
+        && HashTraits<HashT>::WIDTH != options.bitEntropies.size())
+    {
+        throw std::invalid_argument("bitEntropies doesn't match the width");
+    }
+    mBitOrder.Reset(options.bitOrder);
+    mContainerPtr = SimhashContainerFactory<HashT>::CreateSimhashContainer(
+        options, options.level, 0U, HashTraits<HashT>::WIDTH);
+    //The sub-indexes of hot buckets are at level 1 at least.
+    mStats.levels.resize(std::max(options.level,
+        options.hotBucketSize ? 1U : 0U) + 1U);
+    SIMHASH_STATS(mContainerPtr->SetStats(&mStats));
+}
+
+template <typename HashT>
+SimhashTableImpl<HashT>::~SimhashTableImpl()
+{
+    //The child is reaped, and its file is finished.
+    while (mSavePid >= 0 && waitpid(mSavePid, NULL, 0) < 0 && EINTR == errno)
+    {}
+}
+
+template <typename HashT>
+void SimhashTableImpl<HashT>::Clear()
+{
+    if (mFrozen)
+    {
+        Thaw();
+        return;
+    }
+    return mContainerPtr->Clear();
+}
+
+template <typename HashT>
+uint_t SimhashTableImpl<HashT>::GetSize()
+{
+    return mContainerPtr->GetSize();
+}
+
+template <typename HashT>
+bool SimhashTableImpl<HashT>::Insert(HashT hash)
+{
+    SIMHASH_STATS_TIMER(SIMHASH_OP_INSERT);
+    if (mFrozen)
+    {
+        return false;
+    }
+    bool ret = mContainerPtr->Insert(mBitOrder.Forward(hash));
+    SIMHASH_STATS(mStats.inserts += ret ? 1U : 0U);
+    return ret;
+}
+
+template <typename HashT>
+bool SimhashTableImpl<HashT>::Remove(HashT hash)
+{
+    SIMHASH_STATS_TIMER(SIMHASH_OP_REMOVE);
+    if (mFrozen)
+    {
+        return false;
+    }
+    bool ret = mContainerPtr->Remove(mBitOrder.Forward(hash));
+    SIMHASH_STATS(mStats.removes += ret ? 1U : 0U);
+    return ret;
+}
+
+template <typename HashT>
+bool SimhashTableImpl<HashT>::Update(HashT oldHash, HashT newHash)
+{
+    SIMHASH_STATS_TIMER(SIMHASH_OP_UPDATE);
+    if (mFrozen)
+    {
+        return false;
+    }
+    if (oldHash == newHash)
+    {
+        return Search(oldHash);
+    }
+    return mContainerPtr->Update(mBitOrder.Forward(oldHash),
+        mBitOrder.Forward(newHash));
+}
+
+template <typename HashT>
+bool SimhashTableImpl<HashT>::Search(HashT hash)
+{
+    SIMHASH_STATS_TIMER(SIMHASH_OP_SEARCH);
+    return mContainerPtr->Search(mBitOrder.Forward(hash));
+}
+
+template <typename HashT>
+bool SimhashTableImpl<HashT>::HasNearDups(HashT hash)
+{
+    SIMHASH_STATS_TIMER(SIMHASH_OP_HAS_NEAR_DUPS);
+    return mContainerPtr->HasNearDups(mBitOrder.Forward(hash));
+}
+
+template <typename HashT>
+bool SimhashTableImpl<HashT>::FindFirstNearDup(HashT hash, HashT &nearDup)
+{
+    SIMHASH_STATS_TIMER(SIMHASH_OP_FIND_FIRST_NEAR_DUP);
+    if (!mContainerPtr->FindFirstNearDup(mBitOrder.Forward(hash), nearDup))
+    {
+        return false;
+    }
+    nearDup = mBitOrder.Backward(nearDup);
+    return true;
+}
+
+template <typename HashT>
+bool SimhashTableImpl<HashT>::FindNearDups(HashT hash, AnswerType &ans)
 {
-    //Init.
+    SIMHASH_STATS_TIMER(SIMHASH_OP_FIND_NEAR_DUPS);
+    bool ret = mContainerPtr->FindNearDups(mBitOrder.Forward(hash), ans);
+    for (typename AnswerType::iterator it = ans.begin(); ans.end() != it; ++it)
+    {
+        *it = mBitOrder.Backward(*it);
+    }
+    std::sort(ans.begin(), ans.end());
+    SIMHASH_STATS(mStats.duplicatesRemoved += ans.size());
+    ans.resize(std::distance(ans.begin(), std::unique(ans.begin(), ans.end())));
+    SIMHASH_STATS(mStats.duplicatesRemoved -= ans.size());
+    return ret;
+}
+
+template <typename HashT>
+bool SimhashTableImpl<HashT>::HasNearDupsWithin(HashT hash, uint_t hamDist)
+{
+    SIMHASH_STATS_TIMER(SIMHASH_OP_HAS_NEAR_DUPS);
+    return hamDist <= mOptions.maxHamDist && mContainerPtr->HasNearDups(
+        mBitOrder.Forward(hash), HashT(0U), hamDist);
+}
+
+template <typename HashT>
+bool SimhashTableImpl<HashT>::FindNearDupsWithin(HashT hash,
+    uint_t minHamDist, uint_t maxHamDist, AnswerType &ans)
+{
+    SIMHASH_STATS_TIMER(SIMHASH_OP_FIND_NEAR_DUPS);
     ans.clear();
-    //Generate forward permutes.
-    std::vector<hash_t> forwordPermutes;
-    GetForwardPermutes(hash, forwordPermutes);
-    //Find hash from all redundancy containers.
-    FindAnswerType subAns;
-    for (uint_t i = 0; i < mBlockNum; ++i)
+    if (maxHamDist > mOptions.maxHamDist
+        || !mContainerPtr->FindNearDups(mBitOrder.Forward(hash), ans,
+        HashT(0U), maxHamDist))
     {
-        mContainer.at(i)->FindNearDups(forwordPermutes.at(i), subAns,
-            mProps.at(i).leftBackwardMask | mask);
-        for (FindAnswerType::iterator iter = subAns.begin();
-            subAns.end() != iter; ++iter)
+        return false;
+    }
+    //The values nearer than minHamDist are dropped with the duplicates.
+    size_t num = 0;
+    for (typename AnswerType::iterator it = ans.begin(); ans.end() != it; ++it)
+    {
+        *it = mBitOrder.Backward(*it);
+        if (PopCount(*it ^ hash) >= minHamDist)
         {
-            ans.push_back(BackwardPermute(*iter, mProps.at(i)));
+            ans[num++] = *it;
         }
     }
+    ans.resize(num);
+    std::sort(ans.begin(), ans.end());
+    SIMHASH_STATS(mStats.duplicatesRemoved += ans.size());
+    ans.resize(std::distance(ans.begin(), std::unique(ans.begin(), ans.end())));
+    SIMHASH_STATS(mStats.duplicatesRemoved -= ans.size());
     return !ans.empty();
 }
 
-bool SimhashIndexedContainer::HasNearDups(hash_t hash, hash_t mask)
+template <typename HashT>
+uint_t SimhashTableImpl<HashT>::FindNearDupsBatch(
+    const std::vector<HashT> &hashes, std::vector<AnswerType> &answers,
+    uint_t depth)
 {
-    hash_t tmp;
-    return FindFirstNearDup(hash, tmp, mask);
+    std::vector<HashT> permutes(hashes.size());
+    for (size_t i = 0; i < hashes.size(); ++i)
+    {
+        permutes[i] = mBitOrder.Forward(hashes[i]);
+    }
+    mContainerPtr->FindNearDupsBatch(permutes, HashT(0U), answers, depth);
+    uint_t found = 0U;
+    for (size_t i = 0; i < answers.size(); ++i)
+    {
+        AnswerType &ans = answers[i];
+        for (typename AnswerType::iterator it = ans.begin();
+            ans.end() != it; ++it)
+        {
+            *it = mBitOrder.Backward(*it);
+        }
+        std::sort(ans.begin(), ans.end());
+        SIMHASH_STATS(mStats.duplicatesRemoved += ans.size());
+        ans.resize(std::distance(ans.begin(),
+            std::unique(ans.begin(), ans.end())));
+        SIMHASH_STATS(mStats.duplicatesRemoved -= ans.size());
+        found += ans.empty() ? 0U : 1U;
+    }
+    return found;
 }
 
-bool SimhashIndexedContainer::FindFirstNearDup(hash_t hash, hash_t &nearDup,
-    hash_t mask)
+template <typename HashT>
+bool SimhashTableImpl<HashT>::Join(const std::vector<HashT> &queries,
+    BasicSimhashJoinCallback<HashT> &callback, uint_t threadNum)
 {
-    //Generate forward permutes.
-    std::vector<hash_t> forwordPermutes;
-    GetForwardPermutes(hash, forwordPermutes);
-    //Find hash from all redundancy containers.
-    for (uint_t i = 0; i < mBlockNum; ++i)
+    //Joined in the order of bits of the values, the distances are the same.
+    std::vector<HashT> permutes(queries.size());
+    for (size_t i = 0; i < queries.size(); ++i)
+    {
+        permutes[i] = mBitOrder.Forward(queries[i]);
+    }
+    SimhashJoinBackward<HashT> backward(callback, mBitOrder);
+    if (permutes.empty() || mContainerPtr->Join(permutes, backward, threadNum))
+    {
+        return true;
+    }
+    //A leaf or an overlay at the root, its values are copied out.
+    std::vector<HashT> values;
+    values.reserve(mContainerPtr->GetSize());
+    SimhashValueCollector<HashT> collector(values);
+    mContainerPtr->Traverse(collector);
+    JoinSimhash(permutes, values, mOptions.maxHamDist, backward, threadNum);
+    return true;
+}
+
+template <typename HashT>
+bool SimhashTableImpl<HashT>::GetStats(SimhashTableStats &stats)
+{
+#ifdef SIMHASH_ENABLE_STATS
+    stats = mStats;
+    return true;
+#else
+    stats = SimhashTableStats();
+    return false;
+#endif
+}
+
+template <typename HashT>
+void SimhashTableImpl<HashT>::ResetStats()
+{
+    mStats.Clear();
+}
+
+template <typename HashT>
+void SimhashTableImpl<HashT>::GetBucketReport(SimhashBucketReport &report)
+{
+    report = SimhashBucketReport();
+    mContainerPtr->GetBucketReport(report);
+}
+
+template <typename HashT>
+void SimhashTableImpl<HashT>::GetMemoryUsage(SimhashMemoryUsage &usage)
+{
+    usage = SimhashMemoryUsage();
+    mContainerPtr->GetMemoryUsage(usage);
+    if (!usage.containers.empty())
+    {
+        //The tables of the bit order are counted in the root container.
+        usage.containers.front().overheadBytes += mBitOrder.GetMemoryUsage();
+        usage.levels[usage.containers.front().level].overheadBytes
+            += mBitOrder.GetMemoryUsage();
+    }
+}
+
+
+template <typename HashT>
+bool SimhashTableImpl<HashT>::SaveToFile(const std::string &filename,
+    SimhashFileFormat format)
+{
+    SimhashFileWriter<HashT> writer;
+    if (!writer.Open(filename, format))
+    {
+        return false;
+    }
+    //The front container is traversed in the ascending order of the permuted
+    //values, which are the values without a bit order, so a snapshot is
+    //encoded block by block as they come. With a bit order, they are sorted
+    //here, so the writer never reads its blocks back to sort them.
+    if (SIMHASH_FILE_SNAPSHOT != format || mBitOrder.IsIdentity())
+    {
+        SimhashFileVisitor<HashT> visitor(writer, mBitOrder);
+        mContainerPtr->Traverse(visitor);
+        return writer.Close();
+    }
+    std::vector<HashT> values;
+    SimhashSortVisitor<HashT> visitor(mBitOrder, values);
+    mContainerPtr->Traverse(visitor);
+    visitor.StartPlacing();
+    mContainerPtr->Traverse(visitor);
+    visitor.Finish();
+    for (typename std::vector<HashT>::const_iterator it = values.begin();
+        it != values.end(); ++it)
+    {
+        writer.Write(*it);
+    }
+    return writer.Close();
+}
+
+template <typename HashT>
+bool SimhashTableImpl<HashT>::LoadFromFile(const std::string &filename, bool binary)
+{
+    SimhashFileReader<HashT> reader;
+    if (!reader.Open(filename, binary))
     {
-        if (mContainer.at(i)->FindFirstNearDup(hash, nearDup,
-            mProps.at(i).leftBackwardMask | mask))
+        return false;
+    }
+    Clear();
+    std::vector<HashT> values;
+    while (reader.Read(values))
+    {
+        for (typename std::vector<HashT>::iterator it = values.begin();
+            values.end() != it; ++it)
         {
-            return true;
+            mContainerPtr->Insert(mBitOrder.Forward(*it));
         }
     }
-    return false;
+    return reader.Good();
 }
 
-bool SimhashIndexedContainer::SaveToFile(const std::string &filename,
-    bool binary)
+template <typename HashT>
+bool SimhashTableImpl<HashT>::StartSave(const std::string &filename,
+    SimhashFileFormat format)
 {
-    return mContainer.front()->SaveToFile(filename, binary);
+    if (SIMHASH_SAVE_RUNNING == GetSaveState(false))
+    {
+        return false;
+    }
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        return false;
+    }
+    if (0 == pid)
+    {
+        //The child exits without the destructors and atexit of its parent.
+        setpriority(PRIO_PROCESS, 0, 19);
+        std::string tmpFile = filename + ".tmp";
+        bool ret = SaveToFile(tmpFile, format)
+            && !rename(tmpFile.c_str(), filename.c_str());
+        _exit(ret ? 0 : 1);
+    }
+    mSavePid = pid;
+    mSaveState = SIMHASH_SAVE_RUNNING;
+    mOverlayPtr.reset(new SimhashOverlayContainer<HashT>(mOptions,
+        mContainerPtr));
+    SIMHASH_STATS(mOverlayPtr->SetStats(&mStats));
+    mContainerPtr = mOverlayPtr;
+    return true;
 }
 
-void SimhashIndexedContainer::GetForwardPermutes(hash_t hash,
-    std::vector<hash_t> &ans)
+template <typename HashT>
+bool SimhashTableImpl<HashT>::Freeze()
 {
-    //Init.
-    ans.resize(mBlockNum);
-    //Generate forward permutes.
-    for (uint_t i = 0; i < mBlockNum; ++i)
+    if (SIMHASH_SAVE_RUNNING == GetSaveState(false))
     {
-        ans.at(i) = ForwardPermute(hash, mProps.at(i));
+        return false;
     }
+    //A leaf root is replaced, an indexed root replaces its leaves.
+    typename SimhashContainerFactory<HashT>::ContainerPtr frozen
+        = mContainerPtr->Freeze();
+    if (frozen)
+    {
+        mContainerPtr = frozen;
+        SIMHASH_STATS(mContainerPtr->SetStats(&mStats));
+    }
+    mFrozen = true;
+    return true;
 }
 
-SimhashContainerPtr SimhashContainerFactory::CreateSimhashContainer(
-        uint_t maxHamDist, uint_t level, uint_t maskBeginPos, uint_t maskEndPos)
+template <typename HashT>
+void SimhashTableImpl<HashT>::Thaw()
 {
-    if (!level)
+    //A save of the frozen table may still run, its child has its own copy.
+    mOverlayPtr.reset();
+    mContainerPtr = SimhashContainerFactory<HashT>::CreateSimhashContainer(
+        mOptions, mOptions.level, 0U, HashTraits<HashT>::WIDTH);
+    SIMHASH_STATS(mContainerPtr->SetStats(&mStats));
+    mFrozen = false;
+}
+
+template <typename HashT>
+void SimhashTableImpl<HashT>::MergeOverlay()
+{
+    if (mOverlayPtr)
     {
-        return SimhashContainerPtr(new SimhashSequentialContainner(
-            maxHamDist, level));
+        mOverlayPtr->Merge();
+        mContainerPtr = mOverlayPtr->GetBase();
+        mOverlayPtr.reset();
     }
-    else
+}
+
+template <typename HashT>
+SimhashSaveState SimhashTableImpl<HashT>::GetSaveState(bool wait)
+{
+    if (SIMHASH_SAVE_RUNNING != mSaveState)
+    {
+        return mSaveState;
+    }
+    int status = 0;
+    pid_t ret = waitpid(mSavePid, &status, wait ? 0 : WNOHANG);
+    while (ret < 0 && EINTR == errno)
+    {
+        ret = waitpid(mSavePid, &status, wait ? 0 : WNOHANG);
+    }
+    if (0 == ret)
+    {
+        return mSaveState;
+    }
+    //A child reaped elsewhere, e.g. by SIGCHLD ignored, is taken as failed.
+    mSaveState = ret == mSavePid && WIFEXITED(status)
+        && 0 == WEXITSTATUS(status) ? SIMHASH_SAVE_DONE : SIMHASH_SAVE_FAILED;
+    mSavePid = -1;
+    //The child is gone, the base can be written again, unless Clear has
+    //dropped the overlay of a frozen table. The merge costs about the inserts
+    //made during the save, and the writes carry none of it.
+    MergeOverlay();
+    return mSaveState;
+}
+
+SimhashTablePtr CreateSimhashTable(uint_t maxHamDist, uint_t level)
+{
+    return CreateSimhashTable(SimhashTableOptions(maxHamDist, level));
+}
+
+SimhashTablePtr CreateSimhashTable(const SimhashTableOptions &options)
+{
+    return CreateBasicSimhashTable<hash_t>(options);
+}
+
+template <typename HashT>
+std::tr1::shared_ptr<BasicSimhashTable<HashT> > CreateBasicSimhashTable(
+    const SimhashTableOptions &options)
+{
+    return std::tr1::shared_ptr<BasicSimhashTable<HashT> >(
+        new SimhashTableImpl<HashT>(options));
+}
+
+template <typename HashT>
+void ChooseBlockLayout(const std::vector<HashT> &sample, bool reorderBits,
+    SimhashTableOptions &options)
+{
+    static const uint_t WIDTH = HashTraits<HashT>::WIDTH;
+    options.bitEntropies.clear();
+    options.bitOrder.clear();
+    if (sample.empty())
+    {
+        return;
+    }
+    //The binary entropy of each bit, by the frequency of 1.
+    std::vector<uint64_t> ones(WIDTH, 0UL);
+    for (typename std::vector<HashT>::const_iterator it = sample.begin();
+        sample.end() != it; ++it)
+    {
+        for (uint_t i = 0; i < WIDTH / 8U; ++i)
+        {
+            const uint_t byte = GetByte(*it, i);
+            for (uint_t j = 0; j < 8U; ++j)
+            {
+                ones[i * 8U + j] += (byte >> j) & 1U;
+            }
+        }
+    }
+    std::vector<real_t> entropies(WIDTH, 0.0);
+    for (uint_t i = 0; i < WIDTH; ++i)
+    {
+        const real_t p = static_cast<real_t>(ones[i]) / sample.size();
+        if (p > 0.0 && p < 1.0)
+        {
+            entropies[i] = -(p * std::log(p) + (1.0 - p) * std::log(1.0 - p))
+                / std::log(2.0);
+        }
+    }
+    if (!reorderBits)
+    {
+        options.bitEntropies.swap(entropies);
+        return;
+    }
+    //Deal the bits to the blocks in order of entropy, back and forth, and
+    //put the blocks from the highest bits down.
+    std::vector<std::pair<real_t, uint_t> > bits(WIDTH);
+    for (uint_t i = 0; i < WIDTH; ++i)
+    {
+        bits[i] = std::make_pair(-entropies[i], i);
+    }
+    std::sort(bits.begin(), bits.end());
+    const uint_t blockNum = options.maxHamDist + 1U;
+    std::vector<std::vector<uint_t> > blocks(blockNum);
+    for (uint_t i = 0; i < WIDTH; ++i)
+    {
+        const uint_t round = i / blockNum;
+        const uint_t block = round % 2U ? blockNum - 1U - i % blockNum
+            : i % blockNum;
+        blocks[block].push_back(bits[i].second);
+    }
+    options.bitOrder.resize(WIDTH);
+    options.bitEntropies.resize(WIDTH);
+    uint_t pos = WIDTH;
+    for (uint_t i = 0; i < blockNum; ++i)
     {
-        return SimhashContainerPtr(new SimhashIndexedContainer(
-            maxHamDist, level, maskBeginPos, maskEndPos));
+        for (uint_t j = 0; j < blocks[i].size(); ++j)
+        {
+            --pos;
+            options.bitOrder[pos] = blocks[i][j];
+            options.bitEntropies[pos] = entropies[blocks[i][j]];
+        }
     }
 }
 
-SimhashTable::SimhashTable()
+template void ChooseBlockLayout<hash_t>(const std::vector<hash_t> &sample,
+    bool reorderBits, SimhashTableOptions &options);
+template void ChooseBlockLayout<hash128_t>(
+    const std::vector<hash128_t> &sample, bool reorderBits,
+    SimhashTableOptions &options);
+template void ChooseBlockLayout<hash256_t>(
+    const std::vector<hash256_t> &sample, bool reorderBits,
+    SimhashTableOptions &options);
+
+template class BasicSimhashTable<hash_t>;
+template class BasicSimhashTable<hash128_t>;
+template class BasicSimhashTable<hash256_t>;
+template std::tr1::shared_ptr<BasicSimhashTable<hash_t> >
+    CreateBasicSimhashTable<hash_t>(const SimhashTableOptions &options);
+template std::tr1::shared_ptr<BasicSimhashTable<hash128_t> >
+    CreateBasicSimhashTable<hash128_t>(const SimhashTableOptions &options);
+template std::tr1::shared_ptr<BasicSimhashTable<hash256_t> >
+    CreateBasicSimhashTable<hash256_t>(const SimhashTableOptions &options);
+
+/*
+* class SimhashValueCounter
+* SimhashValueCounter counts the visited simhash values.
+*/
+template <typename HashT>
+class SimhashValueCounter : public SimhashContainerVisitor<HashT>
+{
+public :
+    SimhashValueCounter()
+        : mCount(0U)
+    {}
+    virtual void Visit(HashT)
+    {
+        ++mCount;
+    }
+    uint_t GetCount() const
+    {
+        return mCount;
+    }
+private :
+    uint_t mCount;
+};
+
+SimhashTenantTable::SimhashTenantTable()
 {}
 
-SimhashTable::~SimhashTable()
+SimhashTenantTable::~SimhashTenantTable()
 {}
 
-class SimhashTableImpl : public SimhashTable
+/*
+* class SimhashTenantTableImpl
+* The values are kept as (tenant, hash) in a container of hash128_t, whose
+* blocks are the low HASH_WIDTH bits, see SimhashTenantTable.
+*/
+class SimhashTenantTableImpl : public SimhashTenantTable
 {
 private:
-    SimhashTableImpl(uint_t maxHamDist, uint_t level);
-    SimhashTableImpl(const SimhashTableImpl&);
-    SimhashTableImpl& operator=(const SimhashTableImpl&);
+    explicit SimhashTenantTableImpl(const SimhashTableOptions &options);
+    SimhashTenantTableImpl(const SimhashTenantTableImpl&);
+    SimhashTenantTableImpl& operator=(const SimhashTenantTableImpl&);
 public :
-    virtual ~SimhashTableImpl();
-public : 
-    virtual bool Insert         (hash_t hash);
-    virtual bool Remove         (hash_t hash);
-    virtual bool Search         (hash_t hash);
-    virtual bool HasNearDups    (hash_t hash);
-    virtual bool FindFirstNearDup(hash_t hash, hash_t &nearDup);
-    virtual bool FindNearDups   (hash_t hash, FindAnswerType &ans);
+    virtual ~SimhashTenantTableImpl();
+public :
+    virtual bool Insert         (tenant_t tenant, hash_t hash);
+    virtual bool Remove         (tenant_t tenant, hash_t hash);
+    virtual bool Search         (tenant_t tenant, hash_t hash);
+    virtual bool HasNearDups    (tenant_t tenant, hash_t hash);
+    virtual bool FindFirstNearDup(tenant_t tenant, hash_t hash,
+        hash_t &nearDup);
+    virtual bool FindNearDups   (tenant_t tenant, hash_t hash,
+        FindAnswerType &ans);
+    virtual uint_t ClearTenant(tenant_t tenant);
+    virtual uint_t GetTenantSize(tenant_t tenant);
     virtual void Clear();
     virtual uint_t GetSize();
-    virtual bool SaveToFile     (const std::string &filename, bool binary);
-    virtual bool LoadFromFile   (const std::string &filename, bool binary);
+    virtual void GetMemoryUsage(SimhashMemoryUsage &usage);
+private :
+    /* Returns the value of hash in tenant, as it is indexed. */
+    inline hash128_t GetKey(tenant_t tenant, hash_t hash) const
+    {
+        hash128_t key(mBitOrder.Forward(hash));
+        key.SetWord(1U, tenant);
+        return key;
+    }
+    /* Returns the hash of an indexed value. */
+    inline hash_t GetHash(const hash128_t &key) const
+    {
+        return mBitOrder.Backward(key.GetWord(0U));
+    }
 private :
-    SimhashContainerPtr mContainerPtr;
-    friend SimhashTablePtr CreateSimhashTable(uint_t maxHamDist, uint_t level);
+    SimhashContainerFactory<hash128_t>::ContainerPtr mContainerPtr;
+    BitPermutation<hash_t> mBitOrder;   // Applied before values are indexed.
+    hash128_t mTenantMask;              // The bits of tenant.
+    SimhashContainer<hash128_t>::AnswerType mAnswer;
+    friend SimhashTenantTablePtr CreateSimhashTenantTable(
+        const SimhashTableOptions &options);
 };
 
-SimhashTableImpl::SimhashTableImpl(uint_t maxHamDist, uint_t level)
+SimhashTenantTableImpl::SimhashTenantTableImpl(
+    const SimhashTableOptions &options)
+    : mTenantMask(  ~GetLowMask<hash128_t>(HASH_WIDTH)  )
 {
-    mContainerPtr = SimhashContainerFactory::CreateSimhashContainer(maxHamDist,
-        level, 0U, HASH_WIDTH);
+    if (!options.bitEntropies.empty()
+        && HASH_WIDTH != options.bitEntropies.size())
+    {
+        throw std::invalid_argument("bitEntropies doesn't match the width");
+    }
+    mBitOrder.Reset(options.bitOrder);
+    //The tenant bits are above the mask, as if fixed by a parent container.
+    mContainerPtr = SimhashContainerFactory<hash128_t>::CreateSimhashContainer(
+        options, options.level, 0U, HASH_WIDTH);
 }
 
-SimhashTableImpl::~SimhashTableImpl()
+SimhashTenantTableImpl::~SimhashTenantTableImpl()
 {}
 
-void SimhashTableImpl::Clear()
+bool SimhashTenantTableImpl::Insert(tenant_t tenant, hash_t hash)
 {
-    return mContainerPtr->Clear();
+    return mContainerPtr->Insert(GetKey(tenant, hash));
 }
 
-uint_t SimhashTableImpl::GetSize()
+bool SimhashTenantTableImpl::Remove(tenant_t tenant, hash_t hash)
 {
-    return mContainerPtr->GetSize();
+    return mContainerPtr->Remove(GetKey(tenant, hash));
 }
 
-bool SimhashTableImpl::Insert(hash_t hash)
+bool SimhashTenantTableImpl::Search(tenant_t tenant, hash_t hash)
 {
-    return mContainerPtr->Insert(hash);
+    return mContainerPtr->Search(GetKey(tenant, hash));
+}
+
+bool SimhashTenantTableImpl::HasNearDups(tenant_t tenant, hash_t hash)
+{
+    return mContainerPtr->HasNearDups(GetKey(tenant, hash), mTenantMask);
+}
+
+bool SimhashTenantTableImpl::FindFirstNearDup(tenant_t tenant, hash_t hash,
+    hash_t &nearDup)
+{
+    hash128_t found;
+    if (!mContainerPtr->FindFirstNearDup(GetKey(tenant, hash), found,
+        mTenantMask))
+    {
+        return false;
+    }
+    nearDup = GetHash(found);
+    return true;
 }
 
-bool SimhashTableImpl::Remove(hash_t hash)
+bool SimhashTenantTableImpl::FindNearDups(tenant_t tenant, hash_t hash,
+    FindAnswerType &ans)
 {
-    return mContainerPtr->Remove(hash);
+    ans.clear();
+    bool ret = mContainerPtr->FindNearDups(GetKey(tenant, hash), mAnswer,
+        mTenantMask);
+    for (SimhashContainer<hash128_t>::AnswerType::iterator it
+        = mAnswer.begin(); mAnswer.end() != it; ++it)
+    {
+        ans.push_back(GetHash(*it));
+    }
+    std::sort(ans.begin(), ans.end());
+    ans.resize(std::distance(ans.begin(), std::unique(ans.begin(), ans.end())));
+    return ret;
 }
 
-bool SimhashTableImpl::Search(hash_t hash)
+uint_t SimhashTenantTableImpl::ClearTenant(tenant_t tenant)
 {
-    return mContainerPtr->Search(hash);
+    //The values are collected first, the containers can't be changed while
+    //they are traversed.
+    mAnswer.clear();
+    SimhashValueCollector<hash128_t> collector(mAnswer);
+    mContainerPtr->TraverseRange(GetKey(tenant, 0UL) & mTenantMask,
+        GetKey(tenant, 0UL) | ~mTenantMask, collector);
+    for (SimhashContainer<hash128_t>::AnswerType::iterator it
+        = mAnswer.begin(); mAnswer.end() != it; ++it)
+    {
+        mContainerPtr->Remove(*it);
+    }
+    return static_cast<uint_t>(mAnswer.size());
 }
 
-bool SimhashTableImpl::HasNearDups(hash_t hash)
+uint_t SimhashTenantTableImpl::GetTenantSize(tenant_t tenant)
 {
-    return mContainerPtr->HasNearDups(hash);
+    SimhashValueCounter<hash128_t> counter;
+    mContainerPtr->TraverseRange(GetKey(tenant, 0UL) & mTenantMask,
+        GetKey(tenant, 0UL) | ~mTenantMask, counter);
+    return counter.GetCount();
 }
 
-bool SimhashTableImpl::FindFirstNearDup(hash_t hash, hash_t &nearDup)
+void SimhashTenantTableImpl::Clear()
 {
-    return mContainerPtr->FindFirstNearDup(hash, nearDup);
+    mContainerPtr->Clear();
 }
 
-bool SimhashTableImpl::FindNearDups(hash_t hash, FindAnswerType &ans)
+uint_t SimhashTenantTableImpl::GetSize()
 {
-    bool ret = mContainerPtr->FindNearDups(hash, ans);
-    std::sort(ans.begin(), ans.end());
-    ans.resize(std::distance(ans.begin(), std::unique(ans.begin(), ans.end())));
-    return ret;
+    return mContainerPtr->GetSize();
+}
+
+void SimhashTenantTableImpl::GetMemoryUsage(SimhashMemoryUsage &usage)
+{
+    usage = SimhashMemoryUsage();
+    mContainerPtr->GetMemoryUsage(usage);
+    if (!usage.containers.empty())
+    {
+        //The tables of the bit order are counted in the root container.
+        usage.containers.front().overheadBytes += mBitOrder.GetMemoryUsage();
+        usage.levels[usage.containers.front().level].overheadBytes
+            += mBitOrder.GetMemoryUsage();
+    }
+}
+
+SimhashTenantTablePtr CreateSimhashTenantTable(
+    const SimhashTableOptions &options)
+{
+    return SimhashTenantTablePtr(new SimhashTenantTableImpl(options));
+}
+
+/*
+* The constants of the cost model, in nanoseconds. A query of a table much
+* larger than the CPU cache is bound by its dependent loads, so each step of
+* the model is about a cache miss, but the scan of an array, whose next values
+* are prefetched. They are fitted by TestSimhashTableCostModel, which prints
+* the estimated and the measured query time of each layout, to be fitted
+* again on another CPU.
+* NODE_VISIT_NANOS is a node of a std::set, a probe of a binary search or a
+* node of the tree of a frozen leaf, each on the path to a bucket. The nodes
+* near the root are cached, so it is less than a miss of the memory.
+* CANDIDATE_NANOS is a value of a bucket in a std::set, whose in-order step
+* may climb and descend several nodes, and whose distance is computed.
+* ARRAY_CANDIDATE_NANOS is a value of a bucket in an array, the distance only.
+* FILTER_CHECK_NANOS is a check of a bloom prefilter, whose probes are
+* scattered but independent, so their misses overlap.
+*/
+static const double NODE_VISIT_NANOS        = 85.0;
+static const double CANDIDATE_NANOS         = 200.0;
+static const double ARRAY_CANDIDATE_NANOS   = 6.0;
+static const double FILTER_CHECK_NANOS      = 100.0;
+
+/* Returns log2(size + 1), the depth of a balanced tree of size values. */
+static inline double GetTreeDepth(double size)
+{
+    return std::log(size + 1.0) / std::log(2.0);
 }
 
+/*
+* Returns the bytes of a frozen leaf of size values : the array, and the
+* static tree of SimhashFrozenContainer over it, 1 / 7 of the array.
+*/
+static inline double GetFrozenLeafBytes(double size)
+{
+    return size * sizeof(hash_t) * 8.0 / 7.0;
+}
 
-bool SimhashTableImpl::SaveToFile(const std::string &filename, bool binary)
+/*
+* Estimates the leaf container holding size simhash values, with fixedBits
+* bits fixed by the parents, i.e. buckets of size / 2^fixedBits values.
+*/
+static void EstimateLeaf(const SimhashTableOptions &options, bool frozen,
+    uint_t fixedBits, double size, SimhashTableEstimate &estimate)
 {
-    return mContainerPtr->SaveToFile(filename, binary);
+    const double bucket = size / std::pow(2.0, fixedBits);
+    if (frozen)
+    {
+        //A lookup reads a node per level of the tree, 8 keys each.
+        estimate.memoryBytes += static_cast<uint64_t>(GetFrozenLeafBytes(
+            size));
+        estimate.queryNanos = std::ceil(GetTreeDepth(size) / 3.0)
+            * NODE_VISIT_NANOS + bucket * ARRAY_CANDIDATE_NANOS;
+    }
+    else if (SIMHASH_LEAF_SORTED_ARRAY == options.leafType)
+    {
+        //The delta is merged at 1 / 16 of the array, 1 / 32 in average. A
+        //lookup is a binary search of the array, the delta is small enough
+        //to stay cached.
+        estimate.memoryBytes += static_cast<uint64_t>(size * sizeof(hash_t)
+            + size / 32.0 * SET_NODE_BYTES);
+        estimate.queryNanos = GetTreeDepth(size) * NODE_VISIT_NANOS
+            + bucket * ARRAY_CANDIDATE_NANOS;
+    }
+    else
+    {
+        //Each range lookup descends the tree twice, and compares all the
+        //values in the bucket.
+        estimate.memoryBytes += static_cast<uint64_t>(size)
+            * (options.useNodeArena ? ARENA_NODE_BYTES : SET_NODE_BYTES);
+        estimate.queryNanos = 2.0 * GetTreeDepth(size) * NODE_VISIT_NANOS
+            + bucket * CANDIDATE_NANOS;
+    }
 }
 
-bool SimhashTableImpl::LoadFromFile(const std::string &filename, bool binary)
+/*
+* Estimates the container of level, whose mask range is [0, maskEndPos) and
+* fixedBits bits are fixed by the parents, holding size simhash values. The
+* block widths are the same as SimhashIndexedContainer::Init. Returns false
+* if a block would have no bits.
+*/
+static bool EstimateContainer(const SimhashTableOptions &options, bool frozen,
+    uint_t level, uint_t maskEndPos, uint_t fixedBits, double size,
+    SimhashTableEstimate &estimate)
 {
-    std::ifstream fin(filename.c_str(),
-        std::fstream::in | std::fstream::binary);
-    if (!fin.good())
+    if (!level)
+    {
+        EstimateLeaf(options, frozen, fixedBits, size, estimate);
+        return true;
+    }
+    const uint_t blockNum = options.maxHamDist + 1U;
+    if (maskEndPos < blockNum)
     {
         return false;
     }
-    mContainerPtr->Clear();
-    if (binary)     //load in binary mode.
+    const uint_t blockWidth = maskEndPos / blockNum;
+    uint_t remainLen = maskEndPos - blockWidth * blockNum;
+    //The false positive rate of the bloom filter, about 0.6185^bitsPerKey.
+    const double falsePositive = std::pow(0.6185,
+        static_cast<double>(options.prefilterBitsPerKey));
+    double queryNanos = 0.0;
+    for (uint_t i = 0; i < blockNum; ++i)
     {
-        static const uint_t BYTES = static_cast<uint_t>(sizeof(hash_t));
-        static const uint_t BUFF_SIZE = 10000U;
-        hash_t buff[BUFF_SIZE];
-        uint_t count = 0U;
-        do
+        uint_t width = blockWidth;
+        if (remainLen > 0)
         {
-            fin.read(reinterpret_cast<char *>(buff), BYTES * BUFF_SIZE);
-            count = static_cast<uint_t>(fin.gcount()) / BYTES;
-            for (uint_t i = 0; i < count; ++i)
-            {
-                mContainerPtr->Insert(buff[i]);
-            }
-        } while (count);
+            ++width;
+            --remainLen;
+        }
+        SimhashTableEstimate sub;
+        if (!EstimateContainer(options, frozen, level - 1U,
+            maskEndPos - width, fixedBits + width, size, sub))
+        {
+            return false;
+        }
+        estimate.memoryBytes += sub.memoryBytes;
+        if (options.usePrefilter && fixedBits)
+        {
+            //The chance that the key of a random query is in the filter.
+            const double hit = std::min(1.0, 1.0 - std::exp(-size
+                / std::pow(2.0, fixedBits + width)) + falsePositive);
+            estimate.memoryBytes += static_cast<uint64_t>(size
+                * options.prefilterBitsPerKey / 8.0);
+            queryNanos += FILTER_CHECK_NANOS + hit * sub.queryNanos;
+        }
+        else
+        {
+            queryNanos += sub.queryNanos;
+        }
+    }
+    estimate.queryNanos = queryNanos;
+    return true;
+}
+
+SimhashTableEstimate::SimhashTableEstimate()
+    : memoryBytes(  0UL )
+    , queryNanos(   0.0 )
+{}
+
+bool EstimateSimhashTable(const SimhashTableOptions &options,
+    uint64_t expectedSize, SimhashTableEstimate &estimate, bool frozen)
+{
+    estimate = SimhashTableEstimate();
+    const double size = static_cast<double>(expectedSize);
+    if (!EstimateContainer(options, false, options.level, HASH_WIDTH, 0U,
+        size, estimate))
+    {
+        return false;
+    }
+    if (frozen)
+    {
+        //The leaves are frozen one by one, each one collects its values and
+        //builds its arrays before the old one is freed.
+        const uint64_t peakBytes = estimate.memoryBytes + static_cast<uint64_t>(
+            size * sizeof(hash_t) + GetFrozenLeafBytes(size));
+        estimate = SimhashTableEstimate();
+        EstimateContainer(options, true, options.level, HASH_WIDTH, 0U, size,
+            estimate);
+        estimate.memoryBytes = std::max(estimate.memoryBytes, peakBytes);
     }
-    else            //load in string mode.
+    return true;
+}
+
+bool ChooseSimhashTableOptions(uint64_t expectedSize, uint_t maxHamDist,
+    uint64_t memoryBudget, SimhashTableOptions &options, bool frozen)
+{
+    //Higher levels are never worth it, the blocks become too narrow.
+    static const uint_t MAX_LEVEL = 4U;
+    static const SimhashLeafType LEAF_TYPES[] = {SIMHASH_LEAF_SET,
+        SIMHASH_LEAF_SORTED_ARRAY};
+    bool found = false;
+    SimhashTableEstimate best;
+    for (uint_t level = 0U; level <= MAX_LEVEL; ++level)
     {
-        std::string binaryStr;
-        while (std::getline(fin, binaryStr))
+        for (int prefilter = 0; prefilter < (level >= 2U ? 2 : 1); ++prefilter)
         {
-            if (!binaryStr.empty())
+            for (size_t leaf = 0; leaf < 2U; ++leaf)
             {
-                mContainerPtr->Insert(Simhash::BinaryStringToHash(binaryStr));
+                SimhashTableOptions candidate(maxHamDist, level);
+                candidate.usePrefilter = prefilter;
+                candidate.leafType = LEAF_TYPES[leaf];
+                SimhashTableEstimate estimate;
+                if (!EstimateSimhashTable(candidate, expectedSize, estimate,
+                    frozen))
+                {
+                    break;
+                }
+                //The frozen leaves are the same, the less memory is taken.
+                if (estimate.memoryBytes <= memoryBudget && (!found
+                    || estimate.queryNanos < best.queryNanos
+                    || (estimate.queryNanos == best.queryNanos
+                    && estimate.memoryBytes < best.memoryBytes)))
+                {
+                    found = true;
+                    best = estimate;
+                    options = candidate;
+                }
             }
         }
     }
-    fin.close();
-    return true;
+    if (!found)
+    {
+        //Level 0 of sorted arrays uses the least memory.
+        options = SimhashTableOptions(maxHamDist, 0U);
+        options.leafType = SIMHASH_LEAF_SORTED_ARRAY;
+    }
+    return found;
 }
 
-SimhashTablePtr CreateSimhashTable(uint_t maxHamDist, uint_t level)
+SimhashTablePtr CreateSimhashTable(uint64_t expectedSize, uint_t maxHamDist,
+    uint64_t memoryBudget)
 {
-    return SimhashTablePtr(new SimhashTableImpl(maxHamDist, level));
+    SimhashTableOptions options(maxHamDist, 0U);
+    ChooseSimhashTableOptions(expectedSize, maxHamDist, memoryBudget, options);
+    return CreateSimhashTable(options);
 }
 
 } // namespace simhash
@@ -0,0 +1,729 @@
+/*==============================================================================
+*   Copyright (C) 2016 All rights reserved.
+*
+*  File Name    : simhash_trace.cpp
+*  Author       : Zhongping Liang
+*  Date         : 2016-07-22
+*  Version      : 1.0
+*  Description  : This file provides implement of the recorder and the replay
+*           of the traces of SimhashTable.
+==============================================================================*/
+
+#include "simhash_trace.h"
+
+#include <algorithm>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace simhash
+{
+
+static const char *TRACE_OPERATION_NAMES[SIMHASH_TRACE_OP_NUM] = {
+    "Insert",
+    "Remove",
+    "Search",
+    "HasNearDups",
+    "FindFirstNearDup",
+    "FindNearDups",
+    "Update",
+    "FindNearDupsBatch",
+    "Clear",
+    "Freeze"
+};
+
+/* The max bytes of a varint of 64 bits. */
+static const size_t MAX_VARINT_BYTES = 10U;
+
+const char* GetTraceOperationName(uint_t op)
+{
+    return op < SIMHASH_TRACE_OP_NUM ? TRACE_OPERATION_NAMES[op] : "Unknown";
+}
+
+/* Encodes value at out in 7 bits per byte, returns the end. */
+static inline char* EncodeVarint(uint64_t value, char *out)
+{
+    while (value >= 0x80UL)
+    {
+        *out++ = static_cast<char>(value | 0x80UL);
+        value >>= 7;
+    }
+    *out++ = static_cast<char>(value);
+    return out;
+}
+
+/* Decodes a varint at data[pos, size), returns false if it is cut. */
+static inline bool DecodeVarint(const char *data, size_t size, size_t &pos,
+    uint64_t &value)
+{
+    value = 0UL;
+    for (uint_t shift = 0; pos < size && shift < 64U; shift += 7U)
+    {
+        const uint64_t byte = static_cast<unsigned char>(data[pos++]);
+        value |= (byte & 0x7FUL) << shift;
+        if (!(byte & 0x80UL))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Returns whether op changes the table. */
+static inline bool IsTraceWrite(uint_t op)
+{
+    return SIMHASH_OP_INSERT == op || SIMHASH_OP_REMOVE == op
+        || SIMHASH_OP_UPDATE == op || SIMHASH_TRACE_CLEAR == op
+        || SIMHASH_TRACE_FREEZE == op;
+}
+
+SimhashTraceRecord::SimhashTraceRecord()
+    : op(       SIMHASH_OP_INSERT   )
+    , time(     0UL                 )
+    , hash(     0UL                 )
+    , newHash(  0UL                 )
+    , depth(    0U                  )
+{}
+
+SimhashTraceWriter::SimhashTraceWriter()
+    : mFd(          -1      )
+    , mSize(        0       )
+    , mLastTime(    0UL     )
+    , mRecordNum(   0UL     )
+    , mFailed(      false   )
+{}
+
+SimhashTraceWriter::~SimhashTraceWriter()
+{
+    Close();
+}
+
+bool SimhashTraceWriter::Open(const std::string &filename)
+{
+    Close();
+    mFd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+        0644);
+    mBuffer.resize(BUFFER_BYTES);
+    mSize = 0;
+    mRecordNum = 0UL;
+    mFailed = mFd < 0;
+    SimhashTraceHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    header.width = HASH_WIDTH;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    header.startTime = static_cast<uint64_t>(ts.tv_sec) * 1000000000UL
+        + static_cast<uint64_t>(ts.tv_nsec);
+    memcpy(&mBuffer[0], &header, sizeof(header));
+    mSize = sizeof(header);
+    mLastTime = GetNanoTime();
+    return !mFailed;
+}
+
+bool SimhashTraceWriter::Flush()
+{
+    const char *data = mBuffer.empty() ? NULL : &mBuffer[0];
+    size_t size = mSize;
+    while (size && !mFailed)
+    {
+        ssize_t ret = write(mFd, data, size);
+        if (ret < 0 && EINTR == errno)
+        {
+            continue;
+        }
+        if (ret <= 0)
+        {
+            mFailed = true;
+            break;
+        }
+        data += ret;
+        size -= ret;
+    }
+    mSize = 0;
+    return !mFailed;
+}
+
+char* SimhashTraceWriter::Reserve(uint_t op, size_t bytes)
+{
+    if (mBuffer.size() - mSize < bytes + 1U + MAX_VARINT_BYTES)
+    {
+        Flush();
+    }
+    const uint64_t now = GetNanoTime();
+    char *out = &mBuffer[mSize];
+    *out++ = static_cast<char>(op);
+    out = EncodeVarint(now > mLastTime ? now - mLastTime : 0UL, out);
+    mLastTime = std::max(now, mLastTime);
+    ++mRecordNum;
+    return out;
+}
+
+void SimhashTraceWriter::Write(uint_t op, hash_t hash, hash_t newHash)
+{
+    if (mFd < 0)
+    {
+        return;
+    }
+    char *out = Reserve(op, 2U * sizeof(hash_t));
+    if (SIMHASH_TRACE_CLEAR != op && SIMHASH_TRACE_FREEZE != op)
+    {
+        memcpy(out, &hash, sizeof(hash_t));
+        out += sizeof(hash_t);
+    }
+    if (SIMHASH_OP_UPDATE == op)
+    {
+        memcpy(out, &newHash, sizeof(hash_t));
+        out += sizeof(hash_t);
+    }
+    mSize = out - &mBuffer[0];
+}
+
+void SimhashTraceWriter::WriteBatch(const std::vector<hash_t> &hashes,
+    uint_t depth)
+{
+    if (mFd < 0)
+    {
+        return;
+    }
+    char *out = Reserve(SIMHASH_TRACE_FIND_NEAR_DUPS_BATCH,
+        2U * MAX_VARINT_BYTES);
+    out = EncodeVarint(depth, out);
+    out = EncodeVarint(hashes.size(), out);
+    mSize = out - &mBuffer[0];
+    //A large batch is written through the buffer in pieces.
+    for (size_t i = 0; i < hashes.size();)
+    {
+        if (mBuffer.size() - mSize < sizeof(hash_t))
+        {
+            Flush();
+        }
+        const size_t num = std::min(hashes.size() - i,
+            (mBuffer.size() - mSize) / sizeof(hash_t));
+        memcpy(&mBuffer[mSize], &hashes[i], num * sizeof(hash_t));
+        mSize += num * sizeof(hash_t);
+        i += num;
+    }
+}
+
+bool SimhashTraceWriter::Close()
+{
+    if (mFd < 0)
+    {
+        return false;
+    }
+    Flush();
+    mFailed = close(mFd) || mFailed;
+    mFd = -1;
+    std::vector<char>().swap(mBuffer);
+    return !mFailed;
+}
+
+SimhashTraceReader::SimhashTraceReader()
+    : mFd(      -1      )
+    , mData(    NULL    )
+    , mSize(    0       )
+    , mPos(     0       )
+    , mTime(    0UL     )
+    , mFailed(  false   )
+{
+    memset(&mHeader, 0, sizeof(mHeader));
+}
+
+SimhashTraceReader::~SimhashTraceReader()
+{
+    Close();
+}
+
+bool SimhashTraceReader::Open(const std::string &filename)
+{
+    Close();
+    mFd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (mFd < 0 || fstat(mFd, &st)
+        || static_cast<size_t>(st.st_size) < sizeof(mHeader))
+    {
+        Close();
+        return false;
+    }
+    mSize = static_cast<size_t>(st.st_size);
+    void *data = mmap(NULL, mSize, PROT_READ, MAP_PRIVATE, mFd, 0);
+    if (MAP_FAILED == data)
+    {
+        Close();
+        return false;
+    }
+    madvise(data, mSize, MADV_SEQUENTIAL);
+    mData = static_cast<const char*>(data);
+    memcpy(&mHeader, mData, sizeof(mHeader));
+    if (memcmp(mHeader.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC))
+        || TRACE_VERSION != mHeader.version || HASH_WIDTH != mHeader.width)
+    {
+        Close();
+        return false;
+    }
+    mPos = sizeof(mHeader);
+    mTime = 0UL;
+    return true;
+}
+
+bool SimhashTraceReader::Read(SimhashTraceRecord &record)
+{
+    if (mPos >= mSize || mFailed)
+    {
+        return false;
+    }
+    size_t pos = mPos;
+    record.op = static_cast<unsigned char>(mData[pos++]);
+    if (record.op >= SIMHASH_TRACE_OP_NUM)
+    {
+        mFailed = true;
+        return false;
+    }
+    uint64_t delta = 0UL;
+    if (!DecodeVarint(mData, mSize, pos, delta))
+    {
+        return false;
+    }
+    record.hashes.clear();
+    if (SIMHASH_TRACE_FIND_NEAR_DUPS_BATCH == record.op)
+    {
+        uint64_t depth = 0UL, num = 0UL;
+        if (!DecodeVarint(mData, mSize, pos, depth)
+            || !DecodeVarint(mData, mSize, pos, num)
+            || num > (mSize - pos) / sizeof(hash_t))
+        {
+            return false;
+        }
+        record.depth = static_cast<uint_t>(depth);
+        record.hashes.resize(num);
+        if (num)
+        {
+            memcpy(&record.hashes[0], mData + pos, num * sizeof(hash_t));
+        }
+        pos += num * sizeof(hash_t);
+    }
+    else if (SIMHASH_TRACE_CLEAR != record.op
+        && SIMHASH_TRACE_FREEZE != record.op)
+    {
+        const size_t bytes = (SIMHASH_OP_UPDATE == record.op ? 2U : 1U)
+            * sizeof(hash_t);
+        if (mSize - pos < bytes)
+        {
+            return false;
+        }
+        memcpy(&record.hash, mData + pos, sizeof(hash_t));
+        if (SIMHASH_OP_UPDATE == record.op)
+        {
+            memcpy(&record.newHash, mData + pos + sizeof(hash_t),
+                sizeof(hash_t));
+        }
+        pos += bytes;
+    }
+    mTime += delta;
+    record.time = mTime;
+    mPos = pos;
+    return true;
+}
+
+void SimhashTraceReader::Close()
+{
+    if (mData)
+    {
+        munmap(const_cast<char*>(mData), mSize);
+        mData = NULL;
+    }
+    if (mFd >= 0)
+    {
+        close(mFd);
+        mFd = -1;
+    }
+    mSize = 0;
+    mPos = 0;
+    mTime = 0UL;
+    mFailed = false;
+}
+
+/*
+* class SimhashTraceRecorder
+* SimhashTraceRecorder records the operations into mWriter, and passes them
+* to mTablePtr.
+*/
+class SimhashTraceRecorder : public SimhashTable
+{
+public :
+    explicit SimhashTraceRecorder(SimhashTablePtr tablePtr)
+        : mTablePtr(tablePtr)
+    {}
+    virtual ~SimhashTraceRecorder()
+    {}
+private :
+    SimhashTraceRecorder(const SimhashTraceRecorder&);
+    SimhashTraceRecorder& operator=(const SimhashTraceRecorder&);
+public :
+    bool Open(const std::string &filename)
+    {
+        return mWriter.Open(filename);
+    }
+    virtual bool Insert(hash_t hash)
+    {
+        mWriter.Write(SIMHASH_OP_INSERT, hash);
+        return mTablePtr->Insert(hash);
+    }
+    virtual bool Remove(hash_t hash)
+    {
+        mWriter.Write(SIMHASH_OP_REMOVE, hash);
+        return mTablePtr->Remove(hash);
+    }
+    virtual bool Update(hash_t oldHash, hash_t newHash)
+    {
+        mWriter.Write(SIMHASH_OP_UPDATE, oldHash, newHash);
+        return mTablePtr->Update(oldHash, newHash);
+    }
+    virtual bool Search(hash_t hash)
+    {
+        mWriter.Write(SIMHASH_OP_SEARCH, hash);
+        return mTablePtr->Search(hash);
+    }
+    virtual bool HasNearDups(hash_t hash)
+    {
+        mWriter.Write(SIMHASH_OP_HAS_NEAR_DUPS, hash);
+        return mTablePtr->HasNearDups(hash);
+    }
+    virtual bool FindFirstNearDup(hash_t hash, hash_t &nearDup)
+    {
+        mWriter.Write(SIMHASH_OP_FIND_FIRST_NEAR_DUP, hash);
+        return mTablePtr->FindFirstNearDup(hash, nearDup);
+    }
+    virtual bool FindNearDups(hash_t hash, FindAnswerType &ans)
+    {
+        mWriter.Write(SIMHASH_OP_FIND_NEAR_DUPS, hash);
+        return mTablePtr->FindNearDups(hash, ans);
+    }
+    virtual bool HasNearDupsWithin(hash_t hash, uint_t hamDist)
+    {
+        return mTablePtr->HasNearDupsWithin(hash, hamDist);
+    }
+    virtual bool FindNearDupsWithin(hash_t hash, uint_t minHamDist,
+        uint_t maxHamDist, FindAnswerType &ans)
+    {
+        return mTablePtr->FindNearDupsWithin(hash, minHamDist, maxHamDist,
+            ans);
+    }
+    virtual uint_t FindNearDupsBatch(const std::vector<hash_t> &hashes,
+        std::vector<FindAnswerType> &answers, uint_t depth)
+    {
+        mWriter.WriteBatch(hashes, depth);
+        return mTablePtr->FindNearDupsBatch(hashes, answers, depth);
+    }
+    virtual bool Join(const std::vector<hash_t> &queries,
+        SimhashJoinCallback &callback, uint_t threadNum)
+    {
+        return mTablePtr->Join(queries, callback, threadNum);
+    }
+    virtual void Clear()
+    {
+        mWriter.Write(SIMHASH_TRACE_CLEAR);
+        mTablePtr->Clear();
+    }
+    virtual uint_t GetSize()
+    {
+        return mTablePtr->GetSize();
+    }
+    virtual bool SaveToFile(const std::string &filename,
+        SimhashFileFormat format)
+    {
+        return mTablePtr->SaveToFile(filename, format);
+    }
+    virtual bool LoadFromFile(const std::string &filename, bool binary)
+    {
+        mWriter.Write(SIMHASH_TRACE_CLEAR);
+        return mTablePtr->LoadFromFile(filename, binary);
+    }
+    virtual bool StartSave(const std::string &filename,
+        SimhashFileFormat format)
+    {
+        return mTablePtr->StartSave(filename, format);
+    }
+    virtual SimhashSaveState GetSaveState(bool wait)
+    {
+        return mTablePtr->GetSaveState(wait);
+    }
+    virtual bool Freeze()
+    {
+        mWriter.Write(SIMHASH_TRACE_FREEZE);
+        return mTablePtr->Freeze();
+    }
+    virtual bool GetStats(SimhashTableStats &stats)
+    {
+        return mTablePtr->GetStats(stats);
+    }
+    virtual void ResetStats()
+    {
+        mTablePtr->ResetStats();
+    }
+    virtual void GetBucketReport(SimhashBucketReport &report)
+    {
+        mTablePtr->GetBucketReport(report);
+    }
+    virtual void GetMemoryUsage(SimhashMemoryUsage &usage)
+    {
+        mTablePtr->GetMemoryUsage(usage);
+    }
+private :
+    SimhashTablePtr mTablePtr;
+    SimhashTraceWriter mWriter;
+};
+
+SimhashTablePtr CreateSimhashTraceRecorder(SimhashTablePtr tablePtr,
+    const std::string &filename)
+{
+    std::tr1::shared_ptr<SimhashTraceRecorder> recorderPtr(
+        new SimhashTraceRecorder(tablePtr));
+    if (!tablePtr || !recorderPtr->Open(filename))
+    {
+        return SimhashTablePtr();
+    }
+    return recorderPtr;
+}
+
+SimhashReplayOptions::SimhashReplayOptions()
+    : threadNum(    1U      )
+    , speed(        0.0     )
+    , sharedReads(  false   )
+{}
+
+SimhashReplayReport::SimhashReplayReport()
+    : recordNum(    0UL )
+    , queryNum(     0UL )
+    , hitNum(       0UL )
+    , failedWrites( 0UL )
+    , elapsedNanos( 0UL )
+    , tableBytes(   0UL )
+    , residentBytes(0UL )
+{}
+
+std::string SimhashReplayReport::ToString() const
+{
+    std::ostringstream oss;
+    oss << "records=" << recordNum << " queries=" << queryNum << " hits="
+        << hitNum << " failedWrites=" << failedWrites << " elapsedMs="
+        << elapsedNanos / 1000000UL << " recordsPerSecond="
+        << recordNum * 1000000000UL / std::max(elapsedNanos, 1UL)
+        << std::endl;
+    oss << "tableBytes=" << tableBytes << " residentBytes=" << residentBytes
+        << std::endl;
+    for (uint_t i = 0; i < SIMHASH_TRACE_OP_NUM; ++i)
+    {
+        if (latencies[i].GetCount())
+        {
+            oss << TRACE_OPERATION_NAMES[i] << " (ns): "
+                << latencies[i].ToString() << std::endl;
+        }
+    }
+    oss << "All (ns): " << total.ToString() << std::endl;
+    return oss.str();
+}
+
+/* Returns the resident memory of process. */
+static uint64_t GetResidentBytes()
+{
+    unsigned long pages = 0, resident = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (fp)
+    {
+        if (fscanf(fp, "%lu %lu", &pages, &resident) != 2)
+        {
+            resident = 0;
+        }
+        fclose(fp);
+    }
+    return static_cast<uint64_t>(resident) * sysconf(_SC_PAGESIZE);
+}
+
+/* The records of one thread of a replay. */
+struct SimhashReplayWorker
+{
+    std::string filename;
+    SimhashTablePtr tablePtr;
+    const SimhashReplayOptions *options;
+    pthread_rwlock_t *lock;     // NULL with a single thread.
+    uint_t index;
+    uint64_t start;             // The monotonic clock of the trace start.
+    bool good;
+    SimhashReplayReport report;
+};
+
+/* Runs a record on table, and counts it into report. */
+static void RunTraceRecord(SimhashTable &table,
+    const SimhashTraceRecord &record, SimhashReplayReport &report,
+    FindAnswerType &ans, std::vector<FindAnswerType> &answers)
+{
+    bool ret = true;
+    hash_t nearDup = 0UL;
+    switch (record.op)
+    {
+    case SIMHASH_OP_INSERT : ret = table.Insert(record.hash); break;
+    case SIMHASH_OP_REMOVE : ret = table.Remove(record.hash); break;
+    case SIMHASH_OP_UPDATE :
+        ret = table.Update(record.hash, record.newHash);
+        break;
+    case SIMHASH_OP_SEARCH : ret = table.Search(record.hash); break;
+    case SIMHASH_OP_HAS_NEAR_DUPS : ret = table.HasNearDups(record.hash); break;
+    case SIMHASH_OP_FIND_FIRST_NEAR_DUP :
+        ret = table.FindFirstNearDup(record.hash, nearDup);
+        break;
+    case SIMHASH_OP_FIND_NEAR_DUPS :
+        ret = table.FindNearDups(record.hash, ans);
+        break;
+    case SIMHASH_TRACE_FIND_NEAR_DUPS_BATCH :
+        report.hitNum += table.FindNearDupsBatch(record.hashes, answers,
+            record.depth);
+        report.queryNum += record.hashes.size();
+        return;
+    case SIMHASH_TRACE_CLEAR : table.Clear(); return;
+    case SIMHASH_TRACE_FREEZE : ret = table.Freeze(); break;
+    default : return;
+    }
+    if (IsTraceWrite(record.op))
+    {
+        report.failedWrites += ret ? 0UL : 1UL;
+        return;
+    }
+    ++report.queryNum;
+    report.hitNum += ret ? 1UL : 0UL;
+}
+
+static void* ReplayTraceThread(void *arg)
+{
+    SimhashReplayWorker *worker = static_cast<SimhashReplayWorker*>(arg);
+    const SimhashReplayOptions &options = *worker->options;
+    SimhashReplayReport &report = worker->report;
+    SimhashTraceReader reader;
+    worker->good = reader.Open(worker->filename);
+    SimhashTraceRecord record;
+    FindAnswerType ans;
+    std::vector<FindAnswerType> answers;
+    for (uint64_t i = 0; worker->good && reader.Read(record); ++i)
+    {
+        if (i % options.threadNum != worker->index)
+        {
+            continue;
+        }
+        uint64_t begin = GetNanoTime();
+        if (options.speed > 0.0)
+        {
+            begin = worker->start + static_cast<uint64_t>(record.time
+                / options.speed);
+            //A record due is run at once, without the syscall of a sleep.
+            struct timespec ts;
+            ts.tv_sec = begin / 1000000000UL;
+            ts.tv_nsec = begin % 1000000000UL;
+            while (GetNanoTime() < begin
+                && clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL))
+            {}
+        }
+        if (worker->lock && (IsTraceWrite(record.op) || !options.sharedReads))
+        {
+            pthread_rwlock_wrlock(worker->lock);
+        }
+        else if (worker->lock)
+        {
+            pthread_rwlock_rdlock(worker->lock);
+        }
+        RunTraceRecord(*worker->tablePtr, record, report, ans, answers);
+        if (worker->lock)
+        {
+            pthread_rwlock_unlock(worker->lock);
+        }
+        const uint64_t end = GetNanoTime();
+        const uint64_t latency = end > begin ? end - begin : 0UL;
+        report.latencies[record.op].Record(latency);
+        report.total.Record(latency);
+        ++report.recordNum;
+    }
+    worker->good = worker->good && reader.Good();
+    return NULL;
+}
+
+bool ReplaySimhashTrace(const std::string &filename, SimhashTablePtr tablePtr,
+    const SimhashReplayOptions &options, SimhashReplayReport &report)
+{
+    report = SimhashReplayReport();
+    SimhashTraceReader reader;
+    if (!tablePtr || !reader.Open(filename))
+    {
+        return false;
+    }
+    reader.Close();
+    SimhashReplayOptions threadOptions = options;
+    threadOptions.threadNum = std::max(options.threadNum, 1U);
+    //The counters of stats are written by the queries too.
+    SIMHASH_STATS(threadOptions.sharedReads = false);
+    pthread_rwlock_t lock;
+    pthread_rwlock_init(&lock, NULL);
+    const uint64_t resident = GetResidentBytes();
+    //The threads start together a little later.
+    const uint64_t start = GetNanoTime() + 1000000UL;
+    std::vector<SimhashReplayWorker> workers(threadOptions.threadNum);
+    for (uint_t i = 0; i < threadOptions.threadNum; ++i)
+    {
+        workers[i].filename = filename;
+        workers[i].tablePtr = tablePtr;
+        workers[i].options = &threadOptions;
+        workers[i].lock = threadOptions.threadNum > 1U ? &lock : NULL;
+        workers[i].index = i;
+        workers[i].start = start;
+        workers[i].good = false;
+    }
+    if (1U == threadOptions.threadNum)
+    {
+        ReplayTraceThread(&workers[0]);
+    }
+    else
+    {
+        std::vector<pthread_t> threads(threadOptions.threadNum);
+        for (uint_t i = 0; i < threadOptions.threadNum; ++i)
+        {
+            pthread_create(&threads[i], NULL, ReplayTraceThread, &workers[i]);
+        }
+        for (uint_t i = 0; i < threadOptions.threadNum; ++i)
+        {
+            pthread_join(threads[i], NULL);
+        }
+    }
+    const uint64_t end = GetNanoTime();
+    pthread_rwlock_destroy(&lock);
+    bool good = true;
+    for (uint_t i = 0; i < threadOptions.threadNum; ++i)
+    {
+        const SimhashReplayReport &part = workers[i].report;
+        report.recordNum += part.recordNum;
+        report.queryNum += part.queryNum;
+        report.hitNum += part.hitNum;
+        report.failedWrites += part.failedWrites;
+        for (uint_t op = 0; op < SIMHASH_TRACE_OP_NUM; ++op)
+        {
+            report.latencies[op].Merge(part.latencies[op]);
+        }
+        report.total.Merge(part.total);
+        good = good && workers[i].good;
+    }
+    report.elapsedNanos = end > start ? end - start : 0UL;
+    SimhashMemoryUsage usage;
+    tablePtr->GetMemoryUsage(usage);
+    report.tableBytes = usage.GetTotalBytes();
+    const uint64_t grown = GetResidentBytes();
+    report.residentBytes = grown > resident ? grown - resident : 0UL;
+    return good;
+}
+
+} // namespace simhash
@@ -0,0 +1,328 @@
+/*==============================================================================
+*   Copyright (C) 2016 All rights reserved.
+*
+*  File Name    : simhash_window_table.cpp
+*  Author       : Zhongping Liang
+*  Date         : 2016-06-02
+*  Version      : 1.0
+*  Description  : This file provides implement of the SimhashWindowTable.
+==============================================================================*/
+
+#include "simhash_window_table.h"
+
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <pthread.h>
+
+namespace simhash
+{
+
+SimhashWindowTable::SimhashWindowTable()
+{}
+
+SimhashWindowTable::~SimhashWindowTable()
+{}
+
+class SimhashWindowTableImpl : public SimhashWindowTable
+{
+private:
+    SimhashWindowTableImpl(uint_t maxHamDist, uint_t level,
+        timestamp_t windowSpan, uint_t segmentNum);
+    SimhashWindowTableImpl(const SimhashWindowTableImpl&);
+    SimhashWindowTableImpl& operator=(const SimhashWindowTableImpl&);
+public :
+    virtual ~SimhashWindowTableImpl();
+public :
+    virtual bool Insert         (hash_t hash, timestamp_t timestamp);
+    virtual bool Search         (hash_t hash, timestamp_t timestamp);
+    virtual bool HasNearDups    (hash_t hash, timestamp_t timestamp);
+    virtual bool FindFirstNearDup(hash_t hash, timestamp_t timestamp,
+        hash_t &nearDup);
+    virtual bool FindNearDups   (hash_t hash, timestamp_t timestamp,
+        FindAnswerType &ans);
+    virtual uint_t Expire(timestamp_t timestamp);
+    virtual void Clear();
+    virtual uint_t GetSize();
+private :
+    /* Swaps the segment at slot for an empty table, and hands the old one to
+     * the reaper thread to be cleared. */
+    void DropSegment(uint_t slot);
+    /* The reaper thread, clears the dropped tables and keeps them as spares. */
+    static void* RunReaper(void *arg);
+    void Reap();
+    /* Returns true if the segment at slot holds a live epoch. */
+    inline bool IsLive(uint_t slot) const
+    {
+        return mStarted && mEpochs[slot] <= mCurrentEpoch
+            && mEpochs[slot] + mSegmentNum > mCurrentEpoch;
+    }
+    /* Returns the slot of the i-th newest segment. */
+    inline uint_t GetSlot(uint_t i) const
+    {
+        return static_cast<uint_t>((mCurrentEpoch + mSegmentNum
+            - i % mSegmentNum) % mSegmentNum);
+    }
+private :
+    typedef std::vector<SimhashTablePtr> SegmentsType;
+    typedef std::vector<uint64_t> EpochsType;
+    static const size_t MAX_SPARE_NUM = 2U;
+
+    uint_t mMaxHamDist;
+    uint_t mLevel;
+    timestamp_t mSegmentSpan;   // The time span covered by each segment.
+    uint_t mSegmentNum;         // The number of segments in the window.
+    SegmentsType mSegments;     // The segments, used as a ring.
+    EpochsType mEpochs;         // The epoch of each segment.
+    uint64_t mCurrentEpoch;     // The newest epoch ever seen.
+    bool mStarted;              // Whether any timestamp has been seen.
+    SegmentsType mDropped;      // The tables waiting to be cleared.
+    SegmentsType mSpares;       // The cleared tables, ready to be reused.
+    pthread_mutex_t mMutex;     // Guards mDropped, mSpares and mStopping.
+    pthread_cond_t mCond;       // Signals the reaper of a dropped table.
+    pthread_t mReaper;
+    bool mReaperStarted;        // If not, the segments are cleared inline.
+    bool mStopping;
+    friend SimhashWindowTablePtr CreateSimhashWindowTable(uint_t maxHamDist,
+        uint_t level, timestamp_t windowSpan, uint_t segmentNum);
+};
+
+SimhashWindowTableImpl::SimhashWindowTableImpl(uint_t maxHamDist, uint_t level,
+    timestamp_t windowSpan, uint_t segmentNum)
+    : mMaxHamDist(  maxHamDist  )
+    , mLevel(       level       )
+    , mSegmentSpan( (windowSpan + segmentNum - 1U) / segmentNum )
+    , mSegmentNum(  segmentNum  )
+    , mSegments(    segmentNum  )
+    , mEpochs(      segmentNum, 0UL )
+    , mCurrentEpoch(0UL         )
+    , mStarted(     false       )
+    , mStopping(    false       )
+{
+    for (uint_t i = 0; i < mSegmentNum; ++i)
+    {
+        mSegments.at(i) = CreateSimhashTable(maxHamDist, level);
+    }
+    mSpares.push_back(CreateSimhashTable(maxHamDist, level));
+    pthread_mutex_init(&mMutex, NULL);
+    pthread_cond_init(&mCond, NULL);
+    mReaperStarted = !pthread_create(&mReaper, NULL, RunReaper, this);
+}
+
+SimhashWindowTableImpl::~SimhashWindowTableImpl()
+{
+    if (mReaperStarted)
+    {
+        pthread_mutex_lock(&mMutex);
+        mStopping = true;
+        pthread_cond_signal(&mCond);
+        pthread_mutex_unlock(&mMutex);
+        pthread_join(mReaper, NULL);
+    }
+    pthread_cond_destroy(&mCond);
+    pthread_mutex_destroy(&mMutex);
+}
+
+void* SimhashWindowTableImpl::RunReaper(void *arg)
+{
+    static_cast<SimhashWindowTableImpl*>(arg)->Reap();
+    return NULL;
+}
+
+void SimhashWindowTableImpl::Reap()
+{
+    pthread_mutex_lock(&mMutex);
+    while (!mStopping)
+    {
+        if (mDropped.empty())
+        {
+            pthread_cond_wait(&mCond, &mMutex);
+            continue;
+        }
+        SimhashTablePtr table = mDropped.back();
+        mDropped.pop_back();
+        //Clearing walks every node of the permuted containers, which is the
+        //cost kept off the thread moving the window.
+        pthread_mutex_unlock(&mMutex);
+        table->Clear();
+        pthread_mutex_lock(&mMutex);
+        if (mSpares.size() < MAX_SPARE_NUM)
+        {
+            mSpares.push_back(table);
+        }
+    }
+    pthread_mutex_unlock(&mMutex);
+}
+
+void SimhashWindowTableImpl::DropSegment(uint_t slot)
+{
+    SimhashTablePtr &segment = mSegments.at(slot);
+    if (!segment->GetSize())
+    {
+        return;
+    }
+    if (!mReaperStarted)
+    {
+        segment->Clear();
+        return;
+    }
+    SimhashTablePtr spare;
+    pthread_mutex_lock(&mMutex);
+    if (!mSpares.empty())
+    {
+        spare = mSpares.back();
+        mSpares.pop_back();
+    }
+    mDropped.push_back(segment);
+    pthread_cond_signal(&mCond);
+    pthread_mutex_unlock(&mMutex);
+    //Only if the reaper is behind, an empty table is built here.
+    segment = spare ? spare : CreateSimhashTable(mMaxHamDist, mLevel);
+}
+
+uint_t SimhashWindowTableImpl::Expire(timestamp_t timestamp)
+{
+    const uint64_t epoch = timestamp / mSegmentSpan;
+    if (!mStarted)
+    {
+        mStarted = true;
+        mCurrentEpoch = epoch;
+        mEpochs.at(GetSlot(0U)) = epoch;
+        return 0U;
+    }
+    if (epoch <= mCurrentEpoch)
+    {
+        return 0U;
+    }
+    //Drop the segments fall out of the window, each slot at most once.
+    uint64_t steps = epoch - mCurrentEpoch;
+    if (steps > mSegmentNum)
+    {
+        steps = mSegmentNum;
+    }
+    uint_t dropped = 0U;
+    for (uint64_t e = epoch - steps + 1U; e <= epoch; ++e)
+    {
+        const uint_t slot = static_cast<uint_t>(e % mSegmentNum);
+        dropped += mSegments.at(slot)->GetSize() ? 1U : 0U;
+        DropSegment(slot);
+        mEpochs.at(slot) = e;
+    }
+    mCurrentEpoch = epoch;
+    return dropped;
+}
+
+bool SimhashWindowTableImpl::Insert(hash_t hash, timestamp_t timestamp)
+{
+    Expire(timestamp);
+    const uint64_t epoch = timestamp / mSegmentSpan;
+    //Too old, already out of the window.
+    if (epoch + mSegmentNum <= mCurrentEpoch)
+    {
+        return false;
+    }
+    //A late arrival goes into its own segment. If the slot is still labeled
+    //with an epoch older than the window, it holds nothing live.
+    const uint_t slot = static_cast<uint_t>(epoch % mSegmentNum);
+    if (mEpochs.at(slot) != epoch)
+    {
+        DropSegment(slot);
+        mEpochs.at(slot) = epoch;
+    }
+    return mSegments.at(slot)->Insert(hash);
+}
+
+bool SimhashWindowTableImpl::Search(hash_t hash, timestamp_t timestamp)
+{
+    Expire(timestamp);
+    for (uint_t i = 0; i < mSegmentNum; ++i)
+    {
+        const uint_t slot = GetSlot(i);
+        if (IsLive(slot) && mSegments.at(slot)->Search(hash))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool SimhashWindowTableImpl::HasNearDups(hash_t hash, timestamp_t timestamp)
+{
+    hash_t tmp;
+    return FindFirstNearDup(hash, timestamp, tmp);
+}
+
+bool SimhashWindowTableImpl::FindFirstNearDup(hash_t hash,
+    timestamp_t timestamp, hash_t &nearDup)
+{
+    Expire(timestamp);
+    //Visit the newest segment first.
+    for (uint_t i = 0; i < mSegmentNum; ++i)
+    {
+        const uint_t slot = GetSlot(i);
+        if (IsLive(slot) && mSegments.at(slot)->FindFirstNearDup(hash,
+            nearDup))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool SimhashWindowTableImpl::FindNearDups(hash_t hash, timestamp_t timestamp,
+    FindAnswerType &ans)
+{
+    Expire(timestamp);
+    ans.clear();
+    FindAnswerType subAns;
+    for (uint_t i = 0; i < mSegmentNum; ++i)
+    {
+        const uint_t slot = GetSlot(i);
+        if (IsLive(slot) && mSegments.at(slot)->FindNearDups(hash, subAns))
+        {
+            ans.insert(ans.end(), subAns.begin(), subAns.end());
+        }
+    }
+    //A refreshed value may be found in several segments.
+    std::sort(ans.begin(), ans.end());
+    ans.resize(std::distance(ans.begin(), std::unique(ans.begin(), ans.end())));
+    return !ans.empty();
+}
+
+void SimhashWindowTableImpl::Clear()
+{
+    for (uint_t i = 0; i < mSegmentNum; ++i)
+    {
+        DropSegment(i);
+    }
+    std::fill(mEpochs.begin(), mEpochs.end(), 0UL);
+    mCurrentEpoch = 0UL;
+    mStarted = false;
+}
+
+uint_t SimhashWindowTableImpl::GetSize()
+{
+    uint_t size = 0U;
+    for (uint_t i = 0; i < mSegmentNum; ++i)
+    {
+        if (IsLive(i))
+        {
+            size += mSegments.at(i)->GetSize();
+        }
+    }
+    return size;
+}
+
+SimhashWindowTablePtr CreateSimhashWindowTable(uint_t maxHamDist,
+    uint_t level, timestamp_t windowSpan, uint_t segmentNum)
+{
+    if (!windowSpan || !segmentNum)
+    {
+        throw std::invalid_argument("windowSpan and segmentNum should be "
+            "positive.");
+    }
+    return SimhashWindowTablePtr(new SimhashWindowTableImpl(maxHamDist, level,
+        windowSpan, segmentNum));
+}
+
+} // namespace simhash
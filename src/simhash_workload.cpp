@@ -0,0 +1,314 @@
+/*==============================================================================
+*   Copyright (C) 2016 All rights reserved.
+*
+*  File Name    : simhash_workload.cpp
+*  Author       : Zhongping Liang
+*  Date         : 2016-07-22
+*  Version      : 1.0
+*  Description  : This file provides implement of the generator of clustered
+*           corpora of simhash values.
+==============================================================================*/
+
+#include "simhash_workload.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "simhash_stats.h"
+
+namespace simhash
+{
+
+/* The values generated by a thread in a round. */
+static const uint64_t ROUND_VALUES = 1UL << 20;
+
+/* The finalizer of splitmix64, which maps a counter to a random word. */
+static inline uint64_t MixBits(uint64_t x)
+{
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9UL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBUL;
+    return x ^ (x >> 31);
+}
+
+/*
+* class WorkloadRandom
+* The splitmix64 generator, seeded by the corpus and the rank of a cluster,
+* so a cluster is the same whichever thread generates it.
+*/
+class WorkloadRandom
+{
+public :
+    WorkloadRandom(uint64_t seed, uint64_t cluster)
+        : mState(MixBits(seed + 0x9E3779B97F4A7C15UL) ^ cluster)
+    {}
+    inline uint64_t Next()
+    {
+        mState += 0x9E3779B97F4A7C15UL;
+        return MixBits(mState);
+    }
+    /* Returns a uniform value in [0, 1). */
+    inline real_t NextReal()
+    {
+        return static_cast<real_t>(Next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+private :
+    uint64_t mState;
+};
+
+/* The clusters generated by one thread in a round. */
+struct WorkloadTask
+{
+    const SimhashWorkloadOptions *options;
+    const std::vector<real_t> *distanceCdf;
+    uint64_t firstCluster;
+    std::vector<uint64_t> sizes;    // The values of each cluster.
+    std::vector<hash_t> values;
+    std::vector<SimhashWorkloadPair> pairs;
+    uint64_t duplicateNum;
+    std::vector<uint64_t> distanceCounts;
+};
+
+/* Generates the center of a cluster by the bit biases. */
+static hash_t GenerateCenter(const SimhashWorkloadOptions &options,
+    WorkloadRandom &random)
+{
+    if (options.bitBiases.empty())
+    {
+        return random.Next();
+    }
+    hash_t center = 0UL;
+    for (uint_t bit = 0; bit < HASH_WIDTH; ++bit)
+    {
+        center |= random.NextReal() < options.bitBiases[bit]
+            ? HASH_1 << bit : 0UL;
+    }
+    return center;
+}
+
+static void* GenerateClusters(void *arg)
+{
+    WorkloadTask &task = *static_cast<WorkloadTask*>(arg);
+    const SimhashWorkloadOptions &options = *task.options;
+    const std::vector<real_t> &cdf = *task.distanceCdf;
+    for (size_t i = 0; i < task.sizes.size(); ++i)
+    {
+        const uint32_t cluster = static_cast<uint32_t>(task.firstCluster + i);
+        WorkloadRandom random(options.seed, cluster);
+        const hash_t center = GenerateCenter(options, random);
+        task.values.push_back(center);
+        const size_t firstPair = task.pairs.size();
+        for (uint64_t j = 1; j < task.sizes[i]; ++j)
+        {
+            SimhashWorkloadPair pair;
+            pair.center = center;
+            pair.cluster = cluster;
+            if (options.duplicateRate > 0.0
+                && random.NextReal() < options.duplicateRate)
+            {
+                //A copy of the center or of an earlier member.
+                const uint64_t copied = random.Next() % j;
+                pair.value = copied ? task.pairs[firstPair + copied - 1U].value
+                    : center;
+                pair.distance = copied
+                    ? task.pairs[firstPair + copied - 1U].distance : 0U;
+                ++task.duplicateNum;
+            }
+            else
+            {
+                pair.distance = static_cast<uint32_t>(std::upper_bound(
+                    cdf.begin(), cdf.end(), random.NextReal() * cdf.back())
+                    - cdf.begin());
+                pair.distance = std::min(pair.distance,
+                    static_cast<uint32_t>(cdf.size() - 1U));
+                hash_t flips = 0UL;
+                for (uint_t d = 0; d < pair.distance;)
+                {
+                    const hash_t bit = HASH_1 << (random.Next() % HASH_WIDTH);
+                    d += flips & bit ? 0U : 1U;
+                    flips |= bit;
+                }
+                pair.value = center ^ flips;
+            }
+            task.values.push_back(pair.value);
+            task.pairs.push_back(pair);
+            ++task.distanceCounts[pair.distance];
+        }
+    }
+    return NULL;
+}
+
+/* Writes all data into fd, returns false if failed. */
+static bool WriteAll(int fd, const char *data, size_t size)
+{
+    while (size)
+    {
+        ssize_t ret = write(fd, data, size);
+        if (ret < 0 && EINTR == errno)
+        {
+            continue;
+        }
+        if (ret <= 0)
+        {
+            return false;
+        }
+        data += ret;
+        size -= ret;
+    }
+    return true;
+}
+
+SimhashWorkloadOptions::SimhashWorkloadOptions()
+    : valueNum(         1000000UL   )
+    , clusterNum(       100000UL    )
+    , zipfExponent(     1.0         )
+    , duplicateRate(    0.0         )
+    , seed(             0UL         )
+    , threadNum(        0U          )
+{
+    //Members 1 to 3 bits from their centers.
+    distanceWeights.push_back(0.0);
+    distanceWeights.resize(4U, 1.0);
+}
+
+SimhashWorkloadReport::SimhashWorkloadReport()
+    : valueNum(         0UL )
+    , duplicateNum(     0UL )
+    , largestCluster(   0UL )
+    , elapsedNanos(     0UL )
+{}
+
+bool GenerateSimhashWorkload(const SimhashWorkloadOptions &options,
+    const std::string &valueFile, const std::string &pairFile,
+    SimhashWorkloadReport &report, SimhashFileFormat format)
+{
+    const uint64_t start = GetNanoTime();
+    report = SimhashWorkloadReport();
+    std::vector<real_t> cdf;
+    real_t weight = 0.0;
+    for (size_t d = 0; d < options.distanceWeights.size(); ++d)
+    {
+        weight += std::max(options.distanceWeights[d], 0.0);
+        cdf.push_back(weight);
+    }
+    if (!options.clusterNum || options.clusterNum > options.valueNum
+        || options.clusterNum >> 32 || weight <= 0.0
+        || cdf.size() > HASH_WIDTH + 1U || options.zipfExponent < 0.0
+        || options.duplicateRate < 0.0 || options.duplicateRate > 1.0
+        || (!options.bitBiases.empty()
+        && HASH_WIDTH != options.bitBiases.size()))
+    {
+        return false;
+    }
+    SimhashFileWriter<hash_t> writer;
+    int pairFd = -1;
+    if (!writer.Open(valueFile, format) || (!pairFile.empty() && (pairFd
+        = open(pairFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+        0644)) < 0))
+    {
+        return false;
+    }
+    uint_t threadNum = options.threadNum;
+    if (!threadNum)
+    {
+        threadNum = static_cast<uint_t>(std::max(sysconf(_SC_NPROCESSORS_ONLN),
+            1L));
+    }
+    //The values besides the centers go to the clusters by the Zipf weights,
+    //the cluster i ends at round(extra * cum(i + 1) / total).
+    const uint64_t extra = options.valueNum - options.clusterNum;
+    real_t total = 0.0;
+    for (uint64_t i = 0; i < options.clusterNum; ++i)
+    {
+        total += std::pow(static_cast<real_t>(i + 1U), -options.zipfExponent);
+    }
+    real_t cum = 0.0;
+    uint64_t assigned = 0UL;
+    report.distanceCounts.assign(cdf.size(), 0UL);
+    std::vector<WorkloadTask> tasks(threadNum);
+    bool good = true;
+    for (uint64_t next = 0; next < options.clusterNum && good;)
+    {
+        for (uint_t t = 0; t < threadNum; ++t)
+        {
+            WorkloadTask &task = tasks[t];
+            task.options = &options;
+            task.distanceCdf = &cdf;
+            task.firstCluster = next;
+            task.sizes.clear();
+            task.values.clear();
+            task.pairs.clear();
+            task.duplicateNum = 0UL;
+            task.distanceCounts.assign(cdf.size(), 0UL);
+            uint64_t values = 0UL;
+            for (; next < options.clusterNum && values < ROUND_VALUES; ++next)
+            {
+                cum += std::pow(static_cast<real_t>(next + 1U),
+                    -options.zipfExponent);
+                const uint64_t end = next + 1U == options.clusterNum ? extra
+                    : std::min(extra, static_cast<uint64_t>(
+                    std::floor(extra * (cum / total) + 0.5)));
+                const uint64_t size = 1U + std::max(end, assigned) - assigned;
+                assigned = std::max(end, assigned);
+                task.sizes.push_back(size);
+                report.largestCluster = std::max(report.largestCluster, size);
+                values += size;
+            }
+            task.values.reserve(values);
+            task.pairs.reserve(values);
+        }
+        //The calling thread is one of them, also if a thread fails to start.
+        std::vector<pthread_t> threads(threadNum);
+        std::vector<bool> started(threadNum, false);
+        for (uint_t t = 1; t < threadNum; ++t)
+        {
+            started[t] = !tasks[t].sizes.empty()
+                && !pthread_create(&threads[t], NULL, GenerateClusters,
+                &tasks[t]);
+        }
+        for (uint_t t = 0; t < threadNum; ++t)
+        {
+            if (!t || (!started[t] && !tasks[t].sizes.empty()))
+            {
+                GenerateClusters(&tasks[t]);
+            }
+        }
+        for (uint_t t = 1; t < threadNum; ++t)
+        {
+            if (started[t])
+            {
+                pthread_join(threads[t], NULL);
+            }
+        }
+        for (uint_t t = 0; t < threadNum && good; ++t)
+        {
+            const WorkloadTask &task = tasks[t];
+            for (size_t i = 0; i < task.values.size(); ++i)
+            {
+                writer.Write(task.values[i]);
+            }
+            good = pairFd < 0 || task.pairs.empty() || WriteAll(pairFd,
+                reinterpret_cast<const char*>(&task.pairs[0]),
+                task.pairs.size() * sizeof(SimhashWorkloadPair));
+            report.valueNum += task.values.size();
+            report.duplicateNum += task.duplicateNum;
+            for (size_t d = 0; d < cdf.size(); ++d)
+            {
+                report.distanceCounts[d] += task.distanceCounts[d];
+            }
+        }
+    }
+    good = writer.Close() && good;
+    if (pairFd >= 0)
+    {
+        good = !close(pairFd) && good;
+    }
+    report.elapsedNanos = GetNanoTime() - start;
+    return good;
+}
+
+} // namespace simhash
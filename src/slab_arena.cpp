@@ -0,0 +1,87 @@
+/*==============================================================================
+*   Copyright (C) 2016 All rights reserved.
+*
+*  File Name    : slab_arena.cpp
+*  Author       : Zhongping Liang
+*  Date         : 2016-07-22
+*  Version      : 1.0
+*  Description  : This file provides implement of the SlabArena.
+==============================================================================*/
+
+#include "slab_arena.h"
+
+#include <algorithm>
+
+namespace simhash
+{
+
+/* The objects of the first slab. */
+static const size_t MIN_SLAB_OBJECTS = 16U;
+
+SlabArena::SlabArena(size_t slabBytes)
+    : mSlabBytes(       slabBytes   )
+    , mRequestBytes(    0U          )
+    , mObjectBytes(     0U          )
+    , mCursor(          NULL        )
+    , mEnd(             NULL        )
+    , mTotalBytes(      0UL         )
+    , mFreeList(        NULL        )
+    , mObjectNum(       0U          )
+{}
+
+SlabArena::~SlabArena()
+{
+    Release();
+}
+
+void* SlabArena::AllocateSlow(size_t bytes)
+{
+    if (!mRequestBytes)
+    {
+        //The objects are aligned as pointers, and hold the free list link.
+        mRequestBytes = bytes;
+        mObjectBytes = (std::max(bytes, sizeof(void*)) + sizeof(void*) - 1U)
+            & ~(sizeof(void*) - 1U);
+        mSlabBytes = std::max(mSlabBytes, mObjectBytes);
+    }
+    if (bytes != mRequestBytes)
+    {
+        return ::operator new(bytes);
+    }
+    if (mFreeList || mCursor + mObjectBytes <= mEnd)
+    {
+        return Allocate(bytes);
+    }
+    //The slabs double from MIN_SLAB_OBJECTS objects up to mSlabBytes, so that
+    //a small container doesn't take a whole slab.
+    const size_t slabBytes = std::min(mSlabBytes, std::max(MIN_SLAB_OBJECTS
+        * mObjectBytes, static_cast<size_t>(mTotalBytes)));
+    mSlabs.reserve(mSlabs.size() + 1U);
+    mCursor = static_cast<char*>(::operator new(slabBytes));
+    mEnd = mCursor + slabBytes;
+    mTotalBytes += slabBytes;
+    mSlabs.push_back(mCursor);
+    return Allocate(bytes);
+}
+
+void SlabArena::Release()
+{
+    for (std::vector<char*>::iterator it = mSlabs.begin(); mSlabs.end() != it;
+        ++it)
+    {
+        ::operator delete(*it);
+    }
+    std::vector<char*>().swap(mSlabs);
+    mCursor = NULL;
+    mEnd = NULL;
+    mTotalBytes = 0UL;
+    mFreeList = NULL;
+    mObjectNum = 0U;
+}
+
+uint64_t SlabArena::GetMemoryUsage() const
+{
+    return mTotalBytes + mSlabs.capacity() * sizeof(char*);
+}
+
+} // namespace simhash
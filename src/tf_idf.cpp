@@ -0,0 +1,334 @@
+/*==============================================================================
+*   Copyright (C) 2016 All rights reserved.
+*
+*  File Name    : tf_idf.cpp
+*  Author       : Zhongping Liang
+*  Date         : 2016-07-22
+*  Version      : 1.0
+*  Description  : This file provides implement of the IdfDictionary and the
+*           BasicTfIdfWeighter.
+==============================================================================*/
+
+#include "tf_idf.h"
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace simhash
+{
+
+/* Mix: the finalizer of MurmurHash3, for the second hash of keys. */
+static inline uint64_t Mix(uint64_t key)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return key;
+}
+
+/* Returns the bucket of key, by its high bits. */
+static inline uint64_t GetBucket(uint64_t key, uint64_t bucketNum)
+{
+    return (key >> 32) * bucketNum >> 32;
+}
+
+/* Returns the slot of key with the displacement d. */
+static inline uint64_t GetSlot(uint64_t key, uint64_t d, uint64_t slotNum)
+{
+    return (key % slotNum + d * (Mix(key) % (slotNum - 1U) + 1U)) % slotNum;
+}
+
+/* Returns the bytes of the displacements, padded to 8. */
+static inline uint64_t GetDisplacementBytes(uint64_t bucketNum)
+{
+    return (bucketNum * sizeof(uint32_t) + 7U) / 8U * 8U;
+}
+
+/* Returns the least prime not less than num. */
+static uint64_t GetPrime(uint64_t num)
+{
+    for (;; ++num)
+    {
+        bool prime = num >= 2U;
+        for (uint64_t i = 2; prime && i * i <= num; ++i)
+        {
+            prime = num % i != 0U;
+        }
+        if (prime)
+        {
+            return num;
+        }
+    }
+}
+
+/* Compares the buckets by their sizes, the larger first. */
+struct BucketGreater
+{
+    bool operator()(const std::vector<uint32_t> *lhs,
+        const std::vector<uint32_t> *rhs) const
+    {
+        return lhs->size() > rhs->size();
+    }
+};
+
+IdfDictionary::IdfDictionary()
+    : mData(            NULL    )
+    , mSize(            0       )
+    , mHeader(          NULL    )
+    , mDisplacements(   NULL    )
+    , mSlots(           NULL    )
+{}
+
+IdfDictionary::~IdfDictionary()
+{
+    Close();
+}
+
+bool IdfDictionary::Build(const std::vector<std::pair<hash_t, real_t> > &terms,
+    real_t defaultIdf, const std::string &filename)
+{
+    std::vector<hash_t> keys(terms.size());
+    for (size_t i = 0; i < terms.size(); ++i)
+    {
+        keys[i] = terms[i].first;
+    }
+    std::sort(keys.begin(), keys.end());
+    if (std::adjacent_find(keys.begin(), keys.end()) != keys.end()
+        || terms.size() >= 0xFFFFFFFFUL)
+    {
+        return false;
+    }
+    //About 4 keys per bucket, and the slots are 89% full.
+    IdfDictionaryHeader header;
+    memcpy(header.magic, IDF_DICTIONARY_MAGIC, sizeof(header.magic));
+    header.version = IDF_DICTIONARY_VERSION;
+    header.reserved = 0U;
+    header.keyNum = terms.size();
+    header.bucketNum = terms.size() / 4U + 1U;
+    header.slotNum = GetPrime(terms.size() + terms.size() / 8U + 2U);
+    header.defaultIdf = defaultIdf;
+    std::vector<std::vector<uint32_t> > buckets(header.bucketNum);
+    for (size_t i = 0; i < terms.size(); ++i)
+    {
+        buckets[GetBucket(terms[i].first, header.bucketNum)].push_back(i);
+    }
+    std::vector<const std::vector<uint32_t>*> order(buckets.size());
+    for (size_t i = 0; i < buckets.size(); ++i)
+    {
+        order[i] = &buckets[i];
+    }
+    std::stable_sort(order.begin(), order.end(), BucketGreater());
+    std::vector<uint32_t> displacements(header.bucketNum, 0U);
+    std::vector<IdfDictionarySlot> slots(header.slotNum);
+    std::vector<bool> taken(header.slotNum, false);
+    std::vector<uint64_t> positions;
+    for (size_t b = 0; b < order.size() && !order[b]->empty(); ++b)
+    {
+        const std::vector<uint32_t> &bucket = *order[b];
+        uint64_t d = 0;
+        for (; d < header.slotNum; ++d)
+        {
+            //Takes the slots one by one, and gives them back on a collision.
+            positions.clear();
+            for (size_t i = 0; i < bucket.size(); ++i)
+            {
+                uint64_t slot = GetSlot(terms[bucket[i]].first, d,
+                    header.slotNum);
+                if (taken[slot])
+                {
+                    break;
+                }
+                taken[slot] = true;
+                positions.push_back(slot);
+            }
+            if (positions.size() == bucket.size())
+            {
+                break;
+            }
+            for (size_t i = 0; i < positions.size(); ++i)
+            {
+                taken[positions[i]] = false;
+            }
+        }
+        if (d == header.slotNum)    //Two keys have the same f1 and f2.
+        {
+            return false;
+        }
+        displacements[GetBucket(terms[bucket[0]].first, header.bucketNum)]
+            = static_cast<uint32_t>(d);
+        for (size_t i = 0; i < bucket.size(); ++i)
+        {
+            slots[positions[i]].key = terms[bucket[i]].first;
+            slots[positions[i]].idf = terms[bucket[i]].second;
+        }
+    }
+    for (size_t i = 0; i < slots.size(); ++i)
+    {
+        if (!taken[i])
+        {
+            slots[i].key = 0UL;
+            slots[i].idf = defaultIdf;
+        }
+    }
+    displacements.resize(GetDisplacementBytes(header.bucketNum)
+        / sizeof(uint32_t), 0U);
+    FILE *fp = fopen(filename.c_str(), "wb");
+    if (!fp)
+    {
+        return false;
+    }
+    bool ret = fwrite(&header, sizeof(header), 1U, fp) == 1U
+        && fwrite(&displacements[0], sizeof(uint32_t), displacements.size(),
+        fp) == displacements.size()
+        && fwrite(&slots[0], sizeof(IdfDictionarySlot), slots.size(), fp)
+        == slots.size();
+    return 0 == fclose(fp) && ret;
+}
+
+bool IdfDictionary::Open(const std::string &filename)
+{
+    Close();
+    int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st)
+        || static_cast<size_t>(st.st_size) < sizeof(IdfDictionaryHeader))
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return false;
+    }
+    //Shared, so all the processes which map the file use the same pages.
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == data)
+    {
+        return false;
+    }
+    mData = static_cast<const char*>(data);
+    mSize = static_cast<size_t>(st.st_size);
+    const IdfDictionaryHeader *header
+        = reinterpret_cast<const IdfDictionaryHeader*>(mData);
+    //Only the header is checked, the lookups keep in the file anyway.
+    if (memcmp(header->magic, IDF_DICTIONARY_MAGIC, sizeof(header->magic))
+        || IDF_DICTIONARY_VERSION != header->version
+        || !header->bucketNum || header->bucketNum > 0xFFFFFFFFUL
+        || header->slotNum < 2U || header->slotNum > 0xFFFFFFFFUL
+        || mSize != sizeof(IdfDictionaryHeader)
+        + GetDisplacementBytes(header->bucketNum)
+        + header->slotNum * sizeof(IdfDictionarySlot))
+    {
+        Close();
+        return false;
+    }
+    mHeader = header;
+    mDisplacements = reinterpret_cast<const uint32_t*>(mData
+        + sizeof(IdfDictionaryHeader));
+    mSlots = reinterpret_cast<const IdfDictionarySlot*>(mData
+        + sizeof(IdfDictionaryHeader) + GetDisplacementBytes(header->bucketNum));
+    return true;
+}
+
+void IdfDictionary::Close()
+{
+    if (mData)
+    {
+        munmap(const_cast<char*>(mData), mSize);
+    }
+    mData = NULL;
+    mSize = 0;
+    mHeader = NULL;
+    mDisplacements = NULL;
+    mSlots = NULL;
+}
+
+real_t IdfDictionary::GetIdf(hash_t key) const
+{
+    if (!mHeader)
+    {
+        return 0.0;
+    }
+    const uint32_t d = mDisplacements[GetBucket(key, mHeader->bucketNum)];
+    const IdfDictionarySlot &slot = mSlots[GetSlot(key, d, mHeader->slotNum)];
+    return slot.key == key ? slot.idf : mHeader->defaultIdf;
+}
+
+template <typename HashT>
+BasicTfIdfWeighter<HashT>::BasicTfIdfWeighter(const IdfDictionary &dictionary,
+    HashFunc hasher)
+    : mDictionary(  dictionary  )
+    , mHasher(      hasher      )
+{}
+
+template <typename HashT>
+BasicTfIdfWeighter<HashT>::~BasicTfIdfWeighter()
+{}
+
+template <typename HashT>
+void BasicTfIdfWeighter<HashT>::Weigh(const std::vector<std::string> &tokens,
+    std::vector<HashFeatureType> &features)
+{
+    features.clear();
+    mCounts.clear();
+    if (!mHasher)   //Don't put a nullptr, or will do nothing.
+    {
+        return;
+    }
+    size_t size = 16U;
+    while (size < tokens.size() * 2U)
+    {
+        size *= 2U;
+    }
+    if (mIndexes.size() < size)
+    {
+        mIndexes.assign(size, 0U);
+    }
+    const size_t mask = mIndexes.size() - 1U;
+    for (size_t i = 0; i < tokens.size(); ++i)
+    {
+        HashT hash = mHasher(tokens[i]);
+        size_t pos = GetWord(hash, 0U) & mask;
+        for (; mIndexes[pos]; pos = (pos + 1U) & mask)
+        {
+            if (features[mIndexes[pos] - 1U].first == hash)
+            {
+                break;
+            }
+        }
+        if (mIndexes[pos])
+        {
+            ++mCounts[mIndexes[pos] - 1U];
+            continue;
+        }
+        features.push_back(HashFeatureType(hash, 0.0));
+        mCounts.push_back(1U);
+        mIndexes[pos] = static_cast<uint32_t>(features.size());
+    }
+    //Weighs the features, and empties the map for the next document.
+    for (size_t i = 0; i < features.size(); ++i)
+    {
+        const uint64_t key = GetWord(features[i].first, 0U);
+        features[i].second = mCounts[i] * mDictionary.GetIdf(key);
+        size_t pos = key & mask;
+        while (mIndexes[pos] != i + 1U)
+        {
+            pos = (pos + 1U) & mask;
+        }
+        mIndexes[pos] = 0U;
+    }
+}
+
+template class BasicTfIdfWeighter<hash_t>;
+template class BasicTfIdfWeighter<hash128_t>;
+template class BasicTfIdfWeighter<hash256_t>;
+
+} // namespace simhash
@@ -0,0 +1,134 @@
+/*==============================================================================
+*   Copyright (C) 2016 All rights reserved.
+*
+*  File Name    : token_hash_cache.cpp
+*  Author       : Zhongping Liang
+*  Date         : 2016-07-22
+*  Version      : 1.0
+*  Description  : This file provides implement of the BasicTokenHashCache.
+==============================================================================*/
+
+#include "token_hash_cache.h"
+
+#include <cstring>
+#include <algorithm>
+
+namespace simhash
+{
+
+template <typename HashT>
+BasicTokenHashCache<HashT>::BasicTokenHashCache(HashFunc hasher,
+    uint_t slotBits)
+    : mHasher(  hasher  )
+    , mMask(    0UL     )
+    , mShift(   0U      )
+    , mHits(    0UL     )
+    , mMisses(  0UL     )
+{
+    slotBits = std::max(std::min(slotBits, 30U), 1U);
+    mSlots.resize(static_cast<size_t>(1U) << slotBits);
+    mMask = mSlots.size() - 1U;
+    mShift = 64U - slotBits;
+    Clear();
+}
+
+template <typename HashT>
+BasicTokenHashCache<HashT>::~BasicTokenHashCache()
+{}
+
+template <typename HashT>
+HashT BasicTokenHashCache<HashT>::Hash(const std::string &token)
+{
+    if (token.size() > MAX_TOKEN_BYTES)
+    {
+        ++mMisses;
+        return mHasher(token);
+    }
+    //A token of at most 24 bytes is the same as its head, middle and tail
+    //words, so they are compared instead of the bytes.
+    const char *bytes = token.data();
+    const size_t size = token.size();
+    uint64_t head = 0UL, middle = 0UL, tail = 0UL;
+    if (size >= 8U)
+    {
+        memcpy(&head, bytes, 8U);
+        memcpy(&tail, bytes + size - 8U, 8U);
+        if (size > 16U)
+        {
+            memcpy(&middle, bytes + 8, 8U);
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < size; ++i)
+        {
+            head |= static_cast<uint64_t>(static_cast<unsigned char>(bytes[i]))
+                << (i * 8U);
+        }
+    }
+    //Mixes the words, much cheaper than the hasher.
+    const uint64_t mixed = ((head ^ (tail * 0x9e3779b97f4a7c15ULL) ^ middle
+        ^ size) * 0xff51afd7ed558ccdULL) >> mShift;
+    const uint32_t length = static_cast<uint32_t>(size) + 1U;
+    Slot *empty = NULL;
+    for (uint_t p = 0; p < PROBE_NUM; ++p)
+    {
+        Slot &slot = mSlots[(mixed + p) & mMask];
+        if (!slot.length)
+        {
+            empty = &slot;
+            break;
+        }
+        if (slot.length == length && slot.head == head
+            && slot.middle == middle && slot.tail == tail)
+        {
+            ++mHits;
+            return slot.hash;
+        }
+    }
+    ++mMisses;
+    //Takes the empty slot, or evicts the home slot.
+    Slot &slot = empty ? *empty : mSlots[mixed & mMask];
+    slot.head = head;
+    slot.middle = middle;
+    slot.tail = tail;
+    slot.length = length;
+    slot.hash = mHasher(token);
+    return slot.hash;
+}
+
+template <typename HashT>
+real_t BasicTokenHashCache<HashT>::GetHitRate() const
+{
+    const uint64_t lookups = mHits + mMisses;
+    return lookups ? static_cast<real_t>(mHits) / lookups : 0.0;
+}
+
+template <typename HashT>
+void BasicTokenHashCache<HashT>::ResetStats()
+{
+    mHits = 0UL;
+    mMisses = 0UL;
+}
+
+template <typename HashT>
+void BasicTokenHashCache<HashT>::Clear()
+{
+    for (size_t i = 0; i < mSlots.size(); ++i)
+    {
+        mSlots[i].length = 0U;
+    }
+    ResetStats();
+}
+
+template <typename HashT>
+size_t BasicTokenHashCache<HashT>::GetMemoryUsage() const
+{
+    return mSlots.capacity() * sizeof(Slot);
+}
+
+template class BasicTokenHashCache<hash_t>;
+template class BasicTokenHashCache<hash128_t>;
+template class BasicTokenHashCache<hash256_t>;
+
+} // namespace simhash
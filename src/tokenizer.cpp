@@ -0,0 +1,342 @@
+/*==============================================================================
+*   Copyright (C) 2016 All rights reserved.
+*
+*  File Name    : tokenizer.cpp
+*  Author       : Zhongping Liang
+*  Date         : 2016-07-22
+*  Version      : 1.0
+*  Description  : This file provides implement of the Tokenizer.
+==============================================================================*/
+
+#include "tokenizer.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <cstring>
+
+namespace simhash
+{
+
+/* The classes of chars. */
+enum CharClass
+{
+    CHAR_DELIM  = 0,    // The white spaces and the punctuations.
+    CHAR_WORD   = 1,    // The letters and digits, but the CJK ones.
+    CHAR_CJK    = 2     // The CJK ideographs, Hiragana and Katakana.
+};
+
+/* No position. */
+static const size_t NPOS = static_cast<size_t>(-1);
+
+/* The table of classes of ASCII, the letters and digits are CHAR_WORD. */
+static unsigned char ASCII_CLASSES[128];
+
+struct TokenizerTables
+{
+    TokenizerTables()
+    {
+        for (uint_t c = 0; c < 128U; ++c)
+        {
+            bool word = (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z')
+                || (c >= 'A' && c <= 'Z');
+            ASCII_CLASSES[c] = word ? CHAR_WORD : CHAR_DELIM;
+        }
+    }
+};
+
+static TokenizerTables gTokenizerTables;
+
+/* Returns the class of a code point out of ASCII. */
+static inline CharClass ClassifyCodePoint(uint32_t cp)
+{
+    if (cp < 0x100U)    //The Latin-1 signs, but the letters, and the ×, ÷.
+    {
+        if (cp < 0xC0U)
+        {
+            return 0xAAU == cp || 0xB5U == cp || 0xBAU == cp ? CHAR_WORD
+                : CHAR_DELIM;
+        }
+        return 0xD7U == cp || 0xF7U == cp ? CHAR_DELIM : CHAR_WORD;
+    }
+    if (cp < 0x2000U)
+    {
+        return 0x1680U == cp ? CHAR_DELIM : CHAR_WORD;
+    }
+    if (cp < 0x2070U || (cp >= 0x2E00U && cp < 0x2E80U))
+    {
+        return CHAR_DELIM;  //The general and the supplemental punctuations.
+    }
+    if (cp < 0x3000U)
+    {
+        return CHAR_WORD;
+    }
+    if (cp < 0x3040U)
+    {
+        return CHAR_DELIM;  //The CJK symbols and punctuations.
+    }
+    if (cp < 0x3100U)
+    {
+        return 0x30FBU == cp ? CHAR_DELIM : CHAR_CJK;   //Hiragana, Katakana.
+    }
+    if ((cp >= 0x3400U && cp < 0xA000U) || (cp >= 0xF900U && cp < 0xFB00U)
+        || (cp >= 0x20000U && cp < 0x30000U))
+    {
+        return CHAR_CJK;    //The CJK ideographs.
+    }
+    if ((cp >= 0xFE10U && cp < 0xFE20U) || (cp >= 0xFE30U && cp < 0xFE70U)
+        || 0xFEFFU == cp)
+    {
+        return CHAR_DELIM;  //The vertical and small forms, and the BOM.
+    }
+    if (cp >= 0xFF00U && cp < 0xFFA0U)  //The fullwidth and halfwidth forms.
+    {
+        if (cp >= 0xFF66U)
+        {
+            return CHAR_CJK;
+        }
+        return (cp >= 0xFF10U && cp < 0xFF1AU) || (cp >= 0xFF21U
+            && cp < 0xFF3BU) || (cp >= 0xFF41U && cp < 0xFF5BU) ? CHAR_WORD
+            : CHAR_DELIM;
+    }
+    return CHAR_WORD;
+}
+
+/* Decodes the char at p out of ASCII, returns its bytes, 0 if invalid. */
+static inline size_t DecodeChar(const unsigned char *p, size_t left,
+    uint32_t &cp)
+{
+    const uint32_t c = p[0];
+    if (c < 0xC2U || c > 0xF4U)
+    {
+        return 0;
+    }
+    const size_t len = c < 0xE0U ? 2U : (c < 0xF0U ? 3U : 4U);
+    if (left < len)
+    {
+        return 0;
+    }
+    cp = c & (0x7FU >> len);
+    for (size_t i = 1; i < len; ++i)
+    {
+        if ((p[i] & 0xC0U) != 0x80U)
+        {
+            return 0;
+        }
+        cp = (cp << 6) | (p[i] & 0x3FU);
+    }
+    //The overlong forms, the surrogates, and the ones out of Unicode.
+    if ((3U == len && (cp < 0x800U || (cp >= 0xD800U && cp < 0xE000U)))
+        || (4U == len && (cp < 0x10000U || cp > 0x10FFFFU)))
+    {
+        return 0;
+    }
+    return len;
+}
+
+static inline void AddToken(const char *text, size_t begin, size_t end,
+    std::vector<TokenSpan> &tokens)
+{
+    TokenSpan token;
+    token.data = text + begin;
+    token.size = end - begin;
+    tokens.push_back(token);
+}
+
+#ifdef __SSE2__
+/*
+* Classifies 16 bytes of ASCII, sets the bit i of words if the byte i is a
+* letter or digit, and returns the bits of the bytes out of ASCII.
+*/
+static inline uint32_t ClassifyBlock(const unsigned char *p, uint32_t &words)
+{
+    const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    const __m128i flip = _mm_set1_epi8(static_cast<char>(0x80));
+    //x - lo < n unsigned, is (x - lo) ^ 0x80 < n ^ 0x80 signed.
+    const __m128i lower = _mm_or_si128(bytes, _mm_set1_epi8(0x20));
+    const __m128i alpha = _mm_cmplt_epi8(_mm_xor_si128(_mm_sub_epi8(lower,
+        _mm_set1_epi8('a')), flip), _mm_set1_epi8(static_cast<char>(0x80 + 26)));
+    const __m128i digit = _mm_cmplt_epi8(_mm_xor_si128(_mm_sub_epi8(bytes,
+        _mm_set1_epi8('0')), flip), _mm_set1_epi8(static_cast<char>(0x80 + 10)));
+    words = static_cast<uint32_t>(_mm_movemask_epi8(_mm_or_si128(alpha,
+        digit)));
+    return static_cast<uint32_t>(_mm_movemask_epi8(bytes));
+}
+#endif // __SSE2__
+
+/* Lowers the ASCII and Latin-1 letters of text into buffer. */
+static void Lower(const char *text, size_t size, std::string &buffer)
+{
+    buffer.assign(text, size);
+    if (!size)
+    {
+        return;
+    }
+    unsigned char *p = reinterpret_cast<unsigned char*>(&buffer[0]);
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i flip = _mm_set1_epi8(static_cast<char>(0x80));
+    for (; i + 16U <= size; i += 16U)
+    {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<__m128i*>(p + i));
+        const __m128i upper = _mm_cmplt_epi8(_mm_xor_si128(_mm_sub_epi8(bytes,
+            _mm_set1_epi8('A')), flip), _mm_set1_epi8(static_cast<char>(0x80
+            + 26)));
+        bytes = _mm_add_epi8(bytes, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(p + i), bytes);
+    }
+#endif // __SSE2__
+    for (; i < size; ++i)
+    {
+        p[i] = p[i] >= 'A' && p[i] <= 'Z' ? p[i] + 0x20U : p[i];
+    }
+    //À to Þ but ×, are C3 80 to C3 9E in UTF-8, and their lowers are C3 A0 to
+    //C3 BE.
+    for (unsigned char *q = p; (q = static_cast<unsigned char*>(memchr(q, 0xC3,
+        p + size - q))) != NULL && q + 1 < p + size; ++q)
+    {
+        if (q[1] >= 0x80U && q[1] <= 0x9EU && q[1] != 0x97U)
+        {
+            q[1] += 0x20U;
+        }
+    }
+}
+
+Tokenizer::Tokenizer(bool lowercase)
+    : mLowercase(   lowercase   )
+{}
+
+Tokenizer::~Tokenizer()
+{}
+
+void Tokenizer::Tokenize(const char *text, size_t size,
+    std::vector<TokenSpan> &tokens)
+{
+    tokens.clear();
+    if (mLowercase)
+    {
+        Lower(text, size, mBuffer);
+        text = mBuffer.data();
+    }
+    const unsigned char *bytes = reinterpret_cast<const unsigned char*>(text);
+    size_t word = NPOS;         // The start of the word.
+    size_t cjk = NPOS;          // The start of the last char of a CJK run.
+    size_t cjkEnd = 0;          // The end of the last char of a CJK run.
+    bool bigram = false;        // Whether the CJK run has given a bigram.
+    size_t pos = 0;
+    while (pos < size)
+    {
+#ifdef __SSE2__
+        //The ASCII bytes before the first other one, in a block of 16 bytes.
+        if (NPOS == cjk && pos + 16U <= size)
+        {
+            uint32_t words = 0U;
+            const uint32_t others = ClassifyBlock(bytes + pos, words);
+            const uint32_t num = others ? __builtin_ctz(others) : 16U;
+            const uint32_t valid = (1U << num) - 1U;
+            words &= valid;
+            uint32_t i = 0;
+            while (i < num)
+            {
+                if (NPOS == word)
+                {
+                    const uint32_t starts = words >> i;
+                    if (!starts)
+                    {
+                        break;
+                    }
+                    i += __builtin_ctz(starts);
+                    word = pos + i;
+                }
+                const uint32_t ends = (~words & valid) >> i;
+                if (!ends)
+                {
+                    break;  //The word goes on after the ASCII bytes.
+                }
+                i += __builtin_ctz(ends);
+                AddToken(text, word, pos + i, tokens);
+                word = NPOS;
+            }
+            pos += num;
+            if (num)
+            {
+                continue;
+            }
+        }
+#endif // __SSE2__
+        const uint32_t c = bytes[pos];
+        size_t len = 1U;
+        uint32_t cls = CHAR_WORD;
+        if (c < 0x80U)
+        {
+            cls = ASCII_CLASSES[c];
+        }
+        else if (c >= 0xE5U && c <= 0xE9U && pos + 3U <= size
+            && (bytes[pos + 1U] & 0xC0U) == 0x80U
+            && (bytes[pos + 2U] & 0xC0U) == 0x80U)
+        {
+            cls = CHAR_CJK;     //U+5000 to U+9FFF, the most of the ideographs.
+            len = 3U;
+        }
+        else
+        {
+            uint32_t cp = 0U;
+            len = DecodeChar(bytes + pos, size - pos, cp);
+            if (len)
+            {
+                cls = ClassifyCodePoint(cp);
+            }
+            else
+            {
+                len = 1U;   //An invalid byte is a letter.
+            }
+        }
+        if (CHAR_WORD == cls)
+        {
+            if (NPOS != cjk && !bigram)
+            {
+                AddToken(text, cjk, cjkEnd, tokens);
+            }
+            cjk = NPOS;
+            word = NPOS == word ? pos : word;
+        }
+        else
+        {
+            if (NPOS != word)
+            {
+                AddToken(text, word, pos, tokens);
+                word = NPOS;
+            }
+            if (CHAR_CJK == cls)
+            {
+                bigram = NPOS != cjk;
+                if (bigram)
+                {
+                    AddToken(text, cjk, pos + len, tokens);
+                }
+                cjk = pos;
+                cjkEnd = pos + len;
+            }
+            else
+            {
+                if (NPOS != cjk && !bigram)
+                {
+                    AddToken(text, cjk, cjkEnd, tokens);
+                }
+                cjk = NPOS;
+            }
+        }
+        pos += len;
+    }
+    if (NPOS != word)
+    {
+        AddToken(text, word, size, tokens);
+    }
+    if (NPOS != cjk && !bigram)
+    {
+        AddToken(text, cjk, cjkEnd, tokens);
+    }
+}
+
+} // namespace simhash
@@ -1,7 +1,11 @@
+#include <cstdio>
 #include <iostream>
 
 #include "simhash.h"
 #include "hash.h"
+#include "simhash_stats.h"
+#include "tf_idf.h"
+#include "tokenizer.h"
 
 using namespace std;
 using namespace simhash;
@@ -69,6 +73,235 @@ int TestJenkinHash()
     return 0;
 }
 
+int TestBuild128()
+{
+    vector<Simhash128::StringFeatureType> features;
+    features.push_back(Simhash128::StringFeatureType("abcde", 1.0));
+    features.push_back(Simhash128::StringFeatureType("fghij", 2.0));
+    features.push_back(Simhash128::StringFeatureType("klmno", 4.3));
+    hash128_t hash = Simhash128::Build(features, JenkinsHash128);
+    //The low word is the 64-bit simhash.
+    TEST_EQUAL(hash.GetWord(0), 0xB7BE6A85658DB55D);
+    TEST_EQUAL(Simhash128::GetHammingDistance(hash, hash ^ (hash128_t(7U)
+        << 100U)), 3U);
+    return 0;
+}
+
+int TestSimhashAccumulator()
+{
+    vector<Simhash::HashFeatureType> features;
+    hash_t seed = 12345;
+    for (int i = 0; i < 100; ++i)
+    {
+        seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+        features.push_back(Simhash::HashFeatureType(seed, 1.0 + i % 7));
+    }
+    SimhashAccumulator acc;
+    acc.AddFeatures(features);
+    TEST_EQUAL(acc.GetHash(), Simhash::Build(features));
+    //Edit the document, the holds are restored exactly.
+    hash_t hash = acc.GetHash();
+    string saved;
+    acc.Serialize(saved);
+    acc.RemoveFeature(features[3].first, features[3].second);
+    acc.AddFeature(0x1234567812345678UL, 2.5);
+    features[3] = Simhash::HashFeatureType(0x1234567812345678UL, 2.5);
+    TEST_EQUAL(acc.GetHash(), Simhash::Build(features));
+    SimhashAccumulator loaded;
+    TEST_TRUE(loaded.Deserialize(saved.data(), saved.size()));
+    TEST_TRUE(!loaded.Deserialize(saved.data(), saved.size() - 1));
+    TEST_EQUAL(loaded.GetHash(), hash);
+    TEST_EQUAL(saved.size(), 256U);
+    loaded.RemoveFeature(features[3].first, 1.0);
+    loaded.AddFeature(features[3].first, 1.0);
+    TEST_EQUAL(loaded.GetHash(), hash);
+    return 0;
+}
+
+int TestBuildBatch()
+{
+    //Documents of 0 to 999 features, with a few large ones.
+    vector<Simhash::HashFeatureType> features;
+    vector<size_t> offsets(1, 0U);
+    hash_t seed = 12345;
+    for (int doc = 0; doc < 2000; ++doc)
+    {
+        int num = doc % 100 == 7 ? 50000 : doc % 1000;
+        for (int i = 0; i < num; ++i)
+        {
+            seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+            features.push_back(Simhash::HashFeatureType(seed, 1.0 + i % 5));
+        }
+        offsets.push_back(features.size());
+    }
+    const size_t docNum = offsets.size() - 1U;
+    vector<hash_t> out(docNum), threadOut(docNum);
+    uint64_t start = GetNanoTime();
+    Simhash::BuildBatch(&features[0], &offsets[0], docNum, &out[0], 1U);
+    uint64_t mid = GetNanoTime();
+    Simhash::BuildBatch(&features[0], &offsets[0], docNum, &threadOut[0], 4U);
+    uint64_t end = GetNanoTime();
+    //A thread takes a task of at least 16384 features by one atomic add on
+    //the shared cursor, its cost beside the work of a task bounds the time
+    //the threads can wait for the cursor.
+    volatile size_t cursor = 0U;
+    for (int i = 0; i < 1000000; ++i)
+    {
+        __sync_fetch_and_add(&cursor, 1U);
+    }
+    double addNanos = (GetNanoTime() - end) / 1000000.0;
+    double taskNanos = (mid - start) * 16384.0 / features.size();
+    cout << "build " << features.size() << " features: 1 thread "
+        << (mid - start) / 1000000UL << " ms, 4 threads "
+        << (end - mid) / 1000000UL << " ms; an add of the cursor "
+        << addNanos << " ns, a task " << taskNanos / 1000.0 << " us." << endl;
+    TEST_TRUE((addNanos * 100.0 < taskNanos));
+    for (size_t doc = 0; doc < docNum; ++doc)
+    {
+        vector<Simhash::HashFeatureType> docFeatures(features.begin()
+            + offsets[doc], features.begin() + offsets[doc + 1U]);
+        TEST_EQUAL(out[doc], Simhash::Build(docFeatures));
+        TEST_EQUAL(threadOut[doc], out[doc]);
+    }
+    vector<Simhash::StringFeatureType> stringFeatures;
+    stringFeatures.push_back(Simhash::StringFeatureType("abcde", 1.0));
+    stringFeatures.push_back(Simhash::StringFeatureType("fghij", 2.0));
+    stringFeatures.push_back(Simhash::StringFeatureType("klmno", 4.3));
+    size_t stringOffsets[] = {0U, 3U, 3U};
+    hash_t stringOut[2];
+    Simhash::BuildBatch(&stringFeatures[0], stringOffsets, 2U, JenkinsHash,
+        stringOut);
+    TEST_EQUAL(stringOut[0], 0xB7BE6A85658DB55D);
+    TEST_EQUAL(stringOut[1], 0U);
+    return 0;
+}
+
+int TestTokenHashCache()
+{
+    vector<Simhash::StringFeatureType> features;
+    features.push_back(Simhash::StringFeatureType("abcde", 1.0));
+    features.push_back(Simhash::StringFeatureType("fghij", 2.0));
+    features.push_back(Simhash::StringFeatureType("klmno", 4.3));
+    features.push_back(Simhash::StringFeatureType("", 1.0));
+    features.push_back(Simhash::StringFeatureType(string(30, 'x'), 1.0));
+    //Tokens differ only after the first word, and by the zero padding.
+    features.push_back(Simhash::StringFeatureType("abcdefgh1", 1.0));
+    features.push_back(Simhash::StringFeatureType("abcdefgh2", 1.0));
+    features.push_back(Simhash::StringFeatureType(string("ab\0", 3), 1.0));
+    TokenHashCache cache(JenkinsHash, 4U);
+    for (int i = 0; i < 3; ++i)
+    {
+        TEST_EQUAL(Simhash::Build(features, cache),
+            Simhash::Build(features, JenkinsHash));
+    }
+    TEST_EQUAL(cache.Hash("ab"), JenkinsHash("ab"));
+    //The long token always misses, the others hit after the first round.
+    TEST_EQUAL(cache.GetMisses(), 3U + 8U);
+    TEST_EQUAL(cache.GetHits(), 14U);
+    TEST_TRUE((cache.GetHitRate() > 0.5));
+    cache.Clear();
+    TEST_EQUAL(cache.GetHitRate(), 0.0);
+    //A small cache evicts tokens, but the hashes are still right.
+    TokenHashCache128 small(JenkinsHash128, 1U);
+    char token[] = "token0";
+    for (int i = 0; i < 100; ++i)
+    {
+        token[5] = static_cast<char>('0' + i % 10);
+        TEST_TRUE((small.Hash(token) == JenkinsHash128(token)));
+    }
+    return 0;
+}
+
+int TestTfIdf()
+{
+    //Terms t0..t9999, and t0 is a stopword.
+    vector<pair<hash_t, real_t> > terms;
+    char term[16];
+    for (int i = 0; i < 10000; ++i)
+    {
+        sprintf(term, "t%d", i);
+        terms.push_back(make_pair(JenkinsHash(term), i ? 5.0 + i % 3 : 0.01));
+    }
+    string idfFile = "tmp.idf";
+    TEST_TRUE(IdfDictionary::Build(terms, 9.0, idfFile));
+    IdfDictionary dictionary;
+    TEST_TRUE(dictionary.Open(idfFile));
+    TEST_EQUAL(dictionary.GetSize(), 10000U);
+    for (size_t i = 0; i < terms.size(); ++i)
+    {
+        TEST_EQUAL(dictionary.GetIdf(terms[i].first), terms[i].second);
+    }
+    TEST_EQUAL(dictionary.GetIdf(JenkinsHash("unseen")), 9.0);
+    //The keys should be unique.
+    terms.push_back(terms.front());
+    TEST_TRUE(!IdfDictionary::Build(terms, 9.0, "tmp.idf2"));
+    vector<string> tokens;
+    tokens.push_back("t0");
+    tokens.push_back("t1");
+    tokens.push_back("t0");
+    tokens.push_back("unseen");
+    tokens.push_back("t0");
+    TfIdfWeighter weighter(dictionary, JenkinsHash);
+    vector<Simhash::HashFeatureType> features;
+    weighter.Weigh(tokens, features);
+    TEST_EQUAL(features.size(), 3U);
+    TEST_EQUAL(features[0].first, JenkinsHash("t0"));
+    TEST_EQUAL(features[0].second, 3 * 0.01);
+    TEST_EQUAL(features[1].second, 6.0);
+    TEST_EQUAL(features[2].second, 9.0);
+    //The wider hashes share the dictionary, and the map is reused.
+    TfIdfWeighter256 weighter256(dictionary, JenkinsHash256);
+    vector<Simhash256::HashFeatureType> features256;
+    weighter256.Weigh(tokens, features256);
+    weighter256.Weigh(tokens, features256);
+    TEST_EQUAL(features256.size(), 3U);
+    TEST_EQUAL(features256[0].second, 3 * 0.01);
+    TEST_EQUAL(features256[2].second, 9.0);
+    dictionary.Close();
+    TEST_EQUAL(dictionary.GetIdf(terms[1].first), 0.0);
+    TEST_TRUE(!dictionary.Open("tmp.none"));
+    return 0;
+}
+
+static string JoinTokens(const vector<TokenSpan> &tokens)
+{
+    string ans;
+    for (size_t i = 0; i < tokens.size(); ++i)
+    {
+        ans += (i ? "|" : "") + tokens[i].ToString();
+    }
+    return ans;
+}
+
+int TestTokenizer()
+{
+    Tokenizer tokenizer;
+    vector<TokenSpan> tokens;
+    string text = "I love china, I love Chengdu .";
+    tokenizer.Tokenize(text, tokens);
+    TEST_EQUAL(JoinTokens(tokens), "I|love|china|I|love|Chengdu");
+    TEST_TRUE((tokens[0].data == text.data()));
+    //CJK runs give bigrams, split by the CJK punctuations.
+    tokenizer.Tokenize("\xe6\x88\x91\xe7\x88\xb1\xe6\x88\x90\xe9\x83\xbd"
+        "\xe3\x80\x82\xe5\xa5\xbd", tokens);
+    TEST_EQUAL(JoinTokens(tokens), "\xe6\x88\x91\xe7\x88\xb1|"
+        "\xe7\x88\xb1\xe6\x88\x90|\xe6\x88\x90\xe9\x83\xbd|\xe5\xa5\xbd");
+    //The mixed scripts, the no-break space, and the long ASCII runs.
+    tokenizer.Tokenize("iPhone\xe6\x89\x8b\xe6\x9c\xba\xc2\xa0" "caf\xc3\xa9"
+        " a_very_long_identifier_over_16_bytes\t42", tokens);
+    TEST_EQUAL(JoinTokens(tokens), "iPhone|\xe6\x89\x8b\xe6\x9c\xba|"
+        "caf\xc3\xa9|a|very|long|identifier|over|16|bytes|42");
+    //The invalid bytes are letters.
+    tokenizer.Tokenize("ab\xff\xe6\x88 cd", tokens);
+    TEST_EQUAL(JoinTokens(tokens), "ab\xff\xe6\x88|cd");
+    Tokenizer lower(true);
+    lower.Tokenize("The QUICK \xc3\x80 \xc3\x97 BROWN FOX JUMPS OVER\xc3\x89T\xc3"
+        , tokens);
+    TEST_EQUAL(JoinTokens(tokens), "the|quick|\xc3\xa0|brown|fox|jumps|"
+        "over\xc3\xa9t\xc3");
+    return 0;
+}
+
 /*
 int main()
 {
@@ -76,6 +309,12 @@ int main()
 //TestBuildFromHashFeature();
 //TestJenkinHash();
 //TestBuildFromStringFeature();
+//TestBuild128();
+//TestSimhashAccumulator();
+//TestBuildBatch();
+//TestTokenHashCache();
+//TestTfIdf();
+//TestTokenizer();
 cin.get();
 return 0;
 }
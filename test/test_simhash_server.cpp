@@ -0,0 +1,231 @@
+#include <iostream>
+#include <cstdlib>
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "simhash_server.h"
+#include "simhash_client.h"
+#include "simhash_sharded_table.h"
+#include "simhash_stats.h"
+#include "test.h"
+
+using namespace std;
+using namespace simhash;
+
+inline hash_t get_rand(hash_t seed)
+{
+    return seed * (hash_t)25214903917 + (hash_t)11;
+}
+
+/* Collects the pairs of a join. */
+class PairCollector : public SimhashJoinCallback
+{
+public :
+    virtual void OnMatch(hash_t query, hash_t match, uint_t)
+    {
+        pairs.push_back(make_pair(query, match));
+    }
+    vector<pair<hash_t, hash_t> > pairs;
+};
+
+static void* RunServer(void *arg)
+{
+    static_cast<SimhashServer*>(arg)->Run();
+    return NULL;
+}
+
+int TestSimhashServer()
+{
+    hash_t h1 = 0x0000000000000000;
+    hash_t h2 = 0x0000000000000070;
+    hash_t h3 = 0x0000000000000078;
+
+    SimhashTableOptions tableOptions(3U, 1U);
+    tableOptions.leafType = SIMHASH_LEAF_SORTED_ARRAY;
+    SimhashServerOptions serverOptions;
+    serverOptions.address = "unix:/tmp/test_simhash_server.sock";
+    serverOptions.minBatchSize = 2U;
+    SimhashServerPtr serverPtr = CreateSimhashServer(
+        CreateSimhashTable(tableOptions), serverOptions);
+    TEST_TRUE(serverPtr);
+    pthread_t thread;
+    pthread_create(&thread, NULL, RunServer, serverPtr.get());
+
+    SimhashClientPtr clientPtr = CreateSimhashClient(serverOptions.address);
+    TEST_TRUE(clientPtr);
+    TEST_TRUE(clientPtr->Insert(h1));
+    TEST_TRUE(clientPtr->Insert(h3));
+    TEST_TRUE(!clientPtr->Insert(h3));
+    TEST_EQUAL(clientPtr->GetSize(), 2U);
+    TEST_TRUE(clientPtr->Search(h3));
+    FindAnswerType ans;
+    TEST_TRUE(clientPtr->FindNearDups(h2, ans));
+    TEST_EQUAL(ans.size(), 2U);
+
+    //The pipelined queries are run as a batch, after the remove before them.
+    clientPtr->SendRequest(SIMHASH_OP_CODE_REMOVE, h1);
+    for (hash_t i = 0; i < 8; ++i)
+    {
+        clientPtr->SendRequest(SIMHASH_OP_CODE_HAS_NEAR_DUPS, h3 ^ i);
+    }
+    clientPtr->SendRequest(0, h1);
+    TEST_TRUE(clientPtr->Flush());
+    SimhashResponse response;
+    TEST_TRUE(clientPtr->ReceiveResponse(response));
+    TEST_EQUAL(response.status, (uint_t)SIMHASH_STATUS_TRUE);
+    for (hash_t i = 0; i < 8; ++i)
+    {
+        TEST_TRUE(clientPtr->ReceiveResponse(response));
+        TEST_EQUAL(response.status, (uint_t)SIMHASH_STATUS_TRUE);
+    }
+    TEST_TRUE(clientPtr->ReceiveResponse(response));
+    TEST_EQUAL(response.status, (uint_t)SIMHASH_STATUS_BAD_REQUEST);
+
+    serverPtr->Stop();
+    pthread_join(thread, NULL);
+    SimhashServerStats stats;
+    serverPtr->GetStats(stats);
+    TEST_EQUAL(stats.batchedQueries, 8UL);
+    return 0;
+}
+
+int TestSimhashShardedTable()
+{
+    //All shards run in this process, each with its own thread. The time of
+    //the batch is the throughput, which scales only with a core per shard.
+    const long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    uint64_t oneShardTime = 0UL;
+    for (uint_t shardNum = 1U; shardNum <= 4U; shardNum *= 2U)
+    {
+        vector<SimhashServerPtr> servers;
+        vector<pthread_t> threads(shardNum);
+        vector<string> addresses;
+        for (uint_t i = 0; i < shardNum; ++i)
+        {
+            char address[64];
+            sprintf(address, "unix:/tmp/test_simhash_shard%u.sock", i);
+            SimhashServerOptions serverOptions;
+            serverOptions.address = address;
+            SimhashTableOptions tableOptions(3U, 1U);
+            tableOptions.leafType = SIMHASH_LEAF_SORTED_ARRAY;
+            servers.push_back(CreateSimhashServer(
+                CreateSimhashTable(tableOptions), serverOptions));
+            pthread_create(&threads[i], NULL, RunServer, servers.back().get());
+            addresses.push_back(address);
+        }
+        SimhashShardedTablePtr tablePtr = CreateSimhashShardedTable(addresses,
+            3U);
+        TEST_TRUE(tablePtr);
+        SimhashTablePtr localPtr = CreateSimhashTable(3U, 1U);
+        hash_t seed = 12345;
+        vector<hash_t> data;
+        for (int i = 0; i < 100000; ++i)
+        {
+            seed = get_rand(seed);
+            data.push_back(seed);
+            tablePtr->Insert(seed);
+            localPtr->Insert(seed);
+        }
+        TEST_EQUAL(tablePtr->GetSize(), localPtr->GetSize());
+        FindAnswerType ans;
+        TEST_TRUE(tablePtr->FindNearDups(data[0] ^ 0x7UL, ans));
+        TEST_EQUAL(ans.size(), 1U);
+        TEST_EQUAL(ans.front(), data[0]);
+
+        //Half of the queries have near-duplicates.
+        vector<hash_t> queries;
+        for (int i = 0; i < 20000; ++i)
+        {
+            seed = get_rand(seed);
+            queries.push_back(i % 2 ? seed : data[i * 7 % data.size()] ^ 0x7UL);
+        }
+        vector<FindAnswerType> answers, expected;
+        uint64_t start = GetNanoTime();
+        tablePtr->FindNearDupsBatch(queries, answers);
+        uint64_t end = GetNanoTime();
+        localPtr->FindNearDupsBatch(queries, expected);
+        TEST_TRUE((answers == expected));
+        oneShardTime = 1U == shardNum ? end - start : oneShardTime;
+        cout << shardNum << " shards on " << cores << " cores, "
+            << queries.size() << " queries, time " << (end - start) / 1000000UL
+            << " ms, " << queries.size() * 1000000000UL / (end - start)
+            << " queries/s, speedup " << static_cast<double>(oneShardTime)
+            / (end - start) << "." << endl;
+
+        //The join of shards finds the pairs of the local join.
+        PairCollector pairs, localPairs;
+        TEST_TRUE(tablePtr->Join(queries, pairs, 0U));
+        TEST_TRUE(localPtr->Join(queries, localPairs, 1U));
+        sort(pairs.pairs.begin(), pairs.pairs.end());
+        sort(localPairs.pairs.begin(), localPairs.pairs.end());
+        TEST_TRUE((pairs.pairs == localPairs.pairs));
+
+        //The reports are summed over the shards.
+        SimhashBucketReport report, localReport;
+        tablePtr->GetBucketReport(report);
+        localPtr->GetBucketReport(localReport);
+        TEST_EQUAL(report.elementNum, localReport.elementNum);
+        TEST_EQUAL(report.containerNum, localReport.containerNum * shardNum);
+        SimhashMemoryUsage usage;
+        tablePtr->GetMemoryUsage(usage);
+        TEST_EQUAL(usage.levels.front().elementNum, localReport.elementNum);
+        SimhashTableStats stats, localStats;
+        TEST_EQUAL(tablePtr->GetStats(stats), localPtr->GetStats(localStats));
+        TEST_EQUAL(stats.inserts, localStats.inserts);
+
+        //Each shard saves its values to its own file.
+        const string filename = "/tmp/test_simhash_shards.bin";
+        TEST_TRUE(tablePtr->SaveToFile(filename, SIMHASH_FILE_BINARY));
+        TEST_TRUE(tablePtr->StartSave(filename + ".bg", SIMHASH_FILE_SNAPSHOT));
+        TEST_EQUAL(tablePtr->GetSaveState(true), SIMHASH_SAVE_DONE);
+        uint_t saved = 0U, savedInBackground = 0U;
+        for (uint_t i = 0; i < shardNum; ++i)
+        {
+            char suffix[16];
+            sprintf(suffix, ".%u", i);
+            SimhashTablePtr shardPtr = CreateSimhashTable(3U, 1U);
+            TEST_TRUE(shardPtr->LoadFromFile(filename + suffix));
+            saved += shardPtr->GetSize();
+            TEST_TRUE(shardPtr->LoadFromFile(filename + ".bg" + suffix));
+            savedInBackground += shardPtr->GetSize();
+            remove((filename + suffix).c_str());
+            remove((filename + ".bg" + suffix).c_str());
+        }
+        TEST_EQUAL(saved, localPtr->GetSize());
+        TEST_EQUAL(savedInBackground, localPtr->GetSize());
+
+        //The frozen shards answer the same, and take no write.
+        TEST_TRUE(tablePtr->Freeze());
+        TEST_TRUE(!tablePtr->Insert(queries[1]));
+        tablePtr->FindNearDupsBatch(queries, answers);
+        TEST_TRUE((answers == expected));
+
+        //A lost shard fails the queries, instead of answering no dups.
+        servers[0]->Stop();
+        pthread_join(threads[0], NULL);
+        servers[0].reset();
+        TEST_TRUE(!tablePtr->IsBroken());
+        TEST_TRUE(!tablePtr->HasNearDups(data[0] ^ 0x7UL));
+        TEST_TRUE(tablePtr->IsBroken());
+        TEST_EQUAL(tablePtr->FindNearDupsBatch(queries, answers), 0U);
+        TEST_TRUE(!tablePtr->Join(queries, pairs, 0U));
+        tablePtr.reset();
+        for (uint_t i = 1; i < shardNum; ++i)
+        {
+            servers[i]->Stop();
+            pthread_join(threads[i], NULL);
+        }
+    }
+    return 0;
+}
+
+int main()
+{
+    TestSimhashServer();
+    //TestSimhashShardedTable();
+    return 0;
+}
@@ -2,12 +2,25 @@
 #include <cstdlib>
 
 #include "simhash_table.h"
+#include "simhash_tenant_table.h"
+#include "bloom_filter.h"
 
 #include "simhash.h"
 #include "hash.h"
+#include "simhash_file.h"
+#include "simhash_trace.h"
+#include "simhash_workload.h"
 
 #include <cstdlib>
+#include <cstdio>
 #include <ctime>
+#include <cmath>
+#include <algorithm>
+#include <functional>
+
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 using namespace std;
 using namespace simhash;
@@ -182,6 +195,1668 @@ int TestSimhashTableLoad1()
     cout << "Total time " << (end - start) * 1000 / CLOCKS_PER_SEC << " ms." << endl;
     return 0;
 }
+int TestBloomFilter()
+{
+    BlockedBloomFilter filter;
+    uint_t keys = 1000000U;
+    filter.Reset(keys, 10U);
+    hash_t seed = (hash_t)rand();
+    vector<hash_t> added(keys);
+    for (uint_t i = 0; i < keys; ++i)
+    {
+        seed = get_rand(seed);
+        added[i] = seed;
+        filter.Add(seed);
+    }
+    //No false negative.
+    uint_t missed = 0U;
+    for (uint_t i = 0; i < keys; ++i)
+    {
+        missed += filter.MayContain(added[i]) ? 0U : 1U;
+    }
+    TEST_EQUAL(missed, 0U);
+    //About 1% with 10 bits per key, twice of it is allowed.
+    uint_t count = 0U;
+    for (uint_t i = 0; i < keys; ++i)
+    {
+        seed = get_rand(seed);
+        count += filter.MayContain(seed) ? 1U : 0U;
+    }
+    TEST_TRUE((count <= keys / 50U));
+    cout << "False positive rate: " << (double)count / keys << endl;
+    return 0;
+}
+
+int TestSimhashTablePrefilter()
+{
+    for (uint_t level = 1U; level <= 2U; ++level)
+    {
+        SimhashTablePtr tablePtrs[2];
+        for (int prefilter = 0; prefilter < 2; ++prefilter)
+        {
+            SimhashTableOptions options(3U, level);
+            options.usePrefilter = prefilter;
+            tablePtrs[prefilter] = CreateSimhashTable(options);
+        }
+        int repet = 200000;
+        hash_t seed = (hash_t)rand();
+        vector<hash_t> values;
+        for (int i = 1; i <= repet; ++i)
+        {
+            seed = get_rand(seed);
+            values.push_back(seed);
+            tablePtrs[0]->Insert(seed);
+            tablePtrs[1]->Insert(seed);
+        }
+        //Remove some, so that the filters keep keys no longer stored.
+        for (int i = 0; i < repet; i += 10)
+        {
+            tablePtrs[0]->Remove(values[i]);
+            tablePtrs[1]->Remove(values[i]);
+        }
+
+        //The same answers with and without the prefilter, both for random
+        //queries and for queries near the stored values.
+        uint_t diffs = 0U;
+        uint_t hits = 0U;
+        FindAnswerType ans[2];
+        for (int i = 0; i < repet; ++i)
+        {
+            seed = get_rand(seed);
+            hash_t query = i % 2 ? seed : values[i] ^ (seed & 0x10101UL);
+            for (int prefilter = 0; prefilter < 2; ++prefilter)
+            {
+                tablePtrs[prefilter]->FindNearDups(query, ans[prefilter]);
+                sort(ans[prefilter].begin(), ans[prefilter].end());
+            }
+            diffs += ans[0] == ans[1] ? 0U : 1U;
+            diffs += tablePtrs[0]->HasNearDups(query)
+                == tablePtrs[1]->HasNearDups(query) ? 0U : 1U;
+            hits += ans[0].empty() ? 0U : 1U;
+        }
+        TEST_EQUAL(diffs, 0U);
+        TEST_TRUE((hits >= (uint_t)repet / 3U));
+
+        for (int prefilter = 0; prefilter < 2; ++prefilter)
+        {
+            clock_t start = clock();
+            uint_t count = 0;
+            for (int i = 1; i <= repet; ++i)
+            {
+                seed = get_rand(seed);
+                count += tablePtrs[prefilter]->HasNearDups(seed) ? 1 : 0;
+            }
+            clock_t end = clock();
+            cout << "Level " << level << ", prefilter " << prefilter
+                << ", " << repet << " queries, time "
+                << (end - start) * 1000 / CLOCKS_PER_SEC << " ms, "
+                << count << " hits." << endl;
+        }
+    }
+    return 0;
+}
+
+int TestSimhashTableStats()
+{
+    SimhashTablePtr tablePtr = CreateSimhashTable(3, 2);
+    int repet = 100000;
+    hash_t seed = (hash_t)rand();
+    for (int i = 1; i <= repet; ++i)
+    {
+        seed = get_rand(seed);
+        tablePtr->Insert(seed);
+    }
+    FindAnswerType ans;
+    for (int i = 1; i <= repet; ++i)
+    {
+        seed = get_rand(seed);
+        tablePtr->FindNearDups(seed, ans);
+    }
+    SimhashTableStats stats;
+    if (tablePtr->GetStats(stats))
+    {
+        TEST_EQUAL(stats.inserts, (uint64_t)repet);
+        cout << stats.ToString();
+    }
+    else
+    {
+        cout << "Compile with SIMHASH_ENABLE_STATS to collect statistics."
+            << endl;
+    }
+    SimhashBucketReport report;
+    tablePtr->GetBucketReport(report);
+    TEST_EQUAL(report.elementNum, 16U * (uint64_t)repet);
+    cout << report.ToString();
+    return 0;
+}
+
+int TestSimhashTable256()
+{
+    SimhashTableOptions options(8U, 2U);
+    options.usePrefilter = true;
+    SimhashTable256Ptr tablePtr = CreateBasicSimhashTable<hash256_t>(options);
+    int repet = 100000;
+    hash_t seed = (hash_t)rand();
+    hash256_t first;
+    for (int i = 1; i <= repet; ++i)
+    {
+        hash256_t hash;
+        for (uint_t j = 0; j < 4U; ++j)
+        {
+            seed = get_rand(seed);
+            hash.SetWord(j, seed);
+        }
+        first = 1 == i ? hash : first;
+        tablePtr->Insert(hash);
+    }
+    TEST_EQUAL(tablePtr->GetSize(), (uint_t)repet);
+    //Flip 8 bits spread over all words, it is still a near-duplicate.
+    hash256_t query = first;
+    for (uint_t j = 0; j < 8U; ++j)
+    {
+        query ^= hash256_t(1U) << (j * 31U);
+    }
+    hash256_t nearDup;
+    TEST_TRUE(tablePtr->FindFirstNearDup(query, nearDup));
+    TEST_EQUAL(Simhash256::GetHammingDistance(nearDup, first), 0U);
+    query ^= hash256_t(1U) << 255U;
+    TEST_TRUE(!tablePtr->HasNearDups(query));
+
+    clock_t start = clock();
+    uint_t count = 0;
+    for (int i = 1; i <= repet; ++i)
+    {
+        hash256_t hash;
+        for (uint_t j = 0; j < 4U; ++j)
+        {
+            seed = get_rand(seed);
+            hash.SetWord(j, seed);
+        }
+        count += tablePtr->HasNearDups(hash) ? 1 : 0;
+    }
+    clock_t end = clock();
+    cout << "256 bits, k = 8, " << repet << " queries, time "
+        << (end - start) * 1000 / CLOCKS_PER_SEC << " ms, "
+        << count << " hits." << endl;
+    return 0;
+}
+
+/* A skewed simhash value: the bits of the high half are 1 with 2%. */
+hash_t get_skewed_rand(hash_t &seed)
+{
+    hash_t hash = 0;
+    for (uint_t i = 32; i < 64; ++i)
+    {
+        seed = get_rand(seed);
+        hash |= (seed >> 33) % 100 < 2 ? (hash_t)1 << i : 0;
+    }
+    seed = get_rand(seed);
+    return hash | (seed >> 32);
+}
+
+int TestSimhashTableSkewed()
+{
+    int size = 1000000;
+    hash_t seed = (hash_t)rand();
+    vector<hash_t> data, sample;
+    for (int i = 0; i < size; ++i)
+    {
+        data.push_back(get_skewed_rand(seed));
+    }
+    sample.assign(data.begin(), data.begin() + 10000);
+    for (int mode = 0; mode < 4; ++mode)
+    {
+        SimhashTableOptions options(3U, 1U);
+        if (mode >= 1)
+        {
+            ChooseBlockLayout(sample, 3 == mode, options);
+        }
+        options.hotBucketSize = mode >= 2 ? 1024U : 0U;
+        SimhashTablePtr tablePtr = CreateSimhashTable(options);
+        for (int i = 0; i < size; ++i)
+        {
+            tablePtr->Insert(data[i]);
+        }
+        int repet = 1000;
+        uint64_t maxNanos = 0, totalNanos = 0;
+        uint_t hits = 0U;
+        for (int round = 0; round < 2; ++round)
+        {
+            maxNanos = 0;
+            totalNanos = 0;
+            hits = 0U;
+            for (int i = 0; i < repet; ++i)
+            {
+                hash_t query = data[i * 97 % size] ^ ((hash_t)1 << (i % 64));
+                uint64_t start = GetNanoTime();
+                hits += tablePtr->HasNearDups(query) ? 1U : 0U;
+                uint64_t nanos = GetNanoTime() - start;
+                maxNanos = max(maxNanos, nanos);
+                totalNanos += nanos;
+            }
+        }
+        TEST_EQUAL(hits, (uint_t)repet);
+        SimhashBucketReport report;
+        tablePtr->GetBucketReport(report);
+        cout << "Mode " << mode << ": largest bucket "
+            << report.largestBucket << ", mean " << totalNanos / repet
+            << " ns, max " << maxNanos << " ns." << endl;
+    }
+
+    //Small hot buckets are split and merged back all the time, the answers
+    //are still the same as the brute force ones.
+    SimhashTableOptions options(3U, 1U);
+    ChooseBlockLayout(sample, true, options);
+    options.hotBucketSize = 16U;
+    SimhashTablePtr tablePtr = CreateSimhashTable(options);
+    vector<hash_t> small(data.begin(), data.begin() + 4000);
+    sort(small.begin(), small.end());
+    small.erase(unique(small.begin(), small.end()), small.end());
+    for (size_t i = 0; i < small.size(); ++i)
+    {
+        tablePtr->Insert(small[i]);
+    }
+    uint_t diffs = 0U;
+    FindAnswerType ans, expected;
+    for (int round = 0; round < 2; ++round)
+    {
+        for (size_t i = 0; i < small.size(); i += 7)
+        {
+            seed = get_rand(seed);
+            hash_t query = small[i] ^ ((hash_t)1 << (seed % 64))
+                ^ ((hash_t)1 << (seed / 64 % 64));
+            expected.clear();
+            for (size_t j = 0; j < small.size(); ++j)
+            {
+                if (Simhash::IsNearDups(query, small[j], 3U))
+                {
+                    expected.push_back(small[j]);
+                }
+            }
+            tablePtr->FindNearDups(query, ans);
+            sort(ans.begin(), ans.end());
+            diffs += ans == expected ? 0U : 1U;
+            diffs += tablePtr->HasNearDups(query) == !expected.empty()
+                ? 0U : 1U;
+        }
+        //Remove most values, so that the hot buckets are merged back.
+        vector<hash_t> kept;
+        for (size_t i = 0; i < small.size(); ++i)
+        {
+            if (i % 8)
+            {
+                tablePtr->Remove(small[i]);
+            }
+            else
+            {
+                kept.push_back(small[i]);
+            }
+        }
+        small.swap(kept);
+    }
+    TEST_EQUAL(diffs, 0U);
+    TEST_EQUAL(tablePtr->GetSize(), (uint_t)small.size());
+    return 0;
+}
+
+int TestSimhashTableBitSliced()
+{
+    int size = 100000;
+    SimhashTablePtr tablePtrs[2];
+    for (int slice = 0; slice < 2; ++slice)
+    {
+        SimhashTableOptions options(3U, 0U);
+        options.bitSliceSize = slice ? 256U : 0U;
+        tablePtrs[slice] = CreateSimhashTable(options);
+    }
+    hash_t seed = 12345;
+    hash_t first = get_rand(seed);
+    vector<hash_t> data;
+    for (int i = 0; i < size; ++i)
+    {
+        seed = get_rand(seed);
+        data.push_back(seed);
+        tablePtrs[0]->Insert(seed);
+        tablePtrs[1]->Insert(seed);
+    }
+    FindAnswerType ans;
+    TEST_TRUE(tablePtrs[1]->FindNearDups(first ^ 0x7, ans));
+    TEST_EQUAL(ans.size(), 1U);
+
+    //The same answers near the stored values, with the mirror built by the
+    //inserts, kept by the removes, dropped by them and built again.
+    FindAnswerType answers[2];
+    uint_t diffs = 0U;
+    uint_t hits = 0U;
+    const int kept[] = {size, size / 10, 100, size};
+    for (int round = 0; round < 4; ++round)
+    {
+        while ((int)data.size() > kept[round])
+        {
+            tablePtrs[0]->Remove(data.back());
+            tablePtrs[1]->Remove(data.back());
+            data.pop_back();
+        }
+        while ((int)data.size() < kept[round])
+        {
+            seed = get_rand(seed);
+            data.push_back(seed);
+            tablePtrs[0]->Insert(seed);
+            tablePtrs[1]->Insert(seed);
+        }
+        for (int i = 0; i < 200; ++i)
+        {
+            seed = get_rand(seed);
+            hash_t query = data[seed % data.size()];
+            for (int bit = 0; bit < i % 5; ++bit)
+            {
+                seed = get_rand(seed);
+                query ^= (hash_t)1 << (seed % 64);
+            }
+            for (int slice = 0; slice < 2; ++slice)
+            {
+                tablePtrs[slice]->FindNearDups(query, answers[slice]);
+                sort(answers[slice].begin(), answers[slice].end());
+            }
+            diffs += answers[0] == answers[1] ? 0U : 1U;
+            diffs += tablePtrs[0]->HasNearDups(query)
+                == tablePtrs[1]->HasNearDups(query) ? 0U : 1U;
+            hits += answers[1].empty() ? 0U : 1U;
+        }
+    }
+    TEST_EQUAL(diffs, 0U);
+    TEST_TRUE((hits >= 4U * 200U * 3U / 5U));
+
+    for (int slice = 0; slice < 2; ++slice)
+    {
+        int repet = 1000;
+        uint_t count = 0;
+        clock_t start = clock();
+        for (int i = 0; i < repet; ++i)
+        {
+            seed = get_rand(seed);
+            count += tablePtrs[slice]->HasNearDups(seed) ? 1 : 0;
+        }
+        clock_t end = clock();
+        cout << "Level 0, bit-sliced " << slice << ", " << repet
+            << " queries, time " << (end - start) * 1000 / CLOCKS_PER_SEC
+            << " ms, " << count << " hits." << endl;
+    }
+    return 0;
+}
+
+int TestSimhashTableBatch()
+{
+    int size = 1000000;
+    SimhashTableOptions options(3U, 1U);
+    options.leafType = SIMHASH_LEAF_SORTED_ARRAY;
+    SimhashTablePtr tablePtr = CreateSimhashTable(options);
+    hash_t seed = 12345;
+    vector<hash_t> data;
+    for (int i = 0; i < size; ++i)
+    {
+        seed = get_rand(seed);
+        data.push_back(seed);
+        tablePtr->Insert(seed);
+    }
+    vector<hash_t> queries;
+    for (int i = 0; i < 100000; ++i)
+    {
+        queries.push_back(data[i * 97 % size] ^ ((hash_t)1 << (i % 64)));
+    }
+    vector<FindAnswerType> expected(queries.size());
+    for (size_t i = 0; i < queries.size(); ++i)
+    {
+        tablePtr->FindNearDups(queries[i], expected[i]);
+    }
+    for (uint_t depth = 1U; depth <= 64U; depth *= 2U)
+    {
+        vector<FindAnswerType> answers;
+        clock_t start = clock();
+        uint_t found = tablePtr->FindNearDupsBatch(queries, answers, depth);
+        clock_t end = clock();
+        TEST_EQUAL(found, queries.size());
+        TEST_TRUE((answers == expected));
+        cout << "Batch depth " << depth << ", " << queries.size()
+            << " queries, time " << (end - start) * 1000 / CLOCKS_PER_SEC
+            << " ms." << endl;
+    }
+    //The report counts the unmerged inserts and removes as the set leaves,
+    //and leaves them unmerged.
+    SimhashTablePtr setPtr = CreateSimhashTable(SimhashTableOptions(3U, 1U));
+    for (int i = 0; i < size; ++i)
+    {
+        setPtr->Insert(data[i]);
+    }
+    for (int i = 0; i < 1000; ++i)
+    {
+        seed = get_rand(seed);
+        tablePtr->Insert(seed);
+        setPtr->Insert(seed);
+        tablePtr->Remove(data[i * 7]);
+        setPtr->Remove(data[i * 7]);
+    }
+    SimhashMemoryUsage before, after;
+    tablePtr->GetMemoryUsage(before);
+    SimhashBucketReport report, expectedReport;
+    tablePtr->GetBucketReport(report);
+    setPtr->GetBucketReport(expectedReport);
+    tablePtr->GetMemoryUsage(after);
+    TEST_EQUAL(report.elementNum, expectedReport.elementNum);
+    TEST_EQUAL(report.bucketNum, expectedReport.bucketNum);
+    TEST_EQUAL(report.largestBucket, expectedReport.largestBucket);
+    TEST_TRUE((report.sizeDistribution == expectedReport.sizeDistribution));
+    TEST_EQUAL(after.GetTotalBytes(), before.GetTotalBytes());
+    return 0;
+}
+
+int TestSimhashFileIO()
+{
+    //The values are encoded and decoded without a table, to time the I/O.
+    string files[] = {"tmp.str", "tmp.bin", "tmp.hex"};
+    SimhashFileFormat formats[] = {SIMHASH_FILE_BIT_STRING,
+        SIMHASH_FILE_BINARY, SIMHASH_FILE_HEX};
+    int size = 20000000;
+    vector<hash_t> data(size);
+    hash_t seed = 12345;
+    for (int i = 0; i < size; ++i)
+    {
+        seed = get_rand(seed);
+        data[i] = seed;
+    }
+    for (int f = 0; f < 3; ++f)
+    {
+        uint64_t start = GetNanoTime();
+        SimhashFileWriter<hash_t> writer;
+        TEST_TRUE(writer.Open(files[f], formats[f]));
+        for (int i = 0; i < size; ++i)
+        {
+            writer.Write(data[i]);
+        }
+        TEST_TRUE(writer.Close());
+        uint64_t mid = GetNanoTime();
+        SimhashFileReader<hash_t> reader;
+        TEST_TRUE(reader.Open(files[f], SIMHASH_FILE_BINARY == formats[f]));
+        vector<hash_t> values, all;
+        while (reader.Read(values))
+        {
+            all.insert(all.end(), values.begin(), values.end());
+        }
+        uint64_t end = GetNanoTime();
+        TEST_TRUE((all == data));
+        cout << files[f] << ": write " << (mid - start) / 1000000UL
+            << " ms, read " << (end - mid) / 1000000UL << " ms." << endl;
+    }
+
+    //A table saves and loads in all formats, also of 256 bits.
+    SimhashTable256Ptr tablePtr = CreateBasicSimhashTable<hash256_t>(
+        SimhashTableOptions(3U, 1U));
+    vector<hash256_t> wides(1000);
+    for (int i = 0; i < 1000; ++i)
+    {
+        for (uint_t w = 0; w < 4U; ++w)
+        {
+            seed = get_rand(seed);
+            wides[i].SetWord(w, seed);
+        }
+        tablePtr->Insert(wides[i]);
+    }
+    for (int f = 0; f < 3; ++f)
+    {
+        SimhashTable256Ptr loadPtr = CreateBasicSimhashTable<hash256_t>(
+            SimhashTableOptions(3U, 1U));
+        TEST_TRUE(tablePtr->SaveToFile(files[f], formats[f]));
+        TEST_TRUE(loadPtr->LoadFromFile(files[f],
+            SIMHASH_FILE_BINARY == formats[f]));
+        TEST_EQUAL(loadPtr->GetSize(), 1000U);
+        int found = 0;
+        for (int i = 0; i < 1000; ++i)
+        {
+            found += loadPtr->Search(wides[i]) ? 1 : 0;
+        }
+        TEST_EQUAL(found, 1000);
+    }
+    return 0;
+}
+
+int TestSimhashSnapshot()
+{
+    //A snapshot is smaller than the raw. The sorted values are written as
+    //they come, the others are sorted at Close, also after a sorted prefix.
+    int size = 20000000;
+    vector<hash_t> data(size);
+    hash_t seed = 12345;
+    for (int i = 0; i < size; ++i)
+    {
+        seed = get_rand(seed);
+        data[i] = seed;
+    }
+    vector<hash_t> sorted(data);
+    sort(sorted.begin(), sorted.end());
+    vector<hash_t> prefixed(sorted.begin(), sorted.begin() + size / 2);
+    prefixed.insert(prefixed.end(), data.begin() + size / 2, data.end());
+    string files[] = {"tmp.bin", "tmp.snap", "tmp.snap", "tmp.snap"};
+    SimhashFileFormat formats[] = {SIMHASH_FILE_BINARY, SIMHASH_FILE_SNAPSHOT,
+        SIMHASH_FILE_SNAPSHOT, SIMHASH_FILE_SNAPSHOT};
+    const vector<hash_t> *inputs[] = {&data, &data, &sorted, &prefixed};
+    vector<hash_t> prefixedSorted(prefixed);
+    sort(prefixedSorted.begin(), prefixedSorted.end());
+    const vector<hash_t> *outputs[] = {&data, &sorted, &sorted,
+        &prefixedSorted};
+    for (int f = 0; f < 4; ++f)
+    {
+        uint64_t start = GetNanoTime();
+        SimhashFileWriter<hash_t> writer;
+        TEST_TRUE(writer.Open(files[f], formats[f]));
+        for (int i = 0; i < size; ++i)
+        {
+            writer.Write((*inputs[f])[i]);
+        }
+        TEST_TRUE(writer.Close());
+        uint64_t mid = GetNanoTime();
+        SimhashFileReader<hash_t> reader;
+        TEST_TRUE(reader.Open(files[f], true));
+        vector<hash_t> values, all;
+        while (reader.Read(values))
+        {
+            all.insert(all.end(), values.begin(), values.end());
+        }
+        uint64_t end = GetNanoTime();
+        TEST_TRUE(reader.Good());
+        TEST_TRUE((all == *outputs[f]));
+        struct stat st;
+        stat(files[f].c_str(), &st);
+        cout << files[f] << (&sorted == inputs[f] ? " (sorted)" : "")
+            << (&prefixed == inputs[f] ? " (sorted prefix)" : "")
+            << ": " << st.st_size << " bytes, write "
+            << (mid - start) / 1000000UL << " ms, read "
+            << (end - mid) / 1000000UL << " ms." << endl;
+    }
+
+    //A corrupted block is detected by its CRC.
+    FILE *fp = fopen("tmp.snap", "r+b");
+    TEST_TRUE((fp != NULL));
+    fseek(fp, 100000, SEEK_SET);
+    int c = fgetc(fp);
+    fseek(fp, 100000, SEEK_SET);
+    fputc(c ^ 0x10, fp);
+    fclose(fp);
+    SimhashTablePtr tablePtr = CreateSimhashTable(3U, 1U);
+    TEST_TRUE(!tablePtr->LoadFromFile("tmp.snap", true));
+
+    //A table saves and loads snapshots of 128 and 256 bits.
+    SimhashTable128Ptr table128Ptr = CreateBasicSimhashTable<hash128_t>(
+        SimhashTableOptions(3U, 1U));
+    SimhashTable256Ptr table256Ptr = CreateBasicSimhashTable<hash256_t>(
+        SimhashTableOptions(3U, 1U));
+    vector<hash128_t> hashes128(10000);
+    vector<hash256_t> hashes256(10000);
+    for (int i = 0; i < 10000; ++i)
+    {
+        for (uint_t w = 0; w < 4U; ++w)
+        {
+            seed = get_rand(seed);
+            hashes256[i].SetWord(w, seed);
+            if (w < 2U)
+            {
+                hashes128[i].SetWord(w, seed);
+            }
+        }
+        table128Ptr->Insert(hashes128[i]);
+        table256Ptr->Insert(hashes256[i]);
+    }
+    TEST_TRUE(table128Ptr->SaveToFile("tmp.snap", SIMHASH_FILE_SNAPSHOT));
+    table128Ptr->Clear();
+    TEST_TRUE(table128Ptr->LoadFromFile("tmp.snap", true));
+    TEST_TRUE(table256Ptr->SaveToFile("tmp.snap", SIMHASH_FILE_SNAPSHOT));
+    table256Ptr->Clear();
+    TEST_TRUE(table256Ptr->LoadFromFile("tmp.snap", true));
+    TEST_EQUAL(table128Ptr->GetSize(), 10000U);
+    TEST_EQUAL(table256Ptr->GetSize(), 10000U);
+    int found = 0;
+    for (int i = 0; i < 10000; ++i)
+    {
+        found += table128Ptr->Search(hashes128[i]) ? 1 : 0;
+        found += table256Ptr->Search(hashes256[i]) ? 1 : 0;
+    }
+    TEST_EQUAL(found, 20000);
+
+    //Clustered values, as the near-duplicates of a crawl, cost about the
+    //entropy of sorted random values too, their flipped bits are anywhere. A
+    //table with a bit order sorts its values before the writer, so the
+    //snapshot is not much slower to write than without one.
+    SimhashWorkloadOptions workload;
+    workload.valueNum = 2000000U;
+    workload.clusterNum = 200000U;
+    workload.zipfExponent = 1.0;
+    real_t weights[] = {0.0, 1.0, 1.0, 1.0};
+    workload.distanceWeights.assign(weights, weights + 4);
+    SimhashWorkloadReport report;
+    TEST_TRUE(GenerateSimhashWorkload(workload, "tmp.values", "", report));
+    SimhashTableOptions options(3U, 1U);
+    for (uint_t i = 0; i < 64U; ++i)
+    {
+        options.bitOrder.push_back(63U - i);
+    }
+    SimhashTablePtr tablePtrs[] = {CreateSimhashTable(3U, 1U),
+        CreateBasicSimhashTable<hash_t>(options)};
+    vector<hash_t> saved[2];
+    for (int t = 0; t < 2; ++t)
+    {
+        TEST_TRUE(tablePtrs[t]->LoadFromFile("tmp.values", true));
+        uint64_t start = GetNanoTime();
+        TEST_TRUE(tablePtrs[t]->SaveToFile("tmp.snap", SIMHASH_FILE_SNAPSHOT));
+        uint64_t end = GetNanoTime();
+        SimhashFileReader<hash_t> reader;
+        TEST_TRUE(reader.Open("tmp.snap", true));
+        vector<hash_t> values;
+        while (reader.Read(values))
+        {
+            saved[t].insert(saved[t].end(), values.begin(), values.end());
+        }
+        TEST_TRUE(reader.Good());
+        TEST_EQUAL(saved[t].size(), tablePtrs[t]->GetSize());
+        struct stat st;
+        stat("tmp.snap", &st);
+        double ratio = saved[t].size() * sizeof(hash_t) * 1.0 / st.st_size;
+        double bits = log(saved[t].size() * 1.0) / log(2.0);
+        double bound = 64.0 / (64.0 - bits + 1.44);
+        cout << "tmp.snap (clustered" << (t ? ", bit order" : "") << "): "
+            << st.st_size << " bytes, " << ratio << " times smaller ("
+            << bound << " for random), write "
+            << (end - start) / 1000000UL << " ms." << endl;
+        TEST_TRUE((ratio > bound * 0.95));
+    }
+    TEST_TRUE((saved[0] == saved[1]));
+    return 0;
+}
+
+int TestSimhashTableSaveAsync()
+{
+    //The file is the table at StartSave, while the writes go on.
+    SimhashTablePtr tablePtr = CreateSimhashTable(3U, 1U);
+    int size = 2000000, more = 500000;
+    vector<hash_t> data(size + more * 2);
+    hash_t seed = 12345;
+    for (size_t i = 0; i < data.size(); ++i)
+    {
+        seed = get_rand(seed);
+        data[i] = seed;
+    }
+    for (int i = 0; i < size; ++i)
+    {
+        tablePtr->Insert(data[i]);
+    }
+    uint64_t start = GetNanoTime();
+    for (int i = size; i < size + more; ++i)
+    {
+        tablePtr->Insert(data[i]);
+    }
+    uint64_t mid = GetNanoTime();
+    TEST_EQUAL(tablePtr->GetSaveState(), SIMHASH_SAVE_IDLE);
+    TEST_TRUE(tablePtr->StartSave("tmp.snap", SIMHASH_FILE_SNAPSHOT));
+    TEST_TRUE(!tablePtr->StartSave("tmp.snap", SIMHASH_FILE_SNAPSHOT));
+    uint64_t forked = GetNanoTime();
+    for (int i = size + more; i < size + more * 2; ++i)
+    {
+        tablePtr->Insert(data[i]);
+    }
+    uint64_t end = GetNanoTime();
+    //The writes during the save are seen at once.
+    TEST_TRUE(tablePtr->Remove(data[0]));
+    TEST_TRUE(!tablePtr->Search(data[0]));
+    TEST_TRUE(!tablePtr->Remove(data[0]));
+    TEST_TRUE(tablePtr->Search(data[size + more]));
+    TEST_TRUE(tablePtr->Insert(data[0]));
+    TEST_TRUE(!tablePtr->Insert(data[size + more]));
+    FindAnswerType ans;
+    TEST_TRUE(tablePtr->FindNearDups(data[size + more] ^ 7UL, ans));
+    TEST_TRUE((std::find(ans.begin(), ans.end(), data[size + more])
+        != ans.end()));
+    TEST_TRUE(tablePtr->Remove(data[1]));
+    TEST_TRUE(!tablePtr->HasNearDups(data[1]));
+    TEST_EQUAL(tablePtr->GetSize(), static_cast<uint_t>(size + more * 2 - 1));
+    //A traversal during the save merges the base and the delta in order.
+    TEST_TRUE(tablePtr->SaveToFile("tmp.overlay", SIMHASH_FILE_BINARY));
+    SimhashFileReader<hash_t> reader;
+    TEST_TRUE(reader.Open("tmp.overlay", true));
+    vector<hash_t> values, all;
+    while (reader.Read(values))
+    {
+        all.insert(all.end(), values.begin(), values.end());
+    }
+    TEST_EQUAL(all.size(), static_cast<size_t>(size + more * 2 - 1));
+    TEST_TRUE((std::adjacent_find(all.begin(), all.end(),
+        std::greater_equal<hash_t>()) == all.end()));
+    TEST_TRUE(!std::binary_search(all.begin(), all.end(), data[1]));
+    TEST_TRUE(std::binary_search(all.begin(), all.end(), data[0]));
+    TEST_TRUE(std::binary_search(all.begin(), all.end(),
+        data[size + more * 2 - 1]));
+    TEST_EQUAL(tablePtr->GetSaveState(true), SIMHASH_SAVE_DONE);
+    uint64_t saved = GetNanoTime();
+    cout << "insert " << more << ": " << (mid - start) / 1000000UL
+        << " ms, while saving: " << (end - forked) / 1000000UL
+        << " ms, fork " << (forked - mid) / 1000000UL << " ms, save and merge "
+        << (saved - end) / 1000000UL << " ms." << endl;
+    TEST_EQUAL(tablePtr->GetSize(), static_cast<uint_t>(size + more * 2 - 1));
+    TEST_TRUE(!tablePtr->Search(data[1]));
+    TEST_TRUE(tablePtr->Search(data[size + more * 2 - 1]));
+    //The merged values are found once, and written to as the others.
+    ans.clear();
+    TEST_TRUE(tablePtr->FindNearDups(data[size + more] ^ 7UL, ans));
+    TEST_TRUE((std::count(ans.begin(), ans.end(), data[size + more]) == 1));
+    TEST_TRUE(tablePtr->Remove(data[size + more]));
+    TEST_TRUE(!tablePtr->Search(data[size + more]));
+    TEST_TRUE(tablePtr->Insert(data[size + more]));
+    TEST_TRUE(tablePtr->Insert(data[1]));
+    SimhashTablePtr loadPtr = CreateSimhashTable(3U, 1U);
+    TEST_TRUE(loadPtr->LoadFromFile("tmp.snap", true));
+    TEST_EQUAL(loadPtr->GetSize(), static_cast<uint_t>(size + more));
+    TEST_TRUE(loadPtr->Search(data[1]));
+    return 0;
+}
+
+int TestSimhashTableUpdate()
+{
+    //Edits flip a few bits, Update gives the table of the edited values.
+    SimhashTableOptions options(3U, 1U);
+    options.usePrefilter = true;
+    SimhashTablePtr tablePtr = CreateSimhashTable(options);
+    SimhashTablePtr copyPtr = CreateSimhashTable(options);
+    int size = 1000000, edits = 200000;
+    vector<hash_t> data(size);
+    hash_t seed = 12345;
+    for (int i = 0; i < size; ++i)
+    {
+        seed = get_rand(seed);
+        data[i] = seed;
+        tablePtr->Insert(seed);
+        copyPtr->Insert(seed);
+    }
+    vector<hash_t> edited(data);
+    for (int i = 0; i < edits; ++i)
+    {
+        seed = get_rand(seed);
+        edited[i] ^= (1UL << (seed % 64U)) | (1UL << (seed / 64U % 64U));
+    }
+    uint64_t start = GetNanoTime();
+    for (int i = 0; i < edits; ++i)
+    {
+        TEST_TRUE(tablePtr->Update(data[i], edited[i]));
+    }
+    uint64_t mid = GetNanoTime();
+    for (int i = 0; i < edits; ++i)
+    {
+        copyPtr->Remove(data[i]);
+        copyPtr->Insert(edited[i]);
+    }
+    uint64_t end = GetNanoTime();
+    cout << "update " << edits << ": " << (mid - start) / 1000000UL
+        << " ms, remove and insert: " << (end - mid) / 1000000UL << " ms."
+        << endl;
+    TEST_EQUAL(tablePtr->GetSize(), static_cast<uint_t>(size));
+    TEST_TRUE(!tablePtr->Update(data[size - 1], edited[size - 2]));
+    TEST_TRUE(tablePtr->Update(data[size - 1], data[size - 1]));
+    int same = 0;
+    for (int i = 0; i < edits; ++i)
+    {
+        same += tablePtr->Search(edited[i]) && (data[i] == edited[i]
+            || !tablePtr->Search(data[i])) ? 1 : 0;
+        same += tablePtr->HasNearDups(data[i] ^ 1UL)
+            == copyPtr->HasNearDups(data[i] ^ 1UL) ? 1 : 0;
+    }
+    TEST_EQUAL(same, edits * 2);
+    return 0;
+}
+
+class JoinCollector : public SimhashJoinCallback
+{
+public :
+    JoinCollector()
+        : mWrongDistances(0)
+    {}
+    virtual void OnMatch(hash_t query, hash_t match, uint_t distance)
+    {
+        mPairs.push_back(make_pair(query, match));
+        mWrongDistances += Simhash::GetHammingDistance(query, match)
+            != distance ? 1 : 0;
+    }
+    vector<pair<hash_t, hash_t> > mPairs;
+    int mWrongDistances;
+};
+
+int TestSimhashJoin()
+{
+    //The table has the bits reordered, the join gives the original values.
+    SimhashTableOptions options(3U, 1U);
+    for (uint_t i = 0; i < 64U; ++i)
+    {
+        options.bitOrder.push_back(63U - i);
+    }
+    SimhashTablePtr tablePtr = CreateSimhashTable(options);
+    int size = 1000000, queryNum = 50000;
+    vector<hash_t> data(size), queries;
+    hash_t seed = 12345;
+    for (int i = 0; i < size; ++i)
+    {
+        seed = get_rand(seed);
+        data[i] = seed;
+        tablePtr->Insert(seed);
+    }
+    for (int i = 0; i < queryNum; ++i)
+    {
+        seed = get_rand(seed);
+        hash_t query = i % 2 ? seed : data[seed % size] ^ (1UL << (seed >> 58))
+            ^ (1UL << (seed >> 52 & 63U));
+        queries.push_back(query);
+    }
+    uint64_t start = GetNanoTime();
+    vector<pair<hash_t, hash_t> > expected;
+    FindAnswerType ans;
+    for (int i = 0; i < queryNum; ++i)
+    {
+        tablePtr->FindNearDups(queries[i], ans);
+        for (size_t j = 0; j < ans.size(); ++j)
+        {
+            expected.push_back(make_pair(queries[i], ans[j]));
+        }
+    }
+    uint64_t mid = GetNanoTime();
+    JoinCollector collector;
+    TEST_TRUE(tablePtr->Join(queries, collector));
+    uint64_t end = GetNanoTime();
+    cout << "join " << queryNum << " queries: FindNearDups "
+        << (mid - start) / 1000000UL << " ms, Join " << (end - mid) / 1000000UL
+        << " ms." << endl;
+    //Each pair once, with the right distance.
+    sort(expected.begin(), expected.end());
+    sort(collector.mPairs.begin(), collector.mPairs.end());
+    TEST_TRUE((collector.mPairs == expected));
+    TEST_EQUAL(collector.mWrongDistances, 0);
+    TEST_TRUE((expected.size() >= static_cast<size_t>(queryNum / 2)));
+    //The merge of the nested containers of sorted arrays, frozen or not,
+    //and the copy of a leaf at the root, on parts of the values.
+    SimhashTableOptions optionList[2] = {SimhashTableOptions(3U, 2U),
+        SimhashTableOptions(3U, 0U)};
+    optionList[0].leafType = SIMHASH_LEAF_SORTED_ARRAY;
+    int sizes[2] = {200000, 20000};
+    for (int k = 0; k < 2; ++k)
+    {
+        SimhashTablePtr partPtr = CreateSimhashTable(optionList[k]);
+        for (int i = 0; i < sizes[k]; ++i)
+        {
+            partPtr->Insert(data[i]);
+        }
+        for (int round = 0; round < 2 - k; ++round)
+        {
+            vector<pair<hash_t, hash_t> > partExpected;
+            for (int i = 0; i < queryNum; ++i)
+            {
+                partPtr->FindNearDups(queries[i], ans);
+                for (size_t j = 0; j < ans.size(); ++j)
+                {
+                    partExpected.push_back(make_pair(queries[i], ans[j]));
+                }
+            }
+            JoinCollector partCollector;
+            TEST_TRUE(partPtr->Join(queries, partCollector, 2U));
+            sort(partExpected.begin(), partExpected.end());
+            sort(partCollector.mPairs.begin(), partCollector.mPairs.end());
+            TEST_TRUE((partCollector.mPairs == partExpected));
+            TEST_EQUAL(partCollector.mWrongDistances, 0);
+            TEST_TRUE((!partExpected.empty()));
+            TEST_TRUE(partPtr->Freeze());
+        }
+    }
+    //The same join of files, and of the wider values.
+    string files[] = {"tmp.bin", "tmp.query"};
+    SimhashFileWriter<hash_t> writer;
+    TEST_TRUE(writer.Open(files[1], SIMHASH_FILE_BINARY));
+    for (int i = 0; i < queryNum; ++i)
+    {
+        writer.Write(queries[i]);
+    }
+    TEST_TRUE(writer.Close());
+    TEST_TRUE(tablePtr->SaveToFile(files[0], SIMHASH_FILE_SNAPSHOT));
+    JoinCollector fileCollector;
+    TEST_TRUE(JoinSimhashFiles(files[1], files[0], true, 3U, fileCollector));
+    sort(fileCollector.mPairs.begin(), fileCollector.mPairs.end());
+    TEST_TRUE((fileCollector.mPairs == expected));
+    TEST_TRUE(!JoinSimhashFiles(files[1], "tmp.none", true, 3U,
+        fileCollector));
+    remove(files[0].c_str());
+    remove(files[1].c_str());
+    return 0;
+}
+
+int TestSimhashTenantTable()
+{
+    //Each tenant gives the same answers as a table of its own, and a value
+    //of a tenant is never seen by another one.
+    int tenantNum = 3000, poolSize = 20000;
+    vector<hash_t> pool(poolSize);
+    hash_t seed = 12345;
+    for (int i = 0; i < poolSize; ++i)
+    {
+        seed = get_rand(seed);
+        pool[i] = seed;
+    }
+    SimhashTableOptions optionList[3] = {SimhashTableOptions(3U, 0U),
+        SimhashTableOptions(3U, 1U), SimhashTableOptions(3U, 2U)};
+    optionList[0].hotBucketSize = 256U;
+    optionList[1].leafType = SIMHASH_LEAF_SORTED_ARRAY;
+    optionList[2].usePrefilter = true;
+    for (int k = 0; k < 3; ++k)
+    {
+        SimhashTenantTablePtr tenantPtr
+            = CreateSimhashTenantTable(optionList[k]);
+        vector<SimhashTablePtr> tables(tenantNum);
+        uint64_t separateBytes = 0UL;
+        for (int t = 0; t < tenantNum; ++t)
+        {
+            //A few large tenants, and many small ones.
+            tables[t] = CreateSimhashTable(optionList[k]);
+            int size = 2000 / (t + 1) + 20;
+            for (int j = 0; j < size; ++j)
+            {
+                hash_t hash = pool[(t * 7 + j) % poolSize];
+                TEST_TRUE(tenantPtr->Insert(t, hash));
+                tables[t]->Insert(hash);
+            }
+            TEST_TRUE(!tenantPtr->Insert(t, pool[t * 7 % poolSize]));
+            SimhashMemoryUsage usage;
+            tables[t]->GetMemoryUsage(usage);
+            separateBytes += usage.GetTotalBytes();
+        }
+        SimhashMemoryUsage usage;
+        tenantPtr->GetMemoryUsage(usage);
+        cout << "level " << optionList[k].level << ", " << tenantNum
+            << " tenants of " << tenantPtr->GetSize() << " values: "
+            << usage.GetTotalBytes() / 1024UL << " KB, separate tables "
+            << separateBytes / 1024UL << " KB." << endl;
+        int same = 0, queryNum = 20000;
+        FindAnswerType ans, expected;
+        for (int i = 0; i < queryNum; ++i)
+        {
+            seed = get_rand(seed);
+            int t = static_cast<int>(seed % tenantNum);
+            hash_t query = pool[(seed >> 20) % poolSize] ^ (1UL << (seed >> 58));
+            tenantPtr->FindNearDups(t, query, ans);
+            tables[t]->FindNearDups(query, expected);
+            hash_t first = 0UL;
+            same += ans == expected
+                && tenantPtr->HasNearDups(t, query) == !expected.empty()
+                && tenantPtr->FindFirstNearDup(t, query, first)
+                == !expected.empty()
+                && (expected.empty() || tables[t]->Search(first))
+                && tenantPtr->Search(t, query) == tables[t]->Search(query)
+                ? 1 : 0;
+        }
+        TEST_EQUAL(same, queryNum);
+        //Count, remove and clear each tenant alone.
+        TEST_EQUAL(tenantPtr->GetTenantSize(0), tables[0]->GetSize());
+        TEST_EQUAL(tenantPtr->GetTenantSize(tenantNum - 1),
+            tables[tenantNum - 1]->GetSize());
+        TEST_EQUAL(tenantPtr->GetTenantSize(tenantNum), 0U);
+        TEST_TRUE(tenantPtr->Remove(1, pool[7]));
+        TEST_TRUE(!tenantPtr->Remove(1, pool[7]));
+        TEST_TRUE(!tenantPtr->Search(1, pool[7]));
+        TEST_TRUE(tenantPtr->Search(2, pool[14]));
+        uint_t total = tenantPtr->GetSize();
+        TEST_EQUAL(tenantPtr->ClearTenant(0), tables[0]->GetSize());
+        TEST_EQUAL(tenantPtr->GetTenantSize(0), 0U);
+        TEST_TRUE(!tenantPtr->HasNearDups(0, pool[0]));
+        TEST_TRUE(tenantPtr->HasNearDups(1, pool[8]));
+        TEST_EQUAL(tenantPtr->GetSize(), total - tables[0]->GetSize());
+        TEST_EQUAL(tenantPtr->ClearTenant(0), 0U);
+        tenantPtr->Clear();
+        TEST_EQUAL(tenantPtr->GetSize(), 0U);
+    }
+    return 0;
+}
+
+int TestSimhashTableFreeze()
+{
+    //The set leaves, the sorted array leaves, and the frozen table give the
+    //same answers, and the latencies are compared.
+    int size = 1000000, queryNum = 200000;
+    vector<hash_t> data(size), queries(queryNum);
+    hash_t seed = 12345;
+    for (int i = 0; i < size; ++i)
+    {
+        seed = get_rand(seed);
+        data[i] = seed;
+    }
+    for (int i = 0; i < queryNum; ++i)
+    {
+        seed = get_rand(seed);
+        queries[i] = i % 2 ? seed : data[seed % size] ^ (1UL << (seed >> 58));
+    }
+    SimhashTableOptions options(3U, 1U);
+    SimhashTablePtr tablePtrs[3];
+    tablePtrs[0] = CreateSimhashTable(options);
+    options.leafType = SIMHASH_LEAF_SORTED_ARRAY;
+    tablePtrs[1] = CreateSimhashTable(options);
+    options.leafType = SIMHASH_LEAF_SET;
+    tablePtrs[2] = CreateSimhashTable(options);
+    string names[3] = {"set", "sorted array", "frozen"};
+    for (int k = 0; k < 3; ++k)
+    {
+        for (int i = 0; i < size; ++i)
+        {
+            tablePtrs[k]->Insert(data[i]);
+        }
+    }
+    TEST_TRUE(tablePtrs[2]->Freeze());
+    vector<FindAnswerType> answers[3];
+    for (int k = 0; k < 3; ++k)
+    {
+        int found = 0;
+        uint64_t start = GetNanoTime();
+        for (int i = 0; i < queryNum; ++i)
+        {
+            found += tablePtrs[k]->HasNearDups(queries[i]) ? 1 : 0;
+        }
+        uint64_t mid = GetNanoTime();
+        tablePtrs[k]->FindNearDupsBatch(queries, answers[k], 16U);
+        uint64_t end = GetNanoTime();
+        SimhashMemoryUsage usage;
+        tablePtrs[k]->GetMemoryUsage(usage);
+        cout << names[k] << ": HasNearDups " << (mid - start) / queryNum
+            << " ns, FindNearDupsBatch " << (end - mid) / queryNum
+            << " ns per query, " << usage.GetTotalBytes() / 1048576UL
+            << " MB." << endl;
+        TEST_TRUE((found >= queryNum / 2));
+    }
+    TEST_TRUE((answers[0] == answers[1]));
+    TEST_TRUE((answers[0] == answers[2]));
+    FindAnswerType ans, expected;
+    int same = 0;
+    for (int i = 0; i < queryNum; i += 10)
+    {
+        tablePtrs[0]->FindNearDups(queries[i], expected);
+        tablePtrs[2]->FindNearDups(queries[i], ans);
+        same += ans == expected && tablePtrs[2]->Search(queries[i])
+            == tablePtrs[0]->Search(queries[i]) ? 1 : 0;
+    }
+    TEST_EQUAL(same, queryNum / 10);
+    //A frozen table is read-only until it is cleared.
+    TEST_TRUE(!tablePtrs[2]->Insert(data[0] ^ 1UL));
+    TEST_TRUE(!tablePtrs[2]->Remove(data[0]));
+    TEST_TRUE(!tablePtrs[2]->Update(data[0], data[0] ^ 1UL));
+    TEST_TRUE(tablePtrs[2]->Search(data[0]));
+    TEST_EQUAL(tablePtrs[2]->GetSize(), static_cast<uint_t>(size));
+    tablePtrs[2]->Clear();
+    TEST_EQUAL(tablePtrs[2]->GetSize(), 0U);
+    TEST_TRUE(tablePtrs[2]->Insert(data[0]));
+    TEST_TRUE(tablePtrs[2]->HasNearDups(data[0] ^ 3UL));
+    //A leaf root with hot buckets, and the wider values.
+    SimhashTableOptions hotOptions(3U, 0U);
+    hotOptions.hotBucketSize = 64U;
+    SimhashTablePtr hotPtr = CreateSimhashTable(hotOptions);
+    SimhashTable128Ptr widePtr = CreateBasicSimhashTable<hash128_t>(
+        SimhashTableOptions(5U, 1U));
+    vector<hash128_t> wides(10000);
+    hash128_t flip(3UL);
+    flip.SetWord(1U, 1UL << 40);
+    for (int i = 0; i < 10000; ++i)
+    {
+        wides[i].SetWord(0U, data[i]);
+        wides[i].SetWord(1U, data[size - 1 - i]);
+        hotPtr->Insert(data[i]);
+        widePtr->Insert(wides[i]);
+    }
+    TEST_TRUE(hotPtr->Freeze());
+    TEST_TRUE(widePtr->Freeze());
+    same = 0;
+    for (int i = 0; i < 10000; i += 7)
+    {
+        same += hotPtr->HasNearDups(data[i] ^ 6UL)
+            && hotPtr->FindNearDups(data[i] ^ 6UL, ans) && ans.size() == 1U
+            && widePtr->HasNearDups(wides[i] ^ flip)
+            && !widePtr->Insert(wides[i] ^ flip) ? 1 : 0;
+    }
+    TEST_EQUAL(same, (10000 + 6) / 7);
+    TEST_EQUAL(widePtr->GetSize(), 10000U);
+    return 0;
+}
+
+int TestSimhashTrace()
+{
+    //A recorded workload is read back as it is, and the replay rebuilds
+    //the same table.
+    SimhashTableOptions options(3U, 1U);
+    SimhashTablePtr tablePtr = CreateSimhashTable(options);
+    SimhashTablePtr recorderPtr = CreateSimhashTraceRecorder(tablePtr,
+        "tmp.trace");
+    TEST_TRUE((recorderPtr != NULL));
+    TEST_TRUE((CreateSimhashTraceRecorder(tablePtr, "/none/tmp.trace")
+        == NULL));
+    int size = 100000;
+    vector<hash_t> data(size), batch, hashes;
+    vector<uint_t> ops;
+    hash_t seed = 12345;
+    FindAnswerType ans;
+    vector<FindAnswerType> answers;
+    for (int i = 0; i < size; ++i)
+    {
+        seed = get_rand(seed);
+        data[i] = seed;
+        recorderPtr->Insert(seed);
+        ops.push_back(SIMHASH_OP_INSERT);
+        hashes.push_back(seed);
+        if (i % 10 == 0)
+        {
+            recorderPtr->HasNearDups(data[seed % (i + 1)] ^ 3UL);
+            recorderPtr->FindNearDups(seed ^ 5UL, ans);
+            ops.push_back(SIMHASH_OP_HAS_NEAR_DUPS);
+            ops.push_back(SIMHASH_OP_FIND_NEAR_DUPS);
+            hashes.push_back(data[seed % (i + 1)] ^ 3UL);
+            hashes.push_back(seed ^ 5UL);
+        }
+        if (i % 100 == 0)
+        {
+            recorderPtr->Update(data[i / 2], data[i / 2] ^ 1UL);
+            hashes.push_back(data[i / 2]);
+            data[i / 2] ^= 1UL;
+            recorderPtr->Remove(data[i / 3]);
+            recorderPtr->Search(data[i / 4]);
+            ops.push_back(SIMHASH_OP_UPDATE);
+            ops.push_back(SIMHASH_OP_REMOVE);
+            ops.push_back(SIMHASH_OP_SEARCH);
+            hashes.push_back(data[i / 3]);
+            hashes.push_back(data[i / 4]);
+        }
+    }
+    batch.assign(data.begin(), data.begin() + 1000);
+    recorderPtr->FindNearDupsBatch(batch, answers, 8U);
+    ops.push_back(SIMHASH_TRACE_FIND_NEAR_DUPS_BATCH);
+    hashes.push_back(0UL);
+    uint_t expectedSize = tablePtr->GetSize();
+    recorderPtr.reset();
+    SimhashTraceReader reader;
+    TEST_TRUE(reader.Open("tmp.trace"));
+    SimhashTraceRecord record;
+    size_t num = 0, same = 0;
+    uint64_t lastTime = 0UL;
+    for (; reader.Read(record); ++num)
+    {
+        same += num < ops.size() && record.op == ops[num]
+            && record.time >= lastTime
+            && (SIMHASH_TRACE_FIND_NEAR_DUPS_BATCH == record.op
+            || record.hash == hashes[num]) ? 1U : 0U;
+        lastTime = record.time;
+    }
+    TEST_TRUE(reader.Good());
+    TEST_EQUAL(num, ops.size());
+    TEST_EQUAL(same, ops.size());
+    TEST_TRUE((record.hashes == batch));
+    TEST_EQUAL(record.depth, 8U);
+    //The replay on new tables, by one and by 4 threads.
+    SimhashReplayOptions replayOptions;
+    SimhashReplayReport report;
+    SimhashTablePtr replayPtr = CreateSimhashTable(options);
+    TEST_TRUE(ReplaySimhashTrace("tmp.trace", replayPtr, replayOptions,
+        report));
+    cout << report.ToString();
+    TEST_EQUAL(report.recordNum, ops.size());
+    TEST_EQUAL(replayPtr->GetSize(), expectedSize);
+    TEST_EQUAL(report.latencies[SIMHASH_OP_INSERT].GetCount(),
+        static_cast<uint64_t>(size));
+    TEST_TRUE((report.tableBytes > 0UL));
+    same = 0;
+    for (int i = 0; i < size; i += 13)
+    {
+        same += tablePtr->Search(data[i]) == replayPtr->Search(data[i])
+            ? 1U : 0U;
+    }
+    TEST_EQUAL(same, static_cast<size_t>((size + 12) / 13));
+    //The queries share the table with the hot buckets and the mirrors,
+    //which are kept by the writes alone.
+    replayOptions.threadNum = 4U;
+    replayOptions.sharedReads = true;
+    SimhashTableOptions sharedOptions = options;
+    sharedOptions.hotBucketSize = 4U;
+    sharedOptions.bitSliceSize = 3U;
+    replayPtr = CreateSimhashTable(sharedOptions);
+    TEST_TRUE(ReplaySimhashTrace("tmp.trace", replayPtr, replayOptions,
+        report));
+    TEST_EQUAL(report.recordNum, ops.size());
+    TEST_TRUE((replayPtr->GetSize() >= expectedSize - size / 100));
+    size_t stored = 0;
+    same = 0;
+    for (int i = 0; i < size; i += 13)
+    {
+        if (replayPtr->Search(data[i]))
+        {
+            ++stored;
+            same += replayPtr->HasNearDups(data[i] ^ 0x11UL) ? 1U : 0U;
+        }
+    }
+    TEST_TRUE((stored > 0U));
+    TEST_EQUAL(same, stored);
+    //Paced at 10 times the original rate.
+    replayOptions.threadNum = 1U;
+    replayOptions.speed = 10.0;
+    replayPtr = CreateSimhashTable(options);
+    uint64_t start = GetNanoTime();
+    TEST_TRUE(ReplaySimhashTrace("tmp.trace", replayPtr, replayOptions,
+        report));
+    TEST_TRUE((GetNanoTime() - start >= lastTime / 10U));
+    TEST_EQUAL(replayPtr->GetSize(), expectedSize);
+    //A cut record ends the trace, a bad op fails it.
+    struct stat st;
+    stat("tmp.trace", &st);
+    TEST_TRUE(!truncate("tmp.trace", st.st_size - 3));
+    TEST_TRUE(reader.Open("tmp.trace"));
+    for (num = 0; reader.Read(record); ++num)
+    {}
+    TEST_TRUE(reader.Good());
+    TEST_EQUAL(num, ops.size() - 1U);
+    FILE *fp = fopen("tmp.trace", "r+b");
+    fseek(fp, sizeof(SimhashTraceHeader), SEEK_SET);
+    fputc(SIMHASH_TRACE_OP_NUM, fp);
+    fclose(fp);
+    TEST_TRUE(!ReplaySimhashTrace("tmp.trace", replayPtr, replayOptions,
+        report));
+    TEST_TRUE(!ReplaySimhashTrace("tmp.none", replayPtr, replayOptions,
+        report));
+    remove("tmp.trace");
+    return 0;
+}
+
+int TestSimhashWorkload()
+{
+    SimhashWorkloadOptions options;
+    options.valueNum = 200000UL;
+    options.clusterNum = 20000UL;
+    options.distanceWeights.resize(7U, 1.0);
+    options.duplicateRate = 0.05;
+    options.seed = 7UL;
+    options.threadNum = 4U;
+    SimhashWorkloadReport report;
+    TEST_TRUE(GenerateSimhashWorkload(options, "tmp.values", "tmp.pairs",
+        report));
+    TEST_EQUAL(report.valueNum, options.valueNum);
+    TEST_TRUE((report.duplicateNum > 0UL));
+    TEST_TRUE((report.largestCluster > options.valueNum / 20U));
+    //The same corpus by one thread.
+    options.threadNum = 1U;
+    SimhashWorkloadReport serialReport;
+    TEST_TRUE(GenerateSimhashWorkload(options, "tmp.values1", "tmp.pairs1",
+        serialReport));
+    TEST_EQUAL(serialReport.duplicateNum, report.duplicateNum);
+    TEST_TRUE((serialReport.distanceCounts == report.distanceCounts));
+    SimhashFileReader<hash_t> reader;
+    vector<hash_t> values, serialValues, chunk;
+    TEST_TRUE(reader.Open("tmp.values", true));
+    while (reader.Read(chunk))
+    {
+        values.insert(values.end(), chunk.begin(), chunk.end());
+    }
+    TEST_TRUE(reader.Open("tmp.values1", true));
+    while (reader.Read(chunk))
+    {
+        serialValues.insert(serialValues.end(), chunk.begin(), chunk.end());
+    }
+    TEST_EQUAL(values.size(), options.valueNum);
+    TEST_TRUE((values == serialValues));
+    //The ground truth, one pair per member.
+    vector<SimhashWorkloadPair> pairs(options.valueNum);
+    FILE *fp = fopen("tmp.pairs", "rb");
+    size_t pairNum = fp ? fread(&pairs[0], sizeof(SimhashWorkloadPair),
+        pairs.size(), fp) : 0U;
+    if (fp)
+    {
+        fclose(fp);
+    }
+    TEST_EQUAL(pairNum, options.valueNum - options.clusterNum);
+    pairs.resize(pairNum);
+    size_t exact = 0;
+    vector<hash_t> members;
+    for (size_t i = 0; i < pairs.size(); ++i)
+    {
+        exact += PopCount(pairs[i].value ^ pairs[i].center)
+            == pairs[i].distance ? 1U : 0U;
+        if (pairs[i].distance <= 3U)
+        {
+            members.push_back(pairs[i].value);
+        }
+    }
+    TEST_EQUAL(exact, pairs.size());
+    //A table of k = 3 finds the center of each member within 3 bits.
+    SimhashTablePtr tablePtr = CreateSimhashTable(3U);
+    TEST_TRUE(tablePtr->LoadFromFile("tmp.values"));
+    vector<FindAnswerType> answers;
+    uint64_t start = GetNanoTime();
+    tablePtr->FindNearDupsBatch(members, answers);
+    uint64_t elapsed = GetNanoTime() - start;
+    size_t found = 0;
+    for (size_t i = 0, m = 0; i < pairs.size(); ++i)
+    {
+        if (pairs[i].distance <= 3U)
+        {
+            found += find(answers[m].begin(), answers[m].end(),
+                pairs[i].center) != answers[m].end() ? 1U : 0U;
+            ++m;
+        }
+    }
+    cout << "Generated " << report.valueNum << " values in "
+        << report.elapsedNanos / 1000000UL << " ms, recall " << found
+        << "/" << members.size() << ", "
+        << elapsed / max(members.size(), static_cast<size_t>(1U))
+        << " ns per query" << endl;
+    TEST_EQUAL(found, members.size());
+    //Invalid options.
+    options.clusterNum = options.valueNum + 1U;
+    TEST_TRUE(!GenerateSimhashWorkload(options, "tmp.values", "", report));
+    remove("tmp.values");
+    remove("tmp.values1");
+    remove("tmp.pairs");
+    remove("tmp.pairs1");
+    return 0;
+}
+
+int TestSimhashTableRadius()
+{
+    //A table of maxHamDist 6 answers each radius up to 6 as a scan does,
+    //and a small radius probes fewer containers.
+    int size = 100000, queryNum = 2000;
+    vector<hash_t> data(size), queries(queryNum);
+    hash_t seed = 54321;
+    for (int i = 0; i < size; ++i)
+    {
+        seed = get_rand(seed);
+        data[i] = seed;
+    }
+    for (int i = 0; i < queryNum; ++i)
+    {
+        seed = get_rand(seed);
+        queries[i] = i % 4 ? data[seed % size] : seed;
+        for (int flips = i % 9; flips > 0; --flips)
+        {
+            seed = get_rand(seed);
+            queries[i] ^= 1UL << (seed >> 58);
+        }
+    }
+    SimhashTableOptions options(6U, 1U);
+    SimhashTablePtr tablePtrs[3];
+    tablePtrs[0] = CreateSimhashTable(options);
+    options.leafType = SIMHASH_LEAF_SORTED_ARRAY;
+    tablePtrs[1] = CreateSimhashTable(options);
+    options.level = 2U;
+    options.usePrefilter = true;
+    tablePtrs[2] = CreateSimhashTable(options);
+    string names[3] = {"set", "frozen", "level 2"};
+    for (int k = 0; k < 3; ++k)
+    {
+        for (int i = 0; i < (k < 2 ? size : size / 5); ++i)
+        {
+            tablePtrs[k]->Insert(data[i]);
+        }
+    }
+    TEST_TRUE(tablePtrs[1]->Freeze());
+    FindAnswerType ans, expected;
+    for (int k = 0; k < 3; ++k)
+    {
+        const int num = k < 2 ? size : size / 5;
+        int same = 0, total = 0;
+        for (int i = 0; i < queryNum; i += 4)
+        {
+            for (uint_t d = 0; d <= 6U; ++d)
+            {
+                expected.clear();
+                for (int j = 0; j < num; ++j)
+                {
+                    if (PopCount(data[j] ^ queries[i]) <= d)
+                    {
+                        expected.push_back(data[j]);
+                    }
+                }
+                sort(expected.begin(), expected.end());
+                tablePtrs[k]->FindNearDupsWithin(queries[i], 0U, d, ans);
+                same += ans == expected
+                    && tablePtrs[k]->HasNearDupsWithin(queries[i], d)
+                    == !expected.empty() ? 1 : 0;
+                ++total;
+            }
+            //The values 2 to 4 bits away.
+            tablePtrs[k]->FindNearDupsWithin(queries[i], 2U, 4U, ans);
+            expected.clear();
+            for (int j = 0; j < num; ++j)
+            {
+                const uint_t dist = PopCount(data[j] ^ queries[i]);
+                if (dist >= 2U && dist <= 4U)
+                {
+                    expected.push_back(data[j]);
+                }
+            }
+            sort(expected.begin(), expected.end());
+            same += ans == expected ? 1 : 0;
+            ++total;
+        }
+        TEST_EQUAL(same, total);
+        //The radius of table is the same as FindNearDups.
+        same = 0;
+        for (int i = 0; i < queryNum; ++i)
+        {
+            tablePtrs[k]->FindNearDups(queries[i], expected);
+            tablePtrs[k]->FindNearDupsWithin(queries[i], 0U, 6U, ans);
+            same += ans == expected ? 1 : 0;
+        }
+        TEST_EQUAL(same, queryNum);
+        TEST_TRUE(!tablePtrs[k]->HasNearDupsWithin(queries[0], 7U));
+        TEST_TRUE(!tablePtrs[k]->FindNearDupsWithin(data[0], 0U, 7U, ans));
+        TEST_TRUE(ans.empty());
+        //The latencies by radius.
+        cout << names[k] << ":";
+        for (uint_t d = 0; d <= 6U; d += 2U)
+        {
+            uint64_t start = GetNanoTime();
+            for (int i = 0; i < queryNum; ++i)
+            {
+                tablePtrs[k]->FindNearDupsWithin(queries[i], 0U, d, ans);
+            }
+            cout << " d=" << d << " " << (GetNanoTime() - start) / queryNum
+                << " ns";
+        }
+        cout << endl;
+    }
+    return 0;
+}
+
+uint64_t GetResidentBytes()
+{
+    uint64_t pages = 0, resident = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (fp)
+    {
+        if (fscanf(fp, "%lu %lu", &pages, &resident) != 2)
+        {
+            resident = 0;
+        }
+        fclose(fp);
+    }
+    return resident * 4096UL;
+}
+
+int TestSimhashTableCostModel()
+{
+    //Each layout is estimated, built and measured, then frozen and measured
+    //again. The model is right within 2 times.
+    uint64_t size = 1000000UL, budget = 200UL << 20;
+    SimhashLeafType leafTypes[] = {SIMHASH_LEAF_SET, SIMHASH_LEAF_SORTED_ARRAY};
+    vector<SimhashTableOptions> layouts;
+    vector<double> measured[2];
+    vector<uint64_t> bytes[2];
+    for (uint_t level = 0U; level <= 2U; ++level)
+    {
+        for (int prefilter = 0; prefilter < (level ? 2 : 1); ++prefilter)
+        {
+            for (int leaf = 0; leaf < 2; ++leaf)
+            {
+                SimhashTableOptions options(3U, level);
+                options.usePrefilter = prefilter;
+                options.leafType = leafTypes[leaf];
+                layouts.push_back(options);
+                SimhashTableEstimate estimates[2];
+                TEST_TRUE(EstimateSimhashTable(options, size, estimates[0]));
+                TEST_TRUE(EstimateSimhashTable(options, size, estimates[1],
+                    true));
+
+                uint64_t resident = GetResidentBytes();
+                SimhashTablePtr tablePtr = CreateSimhashTable(options);
+                hash_t seed = (hash_t)rand();
+                for (uint64_t i = 0; i < size; ++i)
+                {
+                    seed = get_rand(seed);
+                    tablePtr->Insert(seed);
+                }
+                resident = GetResidentBytes() - resident;
+                for (int frozen = 0; frozen < 2; ++frozen)
+                {
+                    TEST_TRUE((!frozen || tablePtr->Freeze()));
+                    SimhashMemoryUsage usage;
+                    tablePtr->GetMemoryUsage(usage);
+                    int repet = level ? 100000 : (frozen || leaf ? 100 : 10);
+                    clock_t start = clock();
+                    for (int i = 0; i < repet; ++i)
+                    {
+                        seed = get_rand(seed);
+                        tablePtr->HasNearDups(seed);
+                    }
+                    double nanos = (double)(clock() - start) * 1e9
+                        / CLOCKS_PER_SEC / repet;
+                    cout << "Level " << level << ", prefilter " << prefilter
+                        << ", leaf " << leaf << (frozen ? ", frozen" : "")
+                        << ": memory estimated "
+                        << estimates[frozen].memoryBytes
+                        << ", reported " << usage.GetTotalBytes()
+                        << ", resident " << resident
+                        << "; query estimated "
+                        << (uint64_t)estimates[frozen].queryNanos
+                        << " ns, measured " << (uint64_t)nanos << " ns."
+                        << endl;
+                    TEST_TRUE((nanos < estimates[frozen].queryNanos * 2.0));
+                    TEST_TRUE((nanos > estimates[frozen].queryNanos / 2.0));
+                    //A frozen estimate is the peak of Freeze.
+                    TEST_TRUE((usage.GetTotalBytes()
+                        < estimates[frozen].memoryBytes * 1.1));
+                    TEST_TRUE((frozen || usage.GetTotalBytes()
+                        > estimates[frozen].memoryBytes * 0.9));
+                    measured[frozen].push_back(nanos);
+                    bytes[frozen].push_back(frozen
+                        ? estimates[frozen].memoryBytes
+                        : usage.GetTotalBytes());
+                }
+            }
+        }
+    }
+
+    //The options chosen fit in the budget, and are about as fast as the
+    //fastest layout measured which fits.
+    for (int frozen = 0; frozen < 2; ++frozen)
+    {
+        SimhashTableOptions options;
+        TEST_TRUE(ChooseSimhashTableOptions(size, 3U, budget, options,
+            frozen));
+        cout << "Choose for " << (budget >> 20) << "MB"
+            << (frozen ? ", frozen" : "") << ": level " << options.level
+            << ", prefilter " << options.usePrefilter << ", leaf "
+            << options.leafType << endl;
+        double best = 0.0, chosen = 0.0;
+        for (size_t i = 0; i < layouts.size(); ++i)
+        {
+            if (bytes[frozen][i] > budget)
+            {
+                continue;
+            }
+            if (!best || measured[frozen][i] < best)
+            {
+                best = measured[frozen][i];
+            }
+            if (layouts[i].level == options.level
+                && layouts[i].usePrefilter == options.usePrefilter
+                && layouts[i].leafType == options.leafType)
+            {
+                chosen = measured[frozen][i];
+            }
+        }
+        TEST_TRUE((chosen > 0.0 && chosen < best * 1.5));
+    }
+    return 0;
+}
+
+int TestSimhashTableArena()
+{
+    //The slab arenas against malloc: insert, churn by removes and inserts,
+    //and clear. Each runs in a child process, so that the resident memory
+    //is not taken from the heap freed by the other.
+    int size = 1000000;
+    vector<hash_t> data(size * 3 / 2);
+    hash_t seed = 12345;
+    for (size_t i = 0; i < data.size(); ++i)
+    {
+        seed = get_rand(seed);
+        data[i] = seed;
+    }
+    bool arenas[2] = {true, false};
+    for (int k = 0; k < 2; ++k)
+    {
+        cout.flush();
+        pid_t pid = fork();
+        if (pid)
+        {
+            int status = -1;
+            waitpid(pid, &status, 0);
+            TEST_EQUAL(status, 0);
+            continue;
+        }
+        SimhashTableOptions options(3U, 1U);
+        options.useNodeArena = arenas[k];
+        SimhashTablePtr tablePtr = CreateSimhashTable(options);
+        uint64_t resident = GetResidentBytes();
+        uint64_t start = GetNanoTime();
+        for (int i = 0; i < size; ++i)
+        {
+            tablePtr->Insert(data[i]);
+        }
+        uint64_t inserted = GetNanoTime();
+        uint64_t insertBytes = GetResidentBytes() - resident;
+        //Every other value is replaced by a new one.
+        int replaced = 0;
+        for (int i = 0; i < size; i += 2)
+        {
+            replaced += tablePtr->Remove(data[i])
+                && tablePtr->Insert(data[size + i / 2]) ? 1 : 0;
+        }
+        uint64_t churnBytes = GetResidentBytes() - resident;
+        SimhashMemoryUsage usage;
+        tablePtr->GetMemoryUsage(usage);
+        uint64_t queried = GetNanoTime();
+        int found = 0;
+        for (int i = 1; i < size; i += 2)
+        {
+            found += tablePtr->HasNearDups(data[i] ^ 5UL) ? 1 : 0;
+        }
+        uint64_t cleared = GetNanoTime();
+        tablePtr->Clear();
+        uint64_t end = GetNanoTime();
+        cout << (arenas[k] ? "arena" : "malloc") << ": insert "
+            << (inserted - start) / 1000000UL << " ms, query "
+            << (cleared - queried) / 1000000UL << " ms, clear "
+            << (end - cleared) / 1000000UL << " ms; resident "
+            << insertBytes / 1048576UL << " MB, after churn "
+            << churnBytes / 1048576UL << " MB, reported "
+            << usage.GetTotalBytes() / 1048576UL << " MB." << endl;
+        TEST_EQUAL(replaced, size / 2);
+        TEST_EQUAL(found, size / 2);
+        TEST_EQUAL(tablePtr->GetSize(), 0U);
+        _exit(replaced == size / 2 && found == size / 2 ? 0 : 1);
+    }
+    return 0;
+}
+
 int main()
 {
     //TestIsSimilary();
@@ -191,6 +1866,25 @@ int main()
     //TestSimhashTable();
     //TestSimhashTableInsert();
     //TestSimhashTableSearch();
+    //TestBloomFilter();
+    //TestSimhashTablePrefilter();
+    //TestSimhashTableStats();
+    //TestSimhashTableCostModel();
+    //TestSimhashTable256();
+    //TestSimhashTableSkewed();
+    //TestSimhashTableBitSliced();
+    //TestSimhashTableBatch();
+    //TestSimhashFileIO();
+    //TestSimhashSnapshot();
+    //TestSimhashTableSaveAsync();
+    //TestSimhashTableUpdate();
+    //TestSimhashJoin();
+    //TestSimhashTenantTable();
+    //TestSimhashTableArena();
+    //TestSimhashTableFreeze();
+    //TestSimhashTrace();
+    //TestSimhashWorkload();
+    //TestSimhashTableRadius();
     TestSimhashTableSave();
     TestSimhashTableLoad();
     TestSimhashTableLoad1();
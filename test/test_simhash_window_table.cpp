@@ -0,0 +1,200 @@
+#include <iostream>
+#include <cstdlib>
+#include <ctime>
+#include <vector>
+#include <algorithm>
+#include <sys/time.h>
+
+#include "simhash_window_table.h"
+#include "test.h"
+
+using namespace std;
+using namespace simhash;
+
+inline hash_t get_rand(hash_t seed)
+{
+    return seed * (hash_t)25214903917 + (hash_t)11;
+}
+
+inline double get_wall_ms()
+{
+    timeval now;
+    gettimeofday(&now, NULL);
+    return now.tv_sec * 1000.0 + now.tv_usec / 1000.0;
+}
+
+int TestSimhashWindowTable()
+{
+    hash_t h1 = 0x0000000000000000;
+    hash_t h2 = 0x0000000000000070;
+    hash_t h3 = 0x0000000000000078;
+
+    //Window of 60 time units, split into 6 segments of 10 time units.
+    SimhashWindowTablePtr tablePtr = CreateSimhashWindowTable(3, 1, 60, 6);
+    TEST_TRUE(tablePtr->Insert(h1, 100));
+    TEST_TRUE(tablePtr->Insert(h3, 125));
+    TEST_TRUE(!tablePtr->Insert(h3, 129));
+    TEST_EQUAL(tablePtr->GetSize(), 2U);
+
+    FindAnswerType ans;
+    tablePtr->FindNearDups(h2, 130, ans);
+    TEST_EQUAL(ans.size(), 2U);
+
+    //Epoch 10 falls out of the window at epoch 16.
+    TEST_TRUE(tablePtr->HasNearDups(h2, 159));
+    tablePtr->FindNearDups(h2, 160, ans);
+    TEST_EQUAL(ans.size(), 1U);
+    TEST_EQUAL(ans.front(), h3);
+    TEST_TRUE(!tablePtr->Search(h1, 160));
+
+    //Too late to insert, but a late arrival in the window is accepted.
+    TEST_TRUE(!tablePtr->Insert(h1, 100));
+    TEST_TRUE(tablePtr->Insert(h1, 111));
+    TEST_TRUE(tablePtr->Search(h1, 161));
+
+    //A big jump drops everything.
+    TEST_EQUAL(tablePtr->Expire(1000), 2U);
+    TEST_EQUAL(tablePtr->GetSize(), 0U);
+    TEST_TRUE(!tablePtr->HasNearDups(h2, 1000));
+    return 0;
+}
+
+int TestSimhashWindowTableStart()
+{
+    //Starting at timestamp 0, the newest epoch is below the segment number,
+    //every segment is still visited once.
+    hash_t h1 = 0x0000000000000000;
+    hash_t h2 = 0x0000000000000070;
+    hash_t h3 = 0x0000000000000078;
+    SimhashWindowTablePtr tablePtr = CreateSimhashWindowTable(3, 1, 60, 6);
+    TEST_TRUE(tablePtr->Insert(h1, 0));
+    TEST_TRUE(tablePtr->Insert(h3, 15));
+    TEST_TRUE(tablePtr->Insert(h1, 25));
+    TEST_EQUAL(tablePtr->GetSize(), 3U);
+
+    FindAnswerType ans;
+    TEST_TRUE(tablePtr->FindNearDups(h2, 25, ans));
+    TEST_EQUAL(ans.size(), 2U);
+    hash_t nearDup = h2;
+    TEST_TRUE(tablePtr->FindFirstNearDup(h2, 25, nearDup));
+    TEST_EQUAL(nearDup, h1);
+    TEST_TRUE(tablePtr->Search(h3, 25));
+
+    //Epoch 0 leaves at epoch 6, the refreshed h1 is still in epoch 2.
+    TEST_EQUAL(tablePtr->Expire(60), 1U);
+    TEST_EQUAL(tablePtr->GetSize(), 2U);
+    TEST_TRUE(tablePtr->Search(h1, 60));
+    TEST_TRUE(tablePtr->Insert(h2, 60));
+    tablePtr->Clear();
+    TEST_EQUAL(tablePtr->GetSize(), 0U);
+    TEST_TRUE(tablePtr->Insert(h2, 0));
+    TEST_TRUE(tablePtr->Search(h2, 0));
+    return 0;
+}
+
+int TestSimhashWindowTableExpire()
+{
+    //A full segment of level 2 is dropped by the insert crossing into the
+    //next window, that insert only swaps it for a spare, while clearing the
+    //same table inline walks all the permuted containers.
+    const uint_t size = 1000000U;
+    SimhashWindowTablePtr tablePtr = CreateSimhashWindowTable(3, 2, 2, 2);
+    SimhashTablePtr inlinePtr = CreateSimhashTable(3, 2);
+    hash_t seed = (hash_t)rand();
+    for (uint_t i = 0; i < size; ++i)
+    {
+        seed = get_rand(seed);
+        tablePtr->Insert(seed, 0);
+        inlinePtr->Insert(seed);
+    }
+    double start = get_wall_ms();
+    inlinePtr->Clear();
+    const double clearMs = get_wall_ms() - start;
+    double maxMs = 0.0;
+    for (timestamp_t t = 2; t < 12; t += 2)
+    {
+        start = get_wall_ms();
+        tablePtr->Insert(seed, t);
+        maxMs = max(maxMs, get_wall_ms() - start);
+        for (uint_t i = 0; i < size / 10U; ++i)
+        {
+            seed = get_rand(seed);
+            tablePtr->Insert(seed, t);
+        }
+    }
+    cout << "Clear " << size << " inline: " << clearMs << " ms, boundary "
+        << "insert: " << maxMs << " ms." << endl;
+    TEST_TRUE((maxMs * 10.0 < clearMs));
+    TEST_EQUAL(tablePtr->GetSize(), size / 10U + 1U);
+    return 0;
+}
+
+int TestSimhashWindowTableStream()
+{
+    //One hour window with one-minute segments, 1000 hashes per second. A
+    //probe is kept every 10 minutes, it is found half an hour later, and it
+    //is gone once its segment leaves the window.
+    const timestamp_t window = 3600, span = 60;
+    SimhashWindowTablePtr tablePtr = CreateSimhashWindowTable(3, 1, window,
+        window / span);
+    hash_t seed = (hash_t)rand();
+    vector<hash_t> probes;
+    clock_t start = clock();
+    uint_t count = 0U, found = 0U, expired = 0U, sized = 0U, checks = 0U;
+    FindAnswerType ans;
+    for (timestamp_t t = 0; t < 4 * window; ++t)
+    {
+        for (int i = 0; i < 1000; ++i)
+        {
+            seed = get_rand(seed);
+            count += tablePtr->HasNearDups(seed, t) ? 1U : 0U;
+            tablePtr->Insert(seed, t);
+        }
+        if (t % 600 == 0)
+        {
+            probes.push_back(seed);
+        }
+        if (t % 600 == 0 && t >= 1800)
+        {
+            const hash_t probe = probes[(t - 1800) / 600] ^ 0x5UL;
+            tablePtr->FindNearDups(probe, t, ans);
+            found += tablePtr->HasNearDups(probe, t) && ans.end()
+                != find(ans.begin(), ans.end(), probe ^ 0x5UL) ? 1U : 0U;
+        }
+        if (t % 600 == 0 && t >= window + span)
+        {
+            const hash_t probe = probes[(t - window - span) / 600];
+            expired += !tablePtr->Search(probe, t)
+                && !tablePtr->HasNearDups(probe ^ 0x5UL, t) ? 1U : 0U;
+            ++checks;
+        }
+        if (t >= window)
+        {
+            //The live segments hold between window - span and window seconds.
+            const uint_t size = tablePtr->GetSize();
+            sized += size >= (window - span) * 1000U
+                && size <= (window + 1U) * 1000U ? 1U : 0U;
+        }
+        if (t % 3600 == 0)
+        {
+            cout << "Time " << t << ", size " << tablePtr->GetSize()
+                << ", time " << (clock() - start) * 1000 / CLOCKS_PER_SEC
+                << " ms." << endl;
+        }
+    }
+    cout << "Stream result: " << count << " hits." << endl;
+    TEST_EQUAL(found, static_cast<uint_t>(probes.size() - 3U));
+    TEST_EQUAL(expired, checks);
+    TEST_TRUE((checks > 0U));
+    TEST_EQUAL(sized, static_cast<uint_t>(3 * window));
+    return 0;
+}
+
+int main()
+{
+    TestSimhashWindowTable();
+    TestSimhashWindowTableStart();
+    //TestSimhashWindowTableExpire();
+    //TestSimhashWindowTableStream();
+    return 0;
+}
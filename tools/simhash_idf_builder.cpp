@@ -0,0 +1,122 @@
+/*==============================================================================
+*   Copyright (C) 2016 All rights reserved.
+*
+*  File Name    : simhash_idf_builder.cpp
+*  Author       : Zhongping Liang
+*  Date         : 2016-07-22
+*  Version      : 1.0
+*  Description  : This file provides a builder of the IDF dictionary files.
+*           Usage: simhash_idf_builder [-m minDf] [-t] input output
+*           The input is a corpus of a document per line, split by white
+*           chars. The IDF of a term is log((N + 1) / (df + 1)) + 1 for N
+*           documents, the terms in less than minDf documents are dropped,
+*           and they get the default IDF, log(N + 1) + 1, as the unseen ones.
+*           With -t, the input is a line of "term<TAB>IDF" per term, and the
+*           default IDF is the largest one.
+==============================================================================*/
+
+#include <map>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+
+#include <unistd.h>
+
+#include "hash.h"
+#include "tf_idf.h"
+
+using namespace simhash;
+using namespace std;
+
+int main(int argc, char *argv[])
+{
+    uint64_t minDf = 1UL;
+    bool table = false;
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "m:t")) != -1)
+    {
+        switch (opt)
+        {
+        case 'm' : minDf = strtoull(optarg, NULL, 10); break;
+        case 't' : table = true; break;
+        default :
+            optind = argc;
+            break;
+        }
+    }
+    if (argc - optind != 2)
+    {
+        cerr << "Usage: " << argv[0] << " [-m minDf] [-t] input output"
+            << endl;
+        return 1;
+    }
+    ifstream input(argv[optind]);
+    if (!input)
+    {
+        cerr << "Failed to open " << argv[optind] << endl;
+        return 1;
+    }
+    vector<pair<hash_t, real_t> > terms;
+    real_t defaultIdf = 0.0;
+    string line;
+    string word;
+    if (table)
+    {
+        while (getline(input, line))
+        {
+            string::size_type tab = line.rfind('\t');
+            if (string::npos == tab)
+            {
+                continue;
+            }
+            real_t idf = strtod(line.c_str() + tab + 1U, NULL);
+            terms.push_back(make_pair(JenkinsHash(line.substr(0, tab)), idf));
+            defaultIdf = max(defaultIdf, idf);
+        }
+    }
+    else
+    {
+        //The terms are counted by their hashes, the strings are not kept.
+        map<hash_t, uint64_t> dfs;
+        vector<hash_t> keys;
+        uint64_t docNum = 0UL;
+        while (getline(input, line))
+        {
+            ++docNum;
+            istringstream words(line);
+            keys.clear();
+            while (words >> word)
+            {
+                keys.push_back(JenkinsHash(word));
+            }
+            sort(keys.begin(), keys.end());
+            keys.erase(unique(keys.begin(), keys.end()), keys.end());
+            for (size_t i = 0; i < keys.size(); ++i)
+            {
+                ++dfs[keys[i]];
+            }
+        }
+        for (map<hash_t, uint64_t>::const_iterator it = dfs.begin();
+            dfs.end() != it; ++it)
+        {
+            if (it->second >= minDf)
+            {
+                terms.push_back(make_pair(it->first, log((docNum + 1.0)
+                    / (it->second + 1.0)) + 1.0));
+            }
+        }
+        defaultIdf = log(docNum + 1.0) + 1.0;
+    }
+    if (!IdfDictionary::Build(terms, defaultIdf, argv[optind + 1]))
+    {
+        cerr << "Failed to build " << argv[optind + 1] << endl;
+        return 1;
+    }
+    cout << "Terms " << terms.size() << ", default IDF " << defaultIdf << endl;
+    return 0;
+}
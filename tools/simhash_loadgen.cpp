@@ -0,0 +1,214 @@
+/*==============================================================================
+*   Copyright (C) 2016 All rights reserved.
+*
+*  File Name    : simhash_loadgen.cpp
+*  Author       : Zhongping Liang
+*  Date         : 2016-07-19
+*  Version      : 1.0
+*  Description  : This file provides a load generator of the simhash server.
+*           Usage: simhash_loadgen [-a address] [-q qps] [-t seconds]
+*               [-c connections] [-n preload] [-f]
+*           It inserts preload random values, then sends HasNearDups (or
+*           FindNearDups with -f) at qps in total over the connections, and
+*           reports the latencies. A request is sent at its scheduled time,
+*           and its latency is measured from that time, so a slow server is
+*           not hidden by the requests it delays (no coordinated omission).
+==============================================================================*/
+
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <iostream>
+
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "simhash_client.h"
+#include "simhash_stats.h"
+
+using namespace simhash;
+using namespace std;
+
+static hash_t NextRand(hash_t &state)
+{
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+/* The load of one connection. */
+struct Worker
+{
+    SimhashClientPtr clientPtr;
+    uint_t op;
+    hash_t seed;
+    const vector<hash_t> *values;   // The values preloaded.
+    uint64_t start;         // The scheduled time of the first request.
+    uint64_t interval;      // The time between two requests.
+    uint64_t num;           // The number of requests.
+    uint64_t hits;
+    LatencyHistogram latencies;
+};
+
+static void SleepUntil(uint64_t nanos)
+{
+    struct timespec ts;
+    ts.tv_sec = nanos / 1000000000UL;
+    ts.tv_nsec = nanos % 1000000000UL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL))
+    {}
+}
+
+static void* Send(void *arg)
+{
+    Worker *worker = static_cast<Worker*>(arg);
+    hash_t state = worker->seed;
+    const vector<hash_t> &values = *worker->values;
+    for (uint64_t i = 0; i < worker->num;)
+    {
+        SleepUntil(worker->start + i * worker->interval);
+        //Send all the requests due, in one write.
+        uint64_t now = GetNanoTime();
+        for (; i < worker->num && worker->start + i * worker->interval <= now;
+            ++i)
+        {
+            hash_t query = NextRand(state);
+            if (!values.empty() && (query & 1UL))
+            {
+                //Half of the queries are near a preloaded value.
+                query = values[(query >> 8) % values.size()]
+                    ^ (HASH_1 << (query >> 1) % HASH_WIDTH);
+            }
+            worker->clientPtr->SendRequest(worker->op, query);
+        }
+        if (!worker->clientPtr->Flush())
+        {
+            break;
+        }
+    }
+    return NULL;
+}
+
+static void* Receive(void *arg)
+{
+    Worker *worker = static_cast<Worker*>(arg);
+    SimhashResponse response;
+    for (uint64_t i = 0; i < worker->num; ++i)
+    {
+        if (!worker->clientPtr->ReceiveResponse(response))
+        {
+            break;
+        }
+        uint64_t now = GetNanoTime();
+        uint64_t scheduled = worker->start + i * worker->interval;
+        worker->latencies.Record(now > scheduled ? now - scheduled : 0UL);
+        worker->hits += SIMHASH_STATUS_TRUE == response.status ? 1UL : 0UL;
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    string address = "127.0.0.1:7733";
+    uint64_t qps = 100000UL;
+    uint64_t seconds = 10UL;
+    uint_t connNum = 4U;
+    uint64_t preload = 1000000UL;
+    uint_t op = SIMHASH_OP_CODE_HAS_NEAR_DUPS;
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "a:q:t:c:n:f")) != -1)
+    {
+        switch (opt)
+        {
+        case 'a' : address = optarg; break;
+        case 'q' : qps = strtoull(optarg, NULL, 10); break;
+        case 't' : seconds = strtoull(optarg, NULL, 10); break;
+        case 'c' : connNum = atoi(optarg); break;
+        case 'n' : preload = strtoull(optarg, NULL, 10); break;
+        case 'f' : op = SIMHASH_OP_CODE_FIND_NEAR_DUPS; break;
+        default :
+            cerr << "Usage: " << argv[0] << " [-a address] [-q qps]"
+                << " [-t seconds] [-c connections] [-n preload] [-f]" << endl;
+            return 1;
+        }
+    }
+    if (!qps || !connNum)
+    {
+        cerr << "qps and connections should be positive." << endl;
+        return 1;
+    }
+    vector<Worker> workers(connNum);
+    for (uint_t i = 0; i < connNum; ++i)
+    {
+        workers[i].clientPtr = CreateSimhashClient(address);
+        if (!workers[i].clientPtr)
+        {
+            cerr << "Failed to connect to " << address << endl;
+            return 1;
+        }
+    }
+    //Preload with pipelining, the responses are read in windows.
+    SimhashClientPtr loader = workers[0].clientPtr;
+    hash_t state = 1UL;
+    vector<hash_t> values;
+    const uint64_t window = 4096UL;
+    SimhashResponse response;
+    for (uint64_t sent = 0; sent < preload; sent += window)
+    {
+        uint64_t num = min(window, preload - sent);
+        for (uint64_t i = 0; i < num; ++i)
+        {
+            values.push_back(NextRand(state));
+            loader->SendRequest(SIMHASH_OP_CODE_INSERT, values.back());
+        }
+        loader->Flush();
+        for (uint64_t i = 0; i < num; ++i)
+        {
+            loader->ReceiveResponse(response);
+        }
+    }
+    cout << "Table size " << loader->GetSize() << endl;
+    uint64_t start = GetNanoTime() + 10000000UL;
+    for (uint_t i = 0; i < connNum; ++i)
+    {
+        workers[i].op = op;
+        workers[i].seed = 0x9E3779B97F4A7C15UL * (i + 1U);
+        workers[i].values = &values;
+        workers[i].start = start;
+        workers[i].interval = 1000000000UL * connNum / qps;
+        workers[i].num = qps * seconds / connNum;
+        workers[i].hits = 0UL;
+    }
+    vector<pthread_t> threads(connNum * 2U);
+    for (uint_t i = 0; i < connNum; ++i)
+    {
+        pthread_create(&threads[i * 2U], NULL, Send, &workers[i]);
+        pthread_create(&threads[i * 2U + 1U], NULL, Receive, &workers[i]);
+    }
+    for (size_t i = 0; i < threads.size(); ++i)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    uint64_t elapsed = GetNanoTime() - start;
+    LatencyHistogram latencies;
+    uint64_t hits = 0UL;
+    for (uint_t i = 0; i < connNum; ++i)
+    {
+        latencies.Merge(workers[i].latencies);
+        hits += workers[i].hits;
+        if (workers[i].clientPtr->IsBroken())
+        {
+            cerr << "Connection " << i << " is broken." << endl;
+        }
+    }
+    cout << "Requests " << latencies.GetCount() << ", hits " << hits
+        << ", qps " << latencies.GetCount() * 1000000000UL / max(elapsed, 1UL)
+        << endl;
+    cout << "Latency us: p50 " << latencies.GetPercentile(50.0) / 1000UL
+        << ", p99 " << latencies.GetPercentile(99.0) / 1000UL
+        << ", p999 " << latencies.GetPercentile(99.9) / 1000UL
+        << ", max " << latencies.GetMax() / 1000UL << endl;
+    return 0;
+}
@@ -0,0 +1,122 @@
+/*==============================================================================
+*   Copyright (C) 2016 All rights reserved.
+*
+*  File Name    : simhash_replay.cpp
+*  Author       : Zhongping Liang
+*  Date         : 2016-07-22
+*  Version      : 1.0
+*  Description  : This file provides the replay of a trace of SimhashTable,
+*           see CreateSimhashTraceRecorder.
+*           Usage: simhash_replay -i trace [-f table file] [-k maxHamDist]
+*               [-l level] [-s] [-p] [-z] [-a address]... [-t threads]
+*               [-r speed] [-R]
+*           The table is created by -k, -l, -s (the sorted array leaves), -p
+*           (the prefilters) and -z (freeze after loading), or it is the
+*           sharded table of the -a addresses. -f loads the table saved at
+*           the start of trace. -r 1 replays at the original rate, 2 twice
+*           as fast, and 0 (the default) as fast as possible. -R lets the
+*           queries of -t threads share the table, it is ignored by the
+*           sharded table and by a build with SIMHASH_ENABLE_STATS.
+==============================================================================*/
+
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <iostream>
+
+#include <unistd.h>
+#include <sys/prctl.h>
+
+#include "simhash_trace.h"
+#include "simhash_sharded_table.h"
+
+using namespace simhash;
+using namespace std;
+
+int main(int argc, char *argv[])
+{
+    SimhashTableOptions tableOptions;
+    SimhashReplayOptions replayOptions;
+    string traceFile, tableFile;
+    vector<string> addresses;
+    bool freeze = false;
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "i:f:k:l:spza:t:r:R")) != -1)
+    {
+        switch (opt)
+        {
+        case 'i' : traceFile = optarg; break;
+        case 'f' : tableFile = optarg; break;
+        case 'k' : tableOptions.maxHamDist = atoi(optarg); break;
+        case 'l' : tableOptions.level = atoi(optarg); break;
+        case 's' : tableOptions.leafType = SIMHASH_LEAF_SORTED_ARRAY; break;
+        case 'p' : tableOptions.usePrefilter = true; break;
+        case 'z' : freeze = true; break;
+        case 'a' : addresses.push_back(optarg); break;
+        case 't' : replayOptions.threadNum = atoi(optarg); break;
+        case 'r' : replayOptions.speed = atof(optarg); break;
+        case 'R' : replayOptions.sharedReads = true; break;
+        default :
+            traceFile.clear();
+            break;
+        }
+    }
+    if (traceFile.empty())
+    {
+        cerr << "Usage: " << argv[0] << " -i trace [-f table file]"
+            << " [-k maxHamDist] [-l level] [-s] [-p] [-z] [-a address]..."
+            << " [-t threads] [-r speed] [-R]" << endl;
+        return 1;
+    }
+    SimhashShardedTablePtr shardedPtr;
+    SimhashTablePtr tablePtr;
+    if (addresses.empty())
+    {
+        tablePtr = CreateSimhashTable(tableOptions);
+    }
+    else
+    {
+        shardedPtr = CreateSimhashShardedTable(addresses,
+            tableOptions.maxHamDist);
+        tablePtr = shardedPtr;
+    }
+    if (!tablePtr)
+    {
+        cerr << "Failed to connect to the shards." << endl;
+        return 1;
+    }
+    if (!addresses.empty())
+    {
+        //A shard serves one connection at a time.
+        replayOptions.sharedReads = false;
+    }
+    if (!tableFile.empty() && !tablePtr->LoadFromFile(tableFile))
+    {
+        cerr << "Failed to load " << tableFile << endl;
+        return 1;
+    }
+    if (freeze && !tablePtr->Freeze())
+    {
+        cerr << "Failed to freeze the table." << endl;
+        return 1;
+    }
+    //The paced records wake up on time, not 50us late by the default slack,
+    //which would be counted in their latencies.
+    prctl(PR_SET_TIMERSLACK, 1UL);
+    cout << "Replaying " << traceFile << " on " << tablePtr->GetSize()
+        << " simhash values" << endl;
+    SimhashReplayReport report;
+    bool ret = ReplaySimhashTrace(traceFile, tablePtr, replayOptions, report);
+    cout << report.ToString();
+    if (shardedPtr && shardedPtr->IsBroken())
+    {
+        //The queries after the failure have no answers.
+        cerr << "The connection to some shard failed." << endl;
+        ret = false;
+    }
+    if (!ret)
+    {
+        cerr << "Failed to replay " << traceFile << endl;
+    }
+    return ret ? 0 : 1;
+}
@@ -0,0 +1,84 @@
+/*==============================================================================
+*   Copyright (C) 2016 All rights reserved.
+*
+*  File Name    : simhash_server.cpp
+*  Author       : Zhongping Liang
+*  Date         : 2016-07-19
+*  Version      : 1.0
+*  Description  : This file provides the main of the simhash server.
+*           Usage: simhash_server [-a address] [-f table file] [-k maxHamDist]
+*               [-l level] [-s] [-b minBatchSize] [-d batchDepth]
+*           -s uses the sorted array leaves, which interleave the batches.
+==============================================================================*/
+
+#include <string>
+#include <cstdlib>
+#include <iostream>
+
+#include <signal.h>
+#include <unistd.h>
+
+#include "simhash_server.h"
+
+using namespace simhash;
+using namespace std;
+
+static SimhashServer *gServer = NULL;
+
+static void HandleSignal(int)
+{
+    if (gServer)
+    {
+        gServer->Stop();
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    SimhashServerOptions serverOptions;
+    SimhashTableOptions tableOptions;
+    string filename;
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "a:f:k:l:sb:d:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'a' : serverOptions.address = optarg; break;
+        case 'f' : filename = optarg; break;
+        case 'k' : tableOptions.maxHamDist = atoi(optarg); break;
+        case 'l' : tableOptions.level = atoi(optarg); break;
+        case 's' : tableOptions.leafType = SIMHASH_LEAF_SORTED_ARRAY; break;
+        case 'b' : serverOptions.minBatchSize = atoi(optarg); break;
+        case 'd' : serverOptions.batchDepth = atoi(optarg); break;
+        default :
+            cerr << "Usage: " << argv[0] << " [-a address] [-f table file]"
+                << " [-k maxHamDist] [-l level] [-s] [-b minBatchSize]"
+                << " [-d batchDepth]" << endl;
+            return 1;
+        }
+    }
+    SimhashTablePtr tablePtr = CreateSimhashTable(tableOptions);
+    if (!filename.empty() && !tablePtr->LoadFromFile(filename))
+    {
+        cerr << "Failed to load " << filename << endl;
+        return 1;
+    }
+    SimhashServerPtr serverPtr = CreateSimhashServer(tablePtr, serverOptions);
+    if (!serverPtr)
+    {
+        cerr << "Failed to listen at " << serverOptions.address << endl;
+        return 1;
+    }
+    gServer = serverPtr.get();
+    signal(SIGINT, HandleSignal);
+    signal(SIGTERM, HandleSignal);
+    signal(SIGPIPE, SIG_IGN);
+    cout << "Serving " << tablePtr->GetSize() << " simhash values at "
+        << serverOptions.address << endl;
+    bool ret = serverPtr->Run();
+    SimhashServerStats stats;
+    serverPtr->GetStats(stats);
+    cout << stats.ToString() << endl;
+    gServer = NULL;
+    return ret ? 0 : 1;
+}
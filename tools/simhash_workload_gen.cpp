@@ -0,0 +1,106 @@
+/*==============================================================================
+*   Copyright (C) 2016 All rights reserved.
+*
+*  File Name    : simhash_workload_gen.cpp
+*  Author       : Zhongping Liang
+*  Date         : 2016-07-22
+*  Version      : 1.0
+*  Description  : This file provides the generator of clustered corpora of
+*           simhash values, see simhash_workload.h.
+*           Usage: simhash_workload_gen -o value file [-g pair file]
+*               [-n values] [-c clusters] [-z zipf exponent]
+*               [-d distance weights] [-e duplicate rate] [-b bit bias]
+*               [-s seed] [-t threads] [-S]
+*           -d is the weights of distances from 0 bits, e.g. "0,1,1,1" for 1
+*           to 3 bits evenly. -b is the probability of 1 of all bits, or of
+*           each bit from the lowest, e.g. "0.3" or "0.5,0.5,0.2,...". -S
+*           writes a snapshot instead of the binary format.
+==============================================================================*/
+
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <iostream>
+
+#include <unistd.h>
+
+#include "simhash_workload.h"
+
+using namespace simhash;
+using namespace std;
+
+/* Parses a list of reals separated by ','. */
+static vector<real_t> ParseReals(const string &text)
+{
+    vector<real_t> reals;
+    string::size_type begin = 0;
+    while (!text.empty() && begin <= text.size())
+    {
+        string::size_type end = text.find(',', begin);
+        if (string::npos == end)
+        {
+            end = text.size();
+        }
+        reals.push_back(atof(text.substr(begin, end - begin).c_str()));
+        begin = end + 1U;
+    }
+    return reals;
+}
+
+int main(int argc, char *argv[])
+{
+    SimhashWorkloadOptions options;
+    SimhashFileFormat format = SIMHASH_FILE_BINARY;
+    string valueFile, pairFile;
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "o:g:n:c:z:d:e:b:s:t:S")) != -1)
+    {
+        switch (opt)
+        {
+        case 'o' : valueFile = optarg; break;
+        case 'g' : pairFile = optarg; break;
+        case 'n' : options.valueNum = strtoull(optarg, NULL, 10); break;
+        case 'c' : options.clusterNum = strtoull(optarg, NULL, 10); break;
+        case 'z' : options.zipfExponent = atof(optarg); break;
+        case 'd' : options.distanceWeights = ParseReals(optarg); break;
+        case 'e' : options.duplicateRate = atof(optarg); break;
+        case 'b' : options.bitBiases = ParseReals(optarg); break;
+        case 's' : options.seed = strtoull(optarg, NULL, 10); break;
+        case 't' : options.threadNum = atoi(optarg); break;
+        case 'S' : format = SIMHASH_FILE_SNAPSHOT; break;
+        default :
+            valueFile.clear();
+            break;
+        }
+    }
+    if (valueFile.empty())
+    {
+        cerr << "Usage: " << argv[0] << " -o value file [-g pair file]"
+            << " [-n values] [-c clusters] [-z zipf exponent]"
+            << " [-d distance weights] [-e duplicate rate] [-b bit bias]"
+            << " [-s seed] [-t threads] [-S]" << endl;
+        return 1;
+    }
+    if (1U == options.bitBiases.size())
+    {
+        options.bitBiases.resize(HASH_WIDTH, options.bitBiases[0]);
+    }
+    SimhashWorkloadReport report;
+    if (!GenerateSimhashWorkload(options, valueFile, pairFile, report, format))
+    {
+        cerr << "Failed to generate, check the options and the files." << endl;
+        return 1;
+    }
+    cout << "Values " << report.valueNum << ", duplicates "
+        << report.duplicateNum << ", largest cluster "
+        << report.largestCluster << ", "
+        << report.valueNum * 1000UL / max(report.elapsedNanos / 1000000UL, 1UL)
+        << " values per second" << endl;
+    cout << "Distances:";
+    for (size_t d = 0; d < report.distanceCounts.size(); ++d)
+    {
+        cout << " " << d << "=" << report.distanceCounts[d];
+    }
+    cout << endl;
+    return 0;
+}